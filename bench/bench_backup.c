@@ -0,0 +1,461 @@
+#define _XOPEN_SOURCE 700
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <ftw.h>
+#include <getopt.h>
+#include <dirent.h>
+#include <time.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include "backup_manager.h"
+#include "chunk_cache.h"
+#include "dataset.h"
+
+// Variables globales normalement définies dans main.c
+int verbose_flag = 0;
+int dry_run_flag = 0;
+
+// Mesures d'une phase, remontées du processus fils par un tube
+typedef struct {
+    int ok;
+    double seconds;
+    unsigned long long read_syscalls;  // syscr de /proc/self/io
+    unsigned long long write_syscalls; // syscw de /proc/self/io
+    unsigned long long bytes_read;     // rchar de /proc/self/io
+    unsigned long long bytes_written;  // wchar de /proc/self/io
+} phase_result_t;
+
+typedef enum {
+    PHASE_FULL_BACKUP,
+    PHASE_INCREMENTAL_BACKUP,
+    PHASE_RESTORE,
+    PHASE_PRUNE,  // --prune --keep-daily 1
+    PHASE_RESUME  // --backup --resume
+} phase_t;
+
+static const char *phase_names[] = {"full_backup", "incremental_backup", "restore", "prune", "resume"};
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Lit les compteurs d'E/S du processus courant dans /proc/self/io.
+ */
+static void read_proc_io(phase_result_t *result) {
+    FILE *f = fopen("/proc/self/io", "r");
+    if (!f) {
+        return;
+    }
+    char key[64];
+    unsigned long long value;
+    while (fscanf(f, "%63[^:]: %llu\n", key, &value) == 2) {
+        if (strcmp(key, "syscr") == 0) {
+            result->read_syscalls = value;
+        } else if (strcmp(key, "syscw") == 0) {
+            result->write_syscalls = value;
+        } else if (strcmp(key, "rchar") == 0) {
+            result->bytes_read = value;
+        } else if (strcmp(key, "wchar") == 0) {
+            result->bytes_written = value;
+        }
+    }
+    fclose(f);
+}
+
+/**
+ * @brief Retrouve la sauvegarde la plus récente (nom horodaté le plus grand).
+ */
+static int latest_snapshot(const char *backup_dir, char *path, size_t size) {
+    DIR *dir = opendir(backup_dir);
+    if (!dir) {
+        return -1;
+    }
+    char latest[256] = {0};
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+        if (strcmp(entry->d_name, latest) > 0) {
+            snprintf(latest, sizeof(latest), "%s", entry->d_name);
+        }
+    }
+    closedir(dir);
+    if (latest[0] == '\0') {
+        return -1;
+    }
+    snprintf(path, size, "%s/%s", backup_dir, latest);
+    return 0;
+}
+
+/**
+ * @brief Exécute une phase dans un processus fils pour isoler RSS et compteurs d'E/S.
+ */
+static int run_phase(phase_t phase, const char *source, const char *backup_dir, const char *restore_dir,
+                     phase_result_t *result, long *peak_rss_kb) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+        perror("Erreur pipe");
+        return -1;
+    }
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("Erreur fork");
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        // Les messages du programme ne doivent pas se mêler à la sortie JSON
+        if (!freopen("/dev/null", "w", stdout)) {
+            _exit(1);
+        }
+        phase_result_t child = {0};
+        double start = now_seconds();
+        if (phase == PHASE_RESTORE) {
+            char snapshot[4096];
+            if (latest_snapshot(backup_dir, snapshot, sizeof(snapshot)) == 0) {
+                restore_backup(snapshot, restore_dir, 1, CHUNK_CACHE_DEFAULT_SIZE, NULL);
+                child.ok = 1;
+            }
+        } else if (phase == PHASE_PRUNE) {
+            prune_backups(backup_dir, 1, 0);
+            child.ok = 1;
+        } else {
+            create_backup(source, backup_dir, phase == PHASE_RESUME);
+            child.ok = 1;
+        }
+        child.seconds = now_seconds() - start;
+        read_proc_io(&child);
+        if (write(fds[1], &child, sizeof(child)) != sizeof(child)) {
+            _exit(1);
+        }
+        _exit(0);
+    }
+
+    close(fds[1]);
+    memset(result, 0, sizeof(*result));
+    ssize_t n = read(fds[0], result, sizeof(*result));
+    close(fds[0]);
+    int status;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) < 0) {
+        return -1;
+    }
+    *peak_rss_kb = usage.ru_maxrss;
+    if (n != sizeof(*result) || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        result->ok = 0;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Vrai si le point de reprise d'une sauvegarde en préparation cite un des segments
+ * qu'elle a écrits (nommés d'après son horodatage), que seul ce point de reprise désigne.
+ */
+static int staging_checkpointed(const char *backup_dir) {
+    DIR *dir = opendir(backup_dir);
+    if (!dir) {
+        return 0;
+    }
+    int found = 0;
+    struct dirent *entry;
+    while (!found && (entry = readdir(dir)) != NULL) {
+        if (strncmp(entry->d_name, STAGING_PREFIX, strlen(STAGING_PREFIX)) != 0) {
+            continue;
+        }
+        char path[4096], segment[512], line[8192];
+        snprintf(path, sizeof(path), "%s/%s/%s", backup_dir, entry->d_name, CHECKPOINT_FILE);
+        snprintf(segment, sizeof(segment), ";%s.", entry->d_name + strlen(STAGING_PREFIX));
+        FILE *file = fopen(path, "r");
+        while (file && !found && fgets(line, sizeof(line), file)) {
+            found = strstr(line, segment) != NULL;
+        }
+        if (file) {
+            fclose(file);
+        }
+    }
+    closedir(dir);
+    return found;
+}
+
+/**
+ * @brief Lance une sauvegarde dans un processus fils et la tue (SIGKILL) dès que son point
+ * de reprise, écrit après chaque fichier, cite un de ses segments.
+ * @return 1 si elle a été interrompue, 0 si elle s'est terminée avant, -1 en cas d'erreur.
+ */
+static int run_interrupted_backup(const char *source, const char *backup_dir) {
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("Erreur fork");
+        return -1;
+    }
+    if (pid == 0) {
+        if (!freopen("/dev/null", "w", stdout) || !freopen("/dev/null", "w", stderr)) {
+            _exit(1);
+        }
+        backup_set_checkpoint_interval(0);
+        create_backup(source, backup_dir, 0);
+        _exit(0);
+    }
+    int status;
+    while (waitpid(pid, &status, WNOHANG) == 0) {
+        if (staging_checkpointed(backup_dir)) {
+            kill(pid, SIGKILL);
+            waitpid(pid, &status, 0);
+            return 1;
+        }
+        usleep(200);
+    }
+    return 0;
+}
+
+// Somme des tailles des inodes distincts du dépôt (les liens durs ne comptent qu'une fois)
+typedef struct {
+    ino_t ino;
+    off_t size;
+} inode_size_t;
+
+static inode_size_t *seen_inodes;
+static size_t seen_count, seen_capacity;
+
+static int cmp_inode(const void *a, const void *b) {
+    ino_t x = ((const inode_size_t *)a)->ino, y = ((const inode_size_t *)b)->ino;
+    return (x > y) - (x < y);
+}
+
+static int collect_inode(const char *path, const struct stat *st, int flag, struct FTW *ftw) {
+    (void)path;
+    (void)ftw;
+    if (flag != FTW_F || !S_ISREG(st->st_mode)) {
+        return 0;
+    }
+    if (seen_count == seen_capacity) {
+        seen_capacity = seen_capacity ? seen_capacity * 2 : 1024;
+        seen_inodes = realloc(seen_inodes, seen_capacity * sizeof(inode_size_t));
+    }
+    seen_inodes[seen_count].ino = st->st_ino;
+    seen_inodes[seen_count].size = st->st_size;
+    seen_count++;
+    return 0;
+}
+
+static unsigned long long repository_bytes(const char *backup_dir) {
+    seen_count = 0;
+    nftw(backup_dir, collect_inode, 64, FTW_PHYS);
+    qsort(seen_inodes, seen_count, sizeof(inode_size_t), cmp_inode);
+    unsigned long long bytes = 0;
+    for (size_t i = 0; i < seen_count; i++) {
+        if (i == 0 || seen_inodes[i].ino != seen_inodes[i - 1].ino) {
+            bytes += seen_inodes[i].size;
+        }
+    }
+    return bytes;
+}
+
+static void print_phase_json(FILE *out, phase_t phase, const phase_result_t *r, long rss_kb,
+                             const dataset_t *dataset, unsigned long long stored, int last) {
+    double mb = dataset->bytes / (1024.0 * 1024.0);
+    double secs = r->seconds > 0 ? r->seconds : 1e-9;
+    fprintf(out, "        {\"phase\": \"%s\", \"ok\": %s, \"seconds\": %.6f, \"mb_per_s\": %.3f, "
+            "\"files_per_s\": %.1f, \"peak_rss_kb\": %ld, \"syscalls\": %llu, "
+            "\"read_syscalls\": %llu, \"write_syscalls\": %llu, \"bytes_read\": %llu, "
+            "\"bytes_written\": %llu",
+            phase_names[phase], r->ok ? "true" : "false", r->seconds, mb / secs,
+            dataset->files / secs, rss_kb, r->read_syscalls + r->write_syscalls,
+            r->read_syscalls, r->write_syscalls, r->bytes_read, r->bytes_written);
+    if (phase != PHASE_RESTORE) {
+        fprintf(out, ", \"stored_bytes\": %llu, \"dedup_ratio\": %.4f",
+                stored, stored ? (double)dataset->bytes / stored : 0.0);
+    }
+    fprintf(out, "}%s\n", last ? "" : ",");
+}
+
+/**
+ * @brief Déroule un scénario complet : génération, sauvegarde, modification, sauvegarde incrémentale, restauration,
+ * puis sauvegarde interrompue, --prune et reprise vérifiée par une seconde restauration.
+ */
+static int run_scenario(FILE *out, const char *workdir, dataset_t *dataset, double mutate_percent, int last) {
+    char source[4096], backups[4096], restore[4096];
+    snprintf(source, sizeof(source), "%s/%s-source", workdir, scenario_name(dataset->scenario));
+    snprintf(backups, sizeof(backups), "%s/%s-backups", workdir, scenario_name(dataset->scenario));
+    snprintf(restore, sizeof(restore), "%s/%s-restore", workdir, scenario_name(dataset->scenario));
+    remove_tree(source);
+    remove_tree(backups);
+    remove_tree(restore);
+
+    if (generate_dataset(source, dataset) != 0) {
+        return -1;
+    }
+
+    phase_result_t result;
+    long rss_kb = 0;
+    fprintf(out, "    {\"scenario\": \"%s\", \"files\": %zu, \"bytes\": %zu, \"mutate_percent\": %.1f, \"phases\": [\n",
+            scenario_name(dataset->scenario), dataset->files, dataset->bytes, mutate_percent);
+
+    run_phase(PHASE_FULL_BACKUP, source, backups, restore, &result, &rss_kb);
+    unsigned long long stored_full = repository_bytes(backups);
+    print_phase_json(out, PHASE_FULL_BACKUP, &result, rss_kb, dataset, stored_full, 0);
+
+    // Les noms de sauvegarde sont horodatés à la milliseconde
+    usleep(2000);
+    size_t mutated = mutate_dataset(source, dataset, mutate_percent, 1);
+    run_phase(PHASE_INCREMENTAL_BACKUP, source, backups, restore, &result, &rss_kb);
+    unsigned long long stored_total = repository_bytes(backups);
+    print_phase_json(out, PHASE_INCREMENTAL_BACKUP, &result, rss_kb, dataset, stored_total - stored_full, 0);
+
+    run_phase(PHASE_RESTORE, source, backups, restore, &result, &rss_kb);
+    print_phase_json(out, PHASE_RESTORE, &result, rss_kb, dataset, 0, 1);
+
+    int mismatches = compare_trees(source, restore);
+
+    // Sauvegarde tuée après un point de reprise, --prune, puis --resume : la sauvegarde
+    // reprise doit se restaurer à l'identique (les segments de la sauvegarde interrompue
+    // ne doivent pas avoir été supprimés par --prune)
+    usleep(2000);
+    mutate_dataset(source, dataset, mutate_percent, 2);
+    int interrupted = run_interrupted_backup(source, backups);
+    run_phase(PHASE_PRUNE, source, backups, restore, &result, &rss_kb);
+    run_phase(PHASE_RESUME, source, backups, restore, &result, &rss_kb);
+    remove_tree(restore);
+    run_phase(PHASE_RESTORE, source, backups, restore, &result, &rss_kb);
+    int resume_mismatches = compare_trees(source, restore);
+
+    fprintf(out, "      ], \"mutated_files\": %zu, \"repository_bytes\": %llu, \"restore_mismatches\": %d, "
+            "\"interrupted\": %s, \"resume_after_prune_mismatches\": %d}%s\n",
+            mutated, stored_total, mismatches, interrupted == 1 ? "true" : "false", resume_mismatches,
+            last ? "" : ",");
+
+    remove_tree(source);
+    remove_tree(backups);
+    remove_tree(restore);
+    return 0;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [--scenario NOM|all] [--scale X] [--seed N] [--mutate PCT]\n"
+            "          [--workdir DIR] [--output FICHIER] [--label TEXTE]\n", prog);
+}
+
+int main(int argc, char *argv[]) {
+    static struct option long_options[] = {
+        {"scenario", required_argument, NULL, 'c'},
+        {"scale", required_argument, NULL, 'x'},
+        {"seed", required_argument, NULL, 'e'},
+        {"mutate", required_argument, NULL, 'm'},
+        {"workdir", required_argument, NULL, 'w'},
+        {"output", required_argument, NULL, 'o'},
+        {"label", required_argument, NULL, 'l'},
+        {0, 0, 0, 0}
+    };
+
+    const char *workdir = "bench_work";
+    const char *output = NULL;
+    const char *label = "";
+    double scale = 1.0;
+    double mutate_percent = 10.0;
+    uint64_t seed = 25;
+    int selected[SCENARIO_COUNT] = {0};
+    int any_selected = 0;
+    int opt;
+
+    while ((opt = getopt_long(argc, argv, "c:x:e:m:w:o:l:", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'c':
+                if (strcmp(optarg, "all") == 0) {
+                    for (int i = 0; i < SCENARIO_COUNT; i++) {
+                        selected[i] = 1;
+                    }
+                } else {
+                    int s = scenario_from_name(optarg);
+                    if (s < 0) {
+                        fprintf(stderr, "Scénario inconnu : %s\n", optarg);
+                        return EXIT_FAILURE;
+                    }
+                    selected[s] = 1;
+                }
+                any_selected = 1;
+                break;
+            case 'x':
+                scale = atof(optarg);
+                break;
+            case 'e':
+                seed = strtoull(optarg, NULL, 10);
+                break;
+            case 'm':
+                mutate_percent = atof(optarg);
+                break;
+            case 'w':
+                workdir = optarg;
+                break;
+            case 'o':
+                output = optarg;
+                break;
+            case 'l':
+                label = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (!any_selected) {
+        for (int i = 0; i < SCENARIO_COUNT; i++) {
+            selected[i] = 1;
+        }
+    }
+    if (scale <= 0) {
+        fprintf(stderr, "Le facteur d'échelle doit être positif\n");
+        return EXIT_FAILURE;
+    }
+    if (mkdir(workdir, 0755) != 0 && errno != EEXIST) {
+        perror("Erreur création du répertoire de travail");
+        return EXIT_FAILURE;
+    }
+
+    FILE *out = output ? fopen(output, "w") : stdout;
+    if (!out) {
+        perror("Erreur ouverture du fichier de sortie");
+        return EXIT_FAILURE;
+    }
+
+    int last_selected = -1;
+    for (int i = 0; i < SCENARIO_COUNT; i++) {
+        if (selected[i]) {
+            last_selected = i;
+        }
+    }
+
+    fprintf(out, "{\n  \"label\": \"%s\", \"seed\": %llu, \"scale\": %.3f,\n  \"scenarios\": [\n",
+            label, (unsigned long long)seed, scale);
+    for (int i = 0; i < SCENARIO_COUNT; i++) {
+        if (!selected[i]) {
+            continue;
+        }
+        dataset_t dataset = {.scenario = i, .seed = seed, .scale = scale};
+        run_scenario(out, workdir, &dataset, mutate_percent, i == last_selected);
+        fflush(out);
+    }
+    fprintf(out, "  ]\n}\n");
+
+    if (output) {
+        fclose(out);
+    }
+    rmdir(workdir);
+    free(seen_inodes);
+    return EXIT_SUCCESS;
+}
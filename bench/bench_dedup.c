@@ -0,0 +1,446 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <getopt.h>
+#include <time.h>
+#include <unistd.h>
+#include "deduplication.h"
+#include "backup_manager.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Variables globales normalement définies dans main.c
+int verbose_flag = 0;
+int dry_run_flag = 0;
+
+// Paramètres communs à tous les noyaux mesurés
+typedef struct {
+    int warmup;       // itérations non mesurées
+    int repetitions;  // échantillons mesurés
+    const char *filter; // sous-chaîne du nom des mesures à exécuter
+    FILE *out;
+    int first;        // premier objet JSON émis
+} bench_config_t;
+
+// Échantillons d'une mesure, en cycles et en nanosecondes
+typedef struct {
+    uint64_t *cycles;
+    uint64_t *nanos;
+    int count;
+} samples_t;
+
+/**
+ * @brief Compteur de cycles : TSC sur x86, compteur virtuel sur ARM64, horloge sinon.
+ */
+static inline uint64_t read_cycles(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#elif defined(__aarch64__)
+    uint64_t value;
+    __asm__ volatile("mrs %0, cntvct_el0" : "=r"(value));
+    return value;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+static inline uint64_t read_nanos(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t next_random(uint64_t *state) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static void fill_random(uint64_t *state, unsigned char *buffer, size_t size) {
+    for (size_t i = 0; i < size; i += sizeof(uint64_t)) {
+        uint64_t r = next_random(state);
+        memcpy(buffer + i, &r, size - i < sizeof(r) ? size - i : sizeof(r));
+    }
+}
+
+/**
+ * @brief Construit un flux de chunk_count blocs dont dup_percent % reprennent un bloc déjà vu.
+ */
+static unsigned char *make_stream(size_t chunk_count, int dup_percent, uint64_t seed) {
+    unsigned char *data = malloc(chunk_count * CHUNK_DEFAULT_SIZE);
+    uint64_t state = seed;
+    for (size_t i = 0; i < chunk_count; i++) {
+        unsigned char *block = data + i * CHUNK_DEFAULT_SIZE;
+        if (i > 0 && (int)(next_random(&state) % 100) < dup_percent) {
+            memcpy(block, data + (next_random(&state) % i) * CHUNK_DEFAULT_SIZE, CHUNK_DEFAULT_SIZE);
+        } else {
+            fill_random(&state, block, CHUNK_DEFAULT_SIZE);
+        }
+    }
+    return data;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static uint64_t percentile(const uint64_t *sorted, int count, double p) {
+    int idx = (int)(p / 100.0 * (count - 1) + 0.5);
+    return sorted[idx];
+}
+
+/**
+ * @brief Émet une mesure en JSON : percentiles par opération et débit éventuel.
+ *
+ * @param ops_per_sample nombre d'opérations couvertes par un échantillon
+ * @param bytes_per_sample octets traités par échantillon (0 si sans objet)
+ */
+static void report(bench_config_t *cfg, const char *name, const char *params, samples_t *s,
+                   double ops_per_sample, double bytes_per_sample) {
+    qsort(s->cycles, s->count, sizeof(uint64_t), cmp_u64);
+    qsort(s->nanos, s->count, sizeof(uint64_t), cmp_u64);
+    double p50_ns = percentile(s->nanos, s->count, 50);
+    fprintf(cfg->out, "%s    {\"name\": \"%s\", \"params\": {%s}, \"repetitions\": %d, "
+            "\"cycles_per_op\": {\"min\": %.1f, \"p50\": %.1f, \"p90\": %.1f, \"p99\": %.1f, \"max\": %.1f}, "
+            "\"ns_per_op\": {\"min\": %.1f, \"p50\": %.1f, \"p90\": %.1f, \"p99\": %.1f, \"max\": %.1f}",
+            cfg->first ? "" : ",\n", name, params, s->count,
+            s->cycles[0] / ops_per_sample, percentile(s->cycles, s->count, 50) / ops_per_sample,
+            percentile(s->cycles, s->count, 90) / ops_per_sample, percentile(s->cycles, s->count, 99) / ops_per_sample,
+            s->cycles[s->count - 1] / ops_per_sample,
+            s->nanos[0] / ops_per_sample, p50_ns / ops_per_sample,
+            percentile(s->nanos, s->count, 90) / ops_per_sample, percentile(s->nanos, s->count, 99) / ops_per_sample,
+            s->nanos[s->count - 1] / ops_per_sample);
+    if (bytes_per_sample > 0 && p50_ns > 0) {
+        fprintf(cfg->out, ", \"mb_per_s_p50\": %.1f", bytes_per_sample / p50_ns * 1e9 / (1024.0 * 1024.0));
+    }
+    fprintf(cfg->out, "}");
+    fflush(cfg->out);
+    cfg->first = 0;
+}
+
+static int selected(bench_config_t *cfg, const char *name) {
+    return !cfg->filter || strstr(name, cfg->filter) != NULL;
+}
+
+static void samples_init(samples_t *s, int count) {
+    s->cycles = calloc(count, sizeof(uint64_t));
+    s->nanos = calloc(count, sizeof(uint64_t));
+    s->count = count;
+}
+
+static void samples_free(samples_t *s) {
+    free(s->cycles);
+    free(s->nanos);
+}
+
+// Empêche le compilateur d'éliminer un calcul dont le résultat n'est pas utilisé
+static volatile unsigned int sink;
+
+/**
+ * @brief hash_md5 : lot de HASH_BATCH appels par échantillon (un appel seul est sous la résolution du compteur).
+ */
+#define HASH_BATCH 4096
+static void bench_hash_md5(bench_config_t *cfg) {
+    if (!selected(cfg, "hash_md5")) {
+        return;
+    }
+    unsigned char (*digests)[MD5_DIGEST_LENGTH] = malloc(HASH_BATCH * MD5_DIGEST_LENGTH);
+    uint64_t state = 1;
+    fill_random(&state, (unsigned char *)digests, HASH_BATCH * MD5_DIGEST_LENGTH);
+
+    samples_t s;
+    samples_init(&s, cfg->repetitions);
+    for (int r = -cfg->warmup; r < cfg->repetitions; r++) {
+        uint64_t c0 = read_cycles(), n0 = read_nanos();
+        unsigned int acc = 0;
+        for (int i = 0; i < HASH_BATCH; i++) {
+            acc += hash_md5(digests[i]);
+        }
+        uint64_t c1 = read_cycles(), n1 = read_nanos();
+        sink += acc;
+        if (r >= 0) {
+            s.cycles[r] = c1 - c0;
+            s.nanos[r] = n1 - n0;
+        }
+    }
+    report(cfg, "hash_md5", "\"batch\": 4096", &s, HASH_BATCH, 0);
+    samples_free(&s);
+    free(digests);
+}
+
+/**
+ * @brief compute_md5 sur des tampons de tailles variées.
+ */
+static void bench_compute_md5(bench_config_t *cfg) {
+    if (!selected(cfg, "compute_md5")) {
+        return;
+    }
+    static const size_t sizes[] = {64, 512, 4096, 65536, 1048576};
+    for (size_t k = 0; k < sizeof(sizes) / sizeof(sizes[0]); k++) {
+        size_t size = sizes[k];
+        unsigned char *buffer = malloc(size);
+        unsigned char md5[MD5_DIGEST_LENGTH];
+        uint64_t state = size;
+        fill_random(&state, buffer, size);
+        // Petits tampons : plusieurs appels par échantillon pour rester au-dessus de la résolution
+        int batch = size < 4096 ? 256 : (size < 65536 ? 16 : 1);
+
+        samples_t s;
+        samples_init(&s, cfg->repetitions);
+        for (int r = -cfg->warmup; r < cfg->repetitions; r++) {
+            uint64_t c0 = read_cycles(), n0 = read_nanos();
+            for (int i = 0; i < batch; i++) {
+                compute_md5(buffer, size, md5);
+            }
+            uint64_t c1 = read_cycles(), n1 = read_nanos();
+            sink += md5[0];
+            if (r >= 0) {
+                s.cycles[r] = c1 - c0;
+                s.nanos[r] = n1 - n0;
+            }
+        }
+        char params[64];
+        snprintf(params, sizeof(params), "\"buffer_size\": %zu", size);
+        report(cfg, "compute_md5", params, &s, batch, (double)size * batch);
+        samples_free(&s);
+        free(buffer);
+    }
+}
+
+/**
+ * @brief find_md5 (succès et échec) et add_md5 en fonction du remplissage de la table.
+ */
+static void bench_md5_table(bench_config_t *cfg) {
+    static const int fills[] = {10, 100, 500, 999};
+    for (size_t k = 0; k < sizeof(fills) / sizeof(fills[0]); k++) {
+        int fill = fills[k];
+        unsigned char (*digests)[MD5_DIGEST_LENGTH] = malloc((fill + 1) * MD5_DIGEST_LENGTH);
+        uint64_t state = 7 + fill;
+        fill_random(&state, (unsigned char *)digests, (fill + 1) * MD5_DIGEST_LENGTH);
+        Md5Entry *table = calloc(HASH_TABLE_SIZE, sizeof(Md5Entry));
+        for (int i = 0; i < fill; i++) {
+            add_md5(table, digests[i], i);
+        }
+        char params[64];
+        snprintf(params, sizeof(params), "\"entries\": %d", fill);
+
+        const char *names[] = {"find_md5_hit", "find_md5_miss", "add_md5"};
+        for (int mode = 0; mode < 3; mode++) {
+            if (!selected(cfg, names[mode])) {
+                continue;
+            }
+            samples_t s;
+            samples_init(&s, cfg->repetitions);
+            for (int r = -cfg->warmup; r < cfg->repetitions; r++) {
+                uint64_t c0, c1, n0, n1;
+                if (mode == 0) {
+                    c0 = read_cycles();
+                    n0 = read_nanos();
+                    for (int i = 0; i < fill; i++) {
+                        sink += find_md5(table, digests[i]);
+                    }
+                    c1 = read_cycles();
+                    n1 = read_nanos();
+                } else if (mode == 1) {
+                    c0 = read_cycles();
+                    n0 = read_nanos();
+                    for (int i = 0; i < fill; i++) {
+                        sink += find_md5(table, digests[fill]);
+                    }
+                    c1 = read_cycles();
+                    n1 = read_nanos();
+                } else {
+                    // Insertion de fill entrées dans une table vide
+                    Md5Entry *empty = calloc(HASH_TABLE_SIZE, sizeof(Md5Entry));
+                    c0 = read_cycles();
+                    n0 = read_nanos();
+                    for (int i = 0; i < fill; i++) {
+                        add_md5(empty, digests[i], i);
+                    }
+                    c1 = read_cycles();
+                    n1 = read_nanos();
+                    free(empty);
+                }
+                if (r >= 0) {
+                    s.cycles[r] = c1 - c0;
+                    s.nanos[r] = n1 - n0;
+                }
+            }
+            report(cfg, names[mode], params, &s, fill, 0);
+            samples_free(&s);
+        }
+        free(table);
+        free(digests);
+    }
+}
+
+static void reset_chunks(Chunk *chunks, size_t count, arena_t *arena) {
+    memset(chunks, 0, count * sizeof(Chunk));
+    arena_reset(arena);
+}
+
+/**
+ * @brief deduplicate_file puis undeduplicate_file sur un flux en mémoire (fmemopen, sans disque).
+ */
+static void bench_dedup_roundtrip(bench_config_t *cfg) {
+    static const size_t chunk_counts[] = {16, 256, 2048};
+    static const int dup_percents[] = {0, 50, 90};
+    char tmp_path[] = "/tmp/bench_dedup_XXXXXX";
+    int tmp_fd = mkstemp(tmp_path);
+    if (tmp_fd < 0) {
+        perror("Erreur création du fichier temporaire");
+        return;
+    }
+    close(tmp_fd);
+
+    for (size_t a = 0; a < sizeof(chunk_counts) / sizeof(chunk_counts[0]); a++) {
+        for (size_t b = 0; b < sizeof(dup_percents) / sizeof(dup_percents[0]); b++) {
+            size_t count = chunk_counts[a];
+            int dup = dup_percents[b];
+            size_t size = count * CHUNK_DEFAULT_SIZE;
+            unsigned char *data = make_stream(count, dup, 42 + count + dup);
+            Chunk *chunks = calloc(count + 2, sizeof(Chunk));
+            size_t capacity = count + 2; // suffisant : le tableau n'est jamais agrandi
+            Md5Entry *table = calloc(HASH_TABLE_SIZE, sizeof(Md5Entry));
+            arena_t arena;
+            arena_init(&arena, 0);
+            char params[96];
+            snprintf(params, sizeof(params), "\"chunks\": %zu, \"dup_percent\": %d", count, dup);
+
+            if (selected(cfg, "deduplicate_file")) {
+                samples_t s;
+                samples_init(&s, cfg->repetitions);
+                for (int r = -cfg->warmup; r < cfg->repetitions; r++) {
+                    FILE *f = fmemopen(data, size, "rb");
+                    memset(table, 0, HASH_TABLE_SIZE * sizeof(Md5Entry));
+                    uint64_t c0 = read_cycles(), n0 = read_nanos();
+                    deduplicate_file(f, size, &chunks, &capacity, table, &arena);
+                    uint64_t c1 = read_cycles(), n1 = read_nanos();
+                    fclose(f);
+                    reset_chunks(chunks, count + 2, &arena);
+                    if (r >= 0) {
+                        s.cycles[r] = c1 - c0;
+                        s.nanos[r] = n1 - n0;
+                    }
+                }
+                report(cfg, "deduplicate_file", params, &s, 1, (double)size);
+                samples_free(&s);
+            }
+
+            if (selected(cfg, "undeduplicate_file")) {
+                // Fichier .dedup de référence produit une seule fois par les fonctions du projet
+                FILE *f = fmemopen(data, size, "rb");
+                memset(table, 0, HASH_TABLE_SIZE * sizeof(Md5Entry));
+                deduplicate_file(f, size, &chunks, &capacity, table, &arena);
+                fclose(f);
+                write_backup_file(tmp_path, chunks, (int)count);
+                reset_chunks(chunks, count + 2, &arena);
+
+                FILE *dedup = fopen(tmp_path, "rb");
+                fseek(dedup, 0, SEEK_END);
+                long dedup_size = ftell(dedup);
+                rewind(dedup);
+                unsigned char *dedup_data = malloc(dedup_size);
+                if (fread(dedup_data, 1, dedup_size, dedup) != (size_t)dedup_size) {
+                    dedup_size = 0;
+                }
+                fclose(dedup);
+
+                samples_t s;
+                samples_init(&s, cfg->repetitions);
+                for (int r = -cfg->warmup; r < cfg->repetitions; r++) {
+                    FILE *in = fmemopen(dedup_data, dedup_size, "rb");
+                    Chunk *restored = NULL;
+                    int restored_count = 0;
+                    uint64_t c0 = read_cycles(), n0 = read_nanos();
+                    undeduplicate_file(in, &restored, &restored_count, &arena);
+                    uint64_t c1 = read_cycles(), n1 = read_nanos();
+                    fclose(in);
+                    arena_reset(&arena);
+                    if (r >= 0) {
+                        s.cycles[r] = c1 - c0;
+                        s.nanos[r] = n1 - n0;
+                    }
+                }
+                report(cfg, "undeduplicate_file", params, &s, 1, (double)size);
+                samples_free(&s);
+                free(dedup_data);
+            }
+
+            arena_free(&arena);
+            free(table);
+            free(chunks);
+            free(data);
+        }
+    }
+    unlink(tmp_path);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [--repetitions N] [--warmup N] [--filter NOM] [--output FICHIER]\n", prog);
+}
+
+int main(int argc, char *argv[]) {
+    static struct option long_options[] = {
+        {"repetitions", required_argument, NULL, 'r'},
+        {"warmup", required_argument, NULL, 'w'},
+        {"filter", required_argument, NULL, 'f'},
+        {"output", required_argument, NULL, 'o'},
+        {0, 0, 0, 0}
+    };
+    bench_config_t cfg = {.warmup = 3, .repetitions = 30, .filter = NULL, .out = stdout, .first = 1};
+    const char *output = NULL;
+    int opt;
+
+    while ((opt = getopt_long(argc, argv, "r:w:f:o:", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'r':
+                cfg.repetitions = atoi(optarg);
+                break;
+            case 'w':
+                cfg.warmup = atoi(optarg);
+                break;
+            case 'f':
+                cfg.filter = optarg;
+                break;
+            case 'o':
+                output = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (cfg.repetitions <= 0 || cfg.warmup < 0) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (output) {
+        cfg.out = fopen(output, "w");
+        if (!cfg.out) {
+            perror("Erreur ouverture du fichier de sortie");
+            return EXIT_FAILURE;
+        }
+    }
+
+    fprintf(cfg.out, "{\n  \"chunk_size\": %d, \"hash_table_size\": %d,\n  \"benchmarks\": [\n",
+            CHUNK_DEFAULT_SIZE, HASH_TABLE_SIZE);
+    bench_hash_md5(&cfg);
+    bench_compute_md5(&cfg);
+    bench_md5_table(&cfg);
+    bench_dedup_roundtrip(&cfg);
+    fprintf(cfg.out, "\n  ]\n}\n");
+
+    if (output) {
+        fclose(cfg.out);
+    }
+    return EXIT_SUCCESS;
+}
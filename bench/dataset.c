@@ -0,0 +1,302 @@
+#define _XOPEN_SOURCE 700
+#include "dataset.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <ftw.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#define FILES_PER_DIR 100
+#define BLOCK_SIZE 4096
+#define DUP_POOL_BLOCKS 16
+#define BASE_MTIME 1704067200 // 2024-01-01 00:00:00 UTC, fixe pour des résultats reproductibles
+
+static const char *scenario_names[SCENARIO_COUNT] = {
+    "small_files", "huge_files", "high_dup", "random"
+};
+
+/**
+ * @brief Générateur splitmix64 : rapide, sans état global, reproductible.
+ */
+static uint64_t next_random(uint64_t *state) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static void fill_random(uint64_t *state, unsigned char *buffer, size_t size) {
+    size_t i = 0;
+    while (i < size) {
+        uint64_t r = next_random(state);
+        size_t n = size - i < sizeof(r) ? size - i : sizeof(r);
+        memcpy(buffer + i, &r, n);
+        i += n;
+    }
+}
+
+const char *scenario_name(scenario_t scenario) {
+    if (scenario < 0 || scenario >= SCENARIO_COUNT) {
+        return "unknown";
+    }
+    return scenario_names[scenario];
+}
+
+int scenario_from_name(const char *name) {
+    for (int i = 0; i < SCENARIO_COUNT; i++) {
+        if (strcmp(name, scenario_names[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Nombre de fichiers d'un scénario pour le facteur d'échelle donné.
+ */
+static size_t scenario_file_count(const dataset_t *dataset) {
+    double base;
+    switch (dataset->scenario) {
+        case SCENARIO_SMALL_FILES:
+            base = 4000;
+            break;
+        case SCENARIO_HUGE_FILES:
+            base = 2;
+            break;
+        case SCENARIO_HIGH_DUP:
+            base = 200;
+            break;
+        default:
+            base = 64;
+            break;
+    }
+    size_t count = (size_t)(base * dataset->scale);
+    return count > 0 ? count : 1;
+}
+
+/**
+ * @brief Taille du fichier index, déterminée uniquement par la graine et l'index.
+ */
+static size_t scenario_file_size(const dataset_t *dataset, size_t index) {
+    uint64_t state = dataset->seed ^ (index * 0x100000001B3ULL);
+    uint64_t r = next_random(&state);
+    switch (dataset->scenario) {
+        case SCENARIO_SMALL_FILES:
+            return 512 + r % (BLOCK_SIZE - 511);
+        case SCENARIO_HUGE_FILES:
+            // Pour les gros fichiers, l'échelle joue sur la taille et non sur le nombre
+            return (size_t)(32.0 * 1024 * 1024 * (dataset->scale < 1.0 ? dataset->scale : 1.0)) + r % BLOCK_SIZE;
+        case SCENARIO_HIGH_DUP:
+            return 256 * 1024;
+        default:
+            return 1024 * 1024 + r % BLOCK_SIZE;
+    }
+}
+
+static void file_path(const char *root, size_t index, char *path, size_t size) {
+    snprintf(path, size, "%s/d%03zu/f%06zu.bin", root, index / FILES_PER_DIR, index);
+}
+
+static void dir_path(const char *root, size_t index, char *path, size_t size) {
+    snprintf(path, size, "%s/d%03zu", root, index / FILES_PER_DIR);
+}
+
+/**
+ * @brief Remplit le contenu du fichier index selon le scénario.
+ */
+static void fill_file(const dataset_t *dataset, size_t index, unsigned char *data, size_t size,
+                      unsigned char pool[DUP_POOL_BLOCKS][BLOCK_SIZE]) {
+    uint64_t state = dataset->seed + 0xA5A5A5A5ULL * (index + 1);
+    if (dataset->scenario == SCENARIO_HIGH_DUP) {
+        for (size_t off = 0; off < size; off += BLOCK_SIZE) {
+            size_t n = size - off < BLOCK_SIZE ? size - off : BLOCK_SIZE;
+            memcpy(data + off, pool[next_random(&state) % DUP_POOL_BLOCKS], n);
+        }
+    } else {
+        fill_random(&state, data, size);
+    }
+}
+
+static int write_whole_file(const char *path, const unsigned char *data, size_t size, time_t mtime) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror("Erreur création du fichier de test");
+        return -1;
+    }
+    size_t written = 0;
+    while (written < size) {
+        ssize_t n = write(fd, data + written, size - written);
+        if (n <= 0) {
+            perror("Erreur écriture du fichier de test");
+            close(fd);
+            return -1;
+        }
+        written += (size_t)n;
+    }
+    close(fd);
+    struct timeval times[2] = {{mtime, 0}, {mtime, 0}};
+    utimes(path, times);
+    return 0;
+}
+
+int generate_dataset(const char *root, dataset_t *dataset) {
+    if (mkdir(root, 0755) != 0 && errno != EEXIST) {
+        perror("Erreur création du répertoire du jeu de données");
+        return -1;
+    }
+
+    unsigned char pool[DUP_POOL_BLOCKS][BLOCK_SIZE];
+    uint64_t pool_state = dataset->seed ^ 0xD1B54A32D192ED03ULL;
+    for (int i = 0; i < DUP_POOL_BLOCKS; i++) {
+        fill_random(&pool_state, pool[i], BLOCK_SIZE);
+    }
+
+    dataset->files = scenario_file_count(dataset);
+    dataset->bytes = 0;
+    unsigned char *data = NULL;
+    size_t capacity = 0;
+    char path[4096];
+
+    for (size_t i = 0; i < dataset->files; i++) {
+        if (i % FILES_PER_DIR == 0) {
+            dir_path(root, i, path, sizeof(path));
+            if (mkdir(path, 0755) != 0 && errno != EEXIST) {
+                perror("Erreur création d'un sous-répertoire de test");
+                free(data);
+                return -1;
+            }
+        }
+        size_t size = scenario_file_size(dataset, i);
+        if (size > capacity) {
+            free(data);
+            data = malloc(size);
+            if (!data) {
+                return -1;
+            }
+            capacity = size;
+        }
+        fill_file(dataset, i, data, size, pool);
+        file_path(root, i, path, sizeof(path));
+        if (write_whole_file(path, data, size, BASE_MTIME) != 0) {
+            free(data);
+            return -1;
+        }
+        dataset->bytes += size;
+    }
+    free(data);
+    return 0;
+}
+
+size_t mutate_dataset(const char *root, const dataset_t *dataset, double percent, int round) {
+    size_t target = (size_t)(dataset->files * percent / 100.0 + 0.5);
+    if (target == 0 && percent > 0) {
+        target = 1; // au moins un fichier modifié dès qu'un pourcentage est demandé
+    }
+    if (target == 0 || dataset->files == 0) {
+        return 0;
+    }
+    // Pas régulier sur les index pour répartir les modifications dans l'arborescence
+    size_t step = dataset->files / target;
+    if (step == 0) {
+        step = 1;
+    }
+
+    uint64_t state = (dataset->seed + round - 1) ^ 0x5DEECE66DULL;
+    unsigned char block[BLOCK_SIZE];
+    char path[4096];
+    size_t mutated = 0;
+
+    for (size_t i = 0; i < dataset->files && mutated < target; i += step) {
+        size_t size = scenario_file_size(dataset, i);
+        size_t len = size < BLOCK_SIZE ? size : BLOCK_SIZE;
+        size_t blocks = size / BLOCK_SIZE;
+        off_t offset = blocks > 1 ? (off_t)(next_random(&state) % blocks) * BLOCK_SIZE : 0;
+        fill_random(&state, block, len);
+
+        file_path(root, i, path, sizeof(path));
+        int fd = open(path, O_WRONLY);
+        if (fd < 0) {
+            continue;
+        }
+        if (pwrite(fd, block, len, offset) != (ssize_t)len) {
+            perror("Erreur modification d'un fichier de test");
+        }
+        close(fd);
+        struct timeval times[2] = {{BASE_MTIME + 86400 * round, 0}, {BASE_MTIME + 86400 * round, 0}};
+        utimes(path, times);
+        mutated++;
+    }
+    return mutated;
+}
+
+static int remove_entry(const char *path, const struct stat *st, int flag, struct FTW *ftw) {
+    (void)st;
+    (void)flag;
+    (void)ftw;
+    remove(path);
+    return 0;
+}
+
+void remove_tree(const char *path) {
+    nftw(path, remove_entry, 64, FTW_DEPTH | FTW_PHYS);
+}
+
+/**
+ * @brief Compare deux fichiers octet par octet, renvoie 0 s'ils sont identiques.
+ */
+static int compare_files(const char *expected, const char *actual) {
+    FILE *a = fopen(expected, "rb");
+    FILE *b = fopen(actual, "rb");
+    int differ = 0;
+    if (!a || !b) {
+        differ = 1;
+    } else {
+        unsigned char buf_a[65536], buf_b[65536];
+        size_t na, nb;
+        do {
+            na = fread(buf_a, 1, sizeof(buf_a), a);
+            nb = fread(buf_b, 1, sizeof(buf_b), b);
+            if (na != nb || memcmp(buf_a, buf_b, na) != 0) {
+                differ = 1;
+                break;
+            }
+        } while (na > 0);
+    }
+    if (a) {
+        fclose(a);
+    }
+    if (b) {
+        fclose(b);
+    }
+    return differ;
+}
+
+// nftw n'accepte pas de contexte : la comparaison passe par ces deux variables
+static const char *compare_expected_root;
+static const char *compare_actual_root;
+static int compare_mismatches;
+
+static int compare_entry(const char *path, const struct stat *st, int flag, struct FTW *ftw) {
+    (void)ftw;
+    if (flag != FTW_F || !S_ISREG(st->st_mode)) {
+        return 0;
+    }
+    char actual[4096];
+    snprintf(actual, sizeof(actual), "%s%s", compare_actual_root, path + strlen(compare_expected_root));
+    if (compare_files(path, actual) != 0) {
+        compare_mismatches++;
+    }
+    return 0;
+}
+
+int compare_trees(const char *expected, const char *actual) {
+    compare_expected_root = expected;
+    compare_actual_root = actual;
+    compare_mismatches = 0;
+    nftw(expected, compare_entry, 64, FTW_PHYS);
+    return compare_mismatches;
+}
@@ -0,0 +1,39 @@
+#ifndef DATASET_H
+#define DATASET_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Scénarios de jeux de données synthétiques
+typedef enum {
+    SCENARIO_SMALL_FILES, // beaucoup de petits fichiers (512 o - 4 Ko)
+    SCENARIO_HUGE_FILES,  // quelques très gros fichiers
+    SCENARIO_HIGH_DUP,    // contenu construit à partir d'un petit nombre de blocs
+    SCENARIO_RANDOM,      // contenu aléatoire, pas de doublons
+    SCENARIO_COUNT
+} scenario_t;
+
+// Description d'un jeu de données généré
+typedef struct {
+    scenario_t scenario;
+    uint64_t seed;   // graine du générateur pseudo-aléatoire
+    double scale;    // facteur multiplicatif sur le nombre/la taille des fichiers
+    size_t files;    // nombre de fichiers générés
+    size_t bytes;    // taille logique totale
+} dataset_t;
+
+// Nom d'un scénario (utilisé dans la sortie JSON et en argument)
+const char *scenario_name(scenario_t scenario);
+// Retrouve un scénario à partir de son nom, -1 si inconnu
+int scenario_from_name(const char *name);
+// Génère un jeu de données déterministe dans root (créé si besoin)
+int generate_dataset(const char *root, dataset_t *dataset);
+// Modifie percent % des fichiers du jeu de données (même taille, mtime avancé de round jours) ;
+// chaque round (à partir de 1) écrit un contenu différent
+size_t mutate_dataset(const char *root, const dataset_t *dataset, double percent, int round);
+// Supprime récursivement un répertoire
+void remove_tree(const char *path);
+// Compare récursivement deux arborescences, renvoie 0 si les fichiers sont identiques
+int compare_trees(const char *expected, const char *actual);
+
+#endif // DATASET_H
@@ -0,0 +1,182 @@
+#include "arena.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#define ARENA_ALIGN 16
+
+void arena_init(arena_t *arena, size_t block_size) {
+    arena->first = NULL;
+    arena->current = NULL;
+    arena->block_size = block_size ? block_size : ARENA_BLOCK_SIZE;
+}
+
+void *arena_alloc(arena_t *arena, size_t size) {
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    if (size == 0) {
+        size = ARENA_ALIGN;
+    }
+    // Après arena_reset, les blocs qui suivent le bloc courant sont libres : on les reprend
+    while (arena->current) {
+        arena_block *block = arena->current;
+        if (block->size - block->used >= size) {
+            void *p = block->data + block->used;
+            block->used += size;
+            return p;
+        }
+        if (!block->next) {
+            break;
+        }
+        arena->current = block->next;
+        arena->current->used = 0;
+    }
+
+    size_t block_size = size > arena->block_size ? size : arena->block_size;
+    arena_block *block = malloc(sizeof(arena_block) + block_size);
+    if (!block) {
+        return NULL;
+    }
+    block->next = NULL;
+    block->size = block_size;
+    block->used = size;
+    if (arena->current) {
+        arena->current->next = block;
+    } else {
+        arena->first = block;
+    }
+    arena->current = block;
+    return block->data;
+}
+
+void *arena_calloc(arena_t *arena, size_t size) {
+    void *p = arena_alloc(arena, size);
+    if (p) {
+        memset(p, 0, size);
+    }
+    return p;
+}
+
+char *arena_strdup(arena_t *arena, const char *s) {
+    size_t len = strlen(s) + 1;
+    char *copy = arena_alloc(arena, len);
+    if (copy) {
+        memcpy(copy, s, len);
+    }
+    return copy;
+}
+
+void arena_reset(arena_t *arena) {
+    // Les premiers blocs sont gardés ; au-delà de ARENA_RETAIN_SIZE (après un très gros
+    // fichier par exemple), ils sont libérés pour ne pas garder le pic de mémoire
+    size_t retained = 0;
+    arena_block **link = &arena->first;
+    while (*link) {
+        arena_block *block = *link;
+        if (retained + block->size > ARENA_RETAIN_SIZE && retained > 0) {
+            *link = block->next;
+            free(block);
+            continue;
+        }
+        retained += block->size;
+        link = &block->next;
+    }
+    arena->current = arena->first;
+    if (arena->current) {
+        arena->current->used = 0;
+    }
+}
+
+void arena_free(arena_t *arena) {
+    arena_block *block = arena->first;
+    while (block) {
+        arena_block *next = block->next;
+        free(block);
+        block = next;
+    }
+    arena->first = NULL;
+    arena->current = NULL;
+}
+
+// Hachage FNV-1a d'une chaîne
+static uint64_t hash_string(const char *s) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (; *s; s++) {
+        hash = (hash ^ (unsigned char)*s) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+string_pool_t *string_pool_create(void) {
+    string_pool_t *pool = malloc(sizeof(string_pool_t));
+    if (!pool) {
+        return NULL;
+    }
+    arena_init(&pool->arena, 0);
+    pool->capacity = 1024;
+    pool->count = 0;
+    pool->slots = calloc(pool->capacity, sizeof(const char *));
+    if (!pool->slots) {
+        free(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+static int string_pool_grow(string_pool_t *pool) {
+    size_t capacity = pool->capacity * 2;
+    const char **slots = calloc(capacity, sizeof(const char *));
+    if (!slots) {
+        return -1;
+    }
+    for (size_t i = 0; i < pool->capacity; i++) {
+        if (pool->slots[i]) {
+            size_t slot = hash_string(pool->slots[i]) & (capacity - 1);
+            while (slots[slot]) {
+                slot = (slot + 1) & (capacity - 1);
+            }
+            slots[slot] = pool->slots[i];
+        }
+    }
+    free(pool->slots);
+    pool->slots = slots;
+    pool->capacity = capacity;
+    return 0;
+}
+
+const char *string_pool_intern(string_pool_t *pool, const char *s) {
+    // Table remplie au plus aux trois quarts
+    if ((pool->count + 1) * 4 > pool->capacity * 3 && string_pool_grow(pool) != 0) {
+        return arena_strdup(&pool->arena, s);
+    }
+    size_t slot = hash_string(s) & (pool->capacity - 1);
+    while (pool->slots[slot]) {
+        if (strcmp(pool->slots[slot], s) == 0) {
+            return pool->slots[slot];
+        }
+        slot = (slot + 1) & (pool->capacity - 1);
+    }
+    const char *copy = arena_strdup(&pool->arena, s);
+    pool->slots[slot] = copy;
+    pool->count++;
+    return copy;
+}
+
+const char *string_pool_find(const string_pool_t *pool, const char *s) {
+    size_t slot = hash_string(s) & (pool->capacity - 1);
+    while (pool->slots[slot]) {
+        if (strcmp(pool->slots[slot], s) == 0) {
+            return pool->slots[slot];
+        }
+        slot = (slot + 1) & (pool->capacity - 1);
+    }
+    return NULL;
+}
+
+void string_pool_free(string_pool_t *pool) {
+    if (!pool) {
+        return;
+    }
+    arena_free(&pool->arena);
+    free(pool->slots);
+    free(pool);
+}
@@ -0,0 +1,57 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// Taille par défaut d'un bloc d'arène
+#define ARENA_BLOCK_SIZE (256 * 1024)
+// Au-delà de cette taille, les blocs libérés par arena_reset sont rendus au système
+#define ARENA_RETAIN_SIZE (16 * 1024 * 1024)
+
+// Bloc de mémoire d'une arène, chaîné au suivant
+typedef struct arena_block {
+    struct arena_block *next;
+    size_t size; // octets utilisables dans data
+    size_t used; // octets déjà distribués
+    unsigned char data[];
+} arena_block;
+
+// Arène : allocations par simple incrément dans des blocs, libérées toutes ensemble.
+// Une arène remise à zéro par arena_reset réutilise ses blocs sans nouvel appel à malloc.
+typedef struct {
+    arena_block *first;
+    arena_block *current;
+    size_t block_size;
+} arena_t;
+
+// Ensemble de chaînes : chaque chaîne distincte n'est copiée qu'une fois dans l'arène
+typedef struct {
+    arena_t arena;
+    const char **slots; // table d'adressage ouvert (NULL : case libre)
+    size_t capacity;
+    size_t count;
+} string_pool_t;
+
+// Initialise une arène vide (block_size : 0 pour ARENA_BLOCK_SIZE)
+void arena_init(arena_t *arena, size_t block_size);
+// Alloue size octets alignés sur 16 octets (jamais NULL sauf mémoire épuisée)
+void *arena_alloc(arena_t *arena, size_t size);
+// Alloue size octets mis à zéro
+void *arena_calloc(arena_t *arena, size_t size);
+// Copie une chaîne dans l'arène
+char *arena_strdup(arena_t *arena, const char *s);
+// Libère d'un coup tout ce qui a été alloué, en gardant les blocs pour la suite
+void arena_reset(arena_t *arena);
+// Rend tous les blocs au système
+void arena_free(arena_t *arena);
+
+// Crée un ensemble de chaînes vide
+string_pool_t *string_pool_create(void);
+// Retourne la copie unique de s dans l'ensemble
+const char *string_pool_intern(string_pool_t *pool, const char *s);
+// Copie de s dans l'ensemble, NULL si elle n'y est pas
+const char *string_pool_find(const string_pool_t *pool, const char *s);
+// Libère l'ensemble et toutes ses chaînes
+void string_pool_free(string_pool_t *pool);
+
+#endif // ARENA_H
@@ -1,6 +1,18 @@
+#define _GNU_SOURCE
 #include "backup_manager.h"
 #include "deduplication.h"
 #include "file_handler.h"
+#include "refcount.h"
+#include "chunk_cache.h"
+#include "direct_io.h"
+#include "file_digest.h"
+#include "journal.h"
+#include "manifest.h"
+#include "segment.h"
+#include "path_index.h"
+#include "stats.h"
+#include "throttle.h"
+#include "trace.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -10,12 +22,22 @@
 #include <sys/types.h>
 #include <sys/time.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <unistd.h>
+#include <pthread.h>
 #include <openssl/md5.h>
+#include <openssl/evp.h>
 
 #define MAX_CHUNKS 10000
 #define MAX_SIZE_PATH 2048
 
+// Mémoire allouée par create_backup à ses listes de fichiers (--memory-limit, 0 : pas de limite)
+static size_t memory_limit = 0;
+// Secondes entre deux points de reprise
+static unsigned int checkpoint_interval = CHECKPOINT_INTERVAL;
+// Avec --memory-limit, entrées de la sauvegarde précédente gardées au plus pendant la fusion
+#define STREAM_WINDOW_ENTRIES 4096
+
 extern int verbose_flag;
 extern int dry_run_flag;
 
@@ -25,6 +47,7 @@ extern int dry_run_flag;
 static int file_exists_local(const char *path) {
     struct stat st;
     int exists = (stat(path, &st) == 0);
+    stats_add(STATS_METADATA_OPS, 1);
 
     if (verbose_flag) {
         if (exists) {
@@ -52,6 +75,7 @@ static int create_directory_local(const char *path) {
         return 0;
     }
 
+    stats_add(STATS_METADATA_OPS, 1);
     if (mkdir(path, 0755) == -1 && errno != EEXIST) {
         if (verbose_flag) {
             perror("[ERROR] Échec de la création du répertoire");
@@ -84,6 +108,27 @@ static void get_timestamp_local(char *buffer, size_t size) {
     }
 }
 
+/**
+ * @brief readdir chronométré, compté dans la phase de parcours de la source.
+ */
+static struct dirent *scan_readdir(DIR *dir) {
+    uint64_t start = stats_now_ns();
+    struct dirent *entry = readdir(dir);
+    stats_phase_end(STATS_PHASE_SCAN, start);
+    return entry;
+}
+
+/**
+ * @brief stat chronométré, compté dans la phase de parcours de la source.
+ */
+static int scan_stat(const char *path, struct stat *st) {
+    uint64_t start = stats_now_ns();
+    int ret = stat(path, st);
+    stats_phase_end(STATS_PHASE_SCAN, start);
+    stats_add(STATS_METADATA_OPS, 1);
+    return ret;
+}
+
 /**
  * @brief Trouve le dernier répertoire de sauvegarde (le plus récent).
  */
@@ -108,7 +153,8 @@ static void find_last_backup_local(const char *backup_dir, char *last_backup_dir
         if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
             continue;
         }
-        if (strcmp(entry->d_name, ".backup_log") == 0) {
+        // .backup_log, PACK_DIR et REFCOUNT_DIR ne sont pas des sauvegardes
+        if (entry->d_name[0] == '.') {
             continue;
         }
 
@@ -142,10 +188,140 @@ static void find_last_backup_local(const char *backup_dir, char *last_backup_dir
 }
 
 /**
- * @brief Écrit dans un fichier de backup dédupliqué le tableau de chunks.
+ * @brief Supprime récursivement un répertoire de préparation abandonné.
+ *
+ * Les compteurs de références ne sont pas décrémentés : la sauvegarde a pu s'arrêter
+ * entre l'écriture d'un fichier et l'ajout de ses références. Des compteurs trop hauts
+ * gardent seulement des chunks dans les packs plus longtemps que nécessaire.
+ */
+static void remove_staging_tree(const char *dir_path) {
+    DIR *dir = opendir(dir_path);
+    if (!dir) {
+        return;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+        char path[MAX_SIZE_PATH];
+        snprintf(path, sizeof(path), "%s/%s", dir_path, entry->d_name);
+        struct stat st;
+        if (lstat(path, &st) == 0 && S_ISDIR(st.st_mode)) {
+            remove_staging_tree(path);
+        } else {
+            unlink(path);
+        }
+        stats_add(STATS_METADATA_OPS, 1);
+    }
+    closedir(dir);
+    rmdir(dir_path);
+    stats_add(STATS_METADATA_OPS, 1);
+}
+
+/**
+ * @brief Supprime les répertoires de préparation laissés par une sauvegarde interrompue,
+ * sauf keep (celui que reprend --resume, NULL pour tous les supprimer).
+ *
+ * Les segments de sauvegardes supprimées que --prune a gardés pour leur point de reprise
+ * sont supprimés avec eux s'ils ne sont plus cités.
+ */
+static void remove_stale_staging(const char *backup_dir, const char *keep) {
+    DIR *dir = opendir(backup_dir);
+    if (!dir) {
+        return;
+    }
+    string_pool_t *cited = string_pool_create();
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strncmp(entry->d_name, STAGING_PREFIX, strlen(STAGING_PREFIX)) != 0
+            || (keep && strcmp(entry->d_name, keep) == 0)) {
+            continue;
+        }
+        char path[MAX_SIZE_PATH];
+        snprintf(path, sizeof(path), "%s/%s", backup_dir, entry->d_name);
+        printf("Sauvegarde interrompue supprimée : %s\n", path);
+        if (cited) {
+            char log_path[MAX_SIZE_PATH + sizeof(CHECKPOINT_FILE)];
+            snprintf(log_path, sizeof(log_path), "%s/%s", path, CHECKPOINT_FILE);
+            segment_collect(log_path, cited);
+        }
+        remove_staging_tree(path);
+        segment_remove_run(backup_dir, entry->d_name + strlen(STAGING_PREFIX));
+    }
+    closedir(dir);
+    if (cited) {
+        segment_sweep(backup_dir, cited, NULL);
+        string_pool_free(cited);
+    }
+}
+
+/**
+ * @brief Trouve le répertoire de préparation le plus récent qui a un point de reprise
+ * (la duplication de la sauvegarde précédente y est terminée).
+ * @return 0 et son nom dans name, -1 s'il n'y en a pas.
+ */
+static int find_resumable_staging(const char *backup_dir, char *name, size_t size) {
+    DIR *dir = opendir(backup_dir);
+    if (!dir) {
+        return -1;
+    }
+    name[0] = '\0';
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        // Un nom trop long pour name n'est pas l'horodatage d'une sauvegarde
+        if (strncmp(entry->d_name, STAGING_PREFIX, strlen(STAGING_PREFIX)) != 0
+            || strlen(entry->d_name) >= size || strcmp(entry->d_name, name) <= 0) {
+            continue;
+        }
+        char path[MAX_SIZE_PATH];
+        snprintf(path, sizeof(path), "%s/%s/%s", backup_dir, entry->d_name, CHECKPOINT_FILE);
+        if (file_exists_local(path)) {
+            snprintf(name, size, "%s", entry->d_name);
+        }
+    }
+    closedir(dir);
+    return name[0] ? 0 : -1;
+}
+
+/**
+ * @brief Rend durable tout ce qui a été écrit sur le système de fichiers de backup_dir
+ * (fichiers .dedup, compteurs de références, packs) en un seul appel, plutôt qu'un
+ * fsync par fichier.
+ */
+static int sync_backup_dir(const char *backup_dir) {
+    int fd = open(backup_dir, O_RDONLY | O_DIRECTORY);
+    if (fd < 0) {
+        perror("Erreur d'ouverture du répertoire de sauvegarde");
+        return -1;
+    }
+    int ret = syncfs(fd);
+    if (ret != 0) {
+        perror("Erreur syncfs");
+    }
+    close(fd);
+    return ret;
+}
+
+/**
+ * @brief Rend durables les créations et renommages d'entrées d'un répertoire.
+ */
+static void fsync_directory(const char *path) {
+    int fd = open(path, O_RDONLY | O_DIRECTORY);
+    if (fd < 0) {
+        return;
+    }
+    if (fsync(fd) != 0) {
+        perror("Erreur fsync du répertoire");
+    }
+    close(fd);
+}
+
+/**
+ * @brief Écrit le fichier .dedup de chunks découpés en chunk_size octets.
  * Si dry_run_flag est activé, n'écrit pas réellement, se contente d'afficher ce qui serait fait.
  */
-void write_backup_file(const char *output_filename, Chunk *chunks, int chunk_count) {
+static void write_dedup_file(const char *output_filename, Chunk *chunks, int chunk_count, size_t chunk_size) {
     if (dry_run_flag) {
         if (verbose_flag) {
             printf("[DRY-RUN] Écriture du fichier dédupliqué : %s avec %d chunks (non réalisée)\n", output_filename, chunk_count);
@@ -153,26 +329,40 @@ void write_backup_file(const char *output_filename, Chunk *chunks, int chunk_cou
         return; // Pas d'écriture réelle
     }
 
+    // Le fichier peut être un lien dur vers la sauvegarde précédente :
+    // on le détache avant d'écrire pour ne pas modifier l'ancienne version
+    TRACE_BEGIN("write_backup_file", output_filename);
+    uint64_t start = stats_now_ns();
+    unlink(output_filename);
+    stats_add(STATS_METADATA_OPS, 1);
     FILE *file = fopen(output_filename, "wb");
     if (file == NULL) {
         perror("Erreur d'ouverture du fichier");
+        stats_phase_end(STATS_PHASE_WRITE, start);
+        TRACE_END("write_backup_file");
         return;
     }
 
-    fwrite(&chunk_count, sizeof(int), 1, file);
-    for (int i = 0; i < chunk_count; i++) {
-        size_t chunk_size = chunks[i].lenght;
-        fwrite(chunks[i].md5, MD5_DIGEST_LENGTH, 1, file);
-        fwrite(&chunk_size, sizeof(size_t), 1, file);
-        fwrite(chunks[i].data, 1, chunk_size, file);
-    }
+    uint64_t written = write_dedup_chunks(file, chunks, chunk_count, chunk_size);
     fclose(file);
+    stats_add(STATS_BYTES_WRITTEN, written);
+    throttle_write(written);
+    stats_phase_end(STATS_PHASE_WRITE, start);
+    TRACE_END("write_backup_file");
 
     if (verbose_flag) {
         printf("[INFO] Fichier dédupliqué écrit : %s avec %d chunks\n", output_filename, chunk_count);
     }
 }
 
+/**
+ * @brief Écrit dans un fichier de backup dédupliqué le tableau de chunks, avec la taille
+ * de chunks du dépôt.
+ */
+void write_backup_file(const char *output_filename, Chunk *chunks, int chunk_count) {
+    write_dedup_file(output_filename, chunks, chunk_count, get_chunk_size());
+}
+
 /**
  * @brief Met à jour le fichier .backup_log.
  * Si dry_run_flag est activé, n'écrit pas réellement, se contente d'afficher ce qui serait fait.
@@ -184,7 +374,9 @@ static void update_backup_log_if_needed(const char *backup_log_path, log_t *new_
         }
         return;
     }
+    TRACE_BEGIN("update_backup_log", backup_log_path);
     update_backup_log(backup_log_path, new_logs);
+    TRACE_END("update_backup_log");
     if (verbose_flag) {
         printf("[INFO] .backup_log mis à jour : %s\n", backup_log_path);
     }
@@ -206,6 +398,76 @@ static void copy_file_if_needed(const char *src, const char *dst) {
     }
 }
 
+/**
+ * @brief Remplace les références externes par les données du chunk désigné.
+ *
+ * Chaque référence désigne un chunk de données (jamais une autre référence) dans
+ * backup_dir/emplacement.dedup ou backup_dir/PACK_DIR/emplacement.dedup. Les références d'un fichier modifié pointent en général
+ * toutes vers le même fichier : le dernier fichier chargé est gardé en mémoire. Les chunks
+ * partagés par plusieurs fichiers sont d'abord cherchés par MD5 dans cache (peut être NULL).
+ * Les données résolues sont copiées dans arena.
+ * @return 0, ou -1 si une référence n'a pas pu être résolue.
+ */
+static int resolve_external_chunks(const char *backup_dir, Chunk *chunks, int chunk_count, arena_t *arena,
+                                   chunk_cache_t *cache) {
+    // Le fichier gardé en mémoire a sa propre arène, remise à zéro à chaque changement
+    arena_t cache_arena;
+    arena_init(&cache_arena, 0);
+    const char *cached_location = NULL;
+    Chunk *cached = NULL;
+    int cached_count = 0;
+    int ret = 0;
+
+    for (int i = 0; i < chunk_count; i++) {
+        unsigned int index;
+        const char *location;
+        if (parse_external_ref(&chunks[i], &index, &location) != 0) {
+            continue;
+        }
+        // Une référence porte le MD5 du chunk qu'elle désigne
+        size_t length;
+        void *data = chunk_cache_get(cache, chunks[i].md5, arena, &length);
+        if (data) {
+            chunks[i].data = data;
+            chunks[i].lenght = length;
+            continue;
+        }
+        if (!cached_location || strcmp(cached_location, location) != 0) {
+            arena_reset(&cache_arena);
+            cached = NULL;
+            cached_count = 0;
+            cached_location = arena_strdup(&cache_arena, location);
+
+            // Le fichier a pu être déplacé dans PACK_DIR par --prune
+            char path[MAX_SIZE_PATH];
+            FILE *file = NULL;
+            if (locate_dedup_file(backup_dir, location, path, sizeof(path)) == 0) {
+                file = fopen(path, "rb");
+            }
+            if (file) {
+                TRACE_BEGIN("resolve_external_chunks", location);
+                undeduplicate_file(file, &cached, &cached_count, &cache_arena);
+                fclose(file);
+                TRACE_END("resolve_external_chunks");
+            }
+        }
+        if (index >= (unsigned int)cached_count || (cached[index].lenght & CHUNK_EXTERNAL_REF)) {
+            fprintf(stderr, "Référence vers un chunk introuvable : %s (chunk %u)\n", location, index);
+            ret = -1;
+            // Le chunk est laissé vide plutôt que d'écrire la référence dans le fichier restauré
+            chunks[i].lenght = 0;
+            continue;
+        }
+        chunks[i].data = arena_alloc(arena, cached[index].lenght);
+        memcpy(chunks[i].data, cached[index].data, cached[index].lenght);
+        chunks[i].lenght = cached[index].lenght;
+        chunk_cache_put(cache, cached[index].md5, cached[index].data, cached[index].lenght);
+    }
+
+    arena_free(&cache_arena);
+    return ret;
+}
+
 /**
  * @brief Écrit un fichier restauré à partir d'un tableau de chunks.
  * Si dry_run_flag est activé, n'écrit pas réellement le fichier, juste un message.
@@ -218,15 +480,41 @@ void write_restored_file(const char *output_filename, Chunk *chunks, int chunk_c
         return;
     }
 
+    TRACE_BEGIN("write_restored_file", output_filename);
+    uint64_t start = stats_now_ns();
     FILE *file = fopen(output_filename, "wb");
     if (!file) {
         perror("Erreur d'ouverture du fichier de destination pendant la restauration");
+        stats_phase_end(STATS_PHASE_RESTORE_WRITE, start);
+        TRACE_END("write_restored_file");
         return;
     }
+    // Les suites de zéros ne sont pas écrites : le fichier, vide à l'ouverture, y garde
+    // des trous, et ftruncate fixe la taille s'il se termine par des zéros
+    off_t size = 0;
+    int trailing_hole = 0;
     for (int i = 0; i < chunk_count; i++) {
-        fwrite(chunks[i].data, 1, CHUNK_SIZE, file);
+        if (chunks[i].lenght & CHUNK_ZERO_RUN) {
+            size += CHUNK_ZERO_LENGTH(chunks[i].lenght);
+            fseeko(file, size, SEEK_SET);
+            trailing_hole = 1;
+            continue;
+        }
+        fwrite(chunks[i].data, 1, chunks[i].lenght, file);
+        stats_add(STATS_BYTES_WRITTEN, chunks[i].lenght);
+        size += chunks[i].lenght;
+        trailing_hole = 0;
+    }
+    if (trailing_hole) {
+        fflush(file);
+        if (ftruncate(fileno(file), size) != 0) {
+            perror("Erreur de dimensionnement du fichier restauré");
+        }
     }
     fclose(file);
+    stats_add(STATS_FILES_RESTORED, 1);
+    stats_phase_end(STATS_PHASE_RESTORE_WRITE, start);
+    TRACE_END("write_restored_file");
 
     if (verbose_flag) {
         printf("[INFO] Fichier restauré écrit : %s\n", output_filename);
@@ -234,91 +522,1208 @@ void write_restored_file(const char *output_filename, Chunk *chunks, int chunk_c
 }
 
 /**
- * @brief Crée une nouvelle sauvegarde incrémentale.
+ * @brief Taille du fichier .dedup écrit par write_backup_file pour ces chunks.
  */
-void create_backup(const char *source_dir, const char *backup_dir) {
-    char backup_log_path[1024];
-    snprintf(backup_log_path, sizeof(backup_log_path), "%s/.backup_log", backup_dir);
-    int first_backup = !file_exists_local(backup_log_path);
+static uint64_t dedup_file_size(const Chunk *chunks, int chunk_count) {
+    uint64_t size = DEDUP_HEADER_SIZE;
+    for (int i = 0; i < chunk_count; i++) {
+        size += MD5_DIGEST_LENGTH + sizeof(size_t) + CHUNK_LENGTH(chunks[i].lenght);
+    }
+    return size;
+}
 
-    if (verbose_flag) {
-        printf("[INFO] Début de la sauvegarde. Source : %s, Destination : %s\n", source_dir, backup_dir);
-        if (first_backup) {
-            printf("[INFO] Aucune sauvegarde précédente trouvée. Création de la première sauvegarde.\n");
+// Pile des répertoires de la source restant à parcourir
+typedef struct {
+    char path[2048];
+} dir_stack_entry2;
+
+// État d'une sauvegarde en cours, partagé par les entrées de la source
+typedef struct {
+    const char *backup_dir;
+    const char *new_backup_path;
+    const char *last_backup_dir;
+    const char *timestamp;
+    size_t source_dir_len;
+    int first_backup;
+    log_t *old_logs;
+    log_t *new_logs;
+    backup_summary *summary;
+    arena_t *file_arena; // chunks du fichier en cours, remise à zéro après chaque fichier
+    segment_writer_t *segments; // segments des petits fichiers
+    file_digest_map_t *digests; // contenus déjà stockés, par MD5 et taille du fichier
+    dir_stack_entry2 *dir_stack;
+    int dir_top;
+    int resuming; // reprise d'une sauvegarde interrompue (--resume)
+    const log_element **checkpoint; // entrées terminées avant l'interruption, triées par chemin
+    size_t checkpoint_count;
+    FILE *checkpoint_file; // point de reprise de cette exécution (NULL en dry-run)
+    log_element *checkpointed; // dernière entrée de new_logs écrite dans le point de reprise
+    uint64_t last_checkpoint;
+    // Avec --memory-limit, les entrées de new_logs sont écrites au fil de la sauvegarde dans
+    // son .backup_log et son index, puis retirées de la liste
+    int streaming;
+    manifest_t *scan_manifest; // fichiers réguliers de la source, triés par chemin relatif
+    FILE *log_stream;
+    path_index_writer_t *index_stream;
+    size_t pending_bytes; // mémoire estimée des entrées de new_logs
+    size_t pending_limit;
+} backup_run_t;
+
+// Entrée du point de reprise et son rang dans le fichier
+typedef struct {
+    const log_element *elt;
+    size_t seq;
+} checkpoint_entry_t;
+
+static int compare_checkpoint_entries(const void *a, const void *b) {
+    const checkpoint_entry_t *ea = a;
+    const checkpoint_entry_t *eb = b;
+    int cmp = strcmp(strchr(ea->elt->path, '/') + 1, strchr(eb->elt->path, '/') + 1);
+    if (cmp != 0) {
+        return cmp;
+    }
+    return ea->seq < eb->seq ? -1 : (ea->seq > eb->seq);
+}
+
+/**
+ * @brief Charge le point de reprise d'une sauvegarde interrompue, trié par chemin relatif.
+ *
+ * Un fichier refait après une première reprise apparaît plusieurs fois : seule sa
+ * dernière entrée est gardée.
+ * @return Le nombre d'entrées de *entries.
+ */
+static size_t load_checkpoint(const char *checkpoint_path, log_t *logs, const log_element ***entries) {
+    *logs = read_backup_log(checkpoint_path);
+    size_t count = 0;
+    for (log_element *elt = logs->head; elt; elt = elt->next) {
+        count += strchr(elt->path, '/') != NULL;
+    }
+    checkpoint_entry_t *sorted = malloc((count ? count : 1) * sizeof(checkpoint_entry_t));
+    *entries = malloc((count ? count : 1) * sizeof(log_element *));
+    if (!sorted || !*entries) {
+        free(sorted);
+        return 0;
+    }
+    size_t n = 0;
+    for (log_element *elt = logs->head; elt; elt = elt->next) {
+        if (strchr(elt->path, '/')) {
+            sorted[n].elt = elt;
+            sorted[n].seq = n;
+            n++;
+        }
+    }
+    qsort(sorted, count, sizeof(checkpoint_entry_t), compare_checkpoint_entries);
+    n = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (i + 1 < count
+            && strcmp(strchr(sorted[i].elt->path, '/'), strchr(sorted[i + 1].elt->path, '/')) == 0) {
+            continue;
         }
+        (*entries)[n++] = sorted[i].elt;
     }
+    free(sorted);
+    return n;
+}
 
-    if (!file_exists_local(backup_dir)) {
-        if (dry_run_flag) {
-            if (verbose_flag) {
-                printf("[DRY-RUN] Création du répertoire : %s non réalisée\n", backup_dir);
-            }
+/**
+ * @brief Entrée du point de reprise pour rel_path (NULL si le fichier n'était pas terminé).
+ */
+static const log_element *find_checkpointed(const backup_run_t *run, const char *rel_path) {
+    size_t low = 0, high = run->checkpoint_count;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        int cmp = strcmp(strchr(run->checkpoint[mid]->path, '/') + 1, rel_path);
+        if (cmp == 0) {
+            return run->checkpoint[mid];
+        }
+        if (cmp < 0) {
+            low = mid + 1;
         } else {
-            if (create_directory_local(backup_dir) != 0) {
-                perror("Erreur création backup_dir");
-                return;
-            }
-            if (verbose_flag) {
-                printf("[INFO] Répertoire créé : %s\n", backup_dir);
+            high = mid;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Écrit un point de reprise : les données écrites sont rendues durables (un syncfs)
+ * avant les entrées de new_logs terminées depuis le point précédent, qui les désignent.
+ */
+static int write_checkpoint(backup_run_t *run) {
+    uint64_t start = stats_now_ns();
+    TRACE_BEGIN("checkpoint", run->new_backup_path);
+    int ret = -1;
+    if (segment_writer_flush(run->segments) == 0 && sync_backup_dir(run->backup_dir) == 0) {
+        log_element *elt = run->checkpointed ? run->checkpointed->next : run->new_logs->head;
+        for (; elt; elt = elt->next) {
+            // Une entrée reprise telle quelle figure déjà dans le fichier
+            const log_element *done = run->checkpoint_count ? find_checkpointed(run, strchr(elt->path, '/') + 1) : NULL;
+            if (!done || strcmp(done->date, elt->date) != 0 || memcmp(done->md5, elt->md5, MD5_DIGEST_LENGTH) != 0) {
+                write_log_element(elt, run->checkpoint_file);
             }
+            run->checkpointed = elt;
+        }
+        if (fflush(run->checkpoint_file) == 0 && fdatasync(fileno(run->checkpoint_file)) == 0) {
+            ret = 0;
+        } else {
+            perror("Erreur d'écriture du point de reprise");
         }
     }
+    run->last_checkpoint = stats_now_ns();
+    stats_phase_end(STATS_PHASE_CHECKPOINT, start);
+    TRACE_END("checkpoint");
+    return ret;
+}
 
-    char timestamp[128];
-    get_timestamp_local(timestamp, sizeof(timestamp));
-    char new_backup_path[2048];
-    snprintf(new_backup_path, sizeof(new_backup_path), "%s/%s", backup_dir, timestamp);
+/**
+ * @brief Avec --memory-limit, écrit les entrées de new_logs dans le .backup_log et l'index
+ * de la sauvegarde puis les retire de la liste.
+ */
+static void release_streamed_entries(backup_run_t *run) {
+    for (log_element *elt = run->new_logs->head; elt; elt = elt->next) {
+        if (run->log_stream) {
+            write_log_element(elt, run->log_stream);
+        }
+        if (run->index_stream) {
+            path_index_writer_add(run->index_stream, elt);
+        }
+    }
+    free_backup_log(run->new_logs);
+    run->checkpointed = NULL;
+    run->pending_bytes = 0;
+}
+
+/**
+ * @brief Écrit un point de reprise si le dernier date de plus de checkpoint_interval secondes
+ * ou, avec --memory-limit, si les entrées de new_logs dépassent leur part de la mémoire :
+ * elles sont alors écrites dans le point de reprise avant d'être retirées de la liste.
+ */
+static void checkpoint_if_due(backup_run_t *run) {
+    int full = run->streaming && run->pending_bytes >= run->pending_limit;
+    if (run->checkpoint_file
+        && (full || stats_now_ns() - run->last_checkpoint >= checkpoint_interval * 1000000000ULL)) {
+        write_checkpoint(run);
+    }
+    if (full) {
+        release_streamed_entries(run);
+    }
+}
+
+/**
+ * @brief Pendant une reprise, rend au .dedup d'un fichier à refaire son état après la
+ * duplication (lien vers la sauvegarde précédente) : l'exécution interrompue a pu le
+ * réécrire, en entier ou en partie, ou le retirer au profit d'un segment.
+ */
+static void restore_cloned_dedup(backup_run_t *run, const char *dedup_filename, const char *rel_path) {
+    char old_dedup[2048];
+    snprintf(old_dedup, sizeof(old_dedup), "%s/%s.dedup", run->last_backup_dir, rel_path);
+    struct stat cur, old;
+    int has_old = run->last_backup_dir[0] != '\0' && stat(old_dedup, &old) == 0;
+    int has_cur = stat(dedup_filename, &cur) == 0;
+    stats_add(STATS_METADATA_OPS, 2);
+    if (has_cur && has_old && cur.st_ino == old.st_ino && cur.st_dev == old.st_dev) {
+        return;
+    }
+    if (has_cur) {
+        unlink(dedup_filename);
+    }
+    if (has_old && link(old_dedup, dedup_filename) == 0) {
+        stats_add(STATS_LINKS_CREATED, 1);
+    }
+    if (verbose_flag) {
+        printf("[INFO] Fichier en cours lors de l'interruption, refait : %s\n", rel_path);
+    }
+}
 
+/**
+ * @brief Stocke un fichier identique à un contenu déjà stocké, sans le redécouper : son
+ * .dedup devient un lien dur vers celui du contenu, ou son entrée reprend l'image rangée
+ * dans un segment (renseignée dans segment, offset et length).
+ *
+ * @return 0 si le fichier est stocké, -1 s'il faut le dédupliquer (contenu disparu, lien impossible).
+ */
+static int store_duplicate(backup_run_t *run, const file_digest_t *digest, int small_file, const char *dedup_filename,
+                           const char **segment, uint64_t *offset, uint32_t *length) {
+    if ((digest->segment != NULL) != small_file) {
+        return -1;
+    }
+    char target[2048];
+    size_t snapshot_len = strcspn(digest->location, "/");
+    if (digest->segment) {
+        snprintf(target, sizeof(target), "%s/%s/%s", run->backup_dir, SEGMENT_DIR, digest->segment);
+    } else if (strncmp(digest->location, run->timestamp, snapshot_len) == 0 && run->timestamp[snapshot_len] == '\0') {
+        // Contenu stocké par cette sauvegarde, encore dans son répertoire de préparation
+        snprintf(target, sizeof(target), "%s%s.dedup", run->new_backup_path, digest->location + snapshot_len);
+    } else {
+        snprintf(target, sizeof(target), "%s/%s.dedup", run->backup_dir, digest->location);
+    }
+    stats_add(STATS_METADATA_OPS, 1);
+    if (access(target, F_OK) != 0) {
+        return -1;
+    }
     if (dry_run_flag) {
         if (verbose_flag) {
-            printf("[DRY-RUN] Création du répertoire de sauvegarde : %s non réalisée\n", new_backup_path);
+            printf("[DRY-RUN] Fichier identique à %s, non stocké\n", digest->location);
         }
     } else {
-        if (create_directory_local(new_backup_path) != 0) {
-            perror("Erreur new_backup_path");
-            return;
+        // Le .dedup peut être un lien vers la version précédente du fichier : il est remplacé
+        if (unlink(dedup_filename) == 0) {
+            stats_add(STATS_METADATA_OPS, 1);
+        }
+        if (!digest->segment) {
+            make_parent_dirs(dedup_filename);
+            stats_add(STATS_METADATA_OPS, 1);
+            if (link(target, dedup_filename) != 0) {
+                return -1;
+            }
+            stats_add(STATS_LINKS_CREATED, 1);
         }
         if (verbose_flag) {
-            printf("[INFO] Nouveau répertoire de sauvegarde créé : %s\n", new_backup_path);
+            printf("[INFO] Fichier identique à %s : %s\n", digest->location, dedup_filename);
         }
     }
+    *segment = digest->segment;
+    *offset = digest->offset;
+    *length = digest->length;
+    return 0;
+}
 
-    log_t old_logs = {0};
-    if (!first_backup) {
-        old_logs = read_backup_log(backup_log_path);
+/**
+ * @brief Ajoute au hachage les st->st_size premiers octets de file. Les trous d'un fichier
+ * creux (trouvés par SEEK_DATA/SEEK_HOLE, comme dans deduplicate_file) sont hachés comme
+ * des zéros sans être lus.
+ * @return 0, ou -1 en cas d'erreur de lecture.
+ */
+static int hash_stream(EVP_MD_CTX *ctx, FILE *file, const struct stat *st) {
+    static const unsigned char zeros[64 * 1024];
+    unsigned char buffer[4096];
+    int fd = fileno(file);
+    int sparse = (off_t)st->st_blocks * 512 < st->st_size;
+    off_t pos = 0;
+    while (pos < st->st_size) {
+        off_t data_end = st->st_size;
+        if (sparse) {
+            off_t data_start = lseek(fd, pos, SEEK_DATA);
+            if (data_start < 0 && errno == ENXIO) {
+                data_start = st->st_size; // plus aucune donnée : le reste est un trou
+            }
+            if (data_start < 0) {
+                sparse = 0; // SEEK_DATA non supporté : lecture complète
+            } else {
+                if (data_start > st->st_size) {
+                    data_start = st->st_size;
+                }
+                for (off_t hole = data_start - pos; hole > 0;) {
+                    size_t n = hole < (off_t)sizeof(zeros) ? (size_t)hole : sizeof(zeros);
+                    EVP_DigestUpdate(ctx, zeros, n);
+                    stats_add(STATS_BYTES_HASHED, n);
+                    hole -= n;
+                }
+                pos = data_start;
+                off_t hole_start = pos < st->st_size ? lseek(fd, pos, SEEK_HOLE) : pos;
+                if (hole_start >= 0 && hole_start < data_end) {
+                    data_end = hole_start;
+                }
+                // lseek a déplacé le descripteur : le FILE est repositionné
+                fseek(file, pos, SEEK_SET);
+            }
+        }
+        while (pos < data_end) {
+            uint64_t left = (uint64_t)(data_end - pos);
+            size_t r = throttle_fread(buffer, left < sizeof(buffer) ? left : sizeof(buffer), file);
+            if (r == 0) {
+                break;
+            }
+            pos += r;
+            EVP_DigestUpdate(ctx, buffer, r);
+            stats_add(STATS_BYTES_READ, r);
+            stats_add(STATS_BYTES_HASHED, r);
+        }
+        if (pos < data_end) {
+            break; // fichier raccourci depuis le stat
+        }
     }
+    return ferror(file) ? -1 : 0;
+}
 
-    if (verbose_flag) {
-        printf("[INFO] Traitement des fichiers de la source : %s\n", source_dir);
+/**
+ * @brief Calcule le MD5 des st->st_size premiers octets de filepath, lus en O_DIRECT quand
+ * --direct-io s'applique au fichier. Comme la déduplication, le hachage s'arrête à la taille
+ * vue lors du stat : un fichier agrandi depuis n'a pas d'empreinte couvrant des octets non
+ * sauvegardés.
+ * @return 0, ou -1 si le fichier n'a pas pu être lu.
+ */
+static int hash_file(const char *filepath, const struct stat *st, unsigned char *md5_sum) {
+    EVP_MD_CTX *ctx = EVP_MD_CTX_new();
+    if (!ctx || EVP_DigestInit_ex(ctx, EVP_md5(), NULL) != 1) {
+        EVP_MD_CTX_free(ctx);
+        return -1;
+    }
+    int ret = 0;
+    direct_reader_t *direct = direct_open(filepath, st);
+    FILE *file = direct ? NULL : fopen(filepath, "rb");
+    if (direct) {
+        const unsigned char *data;
+        size_t r;
+        while ((r = direct_read(direct, &data)) > 0) {
+            EVP_DigestUpdate(ctx, data, r);
+            stats_add(STATS_BYTES_HASHED, r);
+        }
+        ret = direct_close(direct);
+    } else if (file) {
+        ret = hash_stream(ctx, file, st);
+        fclose(file);
+    } else {
+        ret = -1;
+    }
+    if (ret == 0 && EVP_DigestFinal_ex(ctx, md5_sum, NULL) != 1) {
+        ret = -1;
     }
+    EVP_MD_CTX_free(ctx);
+    return ret;
+}
 
-    char last_backup_dir[2048] = {0};
-    if (!first_backup) {
-        find_last_backup_local(backup_dir, last_backup_dir, sizeof(last_backup_dir));
+/**
+ * @brief Sauvegarde un fichier régulier de la source : il est dédupliqué s'il a changé
+ * depuis old_elt (son entrée dans la sauvegarde précédente, NULL s'il est nouveau) puis
+ * ajouté au nouveau .backup_log. Pendant une reprise, done est son entrée dans le point de
+ * reprise (NULL s'il n'était pas terminé).
+ */
+static void backup_regular_file(backup_run_t *run, const char *filepath, const char *rel_path,
+                                const struct stat *st, const log_element *old_elt, const log_element *done) {
+    stats_add(STATS_FILES_SCANNED, 1);
+    run->summary->file_count++;
+    run->summary->logical_bytes += st->st_size;
+    char log_path[2048];
+    snprintf(log_path, sizeof(log_path), "%s/%s", run->timestamp, rel_path);
+    struct tm *tm_info = localtime(&st->st_mtime);
+    char mod_time[128];
+    snprintf(
+        mod_time, sizeof(mod_time), "%04d-%02d-%02d-%02d:%02d:%02d.%03d",
+        tm_info->tm_year + 1900, tm_info->tm_mon + 1, tm_info->tm_mday,
+        tm_info->tm_hour, tm_info->tm_min, tm_info->tm_sec, 0
+    );
+    char dedup_filename[2048];
+    snprintf(dedup_filename, sizeof(dedup_filename), "%s/%s.dedup", run->new_backup_path, rel_path);
+
+    if (run->resuming) {
+        // Un fichier terminé avant l'interruption et de même date n'est pas relu
+        if (done && strcmp(done->date, mod_time) == 0) {
+            stats_add(STATS_FILES_RESUMED, 1);
+            log_element *elt = create_element(run->new_logs, log_path, mod_time, NULL);
+            if (elt) {
+                memcpy(elt->md5, done->md5, MD5_DIGEST_LENGTH);
+                if (done->segment) {
+                    set_element_segment(run->new_logs, elt, done->segment, done->offset, done->length);
+                }
+            }
+            run->pending_bytes += sizeof(log_element) + strlen(log_path) + sizeof(mod_time);
+            checkpoint_if_due(run);
+            return;
+        }
+        restore_cloned_dedup(run, dedup_filename, rel_path);
     }
 
-    // Duplication de la dernière sauvegarde par liens durs
-    if (!first_backup && last_backup_dir[0] != '\0') {
-        typedef struct {
-            char path[2048];
-        } dir_stack_entry;
-        dir_stack_entry stack[1000];
-        int top = 0;
-        strncpy(stack[top++].path, last_backup_dir, sizeof(stack[0].path) - 1);
+    // Calcul MD5
+    unsigned char md5_sum[MD5_DIGEST_LENGTH];
+    {
+        uint64_t hash_start = stats_now_ns();
+        TRACE_BEGIN("hash_file", rel_path);
+        if (hash_file(filepath, st, md5_sum) != 0) {
+            memset(md5_sum, 0, MD5_DIGEST_LENGTH);
+        }
+        stats_phase_end(STATS_PHASE_HASH, hash_start);
+        TRACE_END("hash_file");
+    }
 
-        while (top > 0) {
-            dir_stack_entry current = stack[--top];
-            DIR *dir = opendir(current.path);
-            if (!dir) {
-                continue;
+    // Un petit fichier est rangé dans un segment plutôt que dans son propre .dedup
+    int small_file = st->st_size <= SEGMENT_SMALL_FILE;
+    const char *segment = NULL;
+    uint64_t segment_offset = 0;
+    uint32_t segment_length = 0;
+    int file_unchanged = 0;
+    if (!run->first_backup && old_elt && memcmp(old_elt->md5, md5_sum, MD5_DIGEST_LENGTH) == 0) {
+        // Un segment cité par le dernier .backup_log existe toujours : seul --prune en supprime
+        if (old_elt->segment || file_exists_local(dedup_filename)) {
+            file_unchanged = 1;
+        }
+    }
+
+    // Même contenu qu'un fichier déjà stocké (dans cette sauvegarde ou une précédente)
+    static const unsigned char no_md5[MD5_DIGEST_LENGTH];
+    int hashed = memcmp(md5_sum, no_md5, MD5_DIGEST_LENGTH) != 0;
+    const file_digest_t *digest = NULL;
+    if (!file_unchanged && hashed) {
+        digest = file_digest_find(run->digests, md5_sum, (uint64_t)st->st_size);
+    }
+    int stored = hashed;
+
+    if (file_unchanged) {
+        stats_add(STATS_FILES_UNCHANGED, 1);
+        segment = old_elt->segment;
+        segment_offset = old_elt->offset;
+        segment_length = old_elt->length;
+    } else if (digest && store_duplicate(run, digest, small_file, dedup_filename, &segment, &segment_offset,
+                                         &segment_length) == 0) {
+        stats_add(STATS_FILES_DUPLICATE, 1);
+        // Le contenu est déjà connu : rien à ajouter à la table
+        stored = 0;
+    } else {
+        // Redédupliquer
+        stats_add(STATS_FILES_BACKED_UP, 1);
+        direct_reader_t *direct = direct_open(filepath, st);
+        FILE *f = direct ? NULL : fopen(filepath, "rb");
+        if (direct || f) {
+            // Un chunk par bloc de get_chunk_size() octets, plus un de marge : la déduplication
+            // agrandit le tableau s'il ne suffit pas (fichier creux)
+            size_t max_chunks = (size_t)st->st_size / get_chunk_size() + 2;
+            Chunk *chunks = arena_calloc(run->file_arena, max_chunks * sizeof(Chunk));
+            Md5Entry hash_table[HASH_TABLE_SIZE];
+            memset(hash_table, 0, sizeof(hash_table));
+            uint64_t dedup_start = stats_now_ns();
+            TRACE_BEGIN("deduplicate_file", rel_path);
+            if (direct) {
+                deduplicate_direct(direct, (uint64_t)st->st_size, &chunks, &max_chunks, hash_table,
+                                   run->file_arena);
+                direct_close(direct);
+            } else {
+                deduplicate_file(f, (uint64_t)st->st_size, &chunks, &max_chunks, hash_table, run->file_arena);
+                fclose(f);
+            }
+            stats_phase_end(STATS_PHASE_DEDUP, dedup_start);
+            TRACE_END("deduplicate_file");
+            int chunk_count = 0;
+            for (size_t i = 0; i < max_chunks; i++) {
+                if (!chunks[i].data) {
+                    break;
+                }
+                chunk_count++;
             }
-            struct dirent *entry;
 
-            while ((entry = readdir(dir)) != NULL) {
-                if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
-                    continue;
+            // Fichier modifié : les chunks déjà présents dans sa version
+            // précédente sont remplacés par une référence vers celle-ci
+            int referenced = 0;
+            if (!small_file && old_elt && run->last_backup_dir[0] != '\0') {
+                char old_dedup[2048];
+                snprintf(old_dedup, sizeof(old_dedup), "%s/%s.dedup", run->last_backup_dir, rel_path);
+                FILE *fold = fopen(old_dedup, "rb");
+                if (fold) {
+                    const char *last_name = strrchr(run->last_backup_dir, '/');
+                    last_name = last_name ? last_name + 1 : run->last_backup_dir;
+                    char location[2048];
+                    snprintf(location, sizeof(location), "%s/%s", last_name, rel_path);
+                    ChunkRef *refs = NULL;
+                    int ref_count = read_chunk_refs(fold, location, &refs, run->file_arena);
+                    fclose(fold);
+                    if (ref_count > 0) {
+                        referenced = reference_known_chunks(chunks, chunk_count, refs, ref_count,
+                                                            run->file_arena);
+                        if (verbose_flag) {
+                            printf("[INFO] %d chunks repris de %s\n", referenced, location);
+                        }
+                    }
                 }
-                char src_path[2048], dst_path[2048];
+            }
+
+            if (small_file) {
+                // Le .dedup d'une version précédente plus grande, lié depuis la sauvegarde
+                // précédente, est remplacé par l'image rangée dans le segment
+                if (old_elt && !old_elt->segment && !dry_run_flag && unlink(dedup_filename) == 0) {
+                    stats_add(STATS_METADATA_OPS, 1);
+                }
+                if (dry_run_flag) {
+                    if (verbose_flag) {
+                        printf("[DRY-RUN] Ajout de %s à un segment non réalisé\n", rel_path);
+                    }
+                } else if (segment_append(run->segments, chunks, chunk_count, &segment,
+                                          &segment_offset, &segment_length) != 0) {
+                    fprintf(stderr, "Erreur d'écriture de %s dans un segment\n", rel_path);
+                }
+            } else {
+                char tmp[2048];
+                strncpy(tmp, dedup_filename, sizeof(tmp));
+                for (char *p = tmp + strlen(run->new_backup_path) + 1; *p; p++) {
+                    if (*p == '/') {
+                        *p = '\0';
+                        if (dry_run_flag) {
+                            if (verbose_flag) {
+                                printf("[DRY-RUN] Création du répertoire %s (non réalisée)\n", tmp);
+                            }
+                        } else {
+                            create_directory_local(tmp);
+                        }
+                        *p = '/';
+                    }
+                }
+                write_backup_file(dedup_filename, chunks, chunk_count);
+            }
+            run->summary->stored_bytes += dedup_file_size(chunks, chunk_count);
+            if (referenced > 0) {
+                refcount_add_refs(run->backup_dir, chunks, chunk_count, 1, NULL, NULL);
+            }
+            arena_reset(run->file_arena);
+        } else {
+            stored = 0;
+        }
+    }
+    if (stored) {
+        file_digest_add(run->digests, md5_sum, (uint64_t)st->st_size, log_path, segment, segment_offset,
+                        segment_length);
+    }
+
+    // Ajout au new_logs
+    log_element *elt = create_element(run->new_logs, log_path, mod_time, NULL);
+    if (elt) {
+        memcpy(elt->md5, md5_sum, MD5_DIGEST_LENGTH);
+        if (segment) {
+            set_element_segment(run->new_logs, elt, segment, segment_offset, segment_length);
+        }
+    }
+    run->pending_bytes += sizeof(log_element) + strlen(log_path) + sizeof(mod_time);
+    throttle_release_file(filepath);
+    checkpoint_if_due(run);
+}
+
+/**
+ * @brief Entrée de rel_path dans le .backup_log de la sauvegarde précédente (NULL s'il n'y est pas).
+ */
+static const log_element *find_old_entry(const backup_run_t *run, const char *rel_path) {
+    if (run->first_backup) {
+        return NULL;
+    }
+    for (const log_element *e = run->old_logs->head; e; e = e->next) {
+        const char *sep = strchr(e->path, '/');
+        if (sep && strcmp(sep + 1, rel_path) == 0) {
+            return e;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Sauvegarde une entrée de la source : un répertoire est créé dans la sauvegarde
+ * et ajouté à la pile des répertoires à parcourir, un fichier est dédupliqué s'il a changé
+ * et ajouté au nouveau .backup_log.
+ */
+static void backup_entry(backup_run_t *run, const char *filepath, const struct stat *st) {
+    const char *rel_path = filepath + run->source_dir_len;
+    while (*rel_path == '/') {
+        rel_path++;
+    }
+    char dst_path[2048];
+    snprintf(dst_path, sizeof(dst_path), "%s/%s", run->new_backup_path, rel_path);
+
+    if (S_ISDIR(st->st_mode)) {
+        stats_add(STATS_DIRS_SCANNED, 1);
+        if (!file_exists_local(dst_path)) {
+            if (dry_run_flag) {
+                if (verbose_flag) {
+                    printf("[DRY-RUN] Création du répertoire %s non réalisée\n", dst_path);
+                }
+            } else {
+                create_directory_local(dst_path);
+                if (verbose_flag) {
+                    printf("[INFO] Répertoire créé : %s\n", dst_path);
+                }
+            }
+        }
+
+        if (!file_exists_local(dst_path)) {
+            if (dry_run_flag && verbose_flag) {
+                printf("[DRY-RUN] Création du répertoire %s non réalisée\n", dst_path);
+            } else if (!dry_run_flag) {
+                create_directory_local(dst_path);
+            }
+        }
+        strncpy(run->dir_stack[run->dir_top++].path, filepath, sizeof(run->dir_stack[0].path) - 1);
+
+    } else if (S_ISREG(st->st_mode)) {
+        backup_regular_file(run, filepath, rel_path, st, find_old_entry(run, rel_path),
+                            run->resuming ? find_checkpointed(run, rel_path) : NULL);
+    }
+}
+
+// Fichier régulier d'un répertoire de la source, sauvegardé dans l'ordre du disque
+typedef struct {
+    char *path;
+    struct stat st;
+    uint64_t disk_offset; // position du premier bloc sur le disque (ou numéro d'inode)
+} scan_file_t;
+
+static int compare_scan_files(const void *a, const void *b) {
+    const scan_file_t *fa = a, *fb = b;
+    if (fa->st.st_dev != fb->st.st_dev) {
+        return fa->st.st_dev < fb->st.st_dev ? -1 : 1;
+    }
+    return fa->disk_offset < fb->disk_offset ? -1 : (fa->disk_offset > fb->disk_offset);
+}
+
+/**
+ * @brief Demande au noyau de lire à l'avance le début d'un fichier (au plus
+ * SCAN_READAHEAD_BYTES octets) pendant que les précédents sont hachés.
+ */
+static void prefetch_file(const scan_file_t *file) {
+    // Un fichier lu en O_DIRECT ne passe pas par le cache de pages
+    if (file->st.st_size == 0 || direct_io_applies(&file->st)) {
+        return;
+    }
+    int fd = open(file->path, O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+    off_t length = file->st.st_size < SCAN_READAHEAD_BYTES ? file->st.st_size : SCAN_READAHEAD_BYTES;
+    posix_fadvise(fd, 0, length, POSIX_FADV_WILLNEED);
+    close(fd);
+    stats_add(STATS_METADATA_OPS, 1);
+}
+
+/**
+ * @brief Sauvegarde les fichiers réguliers d'un répertoire dans l'ordre de leur position
+ * sur le disque, les SCAN_READAHEAD_FILES suivants étant lus à l'avance.
+ */
+static void backup_directory_files(backup_run_t *run, scan_file_t *files, size_t count) {
+    if (count > 1) {
+        uint64_t start = stats_now_ns();
+        for (size_t i = 0; i < count; i++) {
+            files[i].disk_offset = file_disk_offset(files[i].path, files[i].st.st_ino);
+        }
+        stats_add(STATS_METADATA_OPS, count);
+        qsort(files, count, sizeof(scan_file_t), compare_scan_files);
+        stats_phase_end(STATS_PHASE_SCAN, start);
+    }
+    size_t prefetched = 1; // le premier fichier est lu tout de suite
+    for (size_t i = 0; i < count; i++) {
+        for (; prefetched < count && prefetched <= i + SCAN_READAHEAD_FILES; prefetched++) {
+            prefetch_file(&files[prefetched]);
+        }
+        backup_entry(run, files[i].path, &files[i].st);
+        free(files[i].path);
+    }
+}
+
+FILE *open_entry_dedup(const char *backup_dir, const char *snapshot_path, const log_element *elt) {
+    if (elt->segment) {
+        return segment_open(backup_dir, elt->segment, elt->offset);
+    }
+    const char *sep = strchr(elt->path, '/');
+    if (!sep) {
+        return NULL;
+    }
+    char dedup_path[MAX_SIZE_PATH];
+    snprintf(dedup_path, sizeof(dedup_path), "%s/%s.dedup", snapshot_path, sep + 1);
+    return fopen(dedup_path, "rb");
+}
+
+/**
+ * @brief Taille du fichier d'origine d'une entrée (références et suites de zéros comprises).
+ *
+ * Seuls les en-têtes des chunks de son .dedup sont lus, sans charger les données.
+ */
+static unsigned long long dedup_logical_size(ref_sizes_t *sizes, const char *snapshot_path,
+                                             const log_element *elt) {
+    FILE *file = open_entry_dedup(sizes->backup_dir, snapshot_path, elt);
+    if (!file) {
+        return 0;
+    }
+    unsigned long long size = dedup_image_size(sizes, file);
+    fclose(file);
+    return size;
+}
+
+/**
+ * @brief Prépare une sauvegarde à partir du journal des modifications.
+ *
+ * Les entrées de l'ancien .backup_log hors du journal sont reprises telles quelles (leur
+ * .dedup a été lié depuis la sauvegarde précédente) ; les chemins du journal sont sauvegardés
+ * par backup_entry, les répertoires étant empilés pour être parcourus entièrement.
+ * La taille logique part du résumé de la sauvegarde précédente.
+ * @return 0, ou -1 si ce résumé est introuvable (il faut alors parcourir toute la source).
+ */
+static int backup_from_journal(backup_run_t *run, const char *source_dir, const journal_t *journal) {
+    char summary_path[MAX_SIZE_PATH];
+    snprintf(summary_path, sizeof(summary_path), "%s/%s", run->backup_dir, SUMMARY_FILE);
+    backup_summary *summaries = NULL;
+    int summary_count = read_backup_summaries(summary_path, &summaries);
+    const char *last_name = strrchr(run->last_backup_dir, '/');
+    last_name = last_name ? last_name + 1 : run->last_backup_dir;
+    int found = 0;
+    for (int i = 0; i < summary_count; i++) {
+        if (strcmp(summaries[i].name, last_name) == 0) {
+            run->summary->logical_bytes = summaries[i].logical_bytes;
+            found = 1;
+        }
+    }
+    free(summaries);
+    if (!found) {
+        return -1;
+    }
+
+    TRACE_BEGIN("backup_from_journal", source_dir);
+    ref_sizes_t ref_sizes = {.backup_dir = run->backup_dir};
+    for (log_element *e = run->old_logs->head; e; e = e->next) {
+        const char *sep = strchr(e->path, '/');
+        if (!sep) {
+            continue;
+        }
+        const char *rel = sep + 1;
+        if (journal_is_dirty(journal, rel)) {
+            // Sauvegardé à nouveau ou supprimé : sa taille précédente est retirée
+            unsigned long long old_size = dedup_logical_size(&ref_sizes, run->last_backup_dir, e);
+            run->summary->logical_bytes -= old_size < run->summary->logical_bytes ? old_size
+                                                                                 : run->summary->logical_bytes;
+            continue;
+        }
+        char log_path[MAX_SIZE_PATH];
+        snprintf(log_path, sizeof(log_path), "%s/%s", run->timestamp, rel);
+        log_element *elt = create_element(run->new_logs, log_path, e->date, NULL);
+        if (elt) {
+            memcpy(elt->md5, e->md5, MD5_DIGEST_LENGTH);
+            if (e->segment) {
+                set_element_segment(run->new_logs, elt, e->segment, e->offset, e->length);
+            }
+        }
+        run->summary->file_count++;
+        stats_add(STATS_FILES_UNCHANGED, 1);
+    }
+    ref_sizes_free(&ref_sizes);
+
+    for (int i = 0; i < journal->count; i++) {
+        const char *rel = journal->paths[i];
+        // Un chemin sous un répertoire du journal sera vu lors du parcours de ce répertoire
+        if (journal_has_dirty_parent(journal, rel)) {
+            continue;
+        }
+        char filepath[MAX_SIZE_PATH];
+        snprintf(filepath, sizeof(filepath), "%s/%s", source_dir, rel);
+        struct stat st;
+        if (scan_stat(filepath, &st) == 0) {
+            backup_entry(run, filepath, &st);
+        }
+    }
+    TRACE_END("backup_from_journal");
+    return 0;
+}
+
+int open_repository(const char *backup_dir, size_t chunk_size) {
+    char path[MAX_SIZE_PATH];
+    snprintf(path, sizeof(path), "%s/%s", backup_dir, REPOSITORY_FILE);
+    size_t repository_size = 0;
+    FILE *file = fopen(path, "r");
+    if (file) {
+        unsigned long long size = 0;
+        int parsed = fscanf(file, "chunk_size=%llu", &size) == 1 && valid_chunk_size(size);
+        fclose(file);
+        stats_add(STATS_METADATA_OPS, 1);
+        if (!parsed) {
+            fprintf(stderr, "Erreur: %s illisible\n", path);
+            return -1;
+        }
+        repository_size = size;
+    } else {
+        snprintf(path, sizeof(path), "%s/.backup_log", backup_dir);
+        if (file_exists_local(path)) {
+            repository_size = CHUNK_DEFAULT_SIZE; // dépôt antérieur à REPOSITORY_FILE
+        }
+    }
+    if (repository_size && chunk_size && chunk_size != repository_size) {
+        fprintf(stderr, "Erreur: le dépôt %s a des chunks de %zu octets, pas de %zu (--chunk-size)\n",
+                backup_dir, repository_size, chunk_size);
+        return -1;
+    }
+    if (!repository_size) {
+        repository_size = chunk_size ? chunk_size : CHUNK_DEFAULT_SIZE;
+    }
+    set_chunk_size(repository_size);
+    if (verbose_flag) {
+        printf("[INFO] Chunks de %zu octets\n", repository_size);
+    }
+    return 0;
+}
+
+/**
+ * @brief Inscrit la taille des chunks dans REPOSITORY_FILE s'il n'existe pas encore.
+ */
+static void save_repository(const char *backup_dir) {
+    char path[MAX_SIZE_PATH];
+    snprintf(path, sizeof(path), "%s/%s", backup_dir, REPOSITORY_FILE);
+    if (dry_run_flag || file_exists_local(path)) {
+        return;
+    }
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        perror("Erreur d'écriture des paramètres du dépôt");
+        return;
+    }
+    fprintf(file, "chunk_size=%zu\n", get_chunk_size());
+    if (fclose(file) != 0) {
+        perror("Erreur d'écriture des paramètres du dépôt");
+    }
+    stats_add(STATS_METADATA_OPS, 1);
+}
+
+/**
+ * @brief Retire de la sauvegarde en préparation l'entrée old_rel de la précédente, dont le
+ * fichier n'existe plus dans la source.
+ */
+static void remove_backup_entry(const char *new_backup_path, const char *old_rel) {
+    char dst_path[2048];
+    snprintf(dst_path, sizeof(dst_path), "%s/%s.dedup", new_backup_path, old_rel);
+    struct stat st;
+    if (stat(dst_path, &st) == 0 && !S_ISDIR(st.st_mode)) {
+        // Fichier : lien vers la sauvegarde précédente, il suffit de le retirer
+        if (dry_run_flag) {
+            if (verbose_flag) {
+                printf("[DRY-RUN] Suppression du fichier %s non réalisée\n", dst_path);
+            }
+        } else {
+            unlink(dst_path);
+            stats_add(STATS_METADATA_OPS, 1);
+            stats_add(STATS_FILES_DELETED, 1);
+        }
+    } else if (stat(dst_path, &st) == 0) {
+        typedef struct {
+            char path[2048];
+        } rm_entry;
+        rm_entry rm_stack[1000];
+        int rm_top = 0;
+        strncpy(rm_stack[rm_top++].path, dst_path, sizeof(rm_stack[0].path) - 1);
+        while (rm_top > 0) {
+            rm_entry cur = rm_stack[--rm_top];
+            DIR *dd = opendir(cur.path);
+            if (!dd) {
+                // rmdir ou unlink
+                if (dry_run_flag) {
+                    if (verbose_flag) {
+                        printf("[DRY-RUN] Suppression du répertoire %s non réalisée\n", cur.path);
+                    }
+                } else {
+                    rmdir(cur.path);
+                    stats_add(STATS_METADATA_OPS, 1);
+                }
+                continue;
+            }
+            struct dirent *en;
+            int empty = 1;
+            int kept = 0; // une entrée au chemin trop long reste en place
+            while ((en = readdir(dd)) != NULL) {
+                if (strcmp(en->d_name, ".") == 0 || strcmp(en->d_name, "..") == 0) {
+                    continue;
+                }
+                empty = 0;
+                char fpath[2048];
+                if (snprintf(fpath, sizeof(fpath), "%s/%s", cur.path, en->d_name) >= (int)sizeof(fpath)) {
+                    // Un chemin tronqué désignerait un autre fichier
+                    fprintf(stderr, "Chemin trop long, non supprimé : %s/%s\n", cur.path, en->d_name);
+                    kept = 1;
+                    continue;
+                }
+                struct stat sst;
+                if (stat(fpath, &sst) == 0) {
+                    if (S_ISDIR(sst.st_mode)) {
+                        strncpy(rm_stack[rm_top++].path, fpath, sizeof(rm_stack[0].path) - 1);
+                    } else {
+                        // unlink
+                        if (dry_run_flag) {
+                            if (verbose_flag) {
+                                printf("[DRY-RUN] Suppression du fichier %s non réalisée\n", fpath);
+                            }
+                        } else {
+                            unlink(fpath);
+                            stats_add(STATS_METADATA_OPS, 1);
+                            stats_add(STATS_FILES_DELETED, 1);
+                        }
+                    }
+                }
+            }
+            closedir(dd);
+            if (empty) {
+                if (dry_run_flag) {
+                    if (verbose_flag) {
+                        printf("[DRY-RUN] Suppression du répertoire vide %s non réalisée\n", cur.path);
+                    }
+                } else {
+                    rmdir(cur.path);
+                    stats_add(STATS_METADATA_OPS, 1);
+                }
+            } else if (!kept) {
+                // Repris une fois ses sous-répertoires vidés ; s'il garde une entrée, il ne
+                // serait jamais vide
+                rm_stack[rm_top++] = cur;
+            }
+        }
+    }
+}
+
+void backup_set_memory_limit(size_t bytes) {
+    memory_limit = bytes;
+}
+
+void backup_set_checkpoint_interval(unsigned int seconds) {
+    checkpoint_interval = seconds;
+}
+
+/**
+ * @brief Avec --memory-limit, charge le point de reprise d'une sauvegarde interrompue dans
+ * un manifeste trié par chemin relatif (valeur : la ligne entière). Un fichier refait après
+ * une première reprise y apparaît plusieurs fois, sa dernière entrée en dernier.
+ */
+static manifest_t *load_checkpoint_manifest(const char *checkpoint_path, const char *dir, size_t memory) {
+    FILE *file = fopen(checkpoint_path, "r");
+    if (!file) {
+        return NULL;
+    }
+    manifest_t *manifest = manifest_create(dir, memory);
+    char line[MAX_SIZE_PATH * 4];
+    size_t count = 0;
+    while (manifest && fgets(line, sizeof(line), file)) {
+        line[strcspn(line, "\n")] = '\0';
+        size_t length;
+        const char *rel = path_index_rel_path(line, &length);
+        if (rel == line) {
+            continue;
+        }
+        char rel_path[MAX_SIZE_PATH];
+        snprintf(rel_path, sizeof(rel_path), "%.*s", (int)length, rel);
+        if (manifest_add(manifest, rel_path, line) != 0) {
+            manifest_free(manifest);
+            manifest = NULL;
+        }
+        count++;
+    }
+    fclose(file);
+    stats_add(STATS_METADATA_OPS, 1);
+    if (manifest && manifest_finish(manifest) != 0) {
+        manifest_free(manifest);
+        manifest = NULL;
+    }
+    if (!manifest) {
+        fprintf(stderr, "Point de reprise illisible, tous les fichiers sont refaits : %s\n", checkpoint_path);
+    } else if (verbose_flag) {
+        printf("[INFO] %zu entrées dans le point de reprise\n", count);
+    }
+    return manifest;
+}
+
+/**
+ * @brief Retire de la sauvegarde en préparation un fichier de la précédente absent du
+ * parcours de la source, s'il n'y existe plus.
+ */
+static void remove_if_deleted(backup_run_t *run, const char *source_dir, const char *old_rel) {
+    uint64_t start = stats_now_ns();
+    char src_path[MAX_SIZE_PATH];
+    snprintf(src_path, sizeof(src_path), "%s/%s", source_dir, old_rel);
+    if (!file_exists_local(src_path)) {
+        remove_backup_entry(run->new_backup_path, old_rel);
+    }
+    stats_phase_end(STATS_PHASE_DELETE, start);
+}
+
+/**
+ * @brief Avec --memory-limit, sauvegarde les fichiers du manifeste du parcours dans l'ordre
+ * des chemins, en fusion avec l'index de la sauvegarde précédente (entrées lues une à une) et
+ * le point de reprise : rien n'est gardé en mémoire d'un fichier au suivant, sinon les
+ * entrées de new_logs jusqu'à leur écriture.
+ */
+static void backup_streamed_files(backup_run_t *run, const char *source_dir, manifest_t *checkpoint) {
+    path_index_reader_t *old = NULL;
+    if (!run->first_backup && run->last_backup_dir[0] != '\0') {
+        old = path_index_open(run->last_backup_dir);
+    }
+    const char *old_line = old ? path_index_next(old) : NULL;
+    const char *done_key = NULL, *done_line = NULL;
+    int has_done = checkpoint && manifest_next(checkpoint, &done_key, &done_line);
+    // Entrées lues dans l'index et le point de reprise, libérées toutes les STREAM_WINDOW_ENTRIES
+    log_t window = {0};
+    size_t window_count = 0;
+    char line[MAX_SIZE_PATH * 4];
+    for (;;) {
+        const char *rel_path, *value;
+        int has_file = manifest_next(run->scan_manifest, &rel_path, &value);
+        const log_element *old_elt = NULL, *done = NULL;
+
+        // Les entrées de la sauvegarde précédente avant rel_path ne sont plus dans la source
+        while (old_line) {
+            size_t length;
+            const char *rel = path_index_rel_path(old_line, &length);
+            char old_rel[MAX_SIZE_PATH];
+            snprintf(old_rel, sizeof(old_rel), "%.*s", (int)length, rel);
+            int cmp = has_file ? strcmp(old_rel, rel_path) : -1;
+            if (cmp > 0) {
+                break;
+            }
+            if (cmp == 0) {
+                snprintf(line, sizeof(line), "%s", old_line);
+                old_elt = parse_log_line(&window, line);
+                window_count++;
+            } else {
+                remove_if_deleted(run, source_dir, old_rel);
+            }
+            old_line = path_index_next(old);
+            if (cmp == 0) {
+                break;
+            }
+        }
+        if (!has_file) {
+            break;
+        }
+
+        // Dernière entrée du fichier dans le point de reprise
+        int cmp;
+        while (has_done && (cmp = strcmp(done_key, rel_path)) <= 0) {
+            if (cmp == 0) {
+                snprintf(line, sizeof(line), "%s", done_line);
+                done = parse_log_line(&window, line);
+                window_count++;
+            }
+            has_done = manifest_next(checkpoint, &done_key, &done_line);
+        }
+
+        // Le fichier a pu changer depuis le parcours
+        char filepath[MAX_SIZE_PATH];
+        snprintf(filepath, sizeof(filepath), "%s/%s", source_dir, rel_path);
+        struct stat st;
+        if (scan_stat(filepath, &st) == 0 && S_ISREG(st.st_mode)) {
+            backup_regular_file(run, filepath, rel_path, &st, old_elt, done);
+        } else if (old_elt) {
+            remove_if_deleted(run, source_dir, rel_path);
+        }
+        if (window_count >= STREAM_WINDOW_ENTRIES) {
+            free_backup_log(&window);
+            window_count = 0;
+        }
+    }
+    free_backup_log(&window);
+    if (old) {
+        path_index_close(old);
+    }
+}
+
+/**
+ * @brief Crée une nouvelle sauvegarde incrémentale, ou reprend la dernière interrompue.
+ */
+void create_backup(const char *source_dir, const char *backup_dir, int resume) {
+    TRACE_BEGIN("create_backup", backup_dir);
+    uint64_t backup_start = stats_now_ns();
+    backup_summary summary = {0};
+    char backup_log_path[1024];
+    snprintf(backup_log_path, sizeof(backup_log_path), "%s/.backup_log", backup_dir);
+    int first_backup = !file_exists_local(backup_log_path);
+
+    if (verbose_flag) {
+        printf("[INFO] Début de la sauvegarde. Source : %s, Destination : %s\n", source_dir, backup_dir);
+        if (first_backup) {
+            printf("[INFO] Aucune sauvegarde précédente trouvée. Création de la première sauvegarde.\n");
+        }
+    }
+
+    if (!file_exists_local(backup_dir)) {
+        if (dry_run_flag) {
+            if (verbose_flag) {
+                printf("[DRY-RUN] Création du répertoire : %s non réalisée\n", backup_dir);
+            }
+        } else {
+            if (create_directory_local(backup_dir) != 0) {
+                perror("Erreur création backup_dir");
+                TRACE_END("create_backup");
+                return;
+            }
+            if (verbose_flag) {
+                printf("[INFO] Répertoire créé : %s\n", backup_dir);
+            }
+        }
+    }
+    save_repository(backup_dir);
+
+    // Avec --resume, le répertoire de préparation le plus récent est repris plutôt que supprimé
+    char resumed[sizeof(STAGING_PREFIX) - 1 + BACKUP_NAME_SIZE] = {0};
+    if (resume && find_resumable_staging(backup_dir, resumed, sizeof(resumed)) != 0) {
+        printf("Aucune sauvegarde interrompue à reprendre dans %s : nouvelle sauvegarde\n", backup_dir);
+    }
+    if (!dry_run_flag) {
+        remove_stale_staging(backup_dir, resumed[0] ? resumed : NULL);
+    }
+
+    // Recherche de la dernière sauvegarde avant de créer la nouvelle,
+    // sinon le répertoire tout juste créé serait pris pour la plus récente
+    char last_backup_dir[2048] = {0};
+    if (!first_backup) {
+        find_last_backup_local(backup_dir, last_backup_dir, sizeof(last_backup_dir));
+    }
+
+    char timestamp[BACKUP_NAME_SIZE];
+    if (resumed[0]) {
+        // La sauvegarde reprise garde son horodatage, qui nomme aussi ses segments
+        snprintf(timestamp, sizeof(timestamp), "%s", resumed + strlen(STAGING_PREFIX));
+        printf("Reprise de la sauvegarde interrompue %s\n", timestamp);
+    } else {
+        get_timestamp_local(timestamp, sizeof(timestamp));
+    }
+    char snapshot_path[2048];
+    snprintf(snapshot_path, sizeof(snapshot_path), "%s/%s", backup_dir, timestamp);
+    // La sauvegarde est préparée à part et n'apparaît sous son nom qu'une fois complète
+    char new_backup_path[2048];
+    snprintf(new_backup_path, sizeof(new_backup_path), "%s/%s%s", backup_dir, STAGING_PREFIX, timestamp);
+
+    if (dry_run_flag) {
+        if (verbose_flag) {
+            printf("[DRY-RUN] Création du répertoire de sauvegarde : %s non réalisée\n", new_backup_path);
+        }
+    } else if (!resumed[0]) {
+        if (create_directory_local(new_backup_path) != 0) {
+            perror("Erreur new_backup_path");
+            TRACE_END("create_backup");
+            return;
+        }
+        if (verbose_flag) {
+            printf("[INFO] Nouveau répertoire de sauvegarde créé : %s\n", new_backup_path);
+        }
+    }
+
+    // Avec --memory-limit, les fichiers de la source sont rangés dans un manifeste trié puis
+    // fusionnés avec l'index de la sauvegarde précédente, lu au fil de l'eau
+    manifest_t *scan_manifest = NULL;
+    const char *manifest_dir = file_exists_local(backup_dir) ? backup_dir : P_tmpdir;
+    if (memory_limit > 0) {
+        scan_manifest = manifest_create(manifest_dir, memory_limit / 2);
+        if (!scan_manifest) {
+            fprintf(stderr, "Mémoire insuffisante pour --memory-limit : sauvegarde sans limite\n");
+        }
+    }
+    int streaming = scan_manifest != NULL;
+
+    log_t old_logs = {0};
+    if (!first_backup && !streaming) {
+        old_logs = read_backup_log(backup_log_path);
+    }
+
+    if (verbose_flag) {
+        printf("[INFO] Traitement des fichiers de la source : %s\n", source_dir);
+    }
+
+    // Duplication de la dernière sauvegarde par liens durs (déjà faite pour une reprise)
+    if (!first_backup && last_backup_dir[0] != '\0' && !resumed[0]) {
+        uint64_t clone_start = stats_now_ns();
+        TRACE_BEGIN("clone_last_backup", last_backup_dir);
+        typedef struct {
+            char path[2048];
+        } dir_stack_entry;
+        dir_stack_entry stack[1000];
+        int top = 0;
+        strncpy(stack[top++].path, last_backup_dir, sizeof(stack[0].path) - 1);
+
+        while (top > 0) {
+            dir_stack_entry current = stack[--top];
+            DIR *dir = opendir(current.path);
+            if (!dir) {
+                continue;
+            }
+            struct dirent *entry;
+
+            while ((entry = readdir(dir)) != NULL) {
+                if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+                    continue;
+                }
+                char src_path[2048], dst_path[2048];
                 snprintf(src_path, sizeof(src_path), "%s/%s", current.path, entry->d_name);
                 size_t lblen = strlen(last_backup_dir);
                 const char *rel = src_path + lblen;
@@ -328,6 +1733,7 @@ void create_backup(const char *source_dir, const char *backup_dir) {
                 snprintf(dst_path, sizeof(dst_path), "%s/%s", new_backup_path, rel);
                 struct stat st;
 
+                stats_add(STATS_METADATA_OPS, 1);
                 if (stat(src_path, &st) == 0) {
                     if (S_ISDIR(st.st_mode)) {
                         if (dry_run_flag) {
@@ -349,10 +1755,23 @@ void create_backup(const char *source_dir, const char *backup_dir) {
                                 printf("[DRY-RUN] Sauvegarde du fichier %s vers %s non réalisée\n", src_path, dst_path);
                             }
                         } else {
-                            if (link(src_path, dst_path) != 0) {
+                            stats_add(STATS_METADATA_OPS, 1);
+                            TRACE_BEGIN("link", dst_path);
+                            int linked = link(src_path, dst_path);
+                            TRACE_END("link");
+                            if (linked != 0) {
                                 copy_file_if_needed(src_path, dst_path);
-                            } else if (verbose_flag) {
-                                printf("[INFO] Fichier lié de %s vers %s\n", src_path, dst_path);
+                                stats_add(STATS_COPY_FALLBACKS, 1);
+                                // La copie est un nouveau fichier : ses références comptent en plus
+                                size_t len = strlen(dst_path);
+                                if (len > 6 && strcmp(dst_path + len - 6, ".dedup") == 0) {
+                                    refcount_add_file(backup_dir, dst_path, 1, NULL, NULL);
+                                }
+                            } else {
+                                stats_add(STATS_LINKS_CREATED, 1);
+                                if (verbose_flag) {
+                                    printf("[INFO] Fichier lié de %s vers %s\n", src_path, dst_path);
+                                }
                             }
                         }
                     }
@@ -360,6 +1779,8 @@ void create_backup(const char *source_dir, const char *backup_dir) {
             }
             closedir(dir);
         }
+        stats_phase_end(STATS_PHASE_CLONE, clone_start);
+        TRACE_END("clone_last_backup");
         if (verbose_flag) {
             printf("[INFO] Fin de la sauvegarde de base.\n");
         }
@@ -367,180 +1788,180 @@ void create_backup(const char *source_dir, const char *backup_dir) {
 
     // Parcourt la source et met à jour incrémentalement
     log_t new_logs = {0};
-    new_logs.head = NULL;
-    new_logs.tail = NULL;
 
-    typedef struct {
-        char path[2048];
-    } dir_stack_entry2;
+    // Chunks et données d'un fichier sont pris dans une arène remise à zéro après chaque fichier :
+    // après les premiers fichiers, la déduplication ne fait plus d'appel à malloc
+    arena_t file_arena;
+    arena_init(&file_arena, 0);
+
+    // Les petits fichiers sont ajoutés à la suite de segments partagés
+    segment_writer_t segments;
+    segment_writer_init(&segments, backup_dir, timestamp);
+    // Les fichiers identiques à un contenu déjà stocké ne sont pas redécoupés
+    file_digest_map_t digests;
+    file_digest_load(&digests, backup_dir, streaming ? memory_limit / 4 / FILE_DIGEST_ENTRY_MEMORY : 0);
+
+    // Point de reprise : sa création marque la fin de la duplication ; il reçoit ensuite,
+    // toutes les checkpoint_interval secondes, les entrées des fichiers terminés
+    char checkpoint_path[MAX_SIZE_PATH + sizeof(CHECKPOINT_FILE)]; // répertoire, "/" et CHECKPOINT_FILE
+    snprintf(checkpoint_path, sizeof(checkpoint_path), "%s/%s", new_backup_path, CHECKPOINT_FILE);
+    log_t checkpoint_logs = {0};
+    const log_element **checkpoint = NULL;
+    size_t checkpoint_count = 0;
+    manifest_t *checkpoint_manifest = NULL;
+    if (resumed[0] && streaming) {
+        checkpoint_manifest = load_checkpoint_manifest(checkpoint_path, manifest_dir, memory_limit / 8);
+        segment_writer_resume(&segments);
+    } else if (resumed[0]) {
+        checkpoint_count = load_checkpoint(checkpoint_path, &checkpoint_logs, &checkpoint);
+        segment_writer_resume(&segments);
+        if (verbose_flag) {
+            printf("[INFO] %zu fichiers terminés avant l'interruption\n", checkpoint_count);
+        }
+    }
+    FILE *checkpoint_file = NULL;
+    if (!dry_run_flag) {
+        if (!resumed[0]) {
+            unlink(checkpoint_path);
+        }
+        checkpoint_file = fopen(checkpoint_path, "a");
+        if (!checkpoint_file) {
+            perror("Erreur de création du point de reprise");
+        }
+    }
+
     dir_stack_entry2 src_stack[1000];
-    int src_top = 0;
-    strncpy(src_stack[src_top++].path, source_dir, sizeof(src_stack[0].path) - 1);
-    size_t source_dir_len = strlen(source_dir);
+    backup_run_t run = {
+        .backup_dir = backup_dir,
+        .new_backup_path = new_backup_path,
+        .last_backup_dir = last_backup_dir,
+        .timestamp = timestamp,
+        .source_dir_len = strlen(source_dir),
+        .first_backup = first_backup,
+        .old_logs = &old_logs,
+        .new_logs = &new_logs,
+        .summary = &summary,
+        .file_arena = &file_arena,
+        .segments = &segments,
+        .digests = &digests,
+        .dir_stack = src_stack,
+        .resuming = resumed[0] != '\0',
+        .checkpoint = checkpoint,
+        .checkpoint_count = checkpoint_count,
+        .checkpoint_file = checkpoint_file,
+        .last_checkpoint = stats_now_ns(),
+        .streaming = streaming,
+        .scan_manifest = scan_manifest,
+        .pending_limit = memory_limit / 8,
+    };
+
+    // Avec --memory-limit, le .backup_log et l'index de la sauvegarde sont écrits au fil de la fusion
+    char new_backup_log_path[MAX_SIZE_PATH + sizeof("/.backup_log")];
+    snprintf(new_backup_log_path, sizeof(new_backup_log_path), "%s/.backup_log", new_backup_path);
+    char index_path[MAX_SIZE_PATH + sizeof(PATH_INDEX_FILE)]; // répertoire, "/" et PATH_INDEX_FILE
+    snprintf(index_path, sizeof(index_path), "%s/%s", new_backup_path, PATH_INDEX_FILE);
+    int stream_ok = 1;
+    if (streaming && !dry_run_flag) {
+        // Le .backup_log lié depuis la sauvegarde précédente n'est pas réécrit sur place
+        unlink(new_backup_log_path);
+        run.log_stream = fopen(new_backup_log_path, "w");
+        run.index_stream = path_index_writer_open(index_path);
+        if (!run.log_stream || !run.index_stream) {
+            perror("Erreur de création du .backup_log de la sauvegarde");
+            stream_ok = 0;
+        }
+    }
 
-    while (src_top > 0) {
-        dir_stack_entry2 current = src_stack[--src_top];
+    // Avec un surveillant actif (--watch), seuls les chemins du journal sont visités
+    journal_t journal;
+    int use_journal = journal_take(backup_dir, source_dir, &journal) == 0 && !first_backup && !streaming
+                      && last_backup_dir[0] != '\0' && backup_from_journal(&run, source_dir, &journal) == 0;
+    if (!use_journal) {
+        strncpy(src_stack[run.dir_top++].path, source_dir, sizeof(src_stack[0].path) - 1);
+    }
+
+    TRACE_BEGIN("scan_source", source_dir);
+    scan_file_t *scan_files = NULL;
+    size_t scan_capacity = 0;
+    while (run.dir_top > 0) {
+        dir_stack_entry2 current = src_stack[--run.dir_top];
         DIR *dir = opendir(current.path);
         if (!dir) {
             continue;
         }
+        // Les fichiers réguliers sont sauvegardés après le parcours du répertoire, triés
+        // par position sur le disque plutôt que dans l'ordre de readdir
+        size_t scan_count = 0;
         struct dirent *entry;
-        while ((entry = readdir(dir)) != NULL) {
+        while ((entry = scan_readdir(dir)) != NULL) {
             if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
                 continue;
             }
             char filepath[2048];
             snprintf(filepath, sizeof(filepath), "%s/%s", current.path, entry->d_name);
             struct stat st;
-            if (stat(filepath, &st) == 0) {
-                const char *rel_path = filepath + source_dir_len;
+            if (scan_stat(filepath, &st) != 0) {
+                continue;
+            }
+            if (!S_ISREG(st.st_mode)) {
+                backup_entry(&run, filepath, &st);
+                continue;
+            }
+            if (streaming) {
+                const char *rel_path = filepath + run.source_dir_len;
                 while (*rel_path == '/') {
                     rel_path++;
                 }
-                char dst_path[2048];
-                snprintf(dst_path, sizeof(dst_path), "%s/%s", new_backup_path, rel_path);
-
-                if (S_ISDIR(st.st_mode)) {
-                    if (!file_exists_local(dst_path)) {
-                        if (dry_run_flag) {
-                            if (verbose_flag) {
-                                printf("[DRY-RUN] Création du répertoire %s non réalisée\n", dst_path);
-                            }
-                        } else {
-                            create_directory_local(dst_path);
-                            if (verbose_flag) {
-                                printf("[INFO] Répertoire créé : %s\n", dst_path);
-                            }
-                        }
-                    }
-
-                    if (!file_exists_local(dst_path)) {
-                        if (dry_run_flag && verbose_flag) {
-                            printf("[DRY-RUN] Création du répertoire %s non réalisée\n", dst_path);
-                        } else if (!dry_run_flag) {
-                            create_directory_local(dst_path);
-                        }
-                    }
-                    strncpy(src_stack[src_top++].path, filepath, sizeof(src_stack[0].path) - 1);
-
-                } else if (S_ISREG(st.st_mode)) {
-                    // Calcul MD5
-                    unsigned char md5_sum[MD5_DIGEST_LENGTH];
-                    {
-                        FILE *fcheck = fopen(filepath, "rb");
-                        if (fcheck) {
-                            unsigned char buffer[4096];
-                            MD5_CTX ctx;
-                            MD5_Init(&ctx);
-                            size_t r;
-                            while ((r = fread(buffer, 1, sizeof(buffer), fcheck)) > 0) {
-                                MD5_Update(&ctx, buffer, r);
-                            }
-                            MD5_Final(md5_sum, &ctx);
-                            fclose(fcheck);
-                        } else {
-                            memset(md5_sum, 0, MD5_DIGEST_LENGTH);
-                        }
-                    }
-
-                    // Chercher old_elt
-                    log_element *old_elt = NULL;
-                    if (!first_backup && old_logs.head) {
-                        for (log_element *e = old_logs.head; e; e = e->next) {
-                            const char *sep = strchr(e->path, '/');
-                            if (sep) {
-                                const char *old_rel = sep + 1;
-                                if (strcmp(old_rel, rel_path) == 0) {
-                                    old_elt = e;
-                                    break;
-                                }
-                            }
-                        }
-                    }
-
-                    char dedup_filename[2048];
-                    snprintf(dedup_filename, sizeof(dedup_filename), "%s/%s.dedup", new_backup_path, rel_path);
-                    int file_unchanged = 0;
-                    if (!first_backup && old_elt && memcmp(old_elt->md5, md5_sum, MD5_DIGEST_LENGTH) == 0) {
-                        if (file_exists_local(dedup_filename)) {
-                            file_unchanged = 1;
-                        }
-                    }
-
-                    if (!file_unchanged) {
-                        // Redédupliquer
-                        FILE *f = fopen(filepath, "rb");
-                        if (f) {
-                            Chunk chunks[MAX_CHUNKS];
-                            memset(chunks, 0, sizeof(chunks));
-                            Md5Entry hash_table[HASH_TABLE_SIZE];
-                            memset(hash_table, 0, sizeof(hash_table));
-                            deduplicate_file(f, chunks, hash_table);
-                            fclose(f);
-                            int chunk_count = 0;
-                            for (int i = 0; i < MAX_CHUNKS; i++) {
-                                if (!chunks[i].data) {
-                                    break;
-                                }
-                                chunk_count++;
-                            }
-
-                            {
-                                char tmp[2048];
-                                strncpy(tmp, dedup_filename, sizeof(tmp));
-                                for (char *p = tmp + strlen(new_backup_path) + 1; *p; p++) {
-                                    if (*p == '/') {
-                                        *p = '\0';
-                                        if (dry_run_flag) {
-                                            if (verbose_flag) {
-                                                printf("[DRY-RUN] Création du répertoire %s (non réalisée)\n", tmp);
-                                            }
-                                        } else {
-                                            create_directory_local(tmp);
-                                        }
-                                        *p = '/';
-                                    }
-                                }
-                            }
-
-                            write_backup_file(dedup_filename, chunks, chunk_count);
-                            for (int i = 0; i < chunk_count; i++) {
-                                free(chunks[i].data);
-                            }
-                        }
-                    }
-
-                    // Ajout au new_logs
-                    log_element *elt = (log_element *)malloc(sizeof(log_element));
-                    memset(elt, 0, sizeof(log_element));
-                    char log_path[2048];
-                    snprintf(log_path, sizeof(log_path), "%s/%s", timestamp, rel_path);
-                    elt->path = strdup(log_path);
-                    struct tm *tm_info = localtime(&st.st_mtime);
-                    char mod_time[128];
-                    snprintf(
-                        mod_time, sizeof(mod_time), "%04d-%02d-%02d-%02d:%02d:%02d.%03d",
-                        tm_info->tm_year + 1900, tm_info->tm_mon + 1, tm_info->tm_mday,
-                        tm_info->tm_hour, tm_info->tm_min, tm_info->tm_sec, 0
-                    );
-                    elt->date = strdup(mod_time);
-                    memcpy(elt->md5, md5_sum, MD5_DIGEST_LENGTH);
-                    elt->next = NULL;
-                    elt->prev = new_logs.tail;
-                    if (new_logs.tail) {
-                        new_logs.tail->next = elt;
-                    } else {
-                        new_logs.head = elt;
-                    }
-                    new_logs.tail = elt;
+                if (manifest_add(scan_manifest, rel_path, NULL) != 0) {
+                    fprintf(stderr, "Erreur d'écriture du manifeste des fichiers : %s non sauvegardé\n", filepath);
+                    stream_ok = 0;
+                }
+                continue;
+            }
+            if (scan_count == scan_capacity) {
+                size_t capacity = scan_capacity ? scan_capacity * 2 : 256;
+                scan_file_t *grown = realloc(scan_files, capacity * sizeof(scan_file_t));
+                if (!grown) {
+                    backup_entry(&run, filepath, &st);
+                    continue;
                 }
+                scan_files = grown;
+                scan_capacity = capacity;
+            }
+            scan_files[scan_count].path = strdup(filepath);
+            scan_files[scan_count].st = st;
+            if (!scan_files[scan_count].path) {
+                backup_entry(&run, filepath, &st);
+                continue;
             }
+            scan_count++;
         }
         closedir(dir);
+        backup_directory_files(&run, scan_files, scan_count);
     }
+    free(scan_files);
 
-    // Supprime ce qui n'existe plus
-    if (!first_backup) {
+    TRACE_END("scan_source");
+
+    if (streaming) {
+        TRACE_BEGIN("backup_streamed_files", source_dir);
+        if (manifest_finish(scan_manifest) == 0) {
+            backup_streamed_files(&run, source_dir, checkpoint_manifest);
+        } else {
+            stream_ok = 0;
+        }
+        TRACE_END("backup_streamed_files");
+        if (verbose_flag) {
+            printf("[INFO] Manifeste des fichiers : %d runs sur disque\n", manifest_run_count(scan_manifest));
+        }
+        manifest_free(scan_manifest);
+        manifest_free(checkpoint_manifest);
+    }
+
+    // Supprime ce qui n'existe plus (fait pendant la fusion avec --memory-limit)
+    if (!first_backup && !streaming) {
+        uint64_t delete_start = stats_now_ns();
+        TRACE_BEGIN("delete_removed", new_backup_path);
         for (log_element *e = old_logs.head; e; e = e->next) {
             const char *sep = strchr(e->path, '/');
             if (!sep) {
@@ -549,99 +1970,121 @@ void create_backup(const char *source_dir, const char *backup_dir) {
             const char *old_rel = sep + 1;
             char src_path[2048];
             snprintf(src_path, sizeof(src_path), "%s/%s", source_dir, old_rel);
-            if (!file_exists_local(src_path)) {
-                char dst_path[2048];
-                snprintf(dst_path, sizeof(dst_path), "%s/%s", new_backup_path, old_rel);
-                struct stat st;
-                if (stat(dst_path, &st) == 0) {
-                    typedef struct {
-                        char path[2048];
-                    } rm_entry;
-                    rm_entry rm_stack[1000];
-                    int rm_top = 0;
-                    strncpy(rm_stack[rm_top++].path, dst_path, sizeof(rm_stack[0].path) - 1);
-                    while (rm_top > 0) {
-                        rm_entry cur = rm_stack[--rm_top];
-                        DIR *dd = opendir(cur.path);
-                        if (!dd) {
-                            // rmdir ou unlink
-                            if (dry_run_flag) {
-                                if (verbose_flag) {
-                                    printf("[DRY-RUN] Suppression du répertoire %s non réalisée\n", cur.path);
-                                }
-                            } else {
-                                rmdir(cur.path);
-                            }
-                            continue;
-                        }
-                        struct dirent *en;
-                        int empty = 1;
-                        while ((en = readdir(dd)) != NULL) {
-                            if (strcmp(en->d_name, ".") == 0 || strcmp(en->d_name, "..") == 0) {
-                                continue;
-                            }
-                            empty = 0;
-                            char fpath[2048];
-                            snprintf(fpath, sizeof(fpath), "%s/%s", cur.path, en->d_name);
-                            struct stat sst;
-                            if (stat(fpath, &sst) == 0) {
-                                if (S_ISDIR(sst.st_mode)) {
-                                    strncpy(rm_stack[rm_top++].path, fpath, sizeof(rm_stack[0].path) - 1);
-                                } else {
-                                    // unlink
-                                    if (dry_run_flag) {
-                                        if (verbose_flag) {
-                                            printf("[DRY-RUN] Suppression du fichier %s non réalisée\n", fpath);
-                                        }
-                                    } else {
-                                        unlink(fpath);
-                                    }
-                                }
-                            }
-                        }
-                        closedir(dd);
-                        if (empty) {
-                            if (dry_run_flag) {
-                                if (verbose_flag) {
-                                    printf("[DRY-RUN] Suppression du répertoire vide %s non réalisée\n", cur.path);
-                                }
-                            } else {
-                                rmdir(cur.path);
-                            }
-                        } else {
-                            rm_stack[rm_top++] = cur;
-                        }
-                    }
-                }
+            // Avec le journal, un chemin qui n'y figure pas existe toujours
+            if ((!use_journal || journal_is_dirty(&journal, old_rel)) && !file_exists_local(src_path)) {
+                remove_backup_entry(new_backup_path, old_rel);
             }
         }
+        stats_phase_end(STATS_PHASE_DELETE, delete_start);
+        TRACE_END("delete_removed");
     }
 
-    // Met à jour .backup_log
-    update_backup_log_if_needed(backup_log_path, &new_logs);
-
-    {
-        char new_backup_log_path[2048];
-        snprintf(new_backup_log_path, sizeof(new_backup_log_path), "%s/.backup_log", new_backup_path);
+    int segments_ok = segment_writer_close(&segments) == 0;
+    if (checkpoint_file) {
+        fclose(checkpoint_file);
+    }
+    free(checkpoint);
+    free_backup_log(&checkpoint_logs);
+
+    // .backup_log de la nouvelle sauvegarde (il remplace le lien vers celui de la précédente)
+    uint64_t log_start = stats_now_ns();
+    // Index trié des chemins, pour restaurer un fichier ou un sous-arbre sans lire tout le log
+    int index_ok = 1;
+    if (streaming) {
+        release_streamed_entries(&run);
+        if (run.log_stream && (fflush(run.log_stream) != 0 || ferror(run.log_stream))) {
+            perror("Erreur d'écriture du .backup_log de la sauvegarde");
+            stream_ok = 0;
+        }
+        if (run.log_stream) {
+            fclose(run.log_stream);
+        }
+        if (run.index_stream) {
+            index_ok = path_index_writer_close(run.index_stream) == 0;
+        }
+    } else {
+        update_backup_log_if_needed(new_backup_log_path, &new_logs);
         if (dry_run_flag) {
             if (verbose_flag) {
-                printf("[DRY-RUN] Copie du .backup_log vers %s non réalisée\n", new_backup_log_path);
+                printf("[DRY-RUN] Écriture de l'index des chemins non réalisée\n");
             }
         } else {
-            copy_file(backup_log_path, new_backup_log_path);
-            if (verbose_flag) {
-                printf("[INFO] .backup_log copié vers %s\n", new_backup_log_path);
+            index_ok = path_index_write(index_path, &new_logs) == 0;
+        }
+    }
+    stats_phase_end(STATS_PHASE_LOG, log_start);
+
+    // Un seul syncfs rend durable tout ce qui a été écrit, puis le renommage publie la
+    // sauvegarde d'un coup ; le .backup_log racine n'est remplacé qu'après
+    int committed = dry_run_flag;
+    if (dry_run_flag) {
+        if (verbose_flag) {
+            printf("[DRY-RUN] Validation de la sauvegarde %s non réalisée\n", snapshot_path);
+        }
+    } else {
+        uint64_t commit_start = stats_now_ns();
+        TRACE_BEGIN("commit_snapshot", snapshot_path);
+        // Les segments cités sont comptés avant la publication : une interruption entre les
+        // deux ne laisse que des compteurs trop hauts, qui gardent des segments plus longtemps
+        int counted = 0;
+        if (segments_ok && index_ok && stream_ok) {
+            segment_refs_init(backup_dir);
+            counted = segment_refs_add(backup_dir, new_backup_log_path, 1, NULL) == 0;
+        }
+        if (counted && sync_backup_dir(backup_dir) == 0) {
+            if (rename(new_backup_path, snapshot_path) == 0) {
+                committed = 1;
+                // Le point de reprise a suivi la sauvegarde validée, il ne sert plus
+                snprintf(checkpoint_path, sizeof(checkpoint_path), "%s/%s", snapshot_path, CHECKPOINT_FILE);
+                unlink(checkpoint_path);
+                if (streaming) {
+                    snprintf(new_backup_log_path, sizeof(new_backup_log_path), "%s/.backup_log", snapshot_path);
+                    replace_backup_log(backup_log_path, new_backup_log_path);
+                } else {
+                    update_backup_log_if_needed(backup_log_path, &new_logs);
+                }
+                file_digest_save(&digests, backup_dir);
+                fsync_directory(backup_dir);
+                if (verbose_flag) {
+                    printf("[INFO] Sauvegarde validée : %s\n", snapshot_path);
+                }
+            } else {
+                perror("Erreur de validation de la sauvegarde");
             }
         }
+        stats_add(STATS_METADATA_OPS, 1);
+        stats_phase_end(STATS_PHASE_COMMIT, commit_start);
+        TRACE_END("commit_snapshot");
+    }
+    if (!committed) {
+        fprintf(stderr, "Sauvegarde non validée, à reprendre avec --resume (sinon supprimée par la suivante) : %s\n",
+                new_backup_path);
+        journal_free(&journal);
+        file_digest_free(&digests);
+        arena_free(&file_arena);
+        free_backup_log(&new_logs);
+        free_backup_log(&old_logs);
+        TRACE_END("create_backup");
+        return;
     }
 
-    for (log_element *x = new_logs.head; x;) {
-        log_element *nx = x->next;
-        free((char *)x->path);
-        free(x->date);
-        free(x);
-        x = nx;
+    // Résumé lu par --list-backups sans parcourir la sauvegarde
+    snprintf(summary.name, sizeof(summary.name), "%s", timestamp);
+    summary.duration = (stats_now_ns() - backup_start) / 1e9;
+    summary.dedup_ratio = summary.stored_bytes ? (double)summary.logical_bytes / summary.stored_bytes : 0.0;
+    char summary_path[1024];
+    snprintf(summary_path, sizeof(summary_path), "%s/%s", backup_dir, SUMMARY_FILE);
+    append_backup_summary(summary_path, &summary);
+
+    if (!dry_run_flag) {
+        journal_commit(backup_dir, &journal);
     }
+    journal_free(&journal);
+    file_digest_free(&digests);
+    arena_free(&file_arena);
+    free_backup_log(&new_logs);
+    free_backup_log(&old_logs);
+    TRACE_END("create_backup");
 }
 
 /**
@@ -654,15 +2097,23 @@ void backup_file(const char *filename) {
         return;
     }
 
-    Chunk chunks[MAX_CHUNKS];
-    memset(chunks, 0, sizeof(chunks));
+    struct stat st;
+    if (fstat(fileno(file), &st) != 0) {
+        perror("Err backup_file fstat");
+        fclose(file);
+        return;
+    }
+    size_t max_chunks = (size_t)st.st_size / get_chunk_size() + 2;
+    arena_t arena;
+    arena_init(&arena, 0);
+    Chunk *chunks = arena_calloc(&arena, max_chunks * sizeof(Chunk));
     Md5Entry hash_table[HASH_TABLE_SIZE];
     memset(hash_table, 0, sizeof(hash_table));
-    deduplicate_file(file, chunks, hash_table);
+    deduplicate_file(file, (uint64_t)st.st_size, &chunks, &max_chunks, hash_table, &arena);
     fclose(file);
 
     int chunk_count = 0;
-    for (int i = 0; i < MAX_CHUNKS; i++) {
+    for (size_t i = 0; i < max_chunks; i++) {
         if (!chunks[i].data) {
             break;
         }
@@ -672,28 +2123,147 @@ void backup_file(const char *filename) {
     char output_filename[MAX_SIZE_PATH];
     snprintf(output_filename, sizeof(output_filename), "%s.dedup", filename);
     write_backup_file(output_filename, chunks, chunk_count);
-    for (int i = 0; i < chunk_count; i++) {
-        free(chunks[i].data);
+    arena_free(&arena);
+}
+
+/**
+ * @brief Indique si l'entrée "sauvegarde/chemin" est le fichier prefix ou se trouve sous prefix/.
+ */
+static int path_matches(const char *path, const char *prefix) {
+    size_t rel_len;
+    const char *rel = path_index_rel_path(path, &rel_len);
+    while (*prefix == '/') {
+        prefix++;
+    }
+    size_t prefix_len = strlen(prefix);
+    while (prefix_len > 0 && prefix[prefix_len - 1] == '/') {
+        prefix_len--;
+    }
+    return prefix_len == 0 || (rel_len >= prefix_len && strncmp(rel, prefix, prefix_len) == 0
+                               && (rel_len == prefix_len || rel[prefix_len] == '/'));
+}
+
+// Fichiers d'une restauration, partagés entre les threads
+typedef struct {
+    const char *backup_id;
+    const char *backup_dir;
+    const char *restore_dir;
+    const log_element **entries;
+    int count;
+    int next; // prochain fichier à restaurer (incrémenté atomiquement)
+    chunk_cache_t *cache;
+} restore_context_t;
+
+/**
+ * @brief Restaure un fichier de la sauvegarde ; ses chunks sont pris dans arena.
+ */
+static void restore_entry(restore_context_t *ctx, const log_element *elt, arena_t *arena) {
+    const char *rel_path = strchr(elt->path, '/') + 1;
+    FILE *fin = open_entry_dedup(ctx->backup_dir, ctx->backup_id, elt);
+    stats_add(STATS_METADATA_OPS, 1);
+    if (!fin) {
+        return;
+    }
+    Chunk *chunks = NULL;
+    int chunk_count = 0;
+    uint64_t read_start = stats_now_ns();
+    TRACE_BEGIN("undeduplicate_file", rel_path);
+    struct stat dedup_st;
+    if (elt->segment) {
+        stats_add(STATS_BYTES_READ, elt->length);
+    } else if (fstat(fileno(fin), &dedup_st) == 0) {
+        stats_add(STATS_BYTES_READ, dedup_st.st_size);
+    }
+    undeduplicate_file(fin, &chunks, &chunk_count, arena);
+    fclose(fin);
+    resolve_external_chunks(ctx->backup_dir, chunks, chunk_count, arena, ctx->cache);
+    stats_phase_end(STATS_PHASE_RESTORE_READ, read_start);
+    TRACE_END("undeduplicate_file");
+
+    char restored_file[MAX_SIZE_PATH];
+    snprintf(restored_file, sizeof(restored_file), "%s/%s", ctx->restore_dir, rel_path);
+
+    {
+        char temp[2048];
+        strncpy(temp, restored_file, sizeof(temp));
+        char *p = strrchr(temp, '/');
+        if (p) {
+            *p = '\0';
+            if (dry_run_flag) {
+                if (verbose_flag) {
+                    printf("[DRY-RUN] Création du répertoire %s pour restauration non réalisée\n", temp);
+                }
+            } else if (create_directory_local(temp) != 0) {
+                // Avec plusieurs threads, un répertoire parent peut ne pas encore exister
+                make_parent_dirs(restored_file);
+            }
+        }
+    }
+
+    write_restored_file(restored_file, chunks, chunk_count);
+}
+
+static void *restore_worker(void *arg) {
+    restore_context_t *ctx = arg;
+    // Les chunks d'un fichier sont libérés d'un coup, l'arène resservant au suivant
+    arena_t file_arena;
+    arena_init(&file_arena, 0);
+    int i;
+    while ((i = __atomic_fetch_add(&ctx->next, 1, __ATOMIC_RELAXED)) < ctx->count) {
+        restore_entry(ctx, ctx->entries[i], &file_arena);
+        arena_reset(&file_arena);
     }
+    arena_free(&file_arena);
+    return NULL;
 }
 
 /**
- * @brief Restaure une sauvegarde.
+ * @brief Restaure une sauvegarde, ou seulement le fichier ou le sous-arbre path_prefix.
+ *
+ * Les fichiers sont répartis entre jobs threads qui partagent un cache LRU de
+ * cache_size octets pour les chunks désignés par des références externes.
+ * Avec path_prefix, les entrées sont cherchées par dichotomie dans l'index des chemins
+ * de la sauvegarde ; seuls les .dedup et segments des fichiers retenus sont lus.
  */
-void restore_backup(const char *backup_id, const char *restore_dir) {
+void restore_backup(const char *backup_id, const char *restore_dir, int jobs, size_t cache_size,
+                    const char *path_prefix) {
+    if (strlen(backup_id) >= MAX_SIZE_PATH) {
+        fprintf(stderr, "Chemin de sauvegarde trop long : %s\n", backup_id);
+        return;
+    }
     char backup_dir[MAX_SIZE_PATH];
     strcpy(backup_dir, backup_id);
     char *last_slash = strrchr(backup_dir, '/');
     if (last_slash) {
         *last_slash = '\0';
     }
-    char backup_log_path[MAX_SIZE_PATH];
-    snprintf(backup_log_path, sizeof(backup_log_path), "%s/.backup_log", backup_dir);
+    char backup_log_path[MAX_SIZE_PATH + sizeof("/.backup_log")];
+    // Le .backup_log copié dans la sauvegarde décrit exactement son contenu ;
+    // celui de la racine ne sert que pour les sauvegardes qui n'en ont pas
+    snprintf(backup_log_path, sizeof(backup_log_path), "%s/.backup_log", backup_id);
     if (!file_exists_local(backup_log_path)) {
-        return;
+        snprintf(backup_log_path, sizeof(backup_log_path), "%s/.backup_log", backup_dir);
     }
 
-    log_t logs = read_backup_log(backup_log_path);
+    TRACE_BEGIN("restore_backup", backup_id);
+    log_t logs = {0};
+    int indexed = -1;
+    if (path_prefix) {
+        char index_path[MAX_SIZE_PATH];
+        snprintf(index_path, sizeof(index_path), "%s/%s", backup_id, PATH_INDEX_FILE);
+        indexed = path_index_lookup(index_path, path_prefix, &logs);
+    }
+    if (indexed < 0) {
+        if (!file_exists_local(backup_log_path)) {
+            TRACE_END("restore_backup");
+            return;
+        }
+        // Sauvegarde antérieure à l'index : le log complet est lu puis filtré
+        logs = read_backup_log(backup_log_path);
+    }
+    if (path_prefix && indexed == 0) {
+        fprintf(stderr, "Aucun fichier sous %s dans la sauvegarde %s\n", path_prefix, backup_id);
+    }
     if (dry_run_flag) {
         if (verbose_flag) {
             printf("[DRY-RUN] Création du répertoire de restauration %s non réalisée\n", restore_dir);
@@ -702,77 +2272,486 @@ void restore_backup(const char *backup_id, const char *restore_dir) {
         create_directory_local(restore_dir);
     }
 
+    restore_context_t ctx = {
+        .backup_id = backup_id,
+        .backup_dir = backup_dir,
+        .restore_dir = restore_dir,
+        .cache = chunk_cache_create(cache_size),
+    };
     for (log_element *elt = logs.head; elt; elt = elt->next) {
-        const char *sep = strchr(elt->path, '/');
-        if (!sep) {
-            continue;
+        ctx.count++;
+    }
+    ctx.entries = malloc((ctx.count ? ctx.count : 1) * sizeof(log_element *));
+    ctx.count = 0;
+    for (log_element *elt = logs.head; elt; elt = elt->next) {
+        if (strchr(elt->path, '/') && (indexed >= 0 || !path_prefix || path_matches(elt->path, path_prefix))) {
+            ctx.entries[ctx.count++] = elt;
         }
-        const char *rel_path = sep + 1;
-        char dedup_file[MAX_SIZE_PATH];
-        snprintf(dedup_file, sizeof(dedup_file), "%s/%s.dedup", backup_id, rel_path);
-        if (!file_exists_local(dedup_file)) {
+    }
+
+    if (jobs > ctx.count) {
+        jobs = ctx.count;
+    }
+    if (jobs <= 1) {
+        restore_worker(&ctx);
+    } else {
+        pthread_t *threads = malloc(jobs * sizeof(pthread_t));
+        int started = 0;
+        for (; started < jobs; started++) {
+            if (pthread_create(&threads[started], NULL, restore_worker, &ctx) != 0) {
+                break;
+            }
+        }
+        if (started == 0) {
+            restore_worker(&ctx);
+        }
+        for (int i = 0; i < started; i++) {
+            pthread_join(threads[i], NULL);
+        }
+        free(threads);
+    }
+
+    free(ctx.entries);
+    chunk_cache_free(ctx.cache);
+    free_backup_log(&logs);
+    TRACE_END("restore_backup");
+}
+
+/**
+ * @brief Écrit une taille en octets avec l'unité la plus adaptée.
+ */
+void format_size(unsigned long long bytes, char *buffer, size_t size) {
+    const char *units[] = {"o", "Ko", "Mo", "Go", "To"};
+    double value = bytes;
+    int unit = 0;
+    while (value >= 1024 && unit < 4) {
+        value /= 1024;
+        unit++;
+    }
+    snprintf(buffer, size, unit ? "%.1f %s" : "%.0f %s", value, units[unit]);
+}
+
+/**
+ * @brief Écrit la liste des sauvegardes dans out.
+ *
+ * Seul le fichier des résumés est lu ; les sauvegardes créées avant son introduction
+ * (fichier absent) sont listées par leur nom en parcourant le répertoire.
+ */
+void write_backup_list(const char *backup_dir, FILE *out) {
+    char summary_path[MAX_SIZE_PATH];
+    snprintf(summary_path, sizeof(summary_path), "%s/%s", backup_dir, SUMMARY_FILE);
+    backup_summary *summaries;
+    int count = read_backup_summaries(summary_path, &summaries);
+    if (count >= 0) {
+        for (int i = 0; i < count; i++) {
+            backup_summary *summary = summaries + i;
+            char logical[32], stored[32];
+            format_size(summary->logical_bytes, logical, sizeof(logical));
+            format_size(summary->stored_bytes, stored, sizeof(stored));
+            fprintf(out, "%s  %6ld fichiers  %10s  %10s stockés  %8.3f s  x%.2f\n", summary->name,
+                    summary->file_count, logical, stored, summary->duration, summary->dedup_ratio);
+        }
+        free(summaries);
+        return;
+    }
+
+    DIR *dir = opendir(backup_dir);
+    if (dir == NULL) {
+        perror("Erreur pendant l'ouverture du dossier");
+        return;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
             continue;
         }
-        FILE *fin = fopen(dedup_file, "rb");
-        if (!fin) {
+        if (entry->d_name[0] == '.') {
             continue;
         }
-        Chunk *chunks = NULL;
-        int chunk_count = 0;
-        undeduplicate_file(fin, &chunks, &chunk_count);
-        fclose(fin);
+        char path[MAX_SIZE_PATH];
+        snprintf(path, sizeof(path), "%s/%s", backup_dir, entry->d_name);
+        struct stat st;
+        if (stat(path, &st) == 0 && S_ISDIR(st.st_mode)) {
+            fprintf(out, "%s\n", entry->d_name);
+        }
+    }
+    closedir(dir);
+}
 
-        char restored_file[MAX_SIZE_PATH];
-        snprintf(restored_file, sizeof(restored_file), "%s/%s", restore_dir, rel_path);
+/**
+ * @brief Liste les sauvegardes.
+ */
+void list_backups(const char *backup_dir) {
+    write_backup_list(backup_dir, stdout);
+}
 
-        {
-            char temp[2048];
-            strncpy(temp, restored_file, sizeof(temp));
-            char *p = strrchr(temp, '/');
-            if (p) {
-                *p = '\0';
-                if (dry_run_flag) {
-                    if (verbose_flag) {
-                        printf("[DRY-RUN] Création du répertoire %s pour restauration non réalisée\n", temp);
-                    }
-                } else {
-                    create_directory_local(temp);
+// Suppression de sauvegardes par --prune
+typedef struct {
+    const char *backup_dir;
+    string_pool_t *lowered; // emplacements dont des compteurs ont baissé : packs à compacter
+} prune_run_t;
+
+static void release_dedup(prune_run_t *run, const char *path, const char *location);
+
+/**
+ * @brief Rappel de refcount_add_refs : un pack dont plus aucun chunk n'est référencé est
+ * libéré, les autres emplacements dont des compteurs ont baissé seront compactés.
+ */
+static void release_location(const char *location, int released, void *ctx) {
+    prune_run_t *run = ctx;
+    if (!released) {
+        string_pool_intern(run->lowered, location);
+        return;
+    }
+    char pack_path[MAX_SIZE_PATH];
+    snprintf(pack_path, sizeof(pack_path), "%s/%s/%s.dedup", run->backup_dir, PACK_DIR, location);
+    if (access(pack_path, F_OK) == 0) {
+        release_dedup(run, pack_path, location);
+    }
+}
+
+/**
+ * @brief Retire un fichier .dedup d'une sauvegarde supprimée.
+ *
+ * Si des chunks de l'emplacement sont encore référencés, le fichier est déplacé dans
+ * PACK_DIR. Sinon il est supprimé ; s'il s'agissait du dernier lien vers ses données,
+ * ses propres références sont décrémentées, ce qui peut libérer d'autres packs.
+ */
+static void release_dedup(prune_run_t *run, const char *path, const char *location) {
+    const char *backup_dir = run->backup_dir;
+    struct stat st;
+    stats_add(STATS_METADATA_OPS, 1);
+    if (stat(path, &st) != 0) {
+        return;
+    }
+
+    char pack_path[MAX_SIZE_PATH];
+    snprintf(pack_path, sizeof(pack_path), "%s/%s/%s.dedup", backup_dir, PACK_DIR, location);
+    if (refcount_is_referenced(backup_dir, location)) {
+        if (strcmp(pack_path, path) != 0) {
+            make_parent_dirs(pack_path);
+            if (rename(path, pack_path) != 0) {
+                perror("Erreur de déplacement vers les packs");
+            } else {
+                // Ses chunks qui ne sont plus référencés peuvent être vidés
+                string_pool_intern(run->lowered, location);
+                if (verbose_flag) {
+                    printf("[INFO] Chunks encore référencés, fichier conservé : %s\n", pack_path);
                 }
             }
+            stats_add(STATS_METADATA_OPS, 1);
         }
+        return;
+    }
+
+    // Les autres liens durs (sauvegardes conservées) gardent les références vivantes
+    if (st.st_nlink == 1) {
+        refcount_add_file(backup_dir, path, -1, release_location, run);
+    }
+    unlink(path);
+    if (strcmp(pack_path, path) == 0) {
+        char packs_root[MAX_SIZE_PATH];
+        snprintf(packs_root, sizeof(packs_root), "%s/%s", backup_dir, PACK_DIR);
+        remove_empty_parents(path, packs_root);
+    }
+    stats_add(STATS_METADATA_OPS, 1);
+    stats_add(STATS_FILES_DELETED, 1);
+    if (verbose_flag) {
+        printf("[INFO] Fichier supprimé : %s\n", path);
+    }
+}
+
+/**
+ * @brief Supprime récursivement le répertoire d'une sauvegarde.
+ */
+static void delete_snapshot_tree(prune_run_t *run, const char *dir_path) {
+    DIR *dir = opendir(dir_path);
+    if (!dir) {
+        return;
+    }
+    const char *backup_dir = run->backup_dir;
+    size_t backup_dir_len = strlen(backup_dir);
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+        char path[MAX_SIZE_PATH];
+        snprintf(path, sizeof(path), "%s/%s", dir_path, entry->d_name);
+        struct stat st;
+        stats_add(STATS_METADATA_OPS, 1);
+        if (lstat(path, &st) != 0) {
+            continue;
+        }
+        size_t len = strlen(path);
+        if (S_ISDIR(st.st_mode)) {
+            delete_snapshot_tree(run, path);
+        } else if (len > backup_dir_len + 6 && strcmp(path + len - 6, ".dedup") == 0) {
+            char location[MAX_SIZE_PATH];
+            snprintf(location, sizeof(location), "%.*s", (int)(len - backup_dir_len - 1 - 6), path + backup_dir_len + 1);
+            release_dedup(run, path, location);
+        } else {
+            unlink(path);
+            stats_add(STATS_METADATA_OPS, 1);
+        }
+    }
+    closedir(dir);
+    rmdir(dir_path);
+    stats_add(STATS_METADATA_OPS, 1);
+}
 
-        write_restored_file(restored_file, chunks, chunk_count);
+/**
+ * @brief Compacte un pack : les chunks de données qui ne sont plus référencés sont vidés.
+ *
+ * Les index des chunks sont conservés (les références restent valides) ; les références
+ * externes du pack sont gardées telles quelles pour que les compteurs restent justes.
+ */
+static void compact_pack(const char *backup_dir, const char *path, const char *location) {
+    uint32_t *counts;
+    int count = refcount_load(backup_dir, location, &counts);
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        free(counts);
+        return;
+    }
+    DedupHeader header;
+    if (read_dedup_header(file, &header) != 0 || header.chunk_count <= 0) {
+        fclose(file);
+        free(counts);
+        return;
+    }
+    int chunk_count = header.chunk_count;
+    arena_t arena;
+    arena_init(&arena, 0);
+    Chunk *chunks = arena_calloc(&arena, chunk_count * sizeof(Chunk));
+    uint64_t total = 0, live = 0;
+    int read_count = 0;
+    for (; read_count < chunk_count; read_count++) {
+        Chunk *chunk = chunks + read_count;
+        if (fread(chunk->md5, 1, MD5_DIGEST_LENGTH, file) != MD5_DIGEST_LENGTH
+            || fread(&chunk->lenght, sizeof(size_t), 1, file) != 1
+            || CHUNK_LENGTH(chunk->lenght) > header.chunk_size) {
+            break;
+        }
+        chunk->data = arena_alloc(&arena, CHUNK_LENGTH(chunk->lenght));
+        if (fread(chunk->data, 1, CHUNK_LENGTH(chunk->lenght), file) != CHUNK_LENGTH(chunk->lenght)) {
+            break;
+        }
+        if (!(chunk->lenght & CHUNK_EXTERNAL_REF)) {
+            total += CHUNK_LENGTH(chunk->lenght);
+            if (read_count < count && counts[read_count] != 0) {
+                live += CHUNK_LENGTH(chunk->lenght);
+            }
+        }
+    }
+    fclose(file);
 
+    if (read_count == chunk_count && total > 0 && live * 100 < total * PACK_LIVE_THRESHOLD) {
         for (int i = 0; i < chunk_count; i++) {
-            free(chunks[i].data);
+            if (!(chunks[i].lenght & CHUNK_EXTERNAL_REF) && (i >= count || counts[i] == 0)) {
+                chunks[i].lenght = 0;
+            }
+        }
+        // Écriture à côté puis rename : une restauration en cours garde l'ancienne version
+        char tmp_path[MAX_SIZE_PATH + 8];
+        snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+        // Le pack garde la taille de chunks avec laquelle il a été écrit
+        write_dedup_file(tmp_path, chunks, chunk_count, header.chunk_size);
+        if (rename(tmp_path, path) != 0) {
+            perror("Erreur de remplacement du pack compacté");
+            unlink(tmp_path);
+        } else if (verbose_flag) {
+            printf("[INFO] Pack compacté : %s (%llu/%llu octets vivants)\n", path,
+                   (unsigned long long)live, (unsigned long long)total);
         }
-        free(chunks);
     }
+    arena_free(&arena);
+    free(counts);
 }
 
 /**
- * @brief Liste les sauvegardes.
+ * @brief Compacte les packs des emplacements dont des compteurs ont baissé pendant
+ * --prune, si la part de leurs données encore vivantes est trop faible.
  */
-void list_backups(const char *backup_dir) {
+static void compact_packs(const char *backup_dir, const string_pool_t *lowered) {
+    for (size_t i = 0; i < lowered->capacity; i++) {
+        const char *location = lowered->slots[i];
+        if (!location) {
+            continue;
+        }
+        char path[MAX_SIZE_PATH];
+        snprintf(path, sizeof(path), "%s/%s/%s.dedup", backup_dir, PACK_DIR, location);
+        struct stat st;
+        // Un pack encore lié dans une sauvegarde est restaurable en entier : on n'y touche pas
+        if (lstat(path, &st) == 0 && S_ISREG(st.st_mode) && st.st_nlink == 1) {
+            compact_pack(backup_dir, path, location);
+        }
+    }
+}
+
+static int compare_names_desc(const void *a, const void *b) {
+    return strcmp(*(const char **)b, *(const char **)a);
+}
+
+/**
+ * @brief Supprime les sauvegardes qui ne sont retenues par aucune règle de conservation.
+ */
+void prune_backups(const char *backup_dir, int keep_daily, int keep_weekly) {
     DIR *dir = opendir(backup_dir);
-    if (dir == NULL) {
+    if (!dir) {
         perror("Erreur pendant l'ouverture du dossier");
         return;
     }
+    TRACE_BEGIN("prune_backups", backup_dir);
+    uint64_t start = stats_now_ns();
+    char **names = NULL;
+    int count = 0;
     struct dirent *entry;
     while ((entry = readdir(dir)) != NULL) {
-        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
-            continue;
-        }
-        if (strcmp(entry->d_name, ".backup_log") == 0) {
+        if (entry->d_name[0] == '.') {
             continue;
         }
         char path[MAX_SIZE_PATH];
         snprintf(path, sizeof(path), "%s/%s", backup_dir, entry->d_name);
         struct stat st;
         if (stat(path, &st) == 0 && S_ISDIR(st.st_mode)) {
-            printf("%s\n", entry->d_name);
+            char **grown = realloc(names, (count + 1) * sizeof(char *));
+            if (!grown) {
+                break;
+            }
+            names = grown;
+            names[count++] = strdup(entry->d_name);
         }
     }
     closedir(dir);
+    qsort(names, count, sizeof(char *), compare_names_desc);
+
+    // Du plus récent au plus ancien : on garde la dernière sauvegarde de chacun des
+    // keep_daily derniers jours et de chacune des keep_weekly dernières semaines
+    int *keep = calloc(count ? count : 1, sizeof(int));
+    char last_day[16] = "", last_week[16] = "";
+    int days = 0, weeks = 0;
+    for (int i = 0; i < count; i++) {
+        struct tm tm_info = {0};
+        if (sscanf(names[i], "%4d-%2d-%2d", &tm_info.tm_year, &tm_info.tm_mon, &tm_info.tm_mday) != 3) {
+            keep[i] = 1; // nom inattendu : pas une sauvegarde créée par --backup
+            continue;
+        }
+        tm_info.tm_year -= 1900;
+        tm_info.tm_mon -= 1;
+        tm_info.tm_hour = 12;
+        tm_info.tm_isdst = -1;
+        mktime(&tm_info);
+        char day[16], week[16];
+        strftime(day, sizeof(day), "%Y-%m-%d", &tm_info);
+        strftime(week, sizeof(week), "%G-%V", &tm_info);
+        if (days < keep_daily && strcmp(day, last_day) != 0) {
+            keep[i] = 1;
+            days++;
+            strcpy(last_day, day);
+        }
+        if (weeks < keep_weekly && strcmp(week, last_week) != 0) {
+            keep[i] = 1;
+            weeks++;
+            strcpy(last_week, week);
+        }
+    }
+
+    // Les plus anciennes d'abord : leurs chunks encore utilisés passent dans les packs.
+    // Seuls les segments, packs et contenus stockés des sauvegardes supprimées sont revus
+    prune_run_t run = {.backup_dir = backup_dir, .lowered = string_pool_create()};
+    string_pool_t *deleted_names = string_pool_create();
+    string_pool_t *released_segments = string_pool_create();
+    int ready = run.lowered && deleted_names && released_segments;
+    if (!ready) {
+        fprintf(stderr, "Erreur : mémoire insuffisante pour --prune\n");
+    } else if (!dry_run_flag) {
+        segment_refs_init(backup_dir);
+    }
+    int deleted = 0;
+    for (int i = ready ? count - 1 : -1; i >= 0; i--) {
+        if (keep[i]) {
+            if (verbose_flag) {
+                printf("[INFO] Sauvegarde conservée : %s\n", names[i]);
+            }
+            continue;
+        }
+        char path[MAX_SIZE_PATH];
+        snprintf(path, sizeof(path), "%s/%s", backup_dir, names[i]);
+        if (dry_run_flag) {
+            if (verbose_flag) {
+                printf("[DRY-RUN] Suppression de la sauvegarde %s non réalisée\n", path);
+            }
+            continue;
+        }
+        TRACE_BEGIN("delete_snapshot", names[i]);
+        char log_path[MAX_SIZE_PATH + sizeof("/.backup_log")];
+        snprintf(log_path, sizeof(log_path), "%s/.backup_log", path);
+        segment_refs_add(backup_dir, log_path, -1, released_segments);
+        delete_snapshot_tree(&run, path);
+        TRACE_END("delete_snapshot");
+        string_pool_intern(deleted_names, names[i]);
+        deleted++;
+        if (verbose_flag) {
+            printf("[INFO] Sauvegarde supprimée : %s\n", names[i]);
+        }
+    }
+    stats_phase_end(STATS_PHASE_DELETE, start);
+
+    // Les résumés des sauvegardes supprimées sont retirés
+    char summary_path[MAX_SIZE_PATH];
+    snprintf(summary_path, sizeof(summary_path), "%s/%s", backup_dir, SUMMARY_FILE);
+    backup_summary *summaries;
+    int summary_count = read_backup_summaries(summary_path, &summaries);
+    if (deleted > 0 && summary_count > 0) {
+        int kept = 0;
+        for (int i = 0; i < summary_count; i++) {
+            const char *key = summaries[i].name;
+            char **found = bsearch(&key, names, count, sizeof(char *), compare_names_desc);
+            if (!found || keep[found - names]) {
+                summaries[kept++] = summaries[i];
+            }
+        }
+        write_backup_summaries(summary_path, summaries, kept);
+    }
+    free(summaries);
+
+    for (int i = 0; i < count; i++) {
+        free(names[i]);
+    }
+    free(names);
+    free(keep);
+
+    if (deleted > 0) {
+        string_pool_t *removed_segments = string_pool_create();
+        int segments_removed = segment_sweep(backup_dir, released_segments, removed_segments);
+        if (verbose_flag && segments_removed > 0) {
+            printf("[INFO] %d segments de petits fichiers supprimés\n", segments_removed);
+        }
+        if (removed_segments) {
+            int digests_removed = file_digest_sweep(backup_dir, deleted_names, removed_segments);
+            if (verbose_flag && digests_removed > 0) {
+                printf("[INFO] %d contenus stockés oubliés\n", digests_removed);
+            }
+            string_pool_free(removed_segments);
+        }
+        // Le compactage n'est pas nécessaire à la cohérence du dépôt : il tourne dans un
+        // processus fils pour que --prune rende la main dès les suppressions faites
+        if (run.lowered->count > 0) {
+            fflush(NULL);
+            pid_t pid = fork();
+            if (pid == 0) {
+                compact_packs(backup_dir, run.lowered);
+                _exit(EXIT_SUCCESS);
+            } else if (pid < 0) {
+                compact_packs(backup_dir, run.lowered);
+            } else if (verbose_flag) {
+                printf("[INFO] Compactage des packs en arrière-plan (pid %d)\n", (int)pid);
+            }
+        }
+    }
+    string_pool_free(run.lowered);
+    string_pool_free(deleted_names);
+    string_pool_free(released_segments);
+    TRACE_END("prune_backups");
 }
@@ -14,21 +14,84 @@
 #include <unistd.h>
 #include <openssl/md5.h>
 
+// Fichier des résumés de sauvegarde, à la racine du répertoire de sauvegarde
+#define SUMMARY_FILE ".backup_summaries"
+// Préfixe du répertoire où une sauvegarde est préparée avant d'être renommée
+// avec son horodatage (ignoré, comme tout nom commençant par '.', par les autres actions)
+#define STAGING_PREFIX ".staging-"
+// Point de reprise d'une sauvegarde en préparation : entrées des fichiers terminés,
+// au format du .backup_log, dont les données ont été rendues durables
+#define CHECKPOINT_FILE ".checkpoint"
+// Intervalle par défaut en secondes entre deux points de reprise
+#define CHECKPOINT_INTERVAL 30
+// Paramètres du dépôt, à la racine du répertoire de sauvegarde : "chunk_size=N", écrit à la
+// première sauvegarde. Un dépôt qui a déjà des sauvegardes sans ce fichier a des chunks
+// de CHUNK_DEFAULT_SIZE octets.
+#define REPOSITORY_FILE ".repository"
+// Pendant le parcours de la source, le début des SCAN_READAHEAD_FILES fichiers suivants
+// (au plus SCAN_READAHEAD_BYTES octets chacun) est lu à l'avance
+#define SCAN_READAHEAD_FILES 8
+#define SCAN_READAHEAD_BYTES (4 * 1024 * 1024)
+// Plus petite valeur acceptée par --memory-limit
+#define BACKUP_MIN_MEMORY_LIMIT (16 * 1024 * 1024)
+
+/**
+ * @brief Lit la taille des chunks du dépôt et la passe à set_chunk_size.
+ *
+ * Un dépôt sans sauvegarde prend chunk_size (CHUNK_DEFAULT_SIZE si 0) ; REPOSITORY_FILE
+ * est écrit par create_backup.
+ *
+ * @param backup_dir Chemin du répertoire de sauvegarde.
+ * @param chunk_size Taille demandée par --chunk-size (0 : celle du dépôt).
+ * @return 0, ou -1 si REPOSITORY_FILE est illisible ou si le dépôt a une autre taille.
+ */
+int open_repository(const char *backup_dir, size_t chunk_size);
+
+/**
+ * @brief Borne la mémoire des listes de fichiers de create_backup (--memory-limit).
+ *
+ * Avec une limite, les fichiers de la source sont rangés dans un manifeste trié par chemin
+ * (runs sur disque au-delà de la moitié de la limite) puis sauvegardés dans cet ordre, en
+ * fusion avec l'index de la sauvegarde précédente lu au fil de l'eau ; les entrées du nouveau
+ * .backup_log sont écrites par lots. Les fichiers ne sont alors plus lus dans l'ordre du
+ * disque, et le journal de --watch n'est pas utilisé.
+ *
+ * @param bytes Mémoire en octets (0 : pas de limite, tout est gardé en mémoire).
+ */
+void backup_set_memory_limit(size_t bytes);
+
+/**
+ * @brief Règle l'intervalle entre deux points de reprise de create_backup.
+ *
+ * @param seconds Intervalle en secondes (CHECKPOINT_INTERVAL par défaut, 0 : après chaque fichier).
+ */
+void backup_set_checkpoint_interval(unsigned int seconds);
+
 /**
  * @brief Crée une nouvelle sauvegarde incrémentale du répertoire source dans le répertoire de backup.
  *
  * Cette fonction :
  * - Vérifie si c'est la première sauvegarde ou non (via .backup_log).
- * - Crée un répertoire horodaté pour la nouvelle sauvegarde.
- * - Si ce n'est pas la première sauvegarde, duplique la dernière en créant des liens durs.
+ * - Inscrit la taille des chunks dans REPOSITORY_FILE s'il n'existe pas encore.
+ * - Crée un répertoire de préparation (STAGING_PREFIX suivi de l'horodatage).
+ * - Si ce n'est pas la première sauvegarde, y duplique la dernière en créant des liens durs.
  * - Parcourt le répertoire source, déduplique ou lie les fichiers inchangés, crée les répertoires manquants.
  * - Supprime les fichiers/répertoires qui n'existent plus dans la source.
- * - Met à jour le fichier .backup_log et le copie dans la nouvelle sauvegarde.
+ * - Écrit le .backup_log de la nouvelle sauvegarde, rend le tout durable en un seul syncfs
+ *   puis renomme le répertoire de préparation avec son horodatage.
+ * - Met à jour le fichier .backup_log à la racine.
+ *
+ * Un arrêt brutal avant le renommage laisse un répertoire de préparation, supprimé par
+ * la sauvegarde suivante : la dernière sauvegarde horodatée est toujours complète.
+ * Toutes les CHECKPOINT_INTERVAL secondes, les fichiers terminés sont ajoutés au point de
+ * reprise ; avec resume, la sauvegarde interrompue la plus récente est reprise : ses fichiers
+ * terminés et de même date ne sont pas relus, les autres sont refaits.
  *
  * @param source_dir Chemin du répertoire source à sauvegarder.
  * @param backup_dir Chemin du répertoire de destination des sauvegardes.
+ * @param resume Reprendre la dernière sauvegarde interrompue plutôt que la supprimer.
  */
-void create_backup(const char *source_dir, const char *backup_dir);
+void create_backup(const char *source_dir, const char *backup_dir, int resume);
 
 /**
  * @brief Restaure une sauvegarde depuis un répertoire de backup vers un répertoire destination.
@@ -39,8 +102,12 @@ void create_backup(const char *source_dir, const char *backup_dir);
  *
  * @param backup_id Chemin vers le répertoire de la sauvegarde.
  * @param restore_dir Chemin vers le répertoire où restaurer les fichiers.
+ * @param jobs Nombre de threads de restauration.
+ * @param cache_size Taille en octets du cache de chunks partagé par les threads (0 : pas de cache).
+ * @param path_prefix Fichier ou répertoire à restaurer, relatif à la sauvegarde (NULL : tout).
  */
-void restore_backup(const char *backup_id, const char *restore_dir);
+void restore_backup(const char *backup_id, const char *restore_dir, int jobs, size_t cache_size,
+                    const char *path_prefix);
 
 /**
  * @brief Écrit dans un fichier de backup dédupliqué le tableau de chunks.
@@ -74,4 +141,39 @@ void write_restored_file(const char *output_filename, Chunk *chunks, int chunk_c
  */
 void list_backups(const char *backup_dir);
 
+/**
+ * @brief Écrit la liste des sauvegardes avec leur résumé (fichiers, taille, octets stockés,
+ * durée, ratio de déduplication) dans out.
+ *
+ * @param backup_dir Chemin du répertoire contenant les sauvegardes.
+ * @param out Flux de sortie (stdout ou socket du client).
+ */
+void write_backup_list(const char *backup_dir, FILE *out);
+
+/**
+ * @brief Ouvre l'image .dedup d'une entrée de .backup_log : dans son segment pour un petit
+ * fichier, sinon le fichier snapshot_path/chemin.dedup.
+ */
+FILE *open_entry_dedup(const char *backup_dir, const char *snapshot_path, const log_element *elt);
+
+/**
+ * @brief Écrit une taille en octets avec l'unité la plus adaptée (ex. "12.3 Mo").
+ */
+void format_size(unsigned long long bytes, char *buffer, size_t size);
+
+/**
+ * @brief Supprime les sauvegardes qui ne sont retenues par aucune règle de conservation.
+ *
+ * Sont conservées la dernière sauvegarde de chacun des keep_daily derniers jours et de chacune
+ * des keep_weekly dernières semaines. Le coût dépend de la taille des sauvegardes supprimées :
+ * seuls leurs fichiers .dedup sont lus, pour décrémenter les compteurs de références tenus à
+ * jour par create_backup. Les fichiers dont des chunks sont encore référencés sont déplacés dans
+ * PACK_DIR ; les packs peu remplis sont ensuite compactés en arrière-plan.
+ *
+ * @param backup_dir Chemin du répertoire contenant les sauvegardes.
+ * @param keep_daily Nombre de jours à conserver.
+ * @param keep_weekly Nombre de semaines à conserver.
+ */
+void prune_backups(const char *backup_dir, int keep_daily, int keep_weekly);
+
 #endif // BACKUP_MANAGER_H
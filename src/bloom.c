@@ -0,0 +1,64 @@
+#include "bloom.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define BLOOM_BLOCK_WORDS (BLOOM_BLOCK_BITS / 64)
+
+int bloom_init(bloom_t *bloom, size_t expected) {
+    bloom->block_count = (expected * BLOOM_BITS_PER_ENTRY + BLOOM_BLOCK_BITS - 1) / BLOOM_BLOCK_BITS;
+    if (bloom->block_count == 0) {
+        bloom->block_count = 1;
+    }
+    size_t size = bloom->block_count * BLOOM_BLOCK_BITS / 8;
+    // Blocs alignés sur les lignes de cache
+    bloom->words = aligned_alloc(BLOOM_BLOCK_BITS / 8, size);
+    if (!bloom->words) {
+        bloom->block_count = 0;
+        return -1;
+    }
+    memset(bloom->words, 0, size);
+    return 0;
+}
+
+/**
+ * @brief Bloc de la clé : h1 ramené à [0, block_count) par multiplication plutôt que modulo.
+ */
+static inline uint64_t *block_of(const bloom_t *bloom, uint64_t h1) {
+    size_t block = (size_t)(((unsigned __int128)h1 * bloom->block_count) >> 64);
+    return bloom->words + block * BLOOM_BLOCK_WORDS;
+}
+
+void bloom_add(bloom_t *bloom, uint64_t h1, uint64_t h2) {
+    uint64_t *block = block_of(bloom, h1);
+    // Double hachage dans le bloc : bits h2 + i * pas
+    uint64_t step = (h2 >> 32) | 1;
+    for (int i = 0; i < BLOOM_HASHES; i++) {
+        unsigned bit = (unsigned)((h2 + i * step) % BLOOM_BLOCK_BITS);
+        block[bit / 64] |= 1ULL << (bit % 64);
+    }
+}
+
+int bloom_may_contain(const bloom_t *bloom, uint64_t h1, uint64_t h2) {
+    if (bloom->block_count == 0) {
+        return 0;
+    }
+    const uint64_t *block = block_of(bloom, h1);
+    uint64_t step = (h2 >> 32) | 1;
+    for (int i = 0; i < BLOOM_HASHES; i++) {
+        unsigned bit = (unsigned)((h2 + i * step) % BLOOM_BLOCK_BITS);
+        if (!(block[bit / 64] & (1ULL << (bit % 64)))) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+size_t bloom_size(const bloom_t *bloom) {
+    return bloom->block_count * BLOOM_BLOCK_BITS / 8;
+}
+
+void bloom_free(bloom_t *bloom) {
+    free(bloom->words);
+    bloom->words = NULL;
+    bloom->block_count = 0;
+}
@@ -0,0 +1,29 @@
+#ifndef BLOOM_H
+#define BLOOM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Filtre de Bloom par blocs : chaque clé choisit un bloc de BLOOM_BLOCK_BITS bits (une ligne
+// de cache) puis y positionne BLOOM_HASHES bits, si bien qu'une recherche ne lit qu'un bloc.
+// Avec BLOOM_BITS_PER_ENTRY bits par clé, environ 1 % de faux positifs.
+#define BLOOM_BLOCK_BITS 512
+#define BLOOM_HASHES 7
+#define BLOOM_BITS_PER_ENTRY 10
+
+typedef struct {
+    uint64_t *words;
+    size_t block_count;
+} bloom_t;
+
+// Crée un filtre vide dimensionné pour expected clés ; -1 si la mémoire manque
+int bloom_init(bloom_t *bloom, size_t expected);
+// Une clé est donnée par deux hachages indépendants de 64 bits (ex. les deux moitiés d'un MD5)
+void bloom_add(bloom_t *bloom, uint64_t h1, uint64_t h2);
+// 0 si la clé n'a jamais été ajoutée, 1 si elle l'a peut-être été
+int bloom_may_contain(const bloom_t *bloom, uint64_t h1, uint64_t h2);
+// Taille du filtre en octets
+size_t bloom_size(const bloom_t *bloom);
+void bloom_free(bloom_t *bloom);
+
+#endif // BLOOM_H
@@ -0,0 +1,482 @@
+#include "check.h"
+#include "backup_manager.h"
+#include "deduplication.h"
+#include "file_handler.h"
+#include "refcount.h"
+#include "segment.h"
+#include "stats.h"
+#include "trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#define MAX_SIZE_PATH 2048
+
+extern int verbose_flag;
+
+// Un fichier .dedup à vérifier (un seul par inode : les liens durs partagent les données)
+typedef struct {
+    char *path;
+    dev_t dev;
+    ino_t ino;
+    uint64_t disk_offset; // position du premier bloc sur le disque (ou numéro d'inode)
+} check_file_t;
+
+// Image .dedup d'un petit fichier rangée dans un segment
+typedef struct {
+    char *segment;
+    uint64_t offset;
+    uint32_t length;
+    char *entry; // entrée du .backup_log, pour le rapport
+} check_packed_t;
+
+typedef struct {
+    const char *backup_dir;
+    check_packed_t *packed;
+    int packed_count;
+    int packed_capacity;
+    check_file_t *files;
+    int file_count;
+    int next_file; // prochain fichier à prendre (incrémenté atomiquement)
+    uint64_t chunks_checked;
+    int problems;
+    pthread_mutex_t report_lock;
+} check_context_t;
+
+// Tailles des chunks du dernier fichier désigné par une référence externe (une par thread)
+typedef struct {
+    char *location;
+    size_t *lengths;
+    int count;
+} ref_target_cache_t;
+
+static void report(check_context_t *ctx, const char *path, int chunk, const char *reason) {
+    pthread_mutex_lock(&ctx->report_lock);
+    if (chunk >= 0) {
+        printf("[CORROMPU] %s : chunk %d, %s\n", path, chunk, reason);
+    } else {
+        printf("[CORROMPU] %s : %s\n", path, reason);
+    }
+    ctx->problems++;
+    pthread_mutex_unlock(&ctx->report_lock);
+}
+
+/**
+ * @brief Générateur pseudo-aléatoire pour --sample (splitmix64).
+ */
+static uint64_t next_random(uint64_t *state) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static int sampled(uint64_t *state, double sample_percent) {
+    return sample_percent >= 100.0 || (next_random(state) % 1000000) < sample_percent * 10000.0;
+}
+
+static int append_file(check_file_t **files, int *count, int *capacity, const char *path, const struct stat *st) {
+    if (*count == *capacity) {
+        *capacity = *capacity ? *capacity * 2 : 256;
+        check_file_t *grown = realloc(*files, *capacity * sizeof(check_file_t));
+        if (!grown) {
+            return -1;
+        }
+        *files = grown;
+    }
+    check_file_t *file = *files + (*count)++;
+    file->path = strdup(path);
+    file->dev = st->st_dev;
+    file->ino = st->st_ino;
+    file->disk_offset = 0;
+    return 0;
+}
+
+/**
+ * @brief Ajoute à files tous les .dedup sous dir_path (les compteurs de références sont ignorés).
+ */
+static void collect_dedup_files(const char *dir_path, check_file_t **files, int *count, int *capacity) {
+    DIR *dir = opendir(dir_path);
+    if (!dir) {
+        return;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0
+            || strcmp(entry->d_name, REFCOUNT_DIR) == 0 || strcmp(entry->d_name, SEGMENT_DIR) == 0
+            || strncmp(entry->d_name, STAGING_PREFIX, strlen(STAGING_PREFIX)) == 0) {
+            // Une sauvegarde en préparation n'est pas encore validée
+            continue;
+        }
+        char path[MAX_SIZE_PATH];
+        snprintf(path, sizeof(path), "%s/%s", dir_path, entry->d_name);
+        struct stat st;
+        stats_add(STATS_METADATA_OPS, 1);
+        if (lstat(path, &st) != 0) {
+            continue;
+        }
+        size_t len = strlen(path);
+        if (S_ISDIR(st.st_mode)) {
+            collect_dedup_files(path, files, count, capacity);
+        } else if (S_ISREG(st.st_mode) && len > 6 && strcmp(path + len - 6, ".dedup") == 0) {
+            append_file(files, count, capacity, path, &st);
+        }
+    }
+    closedir(dir);
+}
+
+static int compare_inode(const void *a, const void *b) {
+    const check_file_t *fa = a, *fb = b;
+    if (fa->dev != fb->dev) {
+        return fa->dev < fb->dev ? -1 : 1;
+    }
+    return fa->ino < fb->ino ? -1 : (fa->ino > fb->ino);
+}
+
+static int compare_disk_offset(const void *a, const void *b) {
+    const check_file_t *fa = a, *fb = b;
+    if (fa->dev != fb->dev) {
+        return fa->dev < fb->dev ? -1 : 1;
+    }
+    return fa->disk_offset < fb->disk_offset ? -1 : (fa->disk_offset > fb->disk_offset);
+}
+
+/**
+ * @brief Lit les tailles (drapeaux compris) des chunks d'un .dedup, sans leurs données.
+ */
+static int read_chunk_lengths(const char *path, size_t **lengths) {
+    *lengths = NULL;
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        return -1;
+    }
+    DedupHeader header;
+    if (read_dedup_header(file, &header) != 0) {
+        fclose(file);
+        return -1;
+    }
+    int chunk_count = header.chunk_count;
+    *lengths = malloc((chunk_count ? chunk_count : 1) * sizeof(size_t));
+    int i = 0;
+    for (; i < chunk_count; i++) {
+        unsigned char md5[MD5_DIGEST_LENGTH];
+        if (fread(md5, 1, MD5_DIGEST_LENGTH, file) != MD5_DIGEST_LENGTH
+            || fread(*lengths + i, sizeof(size_t), 1, file) != 1
+            || CHUNK_LENGTH((*lengths)[i]) > header.chunk_size) {
+            break;
+        }
+        fseek(file, (long)CHUNK_LENGTH((*lengths)[i]), SEEK_CUR);
+    }
+    fclose(file);
+    return i;
+}
+
+/**
+ * @brief Vrai si la référence externe désigne un chunk de données existant.
+ */
+static int external_ref_resolves(check_context_t *ctx, ref_target_cache_t *cache, const char *location,
+                                 unsigned int index) {
+    if (!cache->location || strcmp(cache->location, location) != 0) {
+        free(cache->location);
+        free(cache->lengths);
+        cache->location = strdup(location);
+        cache->lengths = NULL;
+        cache->count = 0;
+        char path[MAX_SIZE_PATH];
+        if (locate_dedup_file(ctx->backup_dir, location, path, sizeof(path)) == 0) {
+            cache->count = read_chunk_lengths(path, &cache->lengths);
+        }
+        if (cache->count < 0) {
+            cache->count = 0;
+        }
+    }
+    return index < (unsigned int)cache->count
+           && !(cache->lengths[index] & (CHUNK_EXTERNAL_REF | CHUNK_ZERO_RUN))
+           && cache->lengths[index] > 0;
+}
+
+/**
+ * @brief Relit une image .dedup depuis la position courante de file et vérifie chacun
+ * de ses chunks ; path nomme l'image dans les rapports.
+ * @return Le nombre d'octets de l'image lus.
+ */
+static uint64_t check_stream(check_context_t *ctx, FILE *file, const char *path, ref_target_cache_t *cache) {
+    DedupHeader header;
+    if (read_dedup_header(file, &header) != 0) {
+        report(ctx, path, -1, "en-tête invalide");
+        return 0;
+    }
+    int chunk_count = header.chunk_count;
+
+    unsigned char (*md5s)[MD5_DIGEST_LENGTH] = malloc((chunk_count ? chunk_count : 1) * MD5_DIGEST_LENGTH);
+    unsigned char *data = malloc(header.chunk_size);
+    uint64_t bytes = header.header_size;
+    for (int i = 0; i < chunk_count; i++) {
+        size_t size;
+        if (fread(md5s[i], 1, MD5_DIGEST_LENGTH, file) != MD5_DIGEST_LENGTH
+            || fread(&size, sizeof(size_t), 1, file) != 1
+            || CHUNK_LENGTH(size) > header.chunk_size
+            || fread(data, 1, CHUNK_LENGTH(size), file) != CHUNK_LENGTH(size)) {
+            report(ctx, path, i, "fichier tronqué");
+            break;
+        }
+        size_t len = CHUNK_LENGTH(size);
+        bytes += MD5_DIGEST_LENGTH + sizeof(size_t) + len;
+        __atomic_fetch_add(&ctx->chunks_checked, 1, __ATOMIC_RELAXED);
+
+        if (size & CHUNK_EXTERNAL_REF) {
+            Chunk ref = {.data = data, .lenght = size};
+            unsigned int index;
+            const char *location;
+            if (parse_external_ref(&ref, &index, &location) != 0) {
+                report(ctx, path, i, "référence externe illisible");
+            } else if (!external_ref_resolves(ctx, cache, location, index)) {
+                report(ctx, path, i, "référence externe vers un chunk introuvable");
+            }
+            continue;
+        }
+        if (len == 0) {
+            continue; // suite de zéros, ou chunk vidé par le compactage d'un pack
+        }
+        unsigned char computed[MD5_DIGEST_LENGTH];
+        compute_md5(data, len, computed);
+        stats_add(STATS_BYTES_HASHED, len);
+        if (memcmp(computed, md5s[i], MD5_DIGEST_LENGTH) == 0) {
+            continue;
+        }
+        // Un chunk de 4 octets au MD5 différent est une référence vers un chunk précédent
+        unsigned int target;
+        memcpy(&target, data, sizeof(unsigned int));
+        if (len != sizeof(unsigned int)) {
+            report(ctx, path, i, "MD5 différent de celui enregistré");
+        } else if (target >= (unsigned int)i || memcmp(md5s[target], md5s[i], MD5_DIGEST_LENGTH) != 0) {
+            report(ctx, path, i, "référence interne invalide ou MD5 différent");
+        }
+    }
+    stats_add(STATS_BYTES_READ, bytes);
+    free(data);
+    free(md5s);
+    return bytes;
+}
+
+/**
+ * @brief Relit un fichier .dedup et vérifie chacun de ses chunks.
+ */
+static void check_file(check_context_t *ctx, const char *path, ref_target_cache_t *cache) {
+    TRACE_BEGIN("check_file", path);
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        report(ctx, path, -1, "illisible");
+        TRACE_END("check_file");
+        return;
+    }
+    check_stream(ctx, file, path, cache);
+    fclose(file);
+    TRACE_END("check_file");
+}
+
+static int compare_packed(const void *a, const void *b) {
+    const check_packed_t *pa = a, *pb = b;
+    int cmp = strcmp(pa->segment, pb->segment);
+    if (cmp != 0) {
+        return cmp;
+    }
+    return pa->offset < pb->offset ? -1 : (pa->offset > pb->offset);
+}
+
+/**
+ * @brief Vérifie les images des petits fichiers, une seule fois chacune (une image est
+ * citée par toutes les sauvegardes où le fichier n'a pas changé), dans l'ordre des segments.
+ * @return Le nombre d'images vérifiées.
+ */
+static int check_packed_entries(check_context_t *ctx) {
+    qsort(ctx->packed, ctx->packed_count, sizeof(check_packed_t), compare_packed);
+    ref_target_cache_t cache = {0};
+    FILE *file = NULL;
+    const char *open_segment = NULL;
+    int checked = 0;
+    for (int i = 0; i < ctx->packed_count; i++) {
+        check_packed_t *packed = &ctx->packed[i];
+        if (i > 0 && compare_packed(&ctx->packed[i - 1], packed) == 0) {
+            continue;
+        }
+        char label[MAX_SIZE_PATH + 64];
+        snprintf(label, sizeof(label), "%s/%s:%llu (%s)", SEGMENT_DIR, packed->segment,
+                 (unsigned long long)packed->offset, packed->entry);
+        if (!open_segment || strcmp(open_segment, packed->segment) != 0) {
+            if (file) {
+                fclose(file);
+            }
+            file = segment_open(ctx->backup_dir, packed->segment, 0);
+            open_segment = packed->segment;
+        }
+        if (!file || fseeko(file, (off_t)packed->offset, SEEK_SET) != 0) {
+            report(ctx, label, -1, "segment illisible");
+            continue;
+        }
+        checked++;
+        if (check_stream(ctx, file, label, &cache) != packed->length) {
+            report(ctx, label, -1, "taille différente de celle du .backup_log");
+        }
+    }
+    if (file) {
+        fclose(file);
+    }
+    free(cache.location);
+    free(cache.lengths);
+    return checked;
+}
+
+static void *check_worker(void *arg) {
+    check_context_t *ctx = arg;
+    ref_target_cache_t cache = {0};
+    int i;
+    // Chaque thread prend le fichier suivant dans l'ordre du disque : la lecture reste séquentielle
+    while ((i = __atomic_fetch_add(&ctx->next_file, 1, __ATOMIC_RELAXED)) < ctx->file_count) {
+        check_file(ctx, ctx->files[i].path, &cache);
+    }
+    free(cache.location);
+    free(cache.lengths);
+    return NULL;
+}
+
+/**
+ * @brief Vérifie que chaque entrée du .backup_log d'une sauvegarde a son fichier .dedup.
+ */
+static void check_snapshot_log(check_context_t *ctx, const char *snapshot, uint64_t *random_state,
+                               double sample_percent) {
+    char log_path[MAX_SIZE_PATH];
+    snprintf(log_path, sizeof(log_path), "%s/%s/.backup_log", ctx->backup_dir, snapshot);
+    if (access(log_path, F_OK) != 0) {
+        return; // sauvegarde antérieure à la copie du .backup_log dans chaque sauvegarde
+    }
+    log_t logs = read_backup_log(log_path);
+    for (log_element *elt = logs.head; elt; elt = elt->next) {
+        const char *sep = strchr(elt->path, '/');
+        // Un seul tirage par entrée, qu'elle soit rangée dans un segment ou dans un .dedup
+        if (!sep || !sampled(random_state, sample_percent)) {
+            continue;
+        }
+        if (elt->segment) {
+            // Petit fichier : son image est vérifiée avec celles des autres sauvegardes
+            if (ctx->packed_count == ctx->packed_capacity) {
+                int capacity = ctx->packed_capacity ? ctx->packed_capacity * 2 : 256;
+                check_packed_t *grown = realloc(ctx->packed, capacity * sizeof(check_packed_t));
+                if (!grown) {
+                    continue;
+                }
+                ctx->packed = grown;
+                ctx->packed_capacity = capacity;
+            }
+            check_packed_t *packed = &ctx->packed[ctx->packed_count++];
+            packed->segment = strdup(elt->segment);
+            packed->offset = elt->offset;
+            packed->length = elt->length;
+            packed->entry = strdup(elt->path);
+        } else {
+            char dedup_path[MAX_SIZE_PATH];
+            snprintf(dedup_path, sizeof(dedup_path), "%s/%s/%s.dedup", ctx->backup_dir, snapshot, sep + 1);
+            struct stat st;
+            stats_add(STATS_METADATA_OPS, 1);
+            if (stat(dedup_path, &st) != 0) {
+                char reason[MAX_SIZE_PATH + 32];
+                snprintf(reason, sizeof(reason), "entrée %s sans fichier .dedup", elt->path);
+                report(ctx, log_path, -1, reason);
+            }
+        }
+    }
+    free_backup_log(&logs);
+}
+
+int check_backups(const char *backup_dir, int jobs, double sample_percent) {
+    DIR *dir = opendir(backup_dir);
+    if (!dir) {
+        perror("Erreur pendant l'ouverture du dossier");
+        return -1;
+    }
+    TRACE_BEGIN("check_backups", backup_dir);
+    check_context_t ctx = {0};
+    ctx.backup_dir = backup_dir;
+    pthread_mutex_init(&ctx.report_lock, NULL);
+    uint64_t random_state = (uint64_t)time(NULL) ^ ((uint64_t)getpid() << 32);
+
+    // 1. Entrées des .backup_log de chaque sauvegarde
+    struct dirent *entry;
+    int snapshots = 0;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+        check_snapshot_log(&ctx, entry->d_name, &random_state, sample_percent);
+        snapshots++;
+    }
+    closedir(dir);
+
+    // 2. Images des petits fichiers rangées dans les segments
+    int packed_checked = check_packed_entries(&ctx);
+
+    // 3. Fichiers .dedup : un par inode, échantillonnés, triés dans l'ordre du disque
+    check_file_t *files = NULL;
+    int count = 0, capacity = 0;
+    collect_dedup_files(backup_dir, &files, &count, &capacity);
+    qsort(files, count, sizeof(check_file_t), compare_inode);
+    int kept = 0;
+    for (int i = 0; i < count; i++) {
+        int duplicate = kept > 0 && files[kept - 1].dev == files[i].dev && files[kept - 1].ino == files[i].ino;
+        if (duplicate || !sampled(&random_state, sample_percent)) {
+            free(files[i].path);
+            continue;
+        }
+        files[kept] = files[i];
+        files[kept].disk_offset = file_disk_offset(files[kept].path, files[kept].ino);
+        kept++;
+    }
+    qsort(files, kept, sizeof(check_file_t), compare_disk_offset);
+    ctx.files = files;
+    ctx.file_count = kept;
+
+    if (jobs < 1) {
+        jobs = 1;
+    }
+    if (jobs > kept) {
+        jobs = kept > 0 ? kept : 1;
+    }
+    pthread_t *threads = malloc(jobs * sizeof(pthread_t));
+    int started = 0;
+    for (; started < jobs; started++) {
+        if (pthread_create(&threads[started], NULL, check_worker, &ctx) != 0) {
+            break;
+        }
+    }
+    if (started == 0) {
+        check_worker(&ctx);
+    }
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+
+    printf("Vérification de %s : %d sauvegardes, %d fichiers .dedup, %d petits fichiers, %llu chunks (%.0f %%), %d problème(s)\n",
+           backup_dir, snapshots, kept, packed_checked, (unsigned long long)ctx.chunks_checked,
+           sample_percent >= 100.0 ? 100.0 : sample_percent, ctx.problems);
+
+    for (int i = 0; i < kept; i++) {
+        free(files[i].path);
+    }
+    free(files);
+    for (int i = 0; i < ctx.packed_count; i++) {
+        free(ctx.packed[i].segment);
+        free(ctx.packed[i].entry);
+    }
+    free(ctx.packed);
+    pthread_mutex_destroy(&ctx.report_lock);
+    TRACE_END("check_backups");
+    return ctx.problems;
+}
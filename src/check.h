@@ -0,0 +1,20 @@
+#ifndef CHECK_H
+#define CHECK_H
+
+/**
+ * @brief Vérifie l'intégrité d'un répertoire de sauvegarde.
+ *
+ * Chaque fichier .dedup (des sauvegardes et des packs, une seule fois par inode) est relu
+ * dans l'ordre de son emplacement sur le disque par jobs threads : le MD5 de chaque chunk
+ * de données est recalculé et comparé à celui enregistré, les références internes et
+ * externes doivent désigner un chunk existant. Chaque entrée des .backup_log des
+ * sauvegardes doit correspondre à un fichier .dedup.
+ *
+ * @param backup_dir Chemin du répertoire contenant les sauvegardes.
+ * @param jobs Nombre de threads de vérification.
+ * @param sample_percent Pourcentage des fichiers et entrées vérifiés (100 : tout).
+ * @return Le nombre de problèmes trouvés, -1 si le répertoire n'a pas pu être lu.
+ */
+int check_backups(const char *backup_dir, int jobs, double sample_percent);
+
+#endif // CHECK_H
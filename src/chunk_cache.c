@@ -0,0 +1,158 @@
+#include "chunk_cache.h"
+#include "deduplication.h"
+#include "stats.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+// Le premier octet du MD5 choisit le sous-cache, les suivants la case de la table
+static chunk_cache_shard *shard_of(chunk_cache_t *cache, const unsigned char *md5) {
+    return &cache->shards[md5[0] % CHUNK_CACHE_SHARDS];
+}
+
+static size_t bucket_of(const chunk_cache_shard *shard, const unsigned char *md5) {
+    uint64_t key;
+    memcpy(&key, md5 + 1, sizeof(key));
+    return key & shard->bucket_mask;
+}
+
+chunk_cache_t *chunk_cache_create(size_t max_bytes) {
+    if (max_bytes == 0) {
+        return NULL;
+    }
+    chunk_cache_t *cache = calloc(1, sizeof(chunk_cache_t));
+    if (!cache) {
+        return NULL;
+    }
+    size_t shard_bytes = max_bytes / CHUNK_CACHE_SHARDS;
+    // Une case par chunk plein que le sous-cache peut contenir
+    size_t buckets = 64;
+    while (buckets < shard_bytes / CHUNK_MIN_SIZE) {
+        buckets *= 2;
+    }
+    for (int i = 0; i < CHUNK_CACHE_SHARDS; i++) {
+        chunk_cache_shard *shard = &cache->shards[i];
+        pthread_mutex_init(&shard->lock, NULL);
+        shard->buckets = calloc(buckets, sizeof(chunk_cache_entry *));
+        shard->bucket_mask = buckets - 1;
+        shard->max_bytes = shard->buckets ? shard_bytes : 0;
+    }
+    return cache;
+}
+
+static void lru_unlink(chunk_cache_shard *shard, chunk_cache_entry *entry) {
+    if (entry->lru_prev) {
+        entry->lru_prev->lru_next = entry->lru_next;
+    } else {
+        shard->lru_head = entry->lru_next;
+    }
+    if (entry->lru_next) {
+        entry->lru_next->lru_prev = entry->lru_prev;
+    } else {
+        shard->lru_tail = entry->lru_prev;
+    }
+}
+
+static void lru_push_front(chunk_cache_shard *shard, chunk_cache_entry *entry) {
+    entry->lru_prev = NULL;
+    entry->lru_next = shard->lru_head;
+    if (shard->lru_head) {
+        shard->lru_head->lru_prev = entry;
+    } else {
+        shard->lru_tail = entry;
+    }
+    shard->lru_head = entry;
+}
+
+static chunk_cache_entry *shard_find(chunk_cache_shard *shard, const unsigned char *md5) {
+    chunk_cache_entry *entry = shard->buckets[bucket_of(shard, md5)];
+    while (entry && memcmp(entry->md5, md5, MD5_DIGEST_LENGTH) != 0) {
+        entry = entry->bucket_next;
+    }
+    return entry;
+}
+
+static void shard_evict(chunk_cache_shard *shard) {
+    chunk_cache_entry *victim = shard->lru_tail;
+    lru_unlink(shard, victim);
+    chunk_cache_entry **link = &shard->buckets[bucket_of(shard, victim->md5)];
+    while (*link != victim) {
+        link = &(*link)->bucket_next;
+    }
+    *link = victim->bucket_next;
+    shard->bytes -= sizeof(chunk_cache_entry) + victim->length;
+    free(victim);
+    stats_add(STATS_CACHE_EVICTIONS, 1);
+}
+
+void *chunk_cache_get(chunk_cache_t *cache, const unsigned char *md5, arena_t *arena, size_t *length) {
+    if (!cache) {
+        return NULL;
+    }
+    chunk_cache_shard *shard = shard_of(cache, md5);
+    void *data = NULL;
+    pthread_mutex_lock(&shard->lock);
+    chunk_cache_entry *entry = shard->max_bytes ? shard_find(shard, md5) : NULL;
+    if (entry) {
+        lru_unlink(shard, entry);
+        lru_push_front(shard, entry);
+        data = arena_alloc(arena, entry->length);
+        if (data) {
+            memcpy(data, entry->data, entry->length);
+            *length = entry->length;
+        }
+    }
+    pthread_mutex_unlock(&shard->lock);
+    stats_add(data ? STATS_CACHE_HITS : STATS_CACHE_MISSES, 1);
+    return data;
+}
+
+void chunk_cache_put(chunk_cache_t *cache, const unsigned char *md5, const void *data, size_t length) {
+    if (!cache) {
+        return;
+    }
+    chunk_cache_shard *shard = shard_of(cache, md5);
+    size_t cost = sizeof(chunk_cache_entry) + length;
+    if (cost > shard->max_bytes) {
+        return;
+    }
+    pthread_mutex_lock(&shard->lock);
+    // Un autre thread a pu ajouter le même chunk entre-temps
+    if (shard_find(shard, md5)) {
+        pthread_mutex_unlock(&shard->lock);
+        return;
+    }
+    while (shard->bytes + cost > shard->max_bytes) {
+        shard_evict(shard);
+    }
+    chunk_cache_entry *entry = malloc(cost);
+    if (entry) {
+        memcpy(entry->md5, md5, MD5_DIGEST_LENGTH);
+        entry->length = length;
+        memcpy(entry->data, data, length);
+        size_t bucket = bucket_of(shard, md5);
+        entry->bucket_next = shard->buckets[bucket];
+        shard->buckets[bucket] = entry;
+        lru_push_front(shard, entry);
+        shard->bytes += cost;
+    }
+    pthread_mutex_unlock(&shard->lock);
+}
+
+void chunk_cache_free(chunk_cache_t *cache) {
+    if (!cache) {
+        return;
+    }
+    for (int i = 0; i < CHUNK_CACHE_SHARDS; i++) {
+        chunk_cache_shard *shard = &cache->shards[i];
+        chunk_cache_entry *entry = shard->lru_head;
+        while (entry) {
+            chunk_cache_entry *next = entry->lru_next;
+            free(entry);
+            entry = next;
+        }
+        free(shard->buckets);
+        pthread_mutex_destroy(&shard->lock);
+    }
+    free(cache);
+}
@@ -0,0 +1,49 @@
+#ifndef CHUNK_CACHE_H
+#define CHUNK_CACHE_H
+
+#include <stddef.h>
+#include <pthread.h>
+#include <openssl/md5.h>
+#include "arena.h"
+
+// Nombre de sous-caches indépendants (chacun avec son verrou)
+#define CHUNK_CACHE_SHARDS 16
+// Taille par défaut du cache de restauration
+#define CHUNK_CACHE_DEFAULT_SIZE (64 * 1024 * 1024)
+
+// Chunk gardé en cache, chaîné dans sa case de la table et dans la liste LRU
+typedef struct chunk_cache_entry {
+    struct chunk_cache_entry *bucket_next;
+    struct chunk_cache_entry *lru_prev; // vers le plus récemment utilisé
+    struct chunk_cache_entry *lru_next; // vers le moins récemment utilisé
+    unsigned char md5[MD5_DIGEST_LENGTH];
+    size_t length;
+    unsigned char data[];
+} chunk_cache_entry;
+
+typedef struct {
+    pthread_mutex_t lock;
+    chunk_cache_entry **buckets;
+    size_t bucket_mask;
+    chunk_cache_entry *lru_head; // plus récemment utilisé
+    chunk_cache_entry *lru_tail; // prochain évincé
+    size_t bytes;
+    size_t max_bytes;
+} chunk_cache_shard;
+
+// Cache LRU de chunks indexé par MD5, partagé entre threads : le MD5 choisit le
+// sous-cache, deux threads ne se bloquent que s'ils visent le même
+typedef struct {
+    chunk_cache_shard shards[CHUNK_CACHE_SHARDS];
+} chunk_cache_t;
+
+// Crée un cache d'au plus max_bytes octets (NULL si max_bytes vaut 0 : cache désactivé)
+chunk_cache_t *chunk_cache_create(size_t max_bytes);
+// Copie dans arena les données du chunk de MD5 md5 ; NULL si absent (ou cache NULL)
+void *chunk_cache_get(chunk_cache_t *cache, const unsigned char *md5, arena_t *arena, size_t *length);
+// Ajoute un chunk au cache, en évinçant les moins récemment utilisés si besoin
+void chunk_cache_put(chunk_cache_t *cache, const unsigned char *md5, const void *data, size_t length);
+// Libère le cache et tous ses chunks
+void chunk_cache_free(chunk_cache_t *cache);
+
+#endif // CHUNK_CACHE_H
@@ -1,15 +1,69 @@
+#define _GNU_SOURCE
 #include "deduplication.h"
 #include "file_handler.h"
+#include "stats.h"
+#include "throttle.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 #include <openssl/md5.h>
 #include <dirent.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 // Récupère les valeurs de verbose_flag et dry_run_flag
 extern int verbose_flag;
 extern int dry_run_flag;
 
+// Taille des chunks des fichiers découpés et écrits
+static size_t chunk_size = CHUNK_DEFAULT_SIZE;
+
+void set_chunk_size(size_t size) {
+    chunk_size = size;
+}
+
+size_t get_chunk_size(void) {
+    return chunk_size;
+}
+
+int valid_chunk_size(size_t size) {
+    return size >= CHUNK_MIN_SIZE && size <= CHUNK_MAX_SIZE && (size & (size - 1)) == 0;
+}
+
+int read_dedup_header(FILE *file, DedupHeader *header) {
+    /* @param: file est positionné au début d'une image .dedup
+    *           header reçoit la version, la taille des chunks et leur nombre
+    *  @return: 0, ou -1 si l'en-tête est illisible ou d'une version inconnue
+    */
+    int first;
+    if (fread(&first, sizeof(int), 1, file) != 1) {
+        return -1;
+    }
+    if (first >= 0) {
+        // Format 0 : le nombre de chunks, de 4096 octets au plus
+        header->version = 0;
+        header->chunk_size = CHUNK_MIN_SIZE;
+        header->chunk_count = first;
+        header->header_size = sizeof(int);
+        return 0;
+    }
+    uint32_t fields[3];
+    if (memcmp(&first, DEDUP_MAGIC, sizeof(int)) != 0 || fread(fields, sizeof(uint32_t), 3, file) != 3
+        || fields[0] != DEDUP_VERSION || !valid_chunk_size(fields[1]) || fields[2] > INT32_MAX) {
+        return -1;
+    }
+    header->version = fields[0];
+    header->chunk_size = fields[1];
+    header->chunk_count = (int)fields[2];
+    header->header_size = DEDUP_HEADER_SIZE;
+    return 0;
+}
+
 // Fonction de hachage MD5 pour l'indexation
 // dans la table de hachage
 unsigned int hash_md5(unsigned char *md5) {
@@ -37,29 +91,25 @@ int find_md5(Md5Entry *hash_table, unsigned char *md5) {
     */
     Md5Entry *parcours = hash_table;
 
-    int liste_non_finie = 1;
-    while(liste_non_finie){ //tant qu'il a des valeurs dans le tableau de hachage
-        if (parcours->index == 0) { // hash_table déclaré par calloc, \
-                                    donc si index et md5 == 0 -> fin de la liste
+    // La table contient au plus HASH_TABLE_SIZE entrées : on ne lit jamais au-delà
+    for (int i=0; i<HASH_TABLE_SIZE; ++i) {
+        if (parcours->index == 0) { // hash_table déclaré par calloc, donc si index et md5 == 0 -> fin de la liste
             int md5_not_null = 0; // Variable mise à 1 si au moins un char de md5 != 0
-            for (int i=0; i<16; ++i) {
-                if (parcours->md5[i] != 0) {
+            for (int j=0; j<MD5_DIGEST_LENGTH; ++j) {
+                if (parcours->md5[j] != 0) {
                     md5_not_null = 1;
                 }
             }
             if (!md5_not_null) {
-                liste_non_finie = 0;
+                return -1;
             }
         }
 
-        if (liste_non_finie) { // On vérifie d'abord qu'on puisse acceder à parcours->md5
-            if ((hash_md5(&(parcours->md5))) == hash_md5(md5)) {
-                if (strcmp(&(parcours->md5), md5) == 0) {
-                    return parcours->index; //on retourne son index
-                }
-            }
-            ++parcours; // aller à l'adresse suivante
+        // Les MD5 sont binaires : comparaison avec memcmp et non strcmp
+        if (memcmp(parcours->md5, md5, MD5_DIGEST_LENGTH) == 0) {
+            return parcours->index; //on retourne son index
         }
+        ++parcours; // aller à l'adresse suivante
     }
     return -1;
 }
@@ -68,109 +118,512 @@ int find_md5(Md5Entry *hash_table, unsigned char *md5) {
 void add_md5(Md5Entry *hash_table, unsigned char *md5, int index) {
     Md5Entry *parcours = hash_table;
 
-    int liste_non_finie = 1;
-    while(liste_non_finie) { // on cherche à trouver la première case libre de la liste
+    for (int i=0; i<HASH_TABLE_SIZE; ++i) { // on cherche à trouver la première case libre de la liste
         if (parcours->index == 0) {
             int md5_not_null = 0; // Variable mise à 1 si au moins un char de md5 != 0
-            for (int i=0; i<16; ++i) {
-                if (parcours->md5[i] != 0) {
+            for (int j=0; j<MD5_DIGEST_LENGTH; ++j) {
+                if (parcours->md5[j] != 0) {
                     md5_not_null = 1;
                 }
             }
             if (!md5_not_null) {
-                liste_non_finie = 0;
+                memcpy(&(parcours->md5), md5, MD5_DIGEST_LENGTH);
+                parcours->index = index;
+                return;
             }
         }
-        if (liste_non_finie){
-            ++parcours; // aller à l'adresse suivante
+        ++parcours; // aller à l'adresse suivante
+    }
+    // Table pleine : le chunk ne sera simplement pas dédupliqué
+}
+
+int is_zero_block(const unsigned char *buffer, size_t size) {
+    size_t i = 0;
+#if defined(__SSE2__)
+    // 64 octets par tour, sortie dès qu'un octet non nul apparaît
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 64 <= size; i += 64) {
+        __m128i acc = _mm_or_si128(
+            _mm_or_si128(_mm_loadu_si128((const __m128i *)(buffer + i)),
+                         _mm_loadu_si128((const __m128i *)(buffer + i + 16))),
+            _mm_or_si128(_mm_loadu_si128((const __m128i *)(buffer + i + 32)),
+                         _mm_loadu_si128((const __m128i *)(buffer + i + 48))));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(acc, zero)) != 0xFFFF) {
+            return 0;
         }
     }
-    memcpy(&(parcours->md5), md5, MD5_DIGEST_LENGTH);
-    parcours->index = index;
+#else
+    for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, buffer + i, sizeof(word));
+        if (word != 0) {
+            return 0;
+        }
+    }
+#endif
+    for (; i < size; i++) {
+        if (buffer[i] != 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Tableau de chunks en cours de remplissage par deduplicate_file ou deduplicate_direct
+typedef struct {
+    Chunk **chunks;     // tableau de l'appelant, remplacé s'il est agrandi
+    size_t *capacity;
+    unsigned int index; // prochaine case
+    Md5Entry *hash_table;
+    arena_t *arena;
+} chunk_output_t;
+
+// Case suivante du tableau : plein (fichier agrandi depuis son stat, ou fichier creux dont
+// les zones de données ne sont pas alignées sur les chunks), il est recopié dans un tableau
+// deux fois plus grand pris dans l'arène, dont la fin reste à zéro
+static inline Chunk *next_chunk(chunk_output_t *out) {
+    if (out->index + 1 >= *out->capacity) {
+        size_t capacity = *out->capacity * 2 + 2;
+        Chunk *grown = arena_calloc(out->arena, capacity * sizeof(Chunk));
+        memcpy(grown, *out->chunks, out->index * sizeof(Chunk));
+        *out->chunks = grown;
+        *out->capacity = capacity;
+    }
+    return *out->chunks + out->index;
+}
+
+// Ajoute size octets nuls à la fin du tableau : la suite de zéros précédente est
+// prolongée si le dernier chunk en est une, sinon un nouveau chunk est créé
+static void add_zero_run(chunk_output_t *out, size_t size) {
+    Chunk *last = out->index > 0 ? *out->chunks + out->index - 1 : NULL;
+    if (last && (last->lenght & CHUNK_ZERO_RUN)) {
+        last->lenght += size;
+    } else {
+        Chunk *chunk = next_chunk(out);
+        memset(chunk->md5, 0, MD5_DIGEST_LENGTH);
+        chunk->data = arena_alloc(out->arena, 0); // non NULL : la case est occupée
+        chunk->lenght = size | CHUNK_ZERO_RUN;
+        out->index++;
+    }
+    stats_add(STATS_BYTES_ZERO, size);
+}
+
+// Ajoute un bloc lu du fichier à la fin du tableau : suite de zéros, référence vers un
+// chunk identique déjà vu dans le fichier, ou nouveau chunk dont les données sont copiées
+static inline __attribute__((always_inline)) void add_block(chunk_output_t *out, const unsigned char *block,
+                                                            size_t taille_bloc) {
+    // Un bloc nul n'est ni haché ni stocké
+    if (is_zero_block(block, taille_bloc)) {
+        add_zero_run(out, taille_bloc);
+        return;
+    }
+    stats_add(STATS_BYTES_HASHED, taille_bloc);
+
+    Chunk *chunk = next_chunk(out);
+    unsigned char md5[MD5_DIGEST_LENGTH];
+    compute_md5((void *)block, taille_bloc, md5);
+    int md5_index = find_md5(out->hash_table, md5);
+    if (md5_index != -1) {
+        chunk->data = arena_alloc(out->arena, sizeof(unsigned int));
+        memcpy(chunk->data, &md5_index, sizeof(int));
+        memcpy(&(chunk->md5), md5, MD5_DIGEST_LENGTH);
+        chunk->lenght = sizeof(unsigned int);
+        stats_add(STATS_CHUNKS_DUPLICATE, 1);
+
+    } else {
+        add_md5(out->hash_table, md5, out->index);
+        memcpy(&(chunk->md5), md5, MD5_DIGEST_LENGTH);
+        chunk->data = arena_alloc(out->arena, taille_bloc);
+        memcpy(chunk->data, block, taille_bloc);
+        chunk->lenght = taille_bloc;
+        stats_add(STATS_CHUNKS_UNIQUE, 1);
+    }
+    out->index++;
+}
+
+// Découpe les length octets lus en chunks de chunk_size octets (le dernier peut être plus
+// court). Toujours développée dans l'appelant : avec une taille constante, le compilateur
+// spécialise la boucle, le test des blocs nuls et la copie des données pour cette taille.
+static inline __attribute__((always_inline)) void split_blocks(chunk_output_t *out, const unsigned char *data,
+                                                               size_t length, const size_t chunk_size) {
+    for (size_t offset = 0; offset < length; offset += chunk_size) {
+        size_t taille_bloc = length - offset < chunk_size ? length - offset : chunk_size;
+        add_block(out, data + offset, taille_bloc);
+    }
+}
+
+// Découpe des données lues avec la taille de chunk courante : une version de la boucle
+// par taille courante, une générique pour les autres
+static void split_data(chunk_output_t *out, const unsigned char *data, size_t length) {
+    switch (chunk_size) {
+        case 4096:
+            split_blocks(out, data, length, 4096);
+            break;
+        case 64 * 1024:
+            split_blocks(out, data, length, 64 * 1024);
+            break;
+        case 1024 * 1024:
+            split_blocks(out, data, length, 1024 * 1024);
+            break;
+        default:
+            split_blocks(out, data, length, chunk_size);
+            break;
+    }
 }
 
 // Fonction pour convertir un fichier non dédupliqué en tableau de chunks
-void deduplicate_file(FILE *file, Chunk *chunks, Md5Entry *hash_table) {
+void deduplicate_file(FILE *file, uint64_t max_size, Chunk **chunks, size_t *capacity, Md5Entry *hash_table,
+                      arena_t *arena) {
     /* @param:  file est le fichier qui sera dédupliqué
-    *           chunks est le tableau de chunks initialisés qui contiendra les chunks issu du fichier
+    *           max_size est le nombre d'octets lus au plus (la taille du fichier lors de son stat)
+    *           chunks est le tableau de *capacity chunks initialisés à zéro qui contiendra les
+    *           chunks issus du fichier ; s'il est trop petit, il est remplacé par un plus grand
+    *           pris dans arena et *capacity est mis à jour
     *           hash_table est le tableau de hachage qui contient les MD5 et l'index des chunks unique
+    *           arena fournit la mémoire des données des chunks (libérée par arena_reset)
     */
 
-    // tampon de la taille d'un chunk (4096 octets = 4096 unsigned char)
-    unsigned char buffer[CHUNK_SIZE];
-    unsigned int index = 0;
-    Chunk *parcours_chunk = chunks;
-    while (!feof(file)) {
-        // Lecture d'un chunk
-        size_t taille_bloc = fread(buffer, 1, CHUNK_SIZE, file);
-        
-        unsigned char *md5 = malloc(16);
-        compute_md5(buffer, taille_bloc, md5);
-        int md5_index = find_md5(hash_table, md5);
-        if (md5_index != -1) {
-            parcours_chunk->data = malloc(sizeof(unsigned int));
-            memcpy(parcours_chunk->data, &md5_index, sizeof(int));
-            memcpy(&(parcours_chunk->md5), md5, MD5_DIGEST_LENGTH);
-            parcours_chunk->lenght = sizeof(unsigned int);
+    // Le fichier est lu par DEDUP_READ_SIZE octets (un multiple de la taille des chunks,
+    // toutes deux des puissances de 2), puis découpé en chunks
+    size_t read_size = chunk_size > DEDUP_READ_SIZE ? chunk_size : DEDUP_READ_SIZE;
+    unsigned char *buffer = malloc(read_size);
+    if (!buffer) {
+        perror("Erreur d'allocation du tampon de lecture");
+        return;
+    }
+    chunk_output_t out = {.chunks = chunks, .capacity = capacity, .hash_table = hash_table, .arena = arena};
 
-        } else {
-            add_md5(hash_table, md5, index);
-            memcpy(&(parcours_chunk->md5), md5, MD5_DIGEST_LENGTH);
-            parcours_chunk->data = malloc(taille_bloc);
-            memcpy(parcours_chunk->data, buffer, taille_bloc);
-            parcours_chunk->lenght = taille_bloc;
+    // Fichier creux (moins de blocs alloués que sa taille) : les trous sont trouvés par
+    // SEEK_DATA/SEEK_HOLE et enregistrés sans être lus
+    int fd = fileno(file);
+    struct stat st;
+    int sparse = fd >= 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode)
+                 && (off_t)st.st_blocks * 512 < st.st_size;
+    off_t end = sparse && (uint64_t)st.st_size < max_size ? st.st_size : (off_t)max_size;
+    off_t pos = 0;
+    off_t data_end = 0; // fin de la zone de données courante
+    while (!feof(file) && pos < end) {
+        size_t wanted = read_size;
+        if (sparse && pos >= data_end) {
+            off_t data_start = lseek(fd, pos, SEEK_DATA);
+            if (data_start < 0 && errno == ENXIO) {
+                // Plus aucune donnée : le reste du fichier est un trou
+                if (end > pos) {
+                    add_zero_run(&out, end - pos);
+                }
+                break;
+            }
+            if (data_start >= 0) {
+                if (data_start > pos) {
+                    off_t zero_end = data_start < end ? data_start : end;
+                    add_zero_run(&out, zero_end - pos);
+                    pos = zero_end;
+                }
+                data_end = lseek(fd, pos, SEEK_HOLE);
+            }
+            if (data_start < 0 || data_end < 0) {
+                sparse = 0; // SEEK_DATA non supporté : lecture complète
+            }
+            // lseek a déplacé le descripteur : le FILE est repositionné
+            fseek(file, pos, SEEK_SET);
+        }
+        if (sparse) {
+            // Pas plus de chunks que n'en couvre la zone de données : le trou suivant n'est pas lu
+            size_t chunks_left = ((size_t)(data_end - pos) + chunk_size - 1) / chunk_size;
+            if (chunks_left * chunk_size < wanted) {
+                wanted = chunks_left * chunk_size;
+            }
+        }
+        if ((uint64_t)(end - pos) < wanted) {
+            // Un fichier agrandi depuis son stat est sauvegardé jusqu'à la taille vue alors
+            wanted = (size_t)(end - pos);
+        }
+        if (wanted == 0) {
+            break;
+        }
+
+        // Lecture de plusieurs chunks
+        size_t taille_lue = throttle_fread(buffer, wanted, file);
+        if (taille_lue == 0) { // fin de fichier atteinte sur une frontière de chunk
+            break;
         }
-        ++parcours_chunk;
-        ++index;
-    }  
+        pos += taille_lue;
+        stats_add(STATS_BYTES_READ, taille_lue);
 
+        split_data(&out, buffer, taille_lue);
+    }
+    free(buffer);
 }
 
 
+// Même découpage que deduplicate_file, sur les requêtes d'un fichier lu en O_DIRECT :
+// les blocs sont traités directement dans les tampons alignés, sans copie intermédiaire
+void deduplicate_direct(direct_reader_t *reader, uint64_t max_size, Chunk **chunks, size_t *capacity,
+                        Md5Entry *hash_table, arena_t *arena) {
+    /* @param:  reader est le fichier ouvert par direct_open
+    *           max_size, chunks, capacity, hash_table et arena ont le même rôle que pour deduplicate_file
+    */
+
+    chunk_output_t out = {.chunks = chunks, .capacity = capacity, .hash_table = hash_table, .arena = arena};
+    const unsigned char *data;
+    size_t length;
+    uint64_t pos = 0;
+    while (pos < max_size && (length = direct_read(reader, &data)) > 0) {
+        // direct_open borne déjà la lecture à st_size : simple garde-fou
+        if (length > max_size - pos) {
+            length = (size_t)(max_size - pos);
+        }
+        pos += length;
+        // Une requête est un multiple de la taille des chunks sauf à la fin du fichier :
+        // les chunks commencent aux mêmes positions qu'en lecture classique
+        split_data(&out, data, length);
+    }
+}
+
 // Fonction permettant de charger un fichier dédupliqué en table de chunks
 // en remplaçant les références par les données correspondantes
-void undeduplicate_file(FILE *file, Chunk **chunks, int *chunk_count) {
+void undeduplicate_file(FILE *file, Chunk **chunks, int *chunk_count, arena_t *arena) {
     /* @param: file est le nom du fichier dédupliqué présent dans le répertoire de sauvegarde
     *           chunks représente le tableau de chunk qui contiendra les chunks restauré depuis filename
     *           chunk_count est un compteur du nombre de chunk restauré depuis le fichier filename
+    *           arena fournit la mémoire du tableau et des données (libérée par arena_reset)
     */
-    unsigned char buffer[CHUNK_SIZE];
-    fread(chunk_count, 1, sizeof(int), file);
-    *chunks = calloc(CHUNK_SIZE, sizeof(Chunk));
-    Chunk *parcours_chunk = *chunks;
-    unsigned int chunk_size_on_file;
-    unsigned char chunk_md5[MD5_DIGEST_LENGTH];
+    *chunks = NULL;
+    DedupHeader header;
+    if (read_dedup_header(file, &header) != 0 || header.chunk_count <= 0) {
+        *chunk_count = 0;
+        return;
+    }
+    *chunk_count = header.chunk_count;
+    *chunks = arena_calloc(arena, *chunk_count * sizeof(Chunk));
+    if (!*chunks) {
+        *chunk_count = 0;
+        return;
+    }
+    // Format écrit par write_backup_file : md5, taille (size_t), données
     unsigned char chunk_md5_computed[MD5_DIGEST_LENGTH];
-    unsigned char *chunk_data;
-    for (int i=0; i<chunk_count; ++i) {
-        fread(chunk_md5, 1, MD5_DIGEST_LENGTH, file); // lecture du md5
-        memcpy(&(parcours_chunk->md5),chunk_md5, MD5_DIGEST_LENGTH);
-        fread(&chunk_size_on_file, 1, sizeof(unsigned int), file);
+    for (int i=0; i<*chunk_count; ++i) {
+        Chunk *parcours_chunk = *chunks + i;
+        size_t chunk_size_on_file;
+        if (fread(parcours_chunk->md5, 1, MD5_DIGEST_LENGTH, file) != MD5_DIGEST_LENGTH
+            || fread(&chunk_size_on_file, sizeof(size_t), 1, file) != 1
+            || CHUNK_LENGTH(chunk_size_on_file) > header.chunk_size) {
+            *chunk_count = i; // fichier tronqué ou corrompu : on garde ce qui a été lu
+            return;
+        }
+        // Une référence externe est conservée telle quelle (drapeau compris) :
+        // c'est à l'appelant de la résoudre, lui seul connaît le répertoire de sauvegarde
+        size_t data_size = CHUNK_LENGTH(chunk_size_on_file);
+        unsigned char *chunk_data = arena_alloc(arena, data_size);
+        if (fread(chunk_data, 1, data_size, file) != data_size) {
+            *chunk_count = i;
+            return;
+        }
+        parcours_chunk->data = chunk_data;
         parcours_chunk->lenght = chunk_size_on_file;
-        if (chunk_size_on_file != CHUNK_SIZE && chunk_size_on_file == sizeof(unsigned int)) { //savoir si le chunk est un index
-            chunk_data = malloc(sizeof(unsigned int));
-            fread(chunk_data, 1, sizeof(unsigned int), file);
-            compute_md5(chunk_data, sizeof(unsigned int),chunk_md5_computed);
-            if (hash_md5(chunk_md5) == hash_md5(chunk_md5_computed)) { // comparaison rapide si différents
-                if (strcmp(chunk_md5, chunk_md5_computed) == 0) { // chunks fait une longueur de 4 octets
-                    memcpy(parcours_chunk->data, chunk_data, sizeof(unsigned int));
-                } else {
-                    memcpy(parcours_chunk->data, (*chunks + *chunk_data)->data, sizeof CHUNK_SIZE);
-                } 
+
+        if (chunk_size_on_file == sizeof(unsigned int)) { //savoir si le chunk est un index
+            // Un vrai chunk de 4 octets a pour MD5 celui de ses données ;
+            // une référence porte le MD5 du chunk qu'elle désigne
+            compute_md5(chunk_data, sizeof(unsigned int), chunk_md5_computed);
+            if (memcmp(parcours_chunk->md5, chunk_md5_computed, MD5_DIGEST_LENGTH) != 0) {
+                unsigned int ref;
+                memcpy(&ref, chunk_data, sizeof(unsigned int));
+                if (ref < (unsigned int)i) { // une référence désigne toujours un chunk précédent
+                    // La cible peut être une référence externe : elle est partagée telle quelle
+                    Chunk *cible = *chunks + ref;
+                    parcours_chunk->data = cible->data;
+                    parcours_chunk->lenght = cible->lenght;
+                }
+            }
+        }
+    }
+}
+
+// Vrai si le chunk de 4 octets est une référence vers un chunk précédent du même fichier
+static int is_internal_ref(const Chunk *chunk) {
+    if (chunk->lenght != sizeof(unsigned int)) {
+        return 0;
+    }
+    unsigned char md5[MD5_DIGEST_LENGTH];
+    compute_md5(chunk->data, sizeof(unsigned int), md5);
+    return memcmp(md5, chunk->md5, MD5_DIGEST_LENGTH) != 0;
+}
+
+// Décode une référence externe : index du chunk et emplacement du fichier qui le contient
+int parse_external_ref(const Chunk *chunk, unsigned int *index, const char **location) {
+    if (!chunk || !(chunk->lenght & CHUNK_EXTERNAL_REF)) {
+        return -1;
+    }
+    size_t len = CHUNK_LENGTH(chunk->lenght);
+    const char *data = chunk->data;
+    if (len <= sizeof(unsigned int) || data[len - 1] != '\0') {
+        return -1; // référence tronquée
+    }
+    memcpy(index, data, sizeof(unsigned int));
+    *location = data + sizeof(unsigned int);
+    return 0;
+}
+
+// Fonction permettant d'écrire des chunks au format .dedup
+uint64_t write_dedup_chunks(FILE *file, const Chunk *chunks, int chunk_count, size_t chunk_size) {
+    /* @param: file est le fichier de sortie (un .dedup ou un segment)
+    *           chunks est le tableau des chunks dédupliqués
+    *           chunk_count est le nombre de chunks
+    *           chunk_size est la taille des chunks inscrite dans l'en-tête
+    *  @return: le nombre d'octets écrits
+    */
+    uint32_t fields[3] = {DEDUP_VERSION, (uint32_t)chunk_size, (uint32_t)chunk_count};
+    fwrite(DEDUP_MAGIC, 1, sizeof(int), file);
+    fwrite(fields, sizeof(uint32_t), 3, file);
+    uint64_t written = DEDUP_HEADER_SIZE;
+    for (int i = 0; i < chunk_count; i++) {
+        // La taille écrite garde les drapeaux CHUNK_EXTERNAL_REF et CHUNK_ZERO_RUN
+        size_t length = chunks[i].lenght;
+        fwrite(chunks[i].md5, MD5_DIGEST_LENGTH, 1, file);
+        fwrite(&length, sizeof(size_t), 1, file);
+        length = CHUNK_LENGTH(length);
+        fwrite(chunks[i].data, 1, length, file);
+        written += MD5_DIGEST_LENGTH + sizeof(size_t) + length;
+    }
+    return written;
+}
+
+// Fonction permettant de lire les MD5 et l'emplacement des données d'un fichier dédupliqué
+int read_chunk_refs(FILE *file, const char *location, ChunkRef **refs, arena_t *arena) {
+    /* @param: file est le fichier .dedup ouvert en lecture
+    *           location est l'emplacement "sauvegarde/chemin" de ce fichier
+    *           refs contiendra, pour chaque chunk, l'emplacement réel de ses données
+    *  @return: le nombre de chunks lus, -1 en cas d'erreur
+    *
+    *  Les données des chunks sont sautées : seules les références de 4 octets et les
+    *  références externes sont lues, pour que chaque entrée désigne directement des données
+    */
+    *refs = NULL;
+    DedupHeader header;
+    if (read_dedup_header(file, &header) != 0) {
+        return -1;
+    }
+    int chunk_count = header.chunk_count;
+    *refs = arena_alloc(arena, chunk_count * sizeof(ChunkRef));
+    if (!*refs) {
+        return -1;
+    }
+    // Les emplacements sont partagés entre entrées : une copie par emplacement distinct consécutif
+    const char *own_location = arena_strdup(arena, location);
+    const char *last_location = NULL;
+    Chunk chunk;
+    // Seules les références sont lues : elles ne dépassent pas CHUNK_REF_MAX_SIZE octets
+    unsigned char data[CHUNK_REF_MAX_SIZE];
+    chunk.data = data;
+    for (int i = 0; i < chunk_count; i++) {
+        ChunkRef *ref = *refs + i;
+        size_t size;
+        if (fread(ref->md5, 1, MD5_DIGEST_LENGTH, file) != MD5_DIGEST_LENGTH
+            || fread(&size, sizeof(size_t), 1, file) != 1
+            || CHUNK_LENGTH(size) > header.chunk_size
+            || ((size & CHUNK_EXTERNAL_REF) && CHUNK_LENGTH(size) > CHUNK_REF_MAX_SIZE)) {
+            *refs = NULL;
+            return -1;
+        }
+        memcpy(chunk.md5, ref->md5, MD5_DIGEST_LENGTH);
+        chunk.lenght = size;
+
+        if ((size & CHUNK_EXTERNAL_REF) || size == sizeof(unsigned int)) {
+            if (fread(data, 1, CHUNK_LENGTH(size), file) != CHUNK_LENGTH(size)) {
+                *refs = NULL;
+                return -1;
             }
-            free(chunk_data);
         } else {
-            if (chunk_size_on_file != CHUNK_SIZE) { //Cas ou on est dans le dernier chunk incomplet (pas à 4096o)
-                chunk_data = malloc(chunk_size_on_file);
-                fread(chunk_data, 1, chunk_size_on_file, file);
-                memcpy(parcours_chunk->data, chunk_data, chunk_size_on_file);
-                free(chunk_data);
-            } else { // Cas général : on se situe dans  un chunk de 4096 octets
-                chunk_data = malloc(CHUNK_SIZE);
-                fread(chunk_data, 1, CHUNK_SIZE, file);
-                memcpy(parcours_chunk->data, chunk_data, CHUNK_SIZE);
-                free(chunk_data);
+            fseek(file, (long)CHUNK_LENGTH(size), SEEK_CUR);
+        }
+
+        const char *ext_location;
+        unsigned int ext_index;
+        if (parse_external_ref(&chunk, &ext_index, &ext_location) == 0) {
+            if (!last_location || strcmp(last_location, ext_location) != 0) {
+                last_location = arena_strdup(arena, ext_location);
+            }
+            ref->location = last_location;
+            ref->index = ext_index;
+        } else if (is_internal_ref(&chunk)) {
+            unsigned int target;
+            memcpy(&target, data, sizeof(unsigned int));
+            if (target >= (unsigned int)i) {
+                *refs = NULL;
+                return -1;
             }
+            ref->location = (*refs)[target].location;
+            ref->index = (*refs)[target].index;
+        } else {
+            ref->location = own_location;
+            ref->index = i;
+        }
+    }
+    return chunk_count;
+}
+
+// Remplace les chunks déjà présents dans refs par une référence vers leur emplacement
+int reference_known_chunks(Chunk *chunks, int chunk_count, ChunkRef *refs, int ref_count, arena_t *arena) {
+    /* @param: chunks est le tableau produit par deduplicate_file
+    *           refs sont les chunks déjà sauvegardés (version précédente du fichier)
+    *  @return: le nombre de chunks remplacés par une référence
+    */
+    if (ref_count <= 0 || chunk_count <= 0) {
+        return 0;
+    }
+    // Table d'adressage ouvert (puissance de 2, remplie au plus à moitié) : MD5 -> index dans refs
+    size_t capacity = 1;
+    while (capacity < (size_t)ref_count * 2) {
+        capacity <<= 1;
+    }
+    int *slots = arena_alloc(arena, capacity * sizeof(int));
+    if (!slots) {
+        return 0;
+    }
+    memset(slots, -1, capacity * sizeof(int));
+    for (int i = 0; i < ref_count; i++) {
+        size_t slot;
+        memcpy(&slot, refs[i].md5, sizeof(size_t));
+        slot &= capacity - 1;
+        while (slots[slot] != -1 && memcmp(refs[slots[slot]].md5, refs[i].md5, MD5_DIGEST_LENGTH) != 0) {
+            slot = (slot + 1) & (capacity - 1);
+        }
+        if (slots[slot] == -1) {
+            slots[slot] = i;
+        }
+    }
+
+    int replaced = 0;
+    for (int i = 0; i < chunk_count; i++) {
+        Chunk *chunk = chunks + i;
+        // Les références internes (4 octets) sont déjà plus petites qu'une référence externe
+        // et les suites de zéros ne stockent rien
+        if ((chunk->lenght & (CHUNK_EXTERNAL_REF | CHUNK_ZERO_RUN)) || is_internal_ref(chunk)) {
+            continue;
+        }
+        size_t slot;
+        memcpy(&slot, chunk->md5, sizeof(size_t));
+        slot &= capacity - 1;
+        while (slots[slot] != -1 && memcmp(refs[slots[slot]].md5, chunk->md5, MD5_DIGEST_LENGTH) != 0) {
+            slot = (slot + 1) & (capacity - 1);
+        }
+        if (slots[slot] == -1) {
+            continue;
+        }
+        ChunkRef *ref = refs + slots[slot];
+        size_t location_len = strlen(ref->location) + 1;
+        size_t size = sizeof(unsigned int) + location_len;
+        if (size > CHUNK_REF_MAX_SIZE || size >= CHUNK_LENGTH(chunk->lenght)) {
+            continue; // la référence ne serait pas plus petite que les données
         }
+        char *data = arena_alloc(arena, size);
+        memcpy(data, &ref->index, sizeof(unsigned int));
+        memcpy(data + sizeof(unsigned int), ref->location, location_len);
+        chunk->data = data;
+        chunk->lenght = size | CHUNK_EXTERNAL_REF;
+        replaced++;
     }
+    stats_add(STATS_CHUNKS_REFERENCED, replaced);
+    return replaced;
 }
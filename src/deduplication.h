@@ -2,18 +2,49 @@
 #define DEDUPLICATION_H
 
 #include <stdio.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <openssl/md5.h>
 #include <dirent.h>
+#include "arena.h"
+#include "direct_io.h"
 
-// Taille d'un chunk (4096 octets)
-#define CHUNK_SIZE 4096
+// Taille des chunks d'un dépôt : une puissance de 2 entre CHUNK_MIN_SIZE et CHUNK_MAX_SIZE,
+// choisie à sa première sauvegarde (--chunk-size) et inscrite dans l'en-tête de chaque .dedup
+#define CHUNK_DEFAULT_SIZE 4096
+#define CHUNK_MIN_SIZE 4096
+#define CHUNK_MAX_SIZE (4 * 1024 * 1024)
+// Une référence externe n'est utilisée que si elle tient dans cette taille
+#define CHUNK_REF_MAX_SIZE CHUNK_MIN_SIZE
+// Les fichiers sont lus par blocs de cette taille (ou d'un chunk, s'il est plus grand)
+#define DEDUP_READ_SIZE (1024 * 1024)
+
+// En-tête d'un .dedup (format 1, DEDUP_HEADER_SIZE octets) : DEDUP_MAGIC, puis version,
+// taille des chunks et nombre de chunks (uint32_t). Le format 0 commençait directement par
+// le nombre de chunks (int), avec des chunks de 4096 octets : DEDUP_MAGIC, lu comme un
+// entier, est négatif et ne peut pas être confondu avec lui.
+#define DEDUP_MAGIC "LPD\xff"
+#define DEDUP_VERSION 1
+#define DEDUP_HEADER_SIZE 16
 
 // Taille de la table de hachage qui contiendra les chunks
 // dont on a déjà calculé le MD5 pour effectuer les comparaisons
 #define HASH_TABLE_SIZE 1000
 
+// Bit de poids fort de la taille d'un chunk : le chunk ne contient pas de données mais
+// une référence vers un chunk d'un autre fichier .dedup (index sur 4 octets puis
+// emplacement "sauvegarde/chemin" terminé par '\0')
+#define CHUNK_EXTERNAL_REF ((size_t)1 << 63)
+// Bit suivant : le chunk est une suite d'octets nuls (trou d'un fichier creux ou blocs
+// à zéro) dont la taille, éventuellement supérieure à celle d'un chunk, suit le drapeau.
+// Aucune donnée n'est stockée et le MD5 est nul.
+#define CHUNK_ZERO_RUN ((size_t)1 << 62)
+// Taille réelle des données stockées d'un chunk, sans les drapeaux
+#define CHUNK_LENGTH(len) (((len) & CHUNK_ZERO_RUN) ? 0 : (len) & ~CHUNK_EXTERNAL_REF)
+// Nombre d'octets nuls représentés par une suite de zéros
+#define CHUNK_ZERO_LENGTH(len) ((len) & ~CHUNK_ZERO_RUN)
+
 // Structure pour un chunk
 typedef struct {
     unsigned char md5[MD5_DIGEST_LENGTH]; // MD5 du chunk
@@ -21,26 +52,67 @@ typedef struct {
     size_t lenght; // taille d'un chunk
 } Chunk;
 
+// En-tête lu d'un .dedup
+typedef struct {
+    uint32_t version;     // 0 : ancien format sans en-tête
+    uint32_t chunk_size;  // taille maximale des données d'un chunk
+    int chunk_count;
+    uint32_t header_size; // octets de l'en-tête
+} DedupHeader;
+
 // Table de hachage pour stocker les MD5 et leurs index
 typedef struct {
     unsigned char md5[MD5_DIGEST_LENGTH];
     int index;
 } Md5Entry;
 
+// Emplacement des données d'un chunk déjà sauvegardé
+typedef struct {
+    unsigned char md5[MD5_DIGEST_LENGTH];
+    const char *location; // "sauvegarde/chemin" du .dedup qui contient les données
+    unsigned int index; // position du chunk dans ce fichier
+} ChunkRef;
+
 
+// Taille des chunks des fichiers découpés et écrits ensuite (CHUNK_DEFAULT_SIZE au départ)
+void set_chunk_size(size_t size);
+size_t get_chunk_size(void);
+// Vrai si size est une taille de chunk acceptée
+int valid_chunk_size(size_t size);
+// Lit l'en-tête d'un .dedup (ou d'une image rangée dans un segment) ; -1 s'il est invalide
+int read_dedup_header(FILE *file, DedupHeader *header);
 // Fonction de hachage MD5 pour l'indexation dans la table de hachage
 unsigned int hash_md5(unsigned char *md5);
 // Fonction pour calculer le MD5 d'un chunk
 void compute_md5(void *data, size_t len, unsigned char *md5_out);
+// Vrai si les size octets de buffer sont tous nuls
+int is_zero_block(const unsigned char *buffer, size_t size);
 // Fonction permettant de chercher un MD5 dans la table de hachage
 int find_md5(Md5Entry *hash_table, unsigned char *md5);
 // Fonction pour ajouter un MD5 dans la table de hachage
 void add_md5(Md5Entry *hash_table, unsigned char *md5, int index);
-// Fonction pour convertir un fichier non dédupliqué en tableau de chunks
-void deduplicate_file(FILE *file, Chunk *chunks, Md5Entry *hash_table);
+// Fonction pour convertir les max_size premiers octets d'un fichier non dédupliqué en tableau
+// de chunks (les données des chunks sont allouées dans arena) ; *chunks, de *capacity cases
+// à zéro, est remplacé par un tableau plus grand pris dans arena s'il ne suffit pas
+void deduplicate_file(FILE *file, uint64_t max_size, Chunk **chunks, size_t *capacity, Md5Entry *hash_table,
+                      arena_t *arena);
+// Même chose pour un fichier ouvert par direct_open (--direct-io)
+void deduplicate_direct(direct_reader_t *reader, uint64_t max_size, Chunk **chunks, size_t *capacity,
+                        Md5Entry *hash_table, arena_t *arena);
 // Fonction permettant de charger un fichier dédupliqué en table de chunks
 // en remplaçant les références par les données correspondantes
-void undeduplicate_file(FILE *file, Chunk **chunks, int *chunk_count);
+// (tableau et données sont alloués dans arena ; un chunk référence partage les données de sa cible)
+void undeduplicate_file(FILE *file, Chunk **chunks, int *chunk_count, arena_t *arena);
+// Fonction permettant d'écrire des chunks au format .dedup, découpés en chunks de chunk_size
+// octets au plus ; retourne le nombre d'octets écrits
+uint64_t write_dedup_chunks(FILE *file, const Chunk *chunks, int chunk_count, size_t chunk_size);
+// Fonction permettant de lire les MD5 et l'emplacement des données d'un fichier dédupliqué
+// sans charger les données ; location est l'emplacement "sauvegarde/chemin" de ce fichier
+int read_chunk_refs(FILE *file, const char *location, ChunkRef **refs, arena_t *arena);
+// Remplace les chunks déjà présents dans refs par une référence vers leur emplacement
+int reference_known_chunks(Chunk *chunks, int chunk_count, ChunkRef *refs, int ref_count, arena_t *arena);
+// Décode une référence externe : index du chunk et emplacement du fichier qui le contient
+int parse_external_ref(const Chunk *chunk, unsigned int *index, const char **location);
 
 #endif // DEDUPLICATION_H
 
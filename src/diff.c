@@ -0,0 +1,198 @@
+#include "diff.h"
+#include "path_index.h"
+#include "backup_manager.h"
+#include "deduplication.h"
+#include "file_handler.h"
+#include "refcount.h"
+#include "stats.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#define MAX_SIZE_PATH 2048
+// Longueur d'un MD5 en hexadécimal dans une entrée
+#define MD5_HEX_LENGTH (2 * MD5_DIGEST_LENGTH)
+
+extern int verbose_flag;
+
+// Une des deux sauvegardes comparées
+typedef struct {
+    const char *snapshot_path;
+    char backup_dir[MAX_SIZE_PATH];
+    path_index_reader_t *reader;
+    const char *line; // entrée courante (NULL : plus d'entrée)
+    const char *rel;  // son chemin relatif, de longueur rel_len
+    size_t rel_len;
+    ref_sizes_t ref_sizes; // tailles des chunks désignés par des références externes
+} diff_side_t;
+
+// Compteurs d'un diff
+typedef struct {
+    unsigned long long compared;
+    unsigned long long added, removed, modified, touched, unchanged;
+    long long added_bytes, removed_bytes, modified_bytes;
+} diff_totals_t;
+
+/**
+ * @brief Passe à l'entrée suivante d'une sauvegarde.
+ */
+static void side_next(diff_side_t *side) {
+    side->line = path_index_next(side->reader);
+    if (side->line) {
+        side->rel = path_index_rel_path(side->line, &side->rel_len);
+    }
+}
+
+static int side_open(diff_side_t *side, const char *snapshot_path) {
+    memset(side, 0, sizeof(*side));
+    side->snapshot_path = snapshot_path;
+    snprintf(side->backup_dir, sizeof(side->backup_dir), "%s", snapshot_path);
+    size_t len = strlen(side->backup_dir);
+    while (len > 1 && side->backup_dir[len - 1] == '/') {
+        side->backup_dir[--len] = '\0';
+    }
+    char *last_slash = strrchr(side->backup_dir, '/');
+    if (last_slash) {
+        *last_slash = '\0';
+    } else {
+        strcpy(side->backup_dir, ".");
+    }
+    side->ref_sizes.backup_dir = side->backup_dir;
+    side->reader = path_index_open(snapshot_path);
+    if (!side->reader) {
+        fprintf(stderr, "Erreur : %s n'a ni index des chemins ni .backup_log\n", snapshot_path);
+        return -1;
+    }
+    side_next(side);
+    return 0;
+}
+
+static void side_close(diff_side_t *side) {
+    path_index_close(side->reader);
+    ref_sizes_free(&side->ref_sizes);
+}
+
+/**
+ * @brief Taille d'origine du fichier d'une entrée, d'après les en-têtes de son image .dedup.
+ */
+static unsigned long long entry_size(diff_side_t *side, const char *line) {
+    char copy[4096 * 4];
+    snprintf(copy, sizeof(copy), "%s", line);
+    log_t logs = {0};
+    log_element *elt = parse_log_line(&logs, copy);
+    FILE *file = elt ? open_entry_dedup(side->backup_dir, side->snapshot_path, elt) : NULL;
+    free_backup_log(&logs);
+    stats_add(STATS_METADATA_OPS, 1);
+    if (!file) {
+        return 0;
+    }
+    unsigned long long size = dedup_image_size(&side->ref_sizes, file);
+    fclose(file);
+    return size;
+}
+
+// Ordre des chemins relatifs, celui de strcmp (et de l'index)
+static int compare_paths(const diff_side_t *a, const diff_side_t *b) {
+    int cmp = memcmp(a->rel, b->rel, a->rel_len < b->rel_len ? a->rel_len : b->rel_len);
+    if (cmp != 0) {
+        return cmp;
+    }
+    return a->rel_len < b->rel_len ? -1 : (a->rel_len > b->rel_len);
+}
+
+/**
+ * @brief Écrit une différence de taille signée (ex. "+12.3 Ko").
+ */
+static void format_delta(long long delta, char *buffer, size_t size) {
+    char text[32];
+    format_size(delta < 0 ? -(unsigned long long)delta : (unsigned long long)delta, text, sizeof(text));
+    snprintf(buffer, size, "%c%s", delta < 0 ? '-' : '+', text);
+}
+
+/**
+ * @brief Compare une entrée présente dans les deux sauvegardes (même chemin).
+ */
+static void compare_entries(diff_side_t *a, diff_side_t *b, diff_totals_t *totals) {
+    // Après le chemin : ";date;md5[;segment;position;taille]"
+    const char *date_a = a->rel + a->rel_len + 1;
+    const char *date_b = b->rel + b->rel_len + 1;
+    size_t date_len_a = strcspn(date_a, ";");
+    size_t date_len_b = strcspn(date_b, ";");
+    const char *md5_a = date_a + date_len_a + (date_a[date_len_a] == ';');
+    const char *md5_b = date_b + date_len_b + (date_b[date_len_b] == ';');
+    int same_content = strncmp(md5_a, md5_b, MD5_HEX_LENGTH) == 0;
+    int same_date = date_len_a == date_len_b && memcmp(date_a, date_b, date_len_a) == 0;
+    char delta_text[48];
+    if (!same_content) {
+        long long delta = (long long)entry_size(b, b->line) - (long long)entry_size(a, a->line);
+        totals->modified++;
+        totals->modified_bytes += delta;
+        format_delta(delta, delta_text, sizeof(delta_text));
+        printf("M %.*s (%s)\n", (int)b->rel_len, b->rel, delta_text);
+    } else if (!same_date) {
+        totals->touched++;
+        printf("T %.*s (date seule)\n", (int)b->rel_len, b->rel);
+    } else {
+        totals->unchanged++;
+    }
+}
+
+int diff_backups(const char *snapshot_a, const char *snapshot_b) {
+    uint64_t start = stats_now_ns();
+    diff_side_t a, b;
+    if (side_open(&a, snapshot_a) != 0) {
+        return -1;
+    }
+    if (side_open(&b, snapshot_b) != 0) {
+        side_close(&a);
+        return -1;
+    }
+
+    // Fusion des deux listes triées par chemin
+    diff_totals_t totals = {0};
+    char delta_text[48];
+    while (a.line || b.line) {
+        int cmp = !a.line ? 1 : !b.line ? -1 : compare_paths(&a, &b);
+        totals.compared++;
+        if (cmp < 0) {
+            long long size = (long long)entry_size(&a, a.line);
+            totals.removed++;
+            totals.removed_bytes -= size;
+            format_delta(-size, delta_text, sizeof(delta_text));
+            printf("- %.*s (%s)\n", (int)a.rel_len, a.rel, delta_text);
+            side_next(&a);
+        } else if (cmp > 0) {
+            long long size = (long long)entry_size(&b, b.line);
+            totals.added++;
+            totals.added_bytes += size;
+            format_delta(size, delta_text, sizeof(delta_text));
+            printf("+ %.*s (%s)\n", (int)b.rel_len, b.rel, delta_text);
+            side_next(&b);
+        } else {
+            compare_entries(&a, &b, &totals);
+            side_next(&a);
+            side_next(&b);
+        }
+    }
+    side_close(&a);
+    side_close(&b);
+
+    double seconds = (stats_now_ns() - start) / 1e9;
+    char added_text[48], removed_text[48], modified_text[48], total_text[48];
+    format_delta(totals.added_bytes, added_text, sizeof(added_text));
+    format_delta(totals.removed_bytes, removed_text, sizeof(removed_text));
+    format_delta(totals.modified_bytes, modified_text, sizeof(modified_text));
+    format_delta(totals.added_bytes + totals.removed_bytes + totals.modified_bytes, total_text,
+                 sizeof(total_text));
+    printf("Différences de %s à %s :\n", snapshot_a, snapshot_b);
+    printf("  Ajoutés   : %llu (%s)\n", totals.added, added_text);
+    printf("  Supprimés : %llu (%s)\n", totals.removed, removed_text);
+    printf("  Modifiés  : %llu (%s), dont seule la date a changé : %llu\n", totals.modified + totals.touched,
+           modified_text, totals.touched);
+    printf("  Inchangés : %llu\n", totals.unchanged);
+    printf("  Total     : %s\n", total_text);
+    printf("%llu entrées comparées en %.3f s (%.0f entrées/s)\n", totals.compared, seconds,
+           seconds > 0 ? totals.compared / seconds : 0.0);
+    return 0;
+}
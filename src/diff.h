@@ -0,0 +1,20 @@
+#ifndef DIFF_H
+#define DIFF_H
+
+/**
+ * @brief Affiche les différences entre deux sauvegardes.
+ *
+ * Les entrées des deux sauvegardes sont lues dans l'ordre des chemins (index des chemins,
+ * ou .backup_log trié pour une sauvegarde qui n'en a pas) et fusionnées : un chemin
+ * absent d'un côté est ajouté ou supprimé, un chemin présent des deux côtés est modifié
+ * si son MD5 ou sa date diffère. Aucune donnée de fichier n'est lue : la taille des
+ * entrées ajoutées, supprimées ou modifiées est calculée à partir des en-têtes de chunks
+ * de leur image .dedup, les entrées inchangées ne coûtent qu'une comparaison.
+ *
+ * @param snapshot_a Chemin de la sauvegarde de référence.
+ * @param snapshot_b Chemin de la sauvegarde comparée.
+ * @return 0, -1 si une des sauvegardes n'a ni index ni .backup_log.
+ */
+int diff_backups(const char *snapshot_a, const char *snapshot_b);
+
+#endif // DIFF_H
@@ -0,0 +1,213 @@
+#define _GNU_SOURCE // O_DIRECT, MAP_HUGETLB
+#include "direct_io.h"
+#include "stats.h"
+#include "throttle.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+extern int verbose_flag;
+
+struct direct_reader {
+    int fd;
+    off_t size;
+    unsigned char *buffers; // depth tampons de DIRECT_IO_REQUEST_SIZE octets
+    size_t lengths[DIRECT_IO_MAX_DEPTH];
+    uint64_t latencies[DIRECT_IO_MAX_DEPTH]; // durée de la lecture de chaque requête
+    int depth;
+    int head;     // prochaine requête rendue à l'appelant
+    int filled;   // requêtes lues et pas encore rendues
+    int holding;  // l'appelant utilise encore la requête head
+    int done;     // le thread a lu tout le fichier
+    int failed;   // errno de la lecture qui a échoué
+    int cancel;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t thread;
+};
+
+static int depth = 0;
+// Les tampons et le lecteur servent à tous les fichiers : un seul est lu à la fois
+static direct_reader_t reader;
+static unsigned char *buffers = NULL;
+
+void direct_io_enable(int requested_depth) {
+    depth = requested_depth > DIRECT_IO_MAX_DEPTH ? DIRECT_IO_MAX_DEPTH : requested_depth;
+}
+
+int direct_io_applies(const struct stat *st) {
+    return depth > 0 && S_ISREG(st->st_mode) && st->st_size >= DIRECT_IO_MIN_SIZE
+           && (off_t)st->st_blocks * 512 >= st->st_size;
+}
+
+/**
+ * @brief Alloue les tampons alignés, sur des pages géantes si le système en a de libres,
+ * sinon sur des pages ordinaires avec les pages géantes transparentes demandées.
+ */
+static unsigned char *allocate_buffers(size_t size) {
+    void *memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (memory != MAP_FAILED) {
+        if (verbose_flag) {
+            printf("[INFO] Tampons de lecture directe sur des pages géantes (%zu octets)\n", size);
+        }
+        return memory;
+    }
+    memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+        return NULL;
+    }
+    madvise(memory, size, MADV_HUGEPAGE);
+    return memory;
+}
+
+/**
+ * @brief Lit la requête qui commence à offset ; la fin du fichier, dont la taille n'est pas
+ * forcément alignée, est relue sans O_DIRECT si le système de fichiers la refuse.
+ */
+static ssize_t read_request(direct_reader_t *r, unsigned char *buffer, off_t offset) {
+    size_t total = 0;
+    while (total < DIRECT_IO_REQUEST_SIZE && offset + (off_t)total < r->size) {
+        ssize_t n = pread(r->fd, buffer + total, DIRECT_IO_REQUEST_SIZE - total, offset + total);
+        if (n < 0 && errno == EINVAL && (fcntl(r->fd, F_GETFL) & O_DIRECT)) {
+            fcntl(r->fd, F_SETFL, fcntl(r->fd, F_GETFL) & ~O_DIRECT);
+            continue;
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return n < 0 ? -1 : (ssize_t)total;
+        }
+        total += n;
+        // Une lecture courte non alignée ne peut venir que de la fin du fichier
+        if (total % DIRECT_IO_ALIGN != 0) {
+            break;
+        }
+    }
+    return total;
+}
+
+static void *prefetch_thread(void *arg) {
+    direct_reader_t *r = arg;
+    off_t offset = 0;
+    int tail = 0;
+    while (offset < r->size) {
+        pthread_mutex_lock(&r->lock);
+        while (r->filled + r->holding >= r->depth && !r->cancel) {
+            pthread_cond_wait(&r->cond, &r->lock);
+        }
+        int cancel = r->cancel;
+        pthread_mutex_unlock(&r->lock);
+        if (cancel) {
+            break;
+        }
+        unsigned char *buffer = r->buffers + (size_t)tail * DIRECT_IO_REQUEST_SIZE;
+        uint64_t start = stats_now_ns();
+        ssize_t n = read_request(r, buffer, offset);
+        pthread_mutex_lock(&r->lock);
+        if (n <= 0) {
+            r->failed = n < 0 ? errno : 0;
+            pthread_mutex_unlock(&r->lock);
+            break;
+        }
+        if (n > r->size - offset) {
+            // Fichier agrandi depuis le stat de l'appelant : lu jusqu'à la taille vue alors
+            n = r->size - offset;
+        }
+        r->lengths[tail] = n;
+        r->latencies[tail] = stats_now_ns() - start;
+        r->filled++;
+        pthread_cond_broadcast(&r->cond);
+        pthread_mutex_unlock(&r->lock);
+        offset += n;
+        tail = (tail + 1) % r->depth;
+    }
+    pthread_mutex_lock(&r->lock);
+    r->done = 1;
+    pthread_cond_broadcast(&r->cond);
+    pthread_mutex_unlock(&r->lock);
+    return NULL;
+}
+
+direct_reader_t *direct_open(const char *path, const struct stat *st) {
+    if (depth <= 0 || !direct_io_applies(st)) {
+        return NULL;
+    }
+    int fd = open(path, O_RDONLY | O_DIRECT);
+    if (fd < 0) {
+        // EINVAL : le système de fichiers (tmpfs par exemple) ne prend pas en charge O_DIRECT
+        return NULL;
+    }
+    if (!buffers) {
+        buffers = allocate_buffers((size_t)DIRECT_IO_MAX_DEPTH * DIRECT_IO_REQUEST_SIZE);
+        if (!buffers) {
+            close(fd);
+            depth = 0;
+            return NULL;
+        }
+    }
+    memset(&reader, 0, sizeof(reader));
+    reader.fd = fd;
+    reader.size = st->st_size;
+    reader.buffers = buffers;
+    reader.depth = depth;
+    pthread_mutex_init(&reader.lock, NULL);
+    pthread_cond_init(&reader.cond, NULL);
+    if (pthread_create(&reader.thread, NULL, prefetch_thread, &reader) != 0) {
+        close(fd);
+        return NULL;
+    }
+    stats_add(STATS_METADATA_OPS, 1);
+    return &reader;
+}
+
+size_t direct_read(direct_reader_t *r, const unsigned char **data) {
+    pthread_mutex_lock(&r->lock);
+    // La requête rendue au dernier appel est libérée pour le thread de lecture
+    if (r->holding) {
+        r->holding = 0;
+        r->filled--;
+        r->head = (r->head + 1) % r->depth;
+        pthread_cond_broadcast(&r->cond);
+    }
+    while (r->filled == 0 && !r->done) {
+        pthread_cond_wait(&r->cond, &r->lock);
+    }
+    size_t length = 0;
+    uint64_t latency = 0;
+    if (r->filled > 0) {
+        r->holding = 1;
+        length = r->lengths[r->head];
+        latency = r->latencies[r->head];
+        *data = r->buffers + (size_t)r->head * DIRECT_IO_REQUEST_SIZE;
+    }
+    pthread_mutex_unlock(&r->lock);
+    stats_add(STATS_BYTES_READ, length);
+    // Les pauses de l'appelant ralentissent aussi le thread, bloqué quand toutes les
+    // requêtes d'avance sont lues
+    throttle_read(length, latency);
+    return length;
+}
+
+int direct_close(direct_reader_t *r) {
+    pthread_mutex_lock(&r->lock);
+    r->cancel = 1;
+    pthread_cond_broadcast(&r->cond);
+    pthread_mutex_unlock(&r->lock);
+    pthread_join(r->thread, NULL);
+    close(r->fd);
+    pthread_mutex_destroy(&r->lock);
+    pthread_cond_destroy(&r->cond);
+    if (r->failed) {
+        errno = r->failed;
+        perror("Erreur de lecture directe");
+    }
+    return r->failed ? -1 : 0;
+}
@@ -0,0 +1,47 @@
+#ifndef DIRECT_IO_H
+#define DIRECT_IO_H
+
+#include <stddef.h>
+#include <sys/stat.h>
+
+// Avec --direct-io, les fichiers d'au moins DIRECT_IO_MIN_SIZE octets sont lus avec
+// O_DIRECT (sans passer par le cache de pages) par requêtes de DIRECT_IO_REQUEST_SIZE
+// octets, un thread lisant jusqu'à « profondeur » requêtes à l'avance. DIRECT_IO_REQUEST_SIZE
+// est CHUNK_MAX_SIZE : un multiple de toutes les tailles de chunks
+#define DIRECT_IO_MIN_SIZE (8 * 1024 * 1024)
+#define DIRECT_IO_REQUEST_SIZE (4 * 1024 * 1024)
+#define DIRECT_IO_DEFAULT_DEPTH 4
+#define DIRECT_IO_MAX_DEPTH 16
+// Alignement des positions, tailles et tampons exigé par O_DIRECT
+#define DIRECT_IO_ALIGN 4096
+
+typedef struct direct_reader direct_reader_t;
+
+// Active la lecture directe avec depth requêtes d'avance (0 : désactivée)
+void direct_io_enable(int depth);
+// Vrai si un fichier de ce type et de cette taille serait lu par direct_open
+int direct_io_applies(const struct stat *st);
+
+/**
+ * @brief Ouvre path en lecture directe et lance la lecture anticipée de ses st->st_size
+ * premiers octets (st est le stat de l'appelant : le reste d'un fichier agrandi depuis
+ * n'est pas lu).
+ *
+ * @return NULL si la lecture directe est désactivée, si le fichier est trop petit ou creux
+ * (ses trous sont trouvés par SEEK_HOLE en lecture classique), ou si le système de fichiers
+ * refuse O_DIRECT : l'appelant lit alors le fichier normalement.
+ */
+direct_reader_t *direct_open(const char *path, const struct stat *st);
+
+/**
+ * @brief Requête suivante du fichier : *data pointe vers ses octets (au plus
+ * DIRECT_IO_REQUEST_SIZE, multiple de la taille des chunks sauf à la fin), valables jusqu'à
+ * l'appel suivant.
+ * @return Le nombre d'octets, 0 à la fin du fichier ou après une erreur.
+ */
+size_t direct_read(direct_reader_t *reader, const unsigned char **data);
+
+// Arrête la lecture et ferme le fichier ; -1 si une lecture a échoué
+int direct_close(direct_reader_t *reader);
+
+#endif // DIRECT_IO_H
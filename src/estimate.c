@@ -0,0 +1,492 @@
+#include "estimate.h"
+#include "backup_manager.h"
+#include "deduplication.h"
+#include "file_handler.h"
+#include "arena.h"
+#include "stats.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define MAX_SIZE_PATH 2048
+// Lectures minimales pour mesurer le débit de lecture et de hachage
+#define ESTIMATE_MIN_TIMING_READS 64
+// Quantile de la loi normale pour un intervalle de confiance à 95 %
+#define Z_95 1.96
+// En-tête de chaque chunk dans un .dedup : MD5 puis taille
+#define CHUNK_HEADER_SIZE (MD5_DIGEST_LENGTH + sizeof(size_t))
+
+extern int verbose_flag;
+
+// Fichier du dernier .backup_log
+typedef struct {
+    const char *rel_path; // chemin relatif à la source
+    const char *location; // "sauvegarde/chemin", emplacement de son .dedup
+    const char *date;
+    int seen; // retrouvé dans la source
+} old_entry_t;
+
+// Fichier régulier de la source
+typedef struct {
+    const char *path;
+    off_t size;
+    int changed;
+    const char *old_location; // version précédente d'un fichier modifié (NULL si nouveau)
+} source_file_t;
+
+// Somme et somme des carrés des valeurs d'un échantillon
+typedef struct {
+    double sum;
+    double sum_sq;
+    uint64_t count;
+} sample_t;
+
+typedef struct {
+    source_file_t *files;
+    int file_count;
+    int file_capacity;
+    int changed_files;
+    int new_files;
+    unsigned long long source_bytes;
+    unsigned long long changed_bytes;
+    uint64_t changed_chunks; // population échantillonnée : chunks des fichiers modifiés
+    uint64_t sampled;
+    uint64_t sampled_new;
+    uint64_t sampled_zero;
+    sample_t new_stored; // octets stockés par un nouveau chunk (en-tête compris)
+    sample_t ref_stored; // octets stockés par une référence vers la version précédente
+    sample_t read_cost;  // secondes par octet lu et haché
+    uint64_t random_state;
+} estimate_t;
+
+/**
+ * @brief Générateur pseudo-aléatoire pour le décalage de l'échantillon (splitmix64).
+ */
+static uint64_t next_random(uint64_t *state) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static void sample_add(sample_t *sample, double value) {
+    sample->sum += value;
+    sample->sum_sq += value * value;
+    sample->count++;
+}
+
+static double sample_mean(const sample_t *sample, double fallback) {
+    return sample->count ? sample->sum / sample->count : fallback;
+}
+
+/**
+ * @brief Demi-largeur de l'intervalle de confiance à 95 % de la moyenne.
+ */
+static double sample_margin(const sample_t *sample) {
+    if (sample->count < 2) {
+        return 0;
+    }
+    double mean = sample->sum / sample->count;
+    double variance = (sample->sum_sq - sample->count * mean * mean) / (sample->count - 1);
+    return variance > 0 ? Z_95 * sqrt(variance / sample->count) : 0;
+}
+
+/**
+ * @brief Intervalle de Wilson à 95 % d'une proportion observée sur n des population
+ * éléments, resserré par la correction de population finie (nul si tout a été lu).
+ */
+static void proportion_bounds(uint64_t hits, uint64_t n, uint64_t population, double *low, double *high) {
+    if (n == 0) {
+        *low = 0;
+        *high = 1;
+        return;
+    }
+    double p = (double)hits / n;
+    double z2 = Z_95 * Z_95;
+    double center = (p + z2 / (2.0 * n)) / (1 + z2 / n);
+    double half = Z_95 * sqrt(p * (1 - p) / n + z2 / (4.0 * n * n)) / (1 + z2 / n);
+    double fpc = population > 1 && n < population ? sqrt((double)(population - n) / (population - 1)) : 0;
+    *low = p - (p - fmax(0, center - half)) * fpc;
+    *high = p + (fmin(1, center + half) - p) * fpc;
+}
+
+static int compare_old_entries(const void *a, const void *b) {
+    return strcmp(((const old_entry_t *)a)->rel_path, ((const old_entry_t *)b)->rel_path);
+}
+
+static int compare_refs_md5(const void *a, const void *b) {
+    return memcmp(((const ChunkRef *)a)->md5, ((const ChunkRef *)b)->md5, MD5_DIGEST_LENGTH);
+}
+
+/**
+ * @brief Lit le dernier .backup_log, trié par chemin relatif.
+ * @return Le nombre d'entrées (0 pour une première sauvegarde).
+ */
+static int load_old_entries(const char *backup_dir, log_t *logs, old_entry_t **entries) {
+    char log_path[MAX_SIZE_PATH];
+    snprintf(log_path, sizeof(log_path), "%s/.backup_log", backup_dir);
+    *entries = NULL;
+    if (access(log_path, F_OK) != 0) {
+        return 0;
+    }
+    *logs = read_backup_log(log_path);
+    int count = 0;
+    for (log_element *e = logs->head; e; e = e->next) {
+        count++;
+    }
+    *entries = calloc(count ? count : 1, sizeof(old_entry_t));
+    if (!*entries) {
+        return 0;
+    }
+    int n = 0;
+    for (log_element *e = logs->head; e; e = e->next) {
+        const char *sep = strchr(e->path, '/');
+        if (sep) {
+            (*entries)[n].rel_path = sep + 1;
+            (*entries)[n].location = e->path;
+            (*entries)[n].date = e->date;
+            n++;
+        }
+    }
+    qsort(*entries, n, sizeof(old_entry_t), compare_old_entries);
+    return n;
+}
+
+/**
+ * @brief Ajoute un fichier de la source ; il est modifié si sa date diffère de celle
+ * enregistrée, comme create_backup la formate.
+ */
+static void add_source_file(estimate_t *est, arena_t *arena, const char *path, const char *rel_path,
+                            const struct stat *st, old_entry_t *old_entries, int old_count) {
+    if (est->file_count == est->file_capacity) {
+        int capacity = est->file_capacity ? est->file_capacity * 2 : 1024;
+        source_file_t *files = realloc(est->files, capacity * sizeof(source_file_t));
+        if (!files) {
+            return;
+        }
+        est->files = files;
+        est->file_capacity = capacity;
+    }
+    source_file_t *file = &est->files[est->file_count++];
+    file->path = arena_strdup(arena, path);
+    file->size = st->st_size;
+    file->old_location = NULL;
+    est->source_bytes += st->st_size;
+
+    old_entry_t key = {.rel_path = rel_path};
+    old_entry_t *old = old_count ? bsearch(&key, old_entries, old_count, sizeof(old_entry_t), compare_old_entries) : NULL;
+    char mod_time[128];
+    struct tm *tm_info = localtime(&st->st_mtime);
+    snprintf(
+        mod_time, sizeof(mod_time), "%04d-%02d-%02d-%02d:%02d:%02d.%03d",
+        tm_info->tm_year + 1900, tm_info->tm_mon + 1, tm_info->tm_mday,
+        tm_info->tm_hour, tm_info->tm_min, tm_info->tm_sec, 0
+    );
+    if (old) {
+        old->seen = 1;
+    }
+    file->changed = !old || !old->date || strcmp(old->date, mod_time) != 0;
+    if (!file->changed) {
+        return;
+    }
+    est->changed_files++;
+    est->changed_bytes += st->st_size;
+    est->changed_chunks += ((uint64_t)st->st_size + get_chunk_size() - 1) / get_chunk_size();
+    if (old) {
+        file->old_location = old->location;
+    } else {
+        est->new_files++;
+    }
+    if (verbose_flag) {
+        printf("[INFO] %s : %s\n", old ? "Modifié" : "Nouveau", rel_path);
+    }
+}
+
+/**
+ * @brief Parcourt la source sans lire le contenu des fichiers.
+ */
+static int scan_source(estimate_t *est, arena_t *arena, const char *source_dir,
+                       old_entry_t *old_entries, int old_count) {
+    size_t source_len = strlen(source_dir);
+    int stack_capacity = 64;
+    int top = 0;
+    char **stack = malloc(stack_capacity * sizeof(char *));
+    if (!stack) {
+        return -1;
+    }
+    stack[top++] = arena_strdup(arena, source_dir);
+    int ret = 0;
+
+    while (top > 0) {
+        char *dir_path = stack[--top];
+        DIR *dir = opendir(dir_path);
+        if (!dir) {
+            perror("Erreur : ouverture du répertoire source");
+            ret = -1;
+            continue;
+        }
+        struct dirent *entry;
+        while ((entry = readdir(dir))) {
+            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+                continue;
+            }
+            char path[MAX_SIZE_PATH];
+            snprintf(path, sizeof(path), "%s/%s", dir_path, entry->d_name);
+            struct stat st;
+            if (stat(path, &st) != 0) {
+                continue;
+            }
+            stats_add(STATS_METADATA_OPS, 1);
+            const char *rel_path = path + source_len;
+            while (*rel_path == '/') {
+                rel_path++;
+            }
+            if (S_ISDIR(st.st_mode)) {
+                stats_add(STATS_DIRS_SCANNED, 1);
+                if (top == stack_capacity) {
+                    char **grown = realloc(stack, stack_capacity * 2 * sizeof(char *));
+                    if (!grown) {
+                        continue;
+                    }
+                    stack = grown;
+                    stack_capacity *= 2;
+                }
+                stack[top++] = arena_strdup(arena, path);
+            } else if (S_ISREG(st.st_mode)) {
+                stats_add(STATS_FILES_SCANNED, 1);
+                add_source_file(est, arena, path, rel_path, &st, old_entries, old_count);
+            }
+        }
+        closedir(dir);
+    }
+    free(stack);
+    return ret;
+}
+
+/**
+ * @brief Lit et hache le chunk index de fd ; retourne sa taille (0 en fin de fichier).
+ */
+static ssize_t read_sample_chunk(estimate_t *est, int fd, uint64_t index, unsigned char *buffer,
+                                 unsigned char *md5, int *zero) {
+    uint64_t start = stats_now_ns();
+    ssize_t length = pread(fd, buffer, get_chunk_size(), (off_t)(index * get_chunk_size()));
+    if (length <= 0) {
+        return 0;
+    }
+    *zero = is_zero_block(buffer, length);
+    if (!*zero) {
+        compute_md5(buffer, length, md5);
+    }
+    sample_add(&est->read_cost, (stats_now_ns() - start) / 1e9 / length);
+    stats_add(STATS_BYTES_READ, length);
+    stats_add(STATS_BYTES_HASHED, length);
+    return length;
+}
+
+/**
+ * @brief Lit sample_percent % des chunks d'un fichier modifié, à intervalle régulier
+ * depuis une position aléatoire, et les compare aux chunks de sa version précédente.
+ */
+static void sample_file(estimate_t *est, const char *backup_dir, const source_file_t *file,
+                        double sample_percent, arena_t *arena) {
+    uint64_t chunk_count = ((uint64_t)file->size + get_chunk_size() - 1) / get_chunk_size();
+    if (chunk_count == 0) {
+        return;
+    }
+    uint64_t sample_count = (uint64_t)ceil(chunk_count * sample_percent / 100.0);
+    if (sample_count < 1) {
+        sample_count = 1;
+    }
+    if (sample_count > chunk_count) {
+        sample_count = chunk_count;
+    }
+    int fd = open(file->path, O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+    unsigned char *buffer = malloc(get_chunk_size());
+    if (!buffer) {
+        close(fd);
+        return;
+    }
+
+    ChunkRef *refs = NULL;
+    int ref_count = 0;
+    double ref_size = 0;
+    if (file->old_location) {
+        char old_dedup[MAX_SIZE_PATH];
+        snprintf(old_dedup, sizeof(old_dedup), "%s/%s.dedup", backup_dir, file->old_location);
+        FILE *fold = fopen(old_dedup, "rb");
+        if (fold) {
+            ref_count = read_chunk_refs(fold, file->old_location, &refs, arena);
+            fclose(fold);
+        }
+        if (ref_count > 0) {
+            qsort(refs, ref_count, sizeof(ChunkRef), compare_refs_md5);
+        }
+        ref_size = CHUNK_HEADER_SIZE + sizeof(unsigned int) + strlen(file->old_location) + 1;
+    }
+
+    double step = (double)chunk_count / sample_count;
+    double offset = (next_random(&est->random_state) % 1000000) / 1e6 * step;
+    for (uint64_t i = 0; i < sample_count; i++) {
+        uint64_t index = (uint64_t)(offset + i * step);
+        unsigned char md5[MD5_DIGEST_LENGTH];
+        int zero = 0;
+        ssize_t length = read_sample_chunk(est, fd, index, buffer, md5, &zero);
+        if (length == 0) {
+            continue;
+        }
+        est->sampled++;
+        if (zero) {
+            est->sampled_zero++;
+            continue;
+        }
+        ChunkRef key;
+        memcpy(key.md5, md5, MD5_DIGEST_LENGTH);
+        if (ref_count > 0 && bsearch(&key, refs, ref_count, sizeof(ChunkRef), compare_refs_md5)) {
+            sample_add(&est->ref_stored, ref_size);
+        } else {
+            est->sampled_new++;
+            sample_add(&est->new_stored, CHUNK_HEADER_SIZE + length);
+        }
+    }
+    free(buffer);
+    close(fd);
+    arena_reset(arena);
+}
+
+/**
+ * @brief Complète la mesure du débit par des lectures réparties sur toute la source
+ * quand les fichiers modifiés n'ont pas fourni assez de chunks.
+ */
+static void sample_timing(estimate_t *est) {
+    if (est->source_bytes == 0) {
+        return;
+    }
+    unsigned char *buffer = malloc(get_chunk_size());
+    if (!buffer) {
+        return;
+    }
+    for (int attempt = 0; est->read_cost.count < ESTIMATE_MIN_TIMING_READS && attempt < 4 * ESTIMATE_MIN_TIMING_READS; attempt++) {
+        // Fichier tiré proportionnellement à sa taille
+        unsigned long long target = next_random(&est->random_state) % est->source_bytes;
+        int i = 0;
+        while (i < est->file_count - 1 && target >= (unsigned long long)est->files[i].size) {
+            target -= est->files[i].size;
+            i++;
+        }
+        int fd = open(est->files[i].path, O_RDONLY);
+        if (fd < 0) {
+            continue;
+        }
+        unsigned char md5[MD5_DIGEST_LENGTH];
+        int zero;
+        read_sample_chunk(est, fd, target / get_chunk_size(), buffer, md5, &zero);
+        close(fd);
+    }
+    free(buffer);
+}
+
+int estimate_backup(const char *source_dir, const char *backup_dir, double sample_percent) {
+    uint64_t start = stats_now_ns();
+    estimate_t est;
+    memset(&est, 0, sizeof(est));
+    est.random_state = (uint64_t)time(NULL) ^ ((uint64_t)getpid() << 32);
+    arena_t arena;
+    arena_init(&arena, 0);
+    arena_t file_arena;
+    arena_init(&file_arena, 0);
+
+    log_t old_logs = {.head = NULL, .tail = NULL, .pool = NULL};
+    old_entry_t *old_entries = NULL;
+    int old_count = load_old_entries(backup_dir, &old_logs, &old_entries);
+
+    uint64_t scan_start = stats_now_ns();
+    int ret = scan_source(&est, &arena, source_dir, old_entries, old_count);
+    double scan_seconds = (stats_now_ns() - scan_start) / 1e9;
+    stats_phase_end(STATS_PHASE_SCAN, scan_start);
+
+    int deleted = 0;
+    for (int i = 0; i < old_count; i++) {
+        deleted += !old_entries[i].seen;
+    }
+
+    uint64_t sample_start = stats_now_ns();
+    for (int i = 0; i < est.file_count; i++) {
+        if (est.files[i].changed) {
+            sample_file(&est, backup_dir, &est.files[i], sample_percent, &file_arena);
+        }
+    }
+    sample_timing(&est);
+    double sample_seconds = (stats_now_ns() - sample_start) / 1e9;
+
+    // Extrapolation aux chunks de tous les fichiers modifiés
+    double population = est.changed_chunks;
+    double new_fraction = est.sampled ? (double)est.sampled_new / est.sampled : 0;
+    double zero_fraction = est.sampled ? (double)est.sampled_zero / est.sampled : 0;
+    double new_low, new_high;
+    proportion_bounds(est.sampled_new, est.sampled, est.changed_chunks, &new_low, &new_high);
+    if (est.changed_chunks == 0) {
+        new_low = new_high = 0;
+    }
+    double new_chunk_size = sample_mean(&est.new_stored, CHUNK_HEADER_SIZE + get_chunk_size());
+    double ref_chunk_size = sample_mean(&est.ref_stored, CHUNK_HEADER_SIZE + sizeof(unsigned int) + 64);
+    double stored[3];
+    double fractions[3] = {new_fraction, new_low, new_high};
+    for (int i = 0; i < 3; i++) {
+        // Les chunks ni nouveaux ni nuls deviennent des références
+        double referenced = fmax(0, 1 - fractions[i] - zero_fraction);
+        stored[i] = est.changed_files * DEDUP_HEADER_SIZE
+                  + population * (fractions[i] * new_chunk_size + referenced * ref_chunk_size);
+    }
+
+    // Une sauvegarde relit toute la source pour son MD5, puis les fichiers modifiés pour
+    // les découper en chunks ; l'écriture est comptée au même débit
+    unsigned long long bytes_to_read = est.source_bytes + est.changed_bytes;
+    double cost = sample_mean(&est.read_cost, 0);
+    double cost_margin = sample_margin(&est.read_cost);
+    double duration = scan_seconds + (bytes_to_read + stored[0]) * cost;
+    double duration_low = scan_seconds + (bytes_to_read + stored[1]) * fmax(0, cost - cost_margin);
+    double duration_high = scan_seconds + (bytes_to_read + stored[2]) * (cost + cost_margin);
+
+    char read_text[32], source_text[32], changed_text[32];
+    char stored_text[32], stored_low_text[32], stored_high_text[32];
+    format_size(bytes_to_read, read_text, sizeof(read_text));
+    format_size(est.source_bytes, source_text, sizeof(source_text));
+    format_size(est.changed_bytes, changed_text, sizeof(changed_text));
+    format_size((unsigned long long)stored[0], stored_text, sizeof(stored_text));
+    format_size((unsigned long long)stored[1], stored_low_text, sizeof(stored_low_text));
+    format_size((unsigned long long)stored[2], stored_high_text, sizeof(stored_high_text));
+
+    printf("Estimation de la sauvegarde de %s (%g %% des chunks modifiés, %llu chunks lus en %.2f s)\n",
+           source_dir, sample_percent, (unsigned long long)est.read_cost.count, sample_seconds);
+    if (old_count == 0) {
+        printf("  Première sauvegarde : tous les fichiers sont nouveaux\n");
+    }
+    printf("  Fichiers        : %d (%d modifiés, %d nouveaux, %d supprimés, %d inchangés)\n",
+           est.file_count, est.changed_files - est.new_files, est.new_files, deleted,
+           est.file_count - est.changed_files);
+    printf("  Octets à lire   : %s (source %s, fichiers modifiés %s)\n", read_text, source_text, changed_text);
+    printf("  Nouveaux chunks : %.0f [%.0f - %.0f] sur %llu\n", population * new_fraction,
+           population * new_low, population * new_high, (unsigned long long)est.changed_chunks);
+    printf("  Octets stockés  : %s [%s - %s]\n", stored_text, stored_low_text, stored_high_text);
+    printf("  Durée estimée   : %.2f s [%.2f s - %.2f s]\n", duration, duration_low, duration_high);
+    printf("Estimation faite en %.2f s\n", (stats_now_ns() - start) / 1e9);
+
+    free(est.files);
+    free(old_entries);
+    if (old_logs.pool) {
+        free_backup_log(&old_logs);
+    }
+    arena_free(&file_arena);
+    arena_free(&arena);
+    return ret;
+}
@@ -0,0 +1,24 @@
+#ifndef ESTIMATE_H
+#define ESTIMATE_H
+
+// Pourcentage des chunks des fichiers modifiés lus par défaut par --estimate
+#define ESTIMATE_DEFAULT_SAMPLE 5.0
+
+/**
+ * @brief Estime le coût d'une sauvegarde de source_dir dans backup_dir sans la faire.
+ *
+ * Les fichiers modifiés sont repérés par leur date de modification (comparée à celle du
+ * .backup_log, sans lire leur contenu). Dans chaque fichier modifié, sample_percent % des
+ * chunks (au moins un), répartis régulièrement, sont lus et hachés : les chunks déjà
+ * présents dans la version précédente ou nuls ne seraient pas stockés. Les octets à lire,
+ * les nouveaux chunks, les octets stockés et la durée de la sauvegarde sont extrapolés à
+ * partir de cet échantillon et affichés avec un intervalle de confiance à 95 %.
+ *
+ * @param source_dir Chemin du répertoire source à sauvegarder.
+ * @param backup_dir Chemin du répertoire de destination des sauvegardes.
+ * @param sample_percent Pourcentage des chunks des fichiers modifiés lus.
+ * @return 0, -1 si la source n'a pas pu être parcourue.
+ */
+int estimate_backup(const char *source_dir, const char *backup_dir, double sample_percent);
+
+#endif // ESTIMATE_H
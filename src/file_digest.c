@@ -0,0 +1,485 @@
+#define _GNU_SOURCE
+#include "file_digest.h"
+#include "manifest.h"
+#include "segment.h"
+#include "stats.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define MAX_SIZE_PATH 2048
+#define FILE_DIGEST_LINE_SIZE (4096 * 4)
+// Capacité initiale de la table (puissance de 2), doublée au-delà de 50 % d'occupation
+#define FILE_DIGEST_INITIAL_CAPACITY 1024
+// Mémoire du tri des contenus restés sur disque
+#define FILE_DIGEST_SORT_MEMORY (4 * 1024 * 1024)
+
+// Contenu resté sur disque : enregistrement de taille fixe du fichier trié, qui désigne
+// sa ligne dans FILE_DIGEST_FILE
+typedef struct {
+    unsigned char md5[MD5_DIGEST_LENGTH];
+    uint64_t size;
+    uint64_t line_offset;
+} file_digest_record_t;
+
+extern int verbose_flag;
+
+static size_t digest_hash(const unsigned char *md5, uint64_t size) {
+    uint64_t h;
+    memcpy(&h, md5, sizeof(h));
+    return (size_t)(h ^ (size * 0x9E3779B97F4A7C15ULL));
+}
+
+/**
+ * @brief Place une entrée dans la table (la capacité est suffisante).
+ */
+static void insert_slot(file_digest_t **slots, size_t capacity, file_digest_t *digest) {
+    size_t i = digest_hash(digest->md5, digest->size) & (capacity - 1);
+    while (slots[i]) {
+        i = (i + 1) & (capacity - 1);
+    }
+    slots[i] = digest;
+}
+
+static int grow(file_digest_map_t *map) {
+    size_t capacity = map->capacity ? map->capacity * 2 : FILE_DIGEST_INITIAL_CAPACITY;
+    file_digest_t **slots = calloc(capacity, sizeof(file_digest_t *));
+    if (!slots) {
+        return -1;
+    }
+    for (size_t i = 0; i < map->capacity; i++) {
+        if (map->slots[i]) {
+            insert_slot(slots, capacity, map->slots[i]);
+        }
+    }
+    free(map->slots);
+    map->slots = slots;
+    map->capacity = capacity;
+    return 0;
+}
+
+static const file_digest_t *find_in_memory(const file_digest_map_t *map, const unsigned char *md5, uint64_t size) {
+    if (map->capacity == 0) {
+        return NULL;
+    }
+    size_t i = digest_hash(md5, size) & (map->capacity - 1);
+    while (map->slots[i]) {
+        const file_digest_t *digest = map->slots[i];
+        if (digest->size == size && memcmp(digest->md5, md5, MD5_DIGEST_LENGTH) == 0) {
+            return digest;
+        }
+        i = (i + 1) & (map->capacity - 1);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Ajoute une entrée si son contenu est inconnu ; NULL s'il l'est déjà ou si la mémoire manque.
+ */
+static file_digest_t *insert(file_digest_map_t *map, const unsigned char *md5, uint64_t size, const char *location,
+                             const char *segment, uint64_t offset, uint32_t length) {
+    if ((map->max_count && map->count >= map->max_count) || find_in_memory(map, md5, size)) {
+        return NULL;
+    }
+    if ((map->count + 1) * 2 > map->capacity && grow(map) != 0) {
+        return NULL;
+    }
+    file_digest_t *digest = arena_alloc(&map->arena, sizeof(file_digest_t));
+    memcpy(digest->md5, md5, MD5_DIGEST_LENGTH);
+    digest->size = size;
+    digest->location = arena_strdup(&map->arena, location);
+    digest->segment = segment ? arena_strdup(&map->arena, segment) : NULL;
+    digest->offset = offset;
+    digest->length = length;
+    digest->added = 0;
+    insert_slot(map->slots, map->capacity, digest);
+    map->count++;
+    return digest;
+}
+
+/**
+ * @brief Découpe une ligne de FILE_DIGEST_FILE (modifiée) ; -1 si elle est mal formée.
+ */
+static int parse_line(char *line, unsigned char *md5, uint64_t *size, char **location, char **segment,
+                      uint64_t *offset, uint32_t *length) {
+    line[strcspn(line, "\n")] = '\0';
+    char *fields[6];
+    int count = 0;
+    for (char *p = line; count < 6; count++) {
+        fields[count] = p;
+        p = strchr(p, ';');
+        if (!p) {
+            count++;
+            break;
+        }
+        *p++ = '\0';
+    }
+    if ((count != 3 && count != 6) || strlen(fields[0]) != 2 * MD5_DIGEST_LENGTH) {
+        return -1;
+    }
+    for (int i = 0; i < MD5_DIGEST_LENGTH; i++) {
+        unsigned int octet;
+        if (sscanf(fields[0] + 2 * i, "%2x", &octet) != 1) {
+            return -1;
+        }
+        md5[i] = (unsigned char)octet;
+    }
+    *size = strtoull(fields[1], NULL, 10);
+    *location = fields[2];
+    *segment = count == 6 ? fields[3] : NULL;
+    *offset = count == 6 ? strtoull(fields[4], NULL, 10) : 0;
+    *length = count == 6 ? (uint32_t)strtoul(fields[5], NULL, 10) : 0;
+    return 0;
+}
+
+static void write_line(FILE *file, const file_digest_t *digest) {
+    for (int i = 0; i < MD5_DIGEST_LENGTH; i++) {
+        fprintf(file, "%02x", digest->md5[i]);
+    }
+    fprintf(file, ";%llu;%s", (unsigned long long)digest->size, digest->location);
+    if (digest->segment) {
+        fprintf(file, ";%s;%llu;%u", digest->segment, (unsigned long long)digest->offset, digest->length);
+    }
+    fputc('\n', file);
+}
+
+/**
+ * @brief Fichier temporaire du répertoire de sauvegarde, supprimé dès sa création.
+ */
+static FILE *temp_file(const char *backup_dir) {
+    char path[MAX_SIZE_PATH];
+    snprintf(path, sizeof(path), "%s/%s.XXXXXX", backup_dir, FILE_DIGEST_FILE);
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        perror("Erreur de création d'un fichier temporaire des contenus stockés");
+        return NULL;
+    }
+    unlink(path);
+    FILE *file = fdopen(fd, "w+b");
+    if (!file) {
+        close(fd);
+    }
+    return file;
+}
+
+/**
+ * @brief Clés du filtre de Bloom d'un contenu : les deux moitiés du MD5, la taille mêlée à la première.
+ */
+static void bloom_keys(const unsigned char *md5, uint64_t size, uint64_t *h1, uint64_t *h2) {
+    memcpy(h1, md5, sizeof(*h1));
+    memcpy(h2, md5 + sizeof(*h1), sizeof(*h2));
+    *h1 ^= size * 0x9E3779B97F4A7C15ULL;
+}
+
+static int compare_record(const file_digest_record_t *record, const unsigned char *md5, uint64_t size) {
+    int cmp = memcmp(record->md5, md5, MD5_DIGEST_LENGTH);
+    if (cmp != 0) {
+        return cmp;
+    }
+    return record->size < size ? -1 : (record->size > size);
+}
+
+/**
+ * @brief Clé de tri d'un contenu resté sur disque : MD5 puis taille en hexadécimal, dont
+ * l'ordre (strcmp) est celui de compare_record.
+ */
+static void overflow_key(const unsigned char *md5, uint64_t size, char *key) {
+    for (int i = 0; i < MD5_DIGEST_LENGTH; i++) {
+        sprintf(key + 2 * i, "%02x", md5[i]);
+    }
+    sprintf(key + 2 * MD5_DIGEST_LENGTH, "%016llx", (unsigned long long)size);
+}
+
+/**
+ * @brief Écrit les contenus restés sur disque, triés, dans un fichier temporaire du
+ * répertoire de sauvegarde (supprimé dès sa création) et construit leur filtre de Bloom,
+ * dimensionné d'après leur nombre.
+ */
+static int build_overflow(file_digest_map_t *map, manifest_t *sorted, size_t count) {
+    map->overflow = temp_file(map->backup_dir);
+    if (!map->overflow || manifest_finish(sorted) != 0 || bloom_init(&map->bloom, count) != 0) {
+        return -1;
+    }
+    const char *key, *value;
+    file_digest_record_t record, last;
+    while (manifest_next(sorted, &key, &value)) {
+        for (int i = 0; i < MD5_DIGEST_LENGTH; i++) {
+            unsigned int octet;
+            sscanf(key + 2 * i, "%2x", &octet);
+            record.md5[i] = (unsigned char)octet;
+        }
+        record.size = strtoull(key + 2 * MD5_DIGEST_LENGTH, NULL, 16);
+        record.line_offset = strtoull(value, NULL, 10);
+        // À contenus égaux, la première ligne du fichier est gardée, comme en mémoire
+        if (map->overflow_count > 0 && compare_record(&last, record.md5, record.size) == 0) {
+            continue;
+        }
+        fwrite(&record, sizeof(record), 1, map->overflow);
+        uint64_t h1, h2;
+        bloom_keys(record.md5, record.size, &h1, &h2);
+        bloom_add(&map->bloom, h1, h2);
+        last = record;
+        map->overflow_count++;
+    }
+    if (fflush(map->overflow) != 0 || ferror(map->overflow)) {
+        perror("Erreur d'écriture de l'index des contenus stockés");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Cherche un contenu parmi ceux restés sur disque : le filtre de Bloom écarte sans
+ * lecture la plupart des contenus absents, les autres sont cherchés par dichotomie dans le
+ * fichier trié puis leur ligne est relue dans FILE_DIGEST_FILE.
+ */
+static const file_digest_t *find_on_disk(file_digest_map_t *map, const unsigned char *md5, uint64_t size) {
+    uint64_t h1, h2;
+    bloom_keys(md5, size, &h1, &h2);
+    if (!bloom_may_contain(&map->bloom, h1, h2)) {
+        stats_add(STATS_BLOOM_NEGATIVES, 1);
+        return NULL;
+    }
+    int fd = fileno(map->overflow);
+    size_t low = 0, high = map->overflow_count;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        file_digest_record_t record;
+        if (pread(fd, &record, sizeof(record), (off_t)(mid * sizeof(record))) != (ssize_t)sizeof(record)) {
+            break;
+        }
+        int cmp = compare_record(&record, md5, size);
+        if (cmp < 0) {
+            low = mid + 1;
+        } else if (cmp > 0) {
+            high = mid;
+        } else {
+            ssize_t n = pread(map->source_fd, map->probed_line, FILE_DIGEST_LINE_SIZE - 1, (off_t)record.line_offset);
+            if (n <= 0) {
+                break;
+            }
+            map->probed_line[n] = '\0';
+            file_digest_t *digest = &map->probed;
+            char *location, *segment;
+            if (parse_line(map->probed_line, digest->md5, &digest->size, &location, &segment, &digest->offset,
+                           &digest->length) != 0) {
+                break;
+            }
+            digest->location = location;
+            digest->segment = segment;
+            digest->added = 0;
+            stats_add(STATS_BLOOM_DISK_HITS, 1);
+            return digest;
+        }
+    }
+    stats_add(STATS_BLOOM_FALSE_POSITIVES, 1);
+    return NULL;
+}
+
+const file_digest_t *file_digest_find(file_digest_map_t *map, const unsigned char *md5, uint64_t size) {
+    const file_digest_t *digest = find_in_memory(map, md5, size);
+    if (!digest && map->overflow) {
+        digest = find_on_disk(map, md5, size);
+    }
+    return digest;
+}
+
+int file_digest_load(file_digest_map_t *map, const char *backup_dir, size_t max_count) {
+    memset(map, 0, sizeof(*map));
+    map->max_count = max_count;
+    map->backup_dir = backup_dir;
+    map->source_fd = -1;
+    arena_init(&map->arena, 0);
+    if (grow(map) != 0) {
+        return -1;
+    }
+    char path[MAX_SIZE_PATH];
+    snprintf(path, sizeof(path), "%s/%s", backup_dir, FILE_DIGEST_FILE);
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        return 0;
+    }
+    // Contenus au-delà de max_count, triés avant d'être écrits dans map->overflow
+    manifest_t *sorted = NULL;
+    size_t sorted_count = 0;
+    int failed = 0;
+    char line[FILE_DIGEST_LINE_SIZE];
+    off_t line_offset = ftello(file);
+    while (fgets(line, sizeof(line), file)) {
+        unsigned char md5[MD5_DIGEST_LENGTH];
+        uint64_t size, offset;
+        uint32_t length;
+        char *location, *segment;
+        if (parse_line(line, md5, &size, &location, &segment, &offset, &length) == 0) {
+            if (!max_count || map->count < max_count) {
+                insert(map, md5, size, location, segment, offset, length);
+            } else if (!failed && !find_in_memory(map, md5, size)) {
+                if (!sorted) {
+                    sorted = manifest_create(backup_dir, FILE_DIGEST_SORT_MEMORY);
+                }
+                char key[2 * MD5_DIGEST_LENGTH + 17], value[32];
+                overflow_key(md5, size, key);
+                snprintf(value, sizeof(value), "%lld", (long long)line_offset);
+                failed = !sorted || manifest_add(sorted, key, value) != 0;
+                sorted_count++;
+            }
+        }
+        line_offset = ftello(file);
+    }
+    fclose(file);
+    stats_add(STATS_METADATA_OPS, 1);
+    if (sorted && !failed) {
+        map->source_fd = open(path, O_RDONLY | O_CLOEXEC);
+        map->probed_line = malloc(FILE_DIGEST_LINE_SIZE);
+        failed = map->source_fd < 0 || !map->probed_line
+                 || build_overflow(map, sorted, sorted_count) != 0;
+    }
+    manifest_free(sorted);
+    if (failed) {
+        // Les contenus restés sur disque ne sont simplement plus liés
+        fprintf(stderr, "Index des contenus stockés incomplet : seuls %zu contenus sont connus\n", map->count);
+        if (map->overflow) {
+            fclose(map->overflow);
+            map->overflow = NULL;
+        }
+        map->overflow_count = 0;
+        bloom_free(&map->bloom);
+    }
+    if (verbose_flag) {
+        printf("[INFO] %zu contenus déjà stockés connus\n", map->count + map->overflow_count);
+        if (map->overflow) {
+            printf("[INFO] dont %zu sur disque, derrière un filtre de Bloom de %zu octets\n", map->overflow_count,
+                   bloom_size(&map->bloom));
+        }
+    }
+    return 0;
+}
+
+void file_digest_add(file_digest_map_t *map, const unsigned char *md5, uint64_t size, const char *location,
+                     const char *segment, uint64_t offset, uint32_t length) {
+    file_digest_t *digest = insert(map, md5, size, location, segment, offset, length);
+    if (digest) {
+        digest->added = 1;
+        map->added++;
+    } else if (map->max_count && map->count >= map->max_count && !find_in_memory(map, md5, size)
+               && !(map->overflow && find_on_disk(map, md5, size))) {
+        // Table pleine : un contenu nouveau est gardé à part pour être inscrit dans FILE_DIGEST_FILE
+        if (!map->pending) {
+            map->pending = temp_file(map->backup_dir);
+        }
+        if (map->pending) {
+            file_digest_t pending = {.size = size, .location = location, .segment = segment, .offset = offset,
+                                     .length = length};
+            memcpy(pending.md5, md5, MD5_DIGEST_LENGTH);
+            write_line(map->pending, &pending);
+            map->added++;
+        }
+    }
+}
+
+int file_digest_save(const file_digest_map_t *map, const char *backup_dir) {
+    if (map->added == 0) {
+        return 0;
+    }
+    char path[MAX_SIZE_PATH];
+    snprintf(path, sizeof(path), "%s/%s", backup_dir, FILE_DIGEST_FILE);
+    FILE *file = fopen(path, "a");
+    if (!file) {
+        perror("Erreur d'ouverture de la liste des contenus stockés");
+        return -1;
+    }
+    for (size_t i = 0; i < map->capacity; i++) {
+        if (map->slots[i] && map->slots[i]->added) {
+            write_line(file, map->slots[i]);
+        }
+    }
+    if (map->pending) {
+        char line[FILE_DIGEST_LINE_SIZE];
+        rewind(map->pending);
+        while (fgets(line, sizeof(line), map->pending)) {
+            fputs(line, file);
+        }
+    }
+    int ret = fclose(file) == 0 ? 0 : -1;
+    stats_add(STATS_METADATA_OPS, 1);
+    return ret;
+}
+
+void file_digest_free(file_digest_map_t *map) {
+    free(map->slots);
+    arena_free(&map->arena);
+    if (map->overflow) {
+        fclose(map->overflow);
+    }
+    if (map->pending) {
+        fclose(map->pending);
+    }
+    if (map->source_fd >= 0) {
+        close(map->source_fd);
+    }
+    bloom_free(&map->bloom);
+    free(map->probed_line);
+    memset(map, 0, sizeof(*map));
+    map->source_fd = -1;
+}
+
+int file_digest_sweep(const char *backup_dir, const string_pool_t *snapshots, const string_pool_t *segments) {
+    if (snapshots->count == 0 && segments->count == 0) {
+        return 0;
+    }
+    char path[MAX_SIZE_PATH], tmp_path[MAX_SIZE_PATH + 8];
+    snprintf(path, sizeof(path), "%s/%s", backup_dir, FILE_DIGEST_FILE);
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    FILE *in = fopen(path, "r");
+    if (!in) {
+        return 0;
+    }
+    FILE *out = fopen(tmp_path, "w");
+    if (!out) {
+        perror("Erreur d'écriture de la liste des contenus stockés");
+        fclose(in);
+        return 0;
+    }
+    int removed = 0;
+    char line[FILE_DIGEST_LINE_SIZE], copy[FILE_DIGEST_LINE_SIZE];
+    while (fgets(line, sizeof(line), in)) {
+        memcpy(copy, line, sizeof(line));
+        unsigned char md5[MD5_DIGEST_LENGTH];
+        uint64_t size, offset;
+        uint32_t length;
+        char *location, *segment;
+        if (parse_line(copy, md5, &size, &location, &segment, &offset, &length) != 0) {
+            removed++;
+            continue;
+        }
+        // L'image d'un petit fichier vit autant que son segment, un .dedup autant que sa sauvegarde
+        int gone;
+        if (segment) {
+            gone = string_pool_find(segments, segment) != NULL;
+        } else {
+            location[strcspn(location, "/")] = '\0';
+            gone = string_pool_find(snapshots, location) != NULL;
+        }
+        if (gone) {
+            removed++;
+        } else {
+            fputs(line, out);
+        }
+    }
+    fclose(in);
+    // Rien à retirer : la liste reste telle quelle
+    if (removed == 0) {
+        fclose(out);
+        unlink(tmp_path);
+        return 0;
+    }
+    if (fclose(out) != 0 || rename(tmp_path, path) != 0) {
+        perror("Erreur d'écriture de la liste des contenus stockés");
+        unlink(tmp_path);
+        return 0;
+    }
+    return removed;
+}
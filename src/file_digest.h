@@ -0,0 +1,69 @@
+#ifndef FILE_DIGEST_H
+#define FILE_DIGEST_H
+
+#include "arena.h"
+#include "bloom.h"
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <openssl/md5.h>
+
+// Contenus déjà stockés, à la racine du répertoire de sauvegarde : une ligne par contenu
+// "md5;taille;sauvegarde/chemin[;segment;position;taille]" qui désigne le .dedup (ou l'image
+// rangée dans un segment) d'un fichier de ce MD5 et de cette taille. Un fichier identique
+// sauvegardé ensuite est lié à ce .dedup ou reprend cette image, sans être redécoupé.
+#define FILE_DIGEST_FILE ".file_digests"
+
+// Un contenu stocké
+typedef struct {
+    unsigned char md5[MD5_DIGEST_LENGTH];
+    uint64_t size;
+    const char *location; // "sauvegarde/chemin" du fichier qui l'a stocké
+    const char *segment;  // segment de l'image d'un petit fichier (NULL : fichier .dedup)
+    uint64_t offset;
+    uint32_t length;
+    int added;            // ajouté par la sauvegarde en cours, pas encore dans FILE_DIGEST_FILE
+} file_digest_t;
+
+// Table des contenus stockés (adressage ouvert, le MD5 sert de hachage). Au-delà de
+// max_count, les contenus de FILE_DIGEST_FILE restent sur disque : triés par MD5 et taille
+// dans un fichier temporaire, derrière un filtre de Bloom qui écarte sans lecture les
+// contenus inconnus
+typedef struct {
+    file_digest_t **slots;
+    size_t capacity;
+    size_t count;
+    size_t added;
+    size_t max_count; // contenus gardés en mémoire (0 : pas de limite)
+    arena_t arena;    // entrées et chaînes
+    const char *backup_dir; // reçoit les fichiers temporaires
+    FILE *overflow;   // contenus restés sur disque, triés (NULL : tous en mémoire)
+    size_t overflow_count;
+    bloom_t bloom;    // contenus de overflow
+    int source_fd;    // FILE_DIGEST_FILE, relu pour un contenu trouvé sur disque
+    file_digest_t probed; // dernier contenu trouvé sur disque
+    char *probed_line;    // ses chaînes
+    FILE *pending;    // contenus ajoutés au-delà de max_count, recopiés par file_digest_save
+} file_digest_map_t;
+
+// Octets de mémoire comptés par contenu retenu (entrée, chaînes et cases de la table)
+#define FILE_DIGEST_ENTRY_MEMORY 256
+
+// Charge FILE_DIGEST_FILE (table vide s'il n'existe pas) en gardant en mémoire au plus
+// max_count contenus (0 : pas de limite), les suivants restant sur disque ; -1 si la
+// mémoire manque
+int file_digest_load(file_digest_map_t *map, const char *backup_dir, size_t max_count);
+// Contenu de ce MD5 et de cette taille ; NULL s'il est inconnu. Un contenu trouvé sur disque
+// reste valable jusqu'à l'appel suivant
+const file_digest_t *file_digest_find(file_digest_map_t *map, const unsigned char *md5, uint64_t size);
+// Enregistre un contenu stocké par la sauvegarde en cours (ignoré s'il est déjà connu)
+void file_digest_add(file_digest_map_t *map, const unsigned char *md5, uint64_t size, const char *location,
+                     const char *segment, uint64_t offset, uint32_t length);
+// Ajoute à FILE_DIGEST_FILE les contenus enregistrés par file_digest_add ; -1 en cas d'erreur
+int file_digest_save(const file_digest_map_t *map, const char *backup_dir);
+void file_digest_free(file_digest_map_t *map);
+// Après --prune : retire les contenus stockés par une des sauvegardes snapshots ou rangés
+// dans un des segments supprimés ; retourne le nombre de lignes retirées
+int file_digest_sweep(const char *backup_dir, const string_pool_t *snapshots, const string_pool_t *segments);
+
+#endif // FILE_DIGEST_H
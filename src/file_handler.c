@@ -2,8 +2,12 @@
 #include <stdlib.h>
 #include <string.h>
 #include <fcntl.h>
+#include <unistd.h>
 #include <dirent.h>
 #include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <linux/fiemap.h>
 #include "file_handler.h"
 #include "deduplication.h"
 
@@ -13,36 +17,133 @@
 extern int verbose_flag;
 extern int dry_run_flag;
 
-// Fonction permettant de créer une structure log_element
-log_element *create_element(char *path, char *mtime, char *md5) {
- /* Crée une structure log_element
-  * @param: path - Chemin vers le fichier
+// Convertit un MD5 binaire en chaîne hexadécimale (33 octets avec le '\0')
+static void md5_to_hex(const unsigned char *md5, char *hex) {
+    for (int i = 0; i < MD5_DIGEST_LENGTH; i++) {
+        sprintf(hex + 2 * i, "%02x", md5[i]);
+    }
+    hex[2 * MD5_DIGEST_LENGTH] = '\0';
+}
+
+// Convertit une chaîne hexadécimale en MD5 binaire, renvoie 0 si la chaîne est valide
+static int hex_to_md5(const char *hex, unsigned char *md5) {
+    if (!hex || strlen(hex) < 2 * MD5_DIGEST_LENGTH) {
+        memset(md5, 0, MD5_DIGEST_LENGTH);
+        return -1;
+    }
+    for (int i = 0; i < MD5_DIGEST_LENGTH; i++) {
+        unsigned int octet;
+        if (sscanf(hex + 2 * i, "%2x", &octet) != 1) {
+            memset(md5, 0, MD5_DIGEST_LENGTH);
+            return -1;
+        }
+        md5[i] = (unsigned char)octet;
+    }
+    return 0;
+}
+
+// Fonction permettant de créer une structure log_element à la fin de la liste logs
+log_element *create_element(log_t *logs, const char *path, const char *mtime, const char *md5) {
+ /* Crée une structure log_element et l'ajoute à la fin de la liste
+  * @param: logs - Liste qui contiendra l'élément (sa mémoire vient de logs->pool)
+  *         path - Chemin vers le fichier
   *         mtime - Dernière date de modification du fichier
-  *         md5 - Hachage md5 du fichier
+  *         md5 - Hachage md5 du fichier (en hexadécimal), NULL pour un MD5 nul
   * @return: un pointeur vers une structure log_element
   */
-    log_element *new_elt = malloc(sizeof(log_element)) ;
-    new_elt->path = strdup(path) ;
-    new_elt->date = strdup(mtime) ;
-    new_elt->date = strdup(md5) ;
+    if (!logs->pool) {
+        logs->pool = string_pool_create() ;
+        if (!logs->pool) {
+            return NULL ;
+        }
+    }
+    // Élément et chemin sont pris dans l'arène de la liste ; les dates, souvent
+    // identiques d'un fichier à l'autre, ne sont stockées qu'une fois
+    log_element *new_elt = arena_alloc(&logs->pool->arena, sizeof(log_element)) ;
+    if (!new_elt) {
+        return NULL ;
+    }
+    new_elt->path = arena_strdup(&logs->pool->arena, path ? path : "") ;
+    new_elt->date = string_pool_intern(logs->pool, mtime ? mtime : "") ;
+    hex_to_md5(md5, new_elt->md5) ;
+    new_elt->segment = NULL ;
+    new_elt->offset = 0 ;
+    new_elt->length = 0 ;
     new_elt->next = NULL ;
-    new_elt->prev = NULL ;
+    new_elt->prev = logs->tail ;
+    if (logs->tail) {
+        logs->tail->next = new_elt ;
+    } else {
+        logs->head = new_elt ;
+    }
+    logs->tail = new_elt ;
 
     if (verbose_flag) {
-        printf("[INFO] Création d'un nouvel élément log : %s, %s, %s\n", path, mtime, md5);
+        printf("[INFO] Création d'un nouvel élément log : %s, %s, %s\n", path, mtime, md5 ? md5 : "-");
     }
 
     return new_elt ;
 }
 
+// Range l'élément dans un segment
+void set_element_segment(log_t *logs, log_element *elt, const char *segment, uint64_t offset, uint32_t length) {
+ /* @param: logs - Liste qui contient l'élément
+  *         elt - Élément d'un petit fichier
+  *         segment - Nom du segment qui contient son image .dedup
+  *         offset, length - Position et taille de cette image dans le segment
+  */
+    elt->segment = string_pool_intern(logs->pool, segment) ;
+    elt->offset = offset ;
+    elt->length = length ;
+}
+
+// Libère en une fois tous les éléments d'une liste de log
+void free_backup_log(log_t *logs) {
+    string_pool_free(logs->pool) ;
+    logs->pool = NULL ;
+    logs->head = NULL ;
+    logs->tail = NULL ;
+}
+
+// Ajoute à logs l'élément décrit par une ligne du fichier .backup_log
+log_element *parse_log_line(log_t *logs, char *line){
+ /* @param: logs - Liste qui recevra l'élément
+  *         line - Ligne "chemin;date;md5[;segment;position;taille]", modifiée par le découpage
+  * @return: l'élément créé, NULL en cas d'erreur
+  */
+    // Supprime le saut de ligne
+    line[strcspn(line, "\n")] = '\0';
+
+    // Découper la ligne en chemin, date et MD5, suivis pour un petit fichier
+    // du segment, de la position et de la taille de son image .dedup
+    char *saveptr = NULL ;
+    char *path = strtok_r(line, ";", &saveptr) ;
+    char *mtime = strtok_r(NULL, ";", &saveptr) ;
+    char *md5 = strtok_r(NULL, ";", &saveptr) ;
+    char *segment = strtok_r(NULL, ";", &saveptr) ;
+    char *offset = strtok_r(NULL, ";", &saveptr) ;
+    char *length = strtok_r(NULL, ";", &saveptr) ;
+
+    if (verbose_flag) {
+        printf("[INFO] Lecture de l'entrée : %s, %s, %s\n", path, mtime, md5);
+    }
+
+    log_element *elt = create_element(logs, path, mtime, md5) ;
+    if (elt && segment && offset && length) {
+        set_element_segment(logs, elt, segment, strtoull(offset, NULL, 10),
+                            (uint32_t)strtoul(length, NULL, 10)) ;
+    }
+    return elt ;
+}
+
 // Fonction permettant de lire un fichier .backup_log
 log_t read_backup_log(const char *logfile){
  /* Lecture des lignes du fichier ".backup_log"
   * @param: logfile - le chemin vers le fichier .backup_log
   * @return: une structure log_t
   */
-    log_t backup = {.head = NULL, .tail = NULL} ;
-    char buffer[BUFFER_SIZE] ;
+    log_t backup = {.head = NULL, .tail = NULL, .pool = NULL} ;
+    char buffer[BUFFER_SIZE * 4] ;
     FILE *f = fopen(logfile, "r") ;
 
     if (verbose_flag) {
@@ -50,29 +151,10 @@ log_t read_backup_log(const char *logfile){
     }
 
     if (f) {
-        while (fgets(buffer, BUFFER_SIZE, f)) {
-            // Supprime le saut de ligne
-            buffer[strcspn(buffer, "\n")] = '\0';
-            
-            // Découper la ligne en chemin, date et MD5
-            char *path = strtok(buffer, ";") ;
-            char *mtime = strtok(NULL, ";") ;
-            char *md5 = strtok(NULL, ";") ;
-
-            if (verbose_flag) {
-                printf("[INFO] Lecture de %s : %s, %s, %s\n", logfile, path, mtime, md5);
-            }
-
+        while (fgets(buffer, sizeof(buffer), f)) {
             // Crée un nouvel élément et l'ajoute à la liste chaînée
-            log_element *ligne = create_element(path, mtime, md5) ;
-
-            if (backup.head == NULL) {
-                backup.head = ligne ;
-                backup.tail = ligne ;
-            } else {
-                ligne->prev = backup.tail ;
-                backup.tail->next = ligne ;
-                backup.tail = ligne ;
+            if (buffer[0] != '\n' && buffer[0] != '\0' && !parse_log_line(&backup, buffer)) {
+                break;
             }
         }
         fclose(f) ;
@@ -85,99 +167,216 @@ log_t read_backup_log(const char *logfile){
 
 // Fonction permettant de mettre à jour le fichier .backup_log
 void update_backup_log(const char *logfile, log_t *logs){
- /* Modification d'une ou plusieurs ligne(s) du fichier ".bakcup_log"
+ /* Réécriture du fichier ".backup_log" à partir de la liste des éléments à jour
+  * Le fichier temporaire est écrit à côté du .backup_log (même système de fichiers)
+  * et rendu durable avant de le remplacer : un arrêt brutal laisse l'ancienne ou la
+  * nouvelle version, jamais un fichier tronqué
   * @param: logfile - le chemin vers le fichier .backup_log
   *         logs - qui est la liste de toutes les lignes du fichier .backup_log sauvegardée dans une structure log_t
   */
-    char buffer[BUFFER_SIZE] ;
-    FILE *f = fopen(logfile, "r") ;
-    if (!f) {
-        perror("Erreur : échec ouverture du fichier en paramètre") ;
-        return ;
-    }
-
-    FILE *temp = fopen("temp.txt", "w") ;
+    char temp_path[BUFFER_SIZE * 2] ;
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", logfile) ;
+    FILE *temp = fopen(temp_path, "w") ;
     if (!temp) {
-        perror("Erreur : échec ouverture du fichier temp.txt") ;
-        fclose(f) ;
+        perror("Erreur : échec ouverture du fichier temporaire du .backup_log") ;
         return ;
     }
 
- 
     if (verbose_flag) {
         printf("[INFO] Mise à jour du fichier %s\n", logfile);
     }
- 
-    log_element *elt = logs->head ;
-
-    // Parcourt chaque ligne et effectue la mise à jour si nécessaire
-    while(fgets(buffer, BUFFER_SIZE, f)) {
-        char *log = malloc(strlen(elt->path) + strlen(elt->date) + strlen(elt->md5) + 3) ;
-        strcpy(log, elt->path) ;
-        strcat(log, ";") ;
-        strcat(log, elt->date) ;
-        strcat(log, ";") ;
-        strcat(log, elt->md5) ;
-
-        if (elt == NULL || strcmp(buffer, log) == 0) {
-            if (verbose_flag) {
-                printf("[INFO] Conservation de la ligne %s\n", buffer);
-            }
-            fwrite(&buffer, BUFFER_SIZE, 1, temp) ;
-        } else {
-            if (verbose_flag) {
-                printf("[INFO] Mise à jour de la ligne %s en %s\n", buffer, log);
-            }
-            fwrite(log, strlen(log), 1, temp) ;
-        }
 
-        elt = elt->next ;
-        free(log) ;
+    // La liste contient l'état complet de la sauvegarde : chaque élément devient une ligne
+    for (log_element *elt = logs->head; elt != NULL; elt = elt->next) {
+        write_log_element(elt, temp) ;
     }
 
-    // Ajoute les nouvelles entrées restantes
-    while (elt != NULL) {
-        fprintf(temp, "%s;%s;%s", elt->path, elt->date, elt->md5);
-        elt = elt->next ;
-    }
-
-    fclose(f) ;
-    fclose(temp) ;
-
     // Remplace le fichier original par le fichier temporaire
     if (dry_run_flag) {
+        fclose(temp) ;
         if (verbose_flag) {
-            printf("[DRY-RUN] Remplacement du fichier %s par temp.txt\n", logfile);
+            printf("[DRY-RUN] Remplacement du fichier %s par %s\n", logfile, temp_path);
         }
+        remove(temp_path) ;
     } else {
-        remove(logfile) ;
-        rename("temp.txt", logfile) ;
+        if (fflush(temp) != 0 || fdatasync(fileno(temp)) != 0) {
+            perror("Erreur : écriture du fichier temporaire du .backup_log") ;
+            fclose(temp) ;
+            remove(temp_path) ;
+            return ;
+        }
+        fclose(temp) ;
+        // rename remplace atomiquement l'ancien fichier (ou le lien dur vers celui de la sauvegarde précédente)
+        if (rename(temp_path, logfile) != 0) {
+            perror("Erreur : remplacement du fichier .backup_log") ;
+            remove(temp_path) ;
+            return ;
+        }
         if (verbose_flag) {
             printf("[INFO] Mise à jour du fichier %s effectuée\n", logfile);
         }
     }
 }
 
+// Fonction permettant de remplacer le fichier .backup_log par une copie d'un autre
+int replace_backup_log(const char *logfile, const char *source){
+ /* Même écriture sûre que update_backup_log, quand les lignes sont déjà dans un fichier
+  * (--memory-limit : le .backup_log de la sauvegarde, écrit au fil de la fusion)
+  * @param: logfile - le chemin vers le fichier .backup_log à remplacer
+  *         source - le fichier dont il devient la copie
+  * @return: 0, ou -1 en cas d'erreur (logfile est alors inchangé)
+  */
+    if (dry_run_flag) {
+        if (verbose_flag) {
+            printf("[DRY-RUN] Remplacement du fichier %s par une copie de %s\n", logfile, source);
+        }
+        return 0 ;
+    }
+    char temp_path[BUFFER_SIZE * 2] ;
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", logfile) ;
+    FILE *in = fopen(source, "r") ;
+    FILE *temp = in ? fopen(temp_path, "w") : NULL ;
+    if (!temp) {
+        perror("Erreur : échec ouverture du fichier temporaire du .backup_log") ;
+        if (in) {
+            fclose(in) ;
+        }
+        return -1 ;
+    }
+    char buffer[BUFFER_SIZE * 64] ;
+    size_t n ;
+    while ((n = fread(buffer, 1, sizeof(buffer), in)) > 0) {
+        fwrite(buffer, 1, n, temp) ;
+    }
+    int failed = ferror(in) || ferror(temp) ;
+    fclose(in) ;
+    if (failed || fflush(temp) != 0 || fdatasync(fileno(temp)) != 0) {
+        perror("Erreur : écriture du fichier temporaire du .backup_log") ;
+        fclose(temp) ;
+        remove(temp_path) ;
+        return -1 ;
+    }
+    fclose(temp) ;
+    if (rename(temp_path, logfile) != 0) {
+        perror("Erreur : remplacement du fichier .backup_log") ;
+        remove(temp_path) ;
+        return -1 ;
+    }
+    if (verbose_flag) {
+        printf("[INFO] Mise à jour du fichier %s effectuée\n", logfile);
+    }
+    return 0 ;
+}
+
 // Ecrit un élément log dans le fichier .backup_log
 void write_log_element(log_element *elt, FILE *logfile){
  /* Ecrire un élément log de la liste chaînée log_element dans le fichier .backup_log
    * @param: elt - un élément log à écrire sur une ligne
-   *         logfile - le chemin du fichier .backup_log
+   *         logfile - le fichier .backup_log ouvert en écriture
    */
-    if (logfile) {
-        if (dry_run_flag) {
-            fprintf(logfile, "%s;%s;%s", elt->path, elt->date, elt->md5) ;
+    if (logfile && elt) {
+        char md5_hex[2 * MD5_DIGEST_LENGTH + 1] ;
+        md5_to_hex(elt->md5, md5_hex) ;
+        if (elt->segment) {
+            fprintf(logfile, "%s;%s;%s;%s;%llu;%u\n", elt->path, elt->date, md5_hex, elt->segment,
+                    (unsigned long long)elt->offset, (unsigned)elt->length) ;
+        } else {
+            fprintf(logfile, "%s;%s;%s\n", elt->path, elt->date, md5_hex) ;
         }
         if (verbose_flag) {
-            printf("[INFO] Écriture de l'élément log %s, %s, %s\n", elt->path, elt->date, elt->md5);
+            printf("[INFO] Écriture de l'élément log %s, %s, %s\n", elt->path, elt->date, md5_hex);
         }
-        fclose(logfile) ;
     } else {
         printf("Erreur : échec ouverture du fichier\n") ;
         return ;
     }
 }
 
+// Écrit une ligne "nom;fichiers;octets logiques;octets stockés;durée;ratio"
+static void write_summary_line(FILE *file, const backup_summary *summary) {
+    fprintf(file, "%s;%ld;%llu;%llu;%.3f;%.2f\n", summary->name, summary->file_count,
+            summary->logical_bytes, summary->stored_bytes, summary->duration, summary->dedup_ratio);
+}
+
+// Ajoute le résumé d'une sauvegarde à la fin du fichier .backup_summaries
+void append_backup_summary(const char *summary_file, const backup_summary *summary){
+    /* Ajoute le résumé d'une sauvegarde au fichier des résumés
+     * @param: summary_file - Chemin du fichier .backup_summaries
+     *         summary - Résumé de la sauvegarde qui vient d'être créée
+     */
+    if (dry_run_flag) {
+        return;
+    }
+    // Une seule écriture en mode ajout : pas besoin de relire le fichier
+    FILE *file = fopen(summary_file, "a");
+    if (!file) {
+        perror("Erreur d'ouverture du fichier des résumés");
+        return;
+    }
+    write_summary_line(file, summary);
+    fclose(file);
+}
+
+// Lit tous les résumés du fichier .backup_summaries
+int read_backup_summaries(const char *summary_file, backup_summary **summaries){
+    /* Lit le fichier des résumés
+     * @param: summary_file - Chemin du fichier .backup_summaries
+     *         summaries - Tableau alloué contenant les résumés lus
+     * @return: le nombre de résumés, -1 si le fichier n'existe pas
+     */
+    *summaries = NULL;
+    FILE *file = fopen(summary_file, "r");
+    if (!file) {
+        return -1;
+    }
+    int count = 0, capacity = 0;
+    char line[BUFFER_SIZE];
+    while (fgets(line, sizeof(line), file)) {
+        backup_summary summary;
+        if (sscanf(line, "%63[^;];%ld;%llu;%llu;%lf;%lf", summary.name, &summary.file_count,
+                   &summary.logical_bytes, &summary.stored_bytes, &summary.duration, &summary.dedup_ratio) != 6) {
+            continue; // ligne incomplète (écriture interrompue)
+        }
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            backup_summary *grown = realloc(*summaries, capacity * sizeof(backup_summary));
+            if (!grown) {
+                break;
+            }
+            *summaries = grown;
+        }
+        (*summaries)[count++] = summary;
+    }
+    fclose(file);
+    return count;
+}
+
+// Réécrit le fichier .backup_summaries avec les résumés donnés
+void write_backup_summaries(const char *summary_file, const backup_summary *summaries, int count){
+    /* Réécrit entièrement le fichier des résumés (fichier temporaire puis rename)
+     * @param: summary_file - Chemin du fichier .backup_summaries
+     *         summaries - Résumés à conserver
+     *         count - Nombre de résumés
+     */
+    if (dry_run_flag) {
+        return;
+    }
+    char temp_file[BUFFER_SIZE * 2];
+    snprintf(temp_file, sizeof(temp_file), "%s.tmp", summary_file);
+    FILE *file = fopen(temp_file, "w");
+    if (!file) {
+        perror("Erreur d'ouverture du fichier des résumés");
+        return;
+    }
+    for (int i = 0; i < count; i++) {
+        write_summary_line(file, summaries + i);
+    }
+    fclose(file);
+    if (rename(temp_file, summary_file) != 0) {
+        perror("Erreur de remplacement du fichier des résumés");
+    }
+}
+
 // Liste les fichiers présents dans un répertoire
 void list_files(const char *path){
  /* Implémenter la logique pour lister les fichiers présents dans un répertoire
@@ -264,3 +463,28 @@ void copy_file(const char *src, const char *dest){
     fclose(src_file) ;
     fclose(dest_file) ;
 }
+
+// Position physique du début d'un fichier (FIEMAP), ou son inode si le système de fichiers
+// ne la donne pas : lire des fichiers dans cet ordre évite les allers-retours de la tête
+uint64_t file_disk_offset(const char *path, ino_t ino){
+ /* @param: path - Chemin du fichier
+  *         ino - Son numéro d'inode
+  */
+    uint64_t offset = ino;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return offset;
+    }
+    struct {
+        struct fiemap map;
+        struct fiemap_extent extent;
+    } request;
+    memset(&request, 0, sizeof(request));
+    request.map.fm_length = FIEMAP_MAX_OFFSET;
+    request.map.fm_extent_count = 1;
+    if (ioctl(fd, FS_IOC_FIEMAP, &request.map) == 0 && request.map.fm_mapped_extents > 0) {
+        offset = request.extent.fe_physical;
+    }
+    close(fd);
+    return offset;
+}
@@ -2,13 +2,19 @@
 #define FILE_HANDLER_H
 
 #include <stdio.h>
+#include <stdint.h>
+#include <sys/types.h>
 #include <openssl/md5.h>
+#include "arena.h"
 
 // Structure pour une ligne du fichier log
 typedef struct log_element{
     const char *path; // Chemin du fichier/dossier
     unsigned char md5[MD5_DIGEST_LENGTH]; // MD5 du fichier dédupliqué
-    char *date; // Date de dernière modification
+    const char *date; // Date de dernière modification (partagée entre les éléments de même date)
+    const char *segment; // Segment qui contient l'image .dedup d'un petit fichier (NULL : fichier .dedup)
+    uint64_t offset; // Position de l'image dans le segment
+    uint32_t length; // Taille de l'image dans le segment
     struct log_element *next;
     struct log_element *prev;
 } log_element;
@@ -17,20 +23,51 @@ typedef struct log_element{
 typedef struct {
     log_element *head; // Début de la liste de log 
     log_element *tail; // Fin de la liste de log
+    string_pool_t *pool; // Éléments, chemins et dates de la liste, libérés par free_backup_log
 } log_t;
 
+// Taille d'un nom de sauvegarde (horodatage YYYY-MM-DD-hh:mm:ss.sss), zéro final compris
+#define BACKUP_NAME_SIZE 64
 
-// Fonction permettant de créer une structure log_element
-log_element *create_element(char *path, char *mtime, char *md5);
+// Résumé d'une sauvegarde, écrit à la fin de create_backup (une ligne par sauvegarde
+// dans le fichier .backup_summaries à la racine du répertoire de sauvegarde)
+typedef struct {
+    char name[BACKUP_NAME_SIZE]; // Nom du répertoire de la sauvegarde (son horodatage)
+    long file_count; // Nombre de fichiers sauvegardés
+    unsigned long long logical_bytes; // Taille totale des fichiers de la source
+    unsigned long long stored_bytes; // Octets écrits par cette sauvegarde (fichiers .dedup nouveaux)
+    double duration; // Durée de la sauvegarde en secondes
+    double dedup_ratio; // logical_bytes / stored_bytes (0 si rien n'a été écrit)
+} backup_summary;
+
+
+// Fonction permettant de créer une structure log_element à la fin de la liste logs
+log_element *create_element(log_t *logs, const char *path, const char *mtime, const char *md5);
+// Libère en une fois tous les éléments d'une liste de log
+void free_backup_log(log_t *logs);
+// Range l'élément dans un segment (nom partagé entre les éléments du même segment)
+void set_element_segment(log_t *logs, log_element *elt, const char *segment, uint64_t offset, uint32_t length);
+// Ajoute à logs l'élément décrit par une ligne du fichier .backup_log (la ligne est modifiée)
+log_element *parse_log_line(log_t *logs, char *line);
 // Fonction permettant de lire un fichier .backup_log
 log_t read_backup_log(const char *logfile);
 // Fonction permettant de mettre à jour le fichier .backup_log
 void update_backup_log(const char *logfile, log_t *logs);
+// Fonction permettant de remplacer le fichier .backup_log par une copie d'un autre
+int replace_backup_log(const char *logfile, const char *source);
 // Ecrit un élément log dans le fichier .backup_log
 void write_log_element(log_element *elt, FILE *logfile);
+// Ajoute le résumé d'une sauvegarde à la fin du fichier des résumés
+void append_backup_summary(const char *summary_file, const backup_summary *summary);
+// Lit tous les résumés ; retourne leur nombre (-1 si le fichier n'existe pas)
+int read_backup_summaries(const char *summary_file, backup_summary **summaries);
+// Réécrit le fichier des résumés avec les count résumés donnés
+void write_backup_summaries(const char *summary_file, const backup_summary *summaries, int count);
 // Liste les fichiers présents dans un répertoire
 void list_files(const char *path);
 // Copie un fichier depuis une source vers une destination
 void copy_file(const char *src, const char *dest);
+// Position physique du début d'un fichier (FIEMAP), à défaut son inode
+uint64_t file_disk_offset(const char *path, ino_t ino);
 
 #endif // FILE_HANDLER_H
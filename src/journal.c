@@ -0,0 +1,510 @@
+#define _GNU_SOURCE
+#include "journal.h"
+#include "arena.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/file.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+#define MAX_SIZE_PATH 2048
+
+extern int verbose_flag;
+
+// Événements qui signalent un changement du contenu d'un répertoire ou d'un fichier
+#define WATCH_MASK (IN_CREATE | IN_DELETE | IN_MODIFY | IN_CLOSE_WRITE | IN_MOVED_FROM | IN_MOVED_TO \
+                    | IN_ATTRIB | IN_DONT_FOLLOW)
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void request_stop(int sig) {
+    (void)sig;
+    stop_requested = 1;
+}
+
+// Chemin relatif surveillé par chaque descripteur inotify
+typedef struct {
+    char **dirs; // indexé par le descripteur de surveillance (NULL : libre)
+    int capacity;
+} watch_table_t;
+
+static void watch_table_set(watch_table_t *table, int wd, const char *rel) {
+    if (wd >= table->capacity) {
+        int capacity = table->capacity ? table->capacity : 256;
+        while (capacity <= wd) {
+            capacity *= 2;
+        }
+        char **dirs = realloc(table->dirs, capacity * sizeof(char *));
+        if (!dirs) {
+            return;
+        }
+        memset(dirs + table->capacity, 0, (capacity - table->capacity) * sizeof(char *));
+        table->dirs = dirs;
+        table->capacity = capacity;
+    }
+    free(table->dirs[wd]);
+    table->dirs[wd] = strdup(rel);
+}
+
+static const char *watch_table_get(const watch_table_t *table, int wd) {
+    return wd >= 0 && wd < table->capacity ? table->dirs[wd] : NULL;
+}
+
+/**
+ * @brief Renomme old_rel en new_rel dans tous les chemins surveillés (répertoire déplacé).
+ */
+static void watch_table_move(watch_table_t *table, const char *old_rel, const char *new_rel) {
+    size_t old_len = strlen(old_rel);
+    for (int wd = 0; wd < table->capacity; wd++) {
+        char *dir = table->dirs[wd];
+        if (!dir || strncmp(dir, old_rel, old_len) != 0 || (dir[old_len] != '\0' && dir[old_len] != '/')) {
+            continue;
+        }
+        char moved[MAX_SIZE_PATH];
+        snprintf(moved, sizeof(moved), "%s%s", new_rel, dir + old_len);
+        free(dir);
+        table->dirs[wd] = strdup(moved);
+    }
+}
+
+/**
+ * @brief Surveille source_dir/rel et tous ses sous-répertoires.
+ * @return 0, ou -1 si un répertoire n'a pas pu être surveillé (limite inotify atteinte ou
+ * chemin plus long que MAX_SIZE_PATH).
+ */
+static int add_watch_tree(int fd, watch_table_t *table, const char *source_dir, const char *rel) {
+    char path[MAX_SIZE_PATH];
+    if (snprintf(path, sizeof(path), rel[0] ? "%s/%s" : "%s", source_dir, rel) >= (int)sizeof(path)) {
+        return -1;
+    }
+    int wd = inotify_add_watch(fd, path, WATCH_MASK | IN_ONLYDIR);
+    if (wd < 0) {
+        // Répertoire déjà supprimé : rien à surveiller
+        return errno == ENOENT || errno == ENOTDIR ? 0 : -1;
+    }
+    watch_table_set(table, wd, rel);
+
+    DIR *dir = opendir(path);
+    if (!dir) {
+        return 0;
+    }
+    int ret = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+        if (entry->d_type != DT_DIR && entry->d_type != DT_UNKNOWN) {
+            continue;
+        }
+        // Un chemin tronqué désignerait un autre répertoire : il n'est pas surveillé
+        char child[MAX_SIZE_PATH];
+        if (snprintf(child, sizeof(child), rel[0] ? "%s/%s" : "%s%s", rel, entry->d_name) >= (int)sizeof(child)) {
+            ret = -1;
+            continue;
+        }
+        if (entry->d_type == DT_UNKNOWN) {
+            char child_path[MAX_SIZE_PATH];
+            struct stat st;
+            if (snprintf(child_path, sizeof(child_path), "%s/%s", source_dir, child) >= (int)sizeof(child_path)) {
+                ret = -1;
+                continue;
+            }
+            if (lstat(child_path, &st) != 0 || !S_ISDIR(st.st_mode)) {
+                continue;
+            }
+        }
+        if (add_watch_tree(fd, table, source_dir, child) != 0) {
+            ret = -1;
+        }
+    }
+    closedir(dir);
+    return ret;
+}
+
+/**
+ * @brief Ajoute des lignes au journal.
+ *
+ * Le journal est verrouillé (flock) pendant l'écriture ; s'il a été pris par une
+ * sauvegarde entre l'ouverture et le verrouillage, un nouveau journal est créé.
+ * Les chemins déjà présents dans le journal courant (seen) ne sont pas réécrits.
+ */
+static void journal_append(const char *journal_path, char **lines, int count, string_pool_t **seen) {
+    for (;;) {
+        int fd = open(journal_path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            perror("Erreur d'ouverture du journal");
+            return;
+        }
+        flock(fd, LOCK_EX);
+        struct stat fst, st;
+        if (fstat(fd, &fst) != 0 || stat(journal_path, &st) != 0 || fst.st_ino != st.st_ino) {
+            close(fd);
+            continue;
+        }
+        if (fst.st_size == 0 || !*seen) {
+            string_pool_free(*seen);
+            *seen = string_pool_create();
+        }
+
+        char buffer[65536];
+        size_t used = 0;
+        for (int i = 0; i < count; i++) {
+            size_t before = *seen ? (*seen)->count : 0;
+            if (*seen) {
+                string_pool_intern(*seen, lines[i]);
+                if ((*seen)->count == before) {
+                    continue; // déjà dans le journal
+                }
+            }
+            size_t len = strlen(lines[i]);
+            if (used + len + 1 > sizeof(buffer)) {
+                if (write(fd, buffer, used) < 0) {
+                    perror("Erreur d'écriture du journal");
+                }
+                used = 0;
+            }
+            if (len + 1 > sizeof(buffer)) {
+                continue;
+            }
+            memcpy(buffer + used, lines[i], len);
+            buffer[used + len] = '\n';
+            used += len + 1;
+        }
+        if (used > 0 && write(fd, buffer, used) < 0) {
+            perror("Erreur d'écriture du journal");
+        }
+        close(fd);
+        return;
+    }
+}
+
+int journal_watch(const char *source_dir, const char *backup_dir) {
+    char source_real[PATH_MAX];
+    if (!realpath(source_dir, source_real)) {
+        perror("Erreur d'accès à la source surveillée");
+        return -1;
+    }
+    int fd = inotify_init1(IN_CLOEXEC);
+    if (fd < 0) {
+        perror("Erreur d'initialisation d'inotify");
+        return -1;
+    }
+
+    char journal_path[MAX_SIZE_PATH], pid_path[MAX_SIZE_PATH];
+    snprintf(journal_path, sizeof(journal_path), "%s/%s", backup_dir, JOURNAL_FILE);
+    snprintf(pid_path, sizeof(pid_path), "%s/%s", backup_dir, JOURNAL_PID_FILE);
+    string_pool_t *seen = NULL;
+
+    watch_table_t table = {0};
+    if (add_watch_tree(fd, &table, source_real, "") != 0) {
+        // Une partie de l'arborescence n'est pas surveillée : les sauvegardes parcourront tout
+        fprintf(stderr, "Arborescence surveillée en partie : limite de surveillances inotify atteinte "
+                        "(fs.inotify.max_user_watches) ou chemin trop long\n");
+        char *overflow = JOURNAL_OVERFLOW;
+        journal_append(journal_path, &overflow, 1, &seen);
+    }
+
+    // Le surveillant ne s'annonce qu'une fois toute l'arborescence surveillée
+    char watcher[JOURNAL_WATCHER_SIZE];
+    if (snprintf(watcher, sizeof(watcher), "%d %lld %s", (int)getpid(), (long long)time(NULL), source_real)
+        >= (int)sizeof(watcher)) {
+        fprintf(stderr, "Chemin de la source surveillée trop long : %s\n", source_real);
+        close(fd);
+        return -1;
+    }
+    char tmp_path[MAX_SIZE_PATH + 8];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", pid_path);
+    FILE *pid_file = fopen(tmp_path, "w");
+    if (!pid_file || fprintf(pid_file, "%s\n", watcher) < 0 || fclose(pid_file) != 0
+        || rename(tmp_path, pid_path) != 0) {
+        perror("Erreur d'écriture de l'identité du surveillant");
+        close(fd);
+        return -1;
+    }
+    if (verbose_flag) {
+        printf("[INFO] Surveillance de %s, journal : %s\n", source_real, journal_path);
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = request_stop; // sans SA_RESTART : read est interrompu
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    // Les chemins d'un lot d'événements sont pris dans une arène vidée après écriture
+    arena_t arena;
+    arena_init(&arena, 0);
+    char events[64 * 1024] __attribute__((aligned(__alignof__(struct inotify_event))));
+    uint32_t move_cookie = 0;
+    char move_from[MAX_SIZE_PATH] = "";
+    while (!stop_requested) {
+        ssize_t n = read(fd, events, sizeof(events));
+        if (n <= 0) {
+            if (n < 0 && errno != EINTR) {
+                perror("Erreur de lecture des événements inotify");
+                break;
+            }
+            continue;
+        }
+        // Au plus deux lignes par événement (chemin et éventuel débordement)
+        int capacity = 2 * (n / sizeof(struct inotify_event) + 1);
+        char **lines = arena_alloc(&arena, capacity * sizeof(char *));
+        int count = 0;
+        for (char *p = events; p < events + n;) {
+            struct inotify_event *ev = (struct inotify_event *)p;
+            p += sizeof(struct inotify_event) + ev->len;
+
+            if (ev->mask & IN_Q_OVERFLOW) {
+                lines[count++] = JOURNAL_OVERFLOW;
+                continue;
+            }
+            if (ev->mask & IN_IGNORED) {
+                if (ev->wd < table.capacity) {
+                    free(table.dirs[ev->wd]);
+                    table.dirs[ev->wd] = NULL;
+                }
+                continue;
+            }
+            const char *dir = watch_table_get(&table, ev->wd);
+            if (!dir || ev->len == 0) {
+                continue;
+            }
+            char rel[MAX_SIZE_PATH];
+            if (snprintf(rel, sizeof(rel), dir[0] ? "%s/%s" : "%s%s", dir, ev->name) >= (int)sizeof(rel)
+                || strchr(rel, '\n')) {
+                lines[count++] = JOURNAL_OVERFLOW; // chemin tronqué ou impossible à écrire sur une ligne
+                continue;
+            }
+
+            if (ev->mask & IN_ISDIR) {
+                if (ev->mask & IN_ATTRIB) {
+                    continue; // les attributs des répertoires ne sont pas sauvegardés
+                }
+                if (ev->mask & IN_MOVED_FROM) {
+                    move_cookie = ev->cookie;
+                    snprintf(move_from, sizeof(move_from), "%s", rel);
+                } else if ((ev->mask & IN_MOVED_TO) && move_cookie && ev->cookie == move_cookie) {
+                    // Déplacement interne : les surveillances suivent le répertoire
+                    watch_table_move(&table, move_from, rel);
+                    move_cookie = 0;
+                } else if (ev->mask & (IN_CREATE | IN_MOVED_TO)) {
+                    if (add_watch_tree(fd, &table, source_real, rel) != 0) {
+                        lines[count++] = JOURNAL_OVERFLOW;
+                    }
+                }
+            }
+            // Un répertoire noté sera parcouru entièrement par la sauvegarde
+            lines[count++] = arena_strdup(&arena, rel);
+        }
+        if (count > 0) {
+            journal_append(journal_path, lines, count, &seen);
+        }
+        arena_reset(&arena);
+    }
+
+    // L'identité n'est retirée que si aucun autre surveillant ne l'a remplacée
+    FILE *current = fopen(pid_path, "r");
+    if (current) {
+        char line[JOURNAL_WATCHER_SIZE] = "";
+        if (fgets(line, sizeof(line), current)) {
+            line[strcspn(line, "\n")] = '\0';
+        }
+        fclose(current);
+        if (strcmp(line, watcher) == 0) {
+            unlink(pid_path);
+        }
+    }
+    arena_free(&arena);
+    string_pool_free(seen);
+    for (int wd = 0; wd < table.capacity; wd++) {
+        free(table.dirs[wd]);
+    }
+    free(table.dirs);
+    close(fd);
+    return stop_requested ? 0 : -1;
+}
+
+// Lit la première ligne d'un fichier, sans le retour à la ligne
+static int read_first_line(const char *path, char *line, size_t size) {
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        return -1;
+    }
+    int ret = fgets(line, size, file) ? 0 : -1;
+    fclose(file);
+    line[strcspn(line, "\n")] = '\0';
+    return ret;
+}
+
+static int compare_paths(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+int journal_take(const char *backup_dir, const char *source_dir, journal_t *journal) {
+    memset(journal, 0, sizeof(*journal));
+    char journal_path[MAX_SIZE_PATH], work_path[MAX_SIZE_PATH], pid_path[MAX_SIZE_PATH];
+    char state_path[MAX_SIZE_PATH];
+    snprintf(journal_path, sizeof(journal_path), "%s/%s", backup_dir, JOURNAL_FILE);
+    snprintf(work_path, sizeof(work_path), "%s/%s", backup_dir, JOURNAL_WORK_FILE);
+    snprintf(pid_path, sizeof(pid_path), "%s/%s", backup_dir, JOURNAL_PID_FILE);
+    snprintf(state_path, sizeof(state_path), "%s/%s", backup_dir, JOURNAL_STATE_FILE);
+
+    // Identité du surveillant : "pid début source"
+    char watcher[JOURNAL_WATCHER_SIZE];
+    if (read_first_line(pid_path, watcher, sizeof(watcher)) == 0) {
+        int pid;
+        long long start;
+        int offset = 0;
+        char source_real[PATH_MAX];
+        if (sscanf(watcher, "%d %lld %n", &pid, &start, &offset) == 2 && offset > 0
+            && realpath(source_dir, source_real) && strcmp(watcher + offset, source_real) == 0
+            && (kill(pid, 0) == 0 || errno == EPERM)) {
+            snprintf(journal->watcher, sizeof(journal->watcher), "%s", watcher);
+        }
+    }
+
+    // Le journal courant rejoint celui d'une sauvegarde précédente non validée, s'il y en a un
+    int fd = open(journal_path, O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+        flock(fd, LOCK_EX);
+        struct stat st;
+        if (stat(work_path, &st) == 0) {
+            FILE *in = fdopen(dup(fd), "r");
+            FILE *out = fopen(work_path, "a");
+            if (in && out) {
+                char buffer[65536];
+                size_t r;
+                while ((r = fread(buffer, 1, sizeof(buffer), in)) > 0) {
+                    fwrite(buffer, 1, r, out);
+                }
+            }
+            if (in) {
+                fclose(in);
+            }
+            if (out) {
+                fclose(out);
+            }
+            unlink(journal_path);
+        } else {
+            rename(journal_path, work_path);
+        }
+        close(fd); // libère le verrou : le surveillant crée un nouveau journal
+    }
+
+    int overflow = 0;
+    FILE *work = fopen(work_path, "r");
+    if (work) {
+        char line[MAX_SIZE_PATH];
+        int capacity = 0;
+        while (fgets(line, sizeof(line), work)) {
+            line[strcspn(line, "\n")] = '\0';
+            if (strcmp(line, JOURNAL_OVERFLOW) == 0) {
+                overflow = 1;
+                continue;
+            }
+            if (line[0] == '\0') {
+                continue;
+            }
+            if (journal->count == capacity) {
+                capacity = capacity ? capacity * 2 : 64;
+                char **paths = realloc(journal->paths, capacity * sizeof(char *));
+                if (!paths) {
+                    overflow = 1;
+                    break;
+                }
+                journal->paths = paths;
+            }
+            journal->paths[journal->count++] = strdup(line);
+        }
+        fclose(work);
+    }
+    if (journal->count > 0) {
+        qsort(journal->paths, journal->count, sizeof(char *), compare_paths);
+        // Un chemin modifié plusieurs fois n'est gardé qu'une fois
+        int unique = 1;
+        for (int i = 1; i < journal->count; i++) {
+            if (strcmp(journal->paths[i], journal->paths[unique - 1]) == 0) {
+                free(journal->paths[i]);
+            } else {
+                journal->paths[unique++] = journal->paths[i];
+            }
+        }
+        journal->count = unique;
+    }
+
+    // Le journal ne couvre l'intervalle depuis la dernière sauvegarde que si le même
+    // surveillant était déjà actif quand celle-ci a pris le journal précédent
+    char state[JOURNAL_WATCHER_SIZE];
+    int valid = journal->watcher[0] && !overflow && read_first_line(state_path, state, sizeof(state)) == 0
+                && strcmp(state, journal->watcher) == 0;
+    if (verbose_flag) {
+        if (valid) {
+            printf("[INFO] Journal de modifications : %d chemins\n", journal->count);
+        } else if (journal->watcher[0]) {
+            printf("[INFO] Journal de modifications incomplet : parcours complet de la source\n");
+        }
+    }
+    return valid ? 0 : -1;
+}
+
+void journal_commit(const char *backup_dir, const journal_t *journal) {
+    char work_path[MAX_SIZE_PATH], state_path[MAX_SIZE_PATH];
+    snprintf(work_path, sizeof(work_path), "%s/%s", backup_dir, JOURNAL_WORK_FILE);
+    snprintf(state_path, sizeof(state_path), "%s/%s", backup_dir, JOURNAL_STATE_FILE);
+    if (!journal->watcher[0]) {
+        unlink(work_path);
+        unlink(state_path);
+        return;
+    }
+    char tmp_path[MAX_SIZE_PATH + 8];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", state_path);
+    FILE *state = fopen(tmp_path, "w");
+    if (!state || fprintf(state, "%s\n", journal->watcher) < 0 || fclose(state) != 0
+        || rename(tmp_path, state_path) != 0) {
+        perror("Erreur d'écriture de l'état du journal");
+        return;
+    }
+    unlink(work_path);
+}
+
+// Cherche path dans les chemins triés du journal
+static int journal_contains(const journal_t *journal, const char *path) {
+    return journal->count > 0
+           && bsearch(&path, journal->paths, journal->count, sizeof(char *), compare_paths) != NULL;
+}
+
+int journal_has_dirty_parent(const journal_t *journal, const char *rel_path) {
+    char prefix[MAX_SIZE_PATH];
+    snprintf(prefix, sizeof(prefix), "%s", rel_path);
+    for (char *slash = strchr(prefix, '/'); slash; slash = strchr(slash + 1, '/')) {
+        *slash = '\0';
+        int found = journal_contains(journal, prefix);
+        *slash = '/';
+        if (found) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int journal_is_dirty(const journal_t *journal, const char *rel_path) {
+    return journal_contains(journal, rel_path) || journal_has_dirty_parent(journal, rel_path);
+}
+
+void journal_free(journal_t *journal) {
+    for (int i = 0; i < journal->count; i++) {
+        free(journal->paths[i]);
+    }
+    free(journal->paths);
+    journal->paths = NULL;
+    journal->count = 0;
+}
@@ -0,0 +1,60 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <limits.h>
+
+// Fichiers tenus par le surveillant (--watch) à la racine du répertoire de sauvegarde
+#define JOURNAL_FILE ".journal"             // chemins modifiés, un par ligne, relatifs à la source
+#define JOURNAL_WORK_FILE ".journal.work"   // journal pris par une sauvegarde en cours
+#define JOURNAL_PID_FILE ".journal.pid"     // identité du surveillant actif
+#define JOURNAL_STATE_FILE ".journal.state" // surveillant pris en compte par la dernière sauvegarde
+// Ligne écrite quand des événements ont pu être perdus
+#define JOURNAL_OVERFLOW "!OVERFLOW"
+// Identité d'un surveillant, "pid début source" : la source est un chemin absolu de PATH_MAX
+// octets au plus, zéro final compris
+#define JOURNAL_WATCHER_SIZE (PATH_MAX + 48)
+
+// Chemins modifiés depuis la dernière sauvegarde, triés
+typedef struct {
+    char **paths;
+    int count;
+    char watcher[JOURNAL_WATCHER_SIZE]; // identité du surveillant lue dans JOURNAL_PID_FILE ("" si aucun)
+} journal_t;
+
+/**
+ * @brief Surveille source_dir et ajoute au journal de backup_dir chaque chemin modifié.
+ *
+ * Utilise inotify (une surveillance par répertoire). Ne rend la main qu'à la réception
+ * de SIGINT/SIGTERM ou en cas d'erreur.
+ *
+ * @return 0 après un arrêt demandé, -1 en cas d'erreur.
+ */
+int journal_watch(const char *source_dir, const char *backup_dir);
+
+/**
+ * @brief Prend le journal accumulé depuis la dernière sauvegarde.
+ *
+ * Le journal est renommé en JOURNAL_WORK_FILE : les événements suivants vont dans un
+ * nouveau journal. Il n'est utilisable que si le surveillant de source_dir tourne
+ * toujours, qu'il était déjà actif lors de la sauvegarde précédente et qu'aucun
+ * événement n'a été perdu.
+ *
+ * @return 0 si journal liste tous les changements, -1 s'il faut parcourir toute la source.
+ */
+int journal_take(const char *backup_dir, const char *source_dir, journal_t *journal);
+
+/**
+ * @brief Valide la prise du journal après une sauvegarde réussie.
+ *
+ * Supprime JOURNAL_WORK_FILE et mémorise le surveillant dont la sauvegarde est à jour.
+ */
+void journal_commit(const char *backup_dir, const journal_t *journal);
+
+// Vrai si rel_path, ou l'un de ses répertoires parents, figure dans le journal
+int journal_is_dirty(const journal_t *journal, const char *rel_path);
+// Vrai si l'un des répertoires parents de rel_path (mais pas rel_path lui-même) figure dans le journal
+int journal_has_dirty_parent(const journal_t *journal, const char *rel_path);
+// Libère les chemins du journal
+void journal_free(journal_t *journal);
+
+#endif // JOURNAL_H
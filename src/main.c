@@ -5,13 +5,49 @@
 #include "file_handler.h"
 #include "deduplication.h"
 #include "backup_manager.h"
+#include "check.h"
+#include "estimate.h"
+#include "diff.h"
+#include "throttle.h"
+#include "direct_io.h"
+#include "chunk_cache.h"
+#include "journal.h"
 #include "network.h"
+#include "stats.h"
+#include "trace.h"
 
 int verbose_flag = 0;
 int dry_run_flag = 0;
 static int backup_flag = 0;
 static int restore_flag = 0;
 static int list_flag = 0;
+static int prune_flag = 0;
+static int check_flag = 0;
+static int watch_flag = 0;
+static int estimate_flag = 0;
+static int diff_flag = 0;
+static int stats_flag = 0; // 0 : pas de résumé, 1 : texte, 2 : JSON
+
+// Lit une taille en octets, avec un suffixe K, M ou G facultatif ; -1 si invalide
+static long long parse_size(const char *text) {
+    char *end;
+    long long size = strtoll(text, &end, 10);
+    if (end == text || size < 0) {
+        return -1;
+    }
+    switch (*end) {
+        case 'G': case 'g': size *= 1024;
+        /* fall through */
+        case 'M': case 'm': size *= 1024;
+        /* fall through */
+        case 'K': case 'k': size *= 1024;
+            end++;
+            break;
+        default:
+            break;
+    }
+    return *end == '\0' ? size : -1;
+}
 
 int main(int argc, char *argv[]) {
     static struct option long_options[] = {
@@ -26,6 +62,26 @@ int main(int argc, char *argv[]) {
         {"dest", required_argument, NULL, 'd'},
         {"source", required_argument, NULL, 's'},
         {"verbose", no_argument, &verbose_flag, 1},
+        {"stats", optional_argument, NULL, 'S'},
+        {"trace", required_argument, NULL, 'T'},
+        {"prune", no_argument, NULL, 'P'},
+        {"keep-daily", required_argument, NULL, 'D'},
+        {"keep-weekly", required_argument, NULL, 'W'},
+        {"check", no_argument, NULL, 'C'},
+        {"jobs", required_argument, NULL, 'J'},
+        {"sample", required_argument, NULL, 'G'},
+        {"cache-size", required_argument, NULL, 'Z'},
+        {"watch", no_argument, NULL, 'O'},
+        {"estimate", no_argument, NULL, 'E'},
+        {"path", required_argument, NULL, 'A'},
+        {"diff", required_argument, NULL, 'F'},
+        {"resume", no_argument, NULL, 'R'},
+        {"bwlimit", required_argument, NULL, 'L'},
+        {"ioprio", required_argument, NULL, 'I'},
+        {"background", no_argument, NULL, 'B'},
+        {"direct-io", optional_argument, NULL, 'X'},
+        {"chunk-size", required_argument, NULL, 'K'},
+        {"memory-limit", required_argument, NULL, 'M'},
         {0, 0, 0, 0}
     };
 
@@ -34,7 +90,21 @@ int main(int argc, char *argv[]) {
     int instance = -1;
 
     const char *source_dir = NULL, *dest_dir = NULL, *dest_server_ip = NULL, *src_server_ip = NULL;
+    const char *trace_file = NULL;
+    const char *path_prefix = NULL;
+    const char *diff_from = NULL;
+    int resume = 0;
+    long long read_limit = 0, write_limit = 0;
+    const char *ioprio = NULL;
+    int background = 0;
+    int direct_depth = 0;
+    long long chunk_size = 0; // 0 : taille du dépôt
+    long long memory_limit = 0; // 0 : pas de limite
     int dest_server_port = 0, src_server_port = 0;
+    int keep_daily = 0, keep_weekly = 0;
+    int jobs = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    double sample_percent = 0; // 0 : valeur par défaut de l'action
+    long long cache_size = CHUNK_CACHE_DEFAULT_SIZE;
 
     while ((opt = getopt_long(argc, argv, "brlyj:k:m:n:d:s:v", long_options, &option_index)) != -1) {
         switch (opt) {
@@ -68,6 +138,106 @@ int main(int argc, char *argv[]) {
             case 's': // --source
                 source_dir = optarg;
                 break;
+            case 'S': // --stats[=json]
+                if (!optarg || strcmp(optarg, "text") == 0) {
+                    stats_flag = 1;
+                } else if (strcmp(optarg, "json") == 0) {
+                    stats_flag = 2;
+                } else {
+                    fprintf(stderr, "Erreur: format de --stats inconnu : %s (text ou json)\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'T': // --trace FILE
+                trace_file = optarg;
+                break;
+            case 'P': // --prune
+                prune_flag = 1;
+                break;
+            case 'D': // --keep-daily N
+                keep_daily = atoi(optarg);
+                break;
+            case 'W': // --keep-weekly N
+                keep_weekly = atoi(optarg);
+                break;
+            case 'C': // --check
+                check_flag = 1;
+                break;
+            case 'J': // --jobs N
+                jobs = atoi(optarg);
+                break;
+            case 'G': // --sample P%
+                sample_percent = atof(optarg); // le '%' final est ignoré par atof
+                if (sample_percent <= 0 || sample_percent > 100) {
+                    fprintf(stderr, "Erreur: --sample attend un pourcentage entre 0 et 100 : %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'O': // --watch
+                watch_flag = 1;
+                break;
+            case 'E': // --estimate
+                estimate_flag = 1;
+                break;
+            case 'F': // --diff SAUVEGARDE_A SAUVEGARDE_B
+                diff_flag = 1;
+                diff_from = optarg;
+                break;
+            case 'L': { // --bwlimit LECTURE[:ÉCRITURE]
+                char limit[64];
+                snprintf(limit, sizeof(limit), "%s", optarg);
+                char *colon = strchr(limit, ':');
+                if (colon) {
+                    *colon = '\0';
+                }
+                read_limit = parse_size(limit);
+                write_limit = colon ? parse_size(colon + 1) : read_limit;
+                if (read_limit <= 0 || write_limit <= 0) {
+                    fprintf(stderr, "Erreur: --bwlimit attend un débit en octets/s (ex. 20M ou 20M:5M) : %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            }
+            case 'I': // --ioprio CLASSE
+                ioprio = optarg;
+                break;
+            case 'B': // --background
+                background = 1;
+                break;
+            case 'X': // --direct-io[=PROFONDEUR]
+                direct_depth = optarg ? atoi(optarg) : DIRECT_IO_DEFAULT_DEPTH;
+                if (direct_depth < 1 || direct_depth > DIRECT_IO_MAX_DEPTH) {
+                    fprintf(stderr, "Erreur: --direct-io attend une profondeur de 1 à %d : %s\n", DIRECT_IO_MAX_DEPTH, optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'K': // --chunk-size TAILLE
+                chunk_size = parse_size(optarg);
+                if (chunk_size < 0 || !valid_chunk_size((size_t)chunk_size)) {
+                    fprintf(stderr, "Erreur: --chunk-size attend une puissance de 2 entre 4K et 4M : %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'M': // --memory-limit TAILLE
+                memory_limit = parse_size(optarg);
+                if (memory_limit < BACKUP_MIN_MEMORY_LIMIT) {
+                    fprintf(stderr, "Erreur: --memory-limit attend une taille d'au moins 16M : %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'R': // --resume
+                resume = 1;
+                break;
+            case 'A': // --path CHEMIN
+                path_prefix = optarg;
+                break;
+            case 'Z': // --cache-size TAILLE
+                cache_size = parse_size(optarg);
+                if (cache_size < 0) {
+                    fprintf(stderr, "Erreur: --cache-size attend une taille (ex. 64M) : %s\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
             case '?': // Unknown option
                 fprintf(stderr, "Option non valide.\n");
                 return EXIT_FAILURE;
@@ -77,16 +247,61 @@ int main(int argc, char *argv[]) {
         }
     }
 
-    if (strcmp("127.0.0.1",dest_server_ip) == 0) { // instance serveur
+    // Sans option --d-server/--s-server, on reste en mode local
+    if (dest_server_ip && strcmp("127.0.0.1",dest_server_ip) == 0) { // instance serveur
         instance = 1;
     }
 
-    if (strcmp("127.0.0.1",src_server_ip) == 0) { // instance client
+    if (src_server_ip && strcmp("127.0.0.1",src_server_ip) == 0) { // instance client
         instance = 2;
-    }    
+    }
+
+    stats_start();
+    if (trace_file) {
+        trace_open(trace_file);
+    }
+
+    if ((backup_flag) + (restore_flag) + (list_flag) + (prune_flag) + (check_flag) + (watch_flag) + (estimate_flag) + (diff_flag) != 1) {
+        fprintf(stderr, "Erreur: Vous devez utiliser une seule option parmi : --backup, --restore, --list-backups, --prune, --check, --watch, --estimate, --diff.\n\n");
+        return EXIT_FAILURE;
+    }
 
-    if ((backup_flag) + (restore_flag) + (list_flag) != 1) {
-        fprintf(stderr, "Erreur: Vous devez utiliser une seule option parmi : --backup, --restore, --list-backups.\n\n");
+    if (resume && !backup_flag) {
+        fprintf(stderr, "Erreur: --resume ne s'utilise qu'avec --backup.\n");
+        return EXIT_FAILURE;
+    }
+
+    if ((read_limit || ioprio || background) && !backup_flag) {
+        fprintf(stderr, "Erreur: --bwlimit, --ioprio et --background ne s'utilisent qu'avec --backup.\n");
+        return EXIT_FAILURE;
+    }
+    if (direct_depth && !backup_flag) {
+        fprintf(stderr, "Erreur: --direct-io ne s'utilise qu'avec --backup.\n");
+        return EXIT_FAILURE;
+    }
+    if (chunk_size && !backup_flag && !estimate_flag) {
+        fprintf(stderr, "Erreur: --chunk-size ne s'utilise qu'avec --backup ou --estimate.\n");
+        return EXIT_FAILURE;
+    }
+    if (memory_limit && !backup_flag) {
+        fprintf(stderr, "Erreur: --memory-limit ne s'utilise qu'avec --backup.\n");
+        return EXIT_FAILURE;
+    }
+    backup_set_memory_limit((size_t)memory_limit);
+    direct_io_enable(direct_depth);
+    throttle_set_bwlimit((uint64_t)read_limit, (uint64_t)write_limit);
+    throttle_set_background(background);
+    // En mode discret, la sauvegarde n'obtient le disque que lorsqu'il est libre
+    if (!ioprio && background) {
+        ioprio = "idle";
+    }
+    if (ioprio && throttle_set_ioprio(ioprio) != 0) {
+        fprintf(stderr, "Erreur: --ioprio attend idle, best-effort ou best-effort:N (0 à 7) : %s\n", ioprio);
+        return EXIT_FAILURE;
+    }
+
+    if (path_prefix && !restore_flag) {
+        fprintf(stderr, "Erreur: --path ne s'utilise qu'avec --restore.\n");
         return EXIT_FAILURE;
     }
 
@@ -127,7 +342,10 @@ int main(int argc, char *argv[]) {
                 }
             }
         } else {
-            create_backup(source_dir, dest_dir);
+            if (open_repository(dest_dir, (size_t)chunk_size) != 0) {
+                return EXIT_FAILURE;
+            }
+            create_backup(source_dir, dest_dir, resume);
         }
     }
 
@@ -159,12 +377,12 @@ int main(int argc, char *argv[]) {
                 }
             }
         } else {
-            restore_backup(source_dir, dest_dir);
+            restore_backup(source_dir, dest_dir, jobs, (size_t)cache_size, path_prefix);
         }
     }
 
     if (list_flag) {
-        if (!source_dir) {
+        if (!source_dir && instance != 2) {
             fprintf(stderr, "Erreur: Vous devez spécifier le dossier de sauvergarde avec l'option --source.\n");
             return EXIT_FAILURE;
         }
@@ -173,16 +391,37 @@ int main(int argc, char *argv[]) {
                 printf("[INFO] Backup en réseau\n");
             }
             if (instance == 1) { //instance serveur
-                // receive_data(); //lecture de "LIST-BACKUP"
-                // construction de la liste de backups
-                // pour chaque element de la liste faire :
-                    // send_data(src_server_ip, src_server_port, backup, size); //envoi de la liste_de_backups
-                // send_data(src_server_ip, src_server_port, "EXIT", size); //envoi de EXIT
+                // Le client envoie "LIST-BACKUP\n" ; la réponse est la liste, terminée par la fermeture
+                int client = wait_for_client(dest_server_port);
+                if (client < 0) {
+                    return EXIT_FAILURE;
+                }
+                char request[64] = {0};
+                ssize_t received = recv(client, request, sizeof(request) - 1, 0);
+                FILE *out = fdopen(client, "w");
+                if (received > 0 && strncmp(request, "LIST-BACKUP", 11) == 0 && out) {
+                    write_backup_list(source_dir, out);
+                } else {
+                    fprintf(stderr, "Erreur: requête inconnue\n");
+                }
+                if (out) {
+                    fclose(out);
+                } else {
+                    close(client);
+                }
             } else {
-                if (instance = 2) { //instance client
-                    send_data(dest_server_ip, dest_server_port, "LIST-BACKUP", 8); // Envoi de LIST-BACKUP au serveur
-                    // tant que receive_data() ne vaut pas "EXIT"
-                        // afficher les resultats sur le terminal
+                if (instance == 2) { //instance client
+                    int sock = connect_to_server(src_server_ip, src_server_port);
+                    if (sock < 0) {
+                        return EXIT_FAILURE;
+                    }
+                    send(sock, "LIST-BACKUP\n", 12, 0);
+                    char buffer[4096];
+                    ssize_t received;
+                    while ((received = recv(sock, buffer, sizeof(buffer), 0)) > 0) {
+                        fwrite(buffer, 1, received, stdout);
+                    }
+                    close(sock);
                 }
             }
         } else {
@@ -190,5 +429,65 @@ int main(int argc, char *argv[]) {
         }
     }
 
-    return EXIT_SUCCESS;
+    if (prune_flag) {
+        if (!source_dir) {
+            fprintf(stderr, "Erreur: Vous devez spécifier le dossier de sauvergarde avec l'option --source.\n");
+            return EXIT_FAILURE;
+        }
+        if (keep_daily <= 0 && keep_weekly <= 0) {
+            fprintf(stderr, "Erreur: --prune demande --keep-daily N ou --keep-weekly M (au moins une sauvegarde conservée).\n");
+            return EXIT_FAILURE;
+        }
+        prune_backups(source_dir, keep_daily, keep_weekly);
+    }
+
+    if (watch_flag) {
+        if (!source_dir || !dest_dir) {
+            fprintf(stderr, "Erreur: Vous devez spécifier les dossiers source et destination.\n");
+            return EXIT_FAILURE;
+        }
+        if (journal_watch(source_dir, dest_dir) != 0) {
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (estimate_flag) {
+        if (!source_dir || !dest_dir) {
+            fprintf(stderr, "Erreur: Vous devez spécifier les dossiers source et destination.\n");
+            return EXIT_FAILURE;
+        }
+        if (open_repository(dest_dir, (size_t)chunk_size) != 0) {
+            return EXIT_FAILURE;
+        }
+        if (estimate_backup(source_dir, dest_dir, sample_percent ? sample_percent : ESTIMATE_DEFAULT_SAMPLE) != 0) {
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (diff_flag) {
+        // La seconde sauvegarde est le premier argument qui n'est pas une option
+        if (optind >= argc) {
+            fprintf(stderr, "Erreur: --diff attend deux sauvegardes : --diff SAUVEGARDE_A SAUVEGARDE_B.\n");
+            return EXIT_FAILURE;
+        }
+        if (diff_backups(diff_from, argv[optind]) != 0) {
+            return EXIT_FAILURE;
+        }
+    }
+
+    int check_failed = 0;
+    if (check_flag) {
+        if (!source_dir) {
+            fprintf(stderr, "Erreur: Vous devez spécifier le dossier de sauvergarde avec l'option --source.\n");
+            return EXIT_FAILURE;
+        }
+        check_failed = check_backups(source_dir, jobs, sample_percent ? sample_percent : 100.0) != 0;
+    }
+
+    if (stats_flag) {
+        stats_print(stdout, stats_flag == 2);
+    }
+    trace_close();
+
+    return check_failed ? EXIT_FAILURE : EXIT_SUCCESS;
 }
@@ -0,0 +1,352 @@
+#include "manifest.h"
+#include "stats.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#define MAX_SIZE_PATH 2048
+
+extern int verbose_flag;
+
+// Entrée en mémoire : rang d'ajout, longueurs, puis clé et valeur terminées par '\0'
+typedef struct {
+    uint64_t seq;
+    uint32_t key_length;
+    uint32_t value_length;
+    char data[];
+} manifest_record_t;
+
+// Run trié sur disque : longueurs (uint32_t) puis clé et valeur de chaque entrée
+typedef struct {
+    FILE *file;
+    char *buffer;           // tampon d'écriture puis de lecture
+    char *record;           // clé puis valeur de l'entrée courante, terminées par '\0'
+    size_t record_capacity;
+    const char *key;
+    const char *value;
+} manifest_run_t;
+
+struct manifest {
+    char dir[MAX_SIZE_PATH];
+    char *buffer;                 // entrées en mémoire
+    size_t buffer_size;
+    size_t used;
+    manifest_record_t **records;  // entrées en mémoire, triées avant d'être écrites
+    size_t record_capacity;
+    size_t count;
+    uint64_t seq;
+    manifest_run_t runs[MANIFEST_MAX_RUNS];
+    int run_count;
+    int total_runs;
+    size_t position;              // prochaine entrée rendue quand tout a tenu en mémoire
+    int heap[MANIFEST_MAX_RUNS];  // runs non épuisés, tas ordonné par entrée courante
+    int heap_size;
+    int returned;                 // l'entrée du sommet a été rendue : son run doit avancer
+};
+
+static int compare_records(const void *a, const void *b) {
+    const manifest_record_t *ra = *(manifest_record_t *const *)a;
+    const manifest_record_t *rb = *(manifest_record_t *const *)b;
+    int cmp = strcmp(ra->data, rb->data);
+    if (cmp != 0) {
+        return cmp;
+    }
+    return ra->seq < rb->seq ? -1 : (ra->seq > rb->seq);
+}
+
+/**
+ * @brief Crée un run vide : fichier temporaire du répertoire du manifeste, supprimé
+ * aussitôt (il disparaît avec le processus, même après un arrêt brutal).
+ */
+static int run_create(manifest_t *manifest, manifest_run_t *run) {
+    memset(run, 0, sizeof(*run));
+    char path[MAX_SIZE_PATH + 32];
+    snprintf(path, sizeof(path), "%s/.manifest-XXXXXX", manifest->dir);
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        perror("Erreur de création d'un run du manifeste");
+        return -1;
+    }
+    unlink(path);
+    run->file = fdopen(fd, "w+b");
+    run->buffer = malloc(MANIFEST_RUN_BUFFER_SIZE);
+    if (!run->file || !run->buffer) {
+        if (run->file) {
+            fclose(run->file);
+        } else {
+            close(fd);
+        }
+        free(run->buffer);
+        return -1;
+    }
+    setvbuf(run->file, run->buffer, _IOFBF, MANIFEST_RUN_BUFFER_SIZE);
+    stats_add(STATS_METADATA_OPS, 2);
+    return 0;
+}
+
+static void run_close(manifest_run_t *run) {
+    if (run->file) {
+        fclose(run->file);
+    }
+    free(run->buffer);
+    free(run->record);
+    memset(run, 0, sizeof(*run));
+}
+
+static void run_write(manifest_run_t *run, const char *key, uint32_t key_length, const char *value,
+                      uint32_t value_length) {
+    uint32_t lengths[2] = {key_length, value_length};
+    fwrite(lengths, sizeof(uint32_t), 2, run->file);
+    fwrite(key, 1, key_length, run->file);
+    fwrite(value, 1, value_length, run->file);
+}
+
+/**
+ * @brief Lit l'entrée suivante du run ; 0 à la fin (ou si le run est illisible).
+ */
+static int run_read(manifest_run_t *run) {
+    uint32_t lengths[2];
+    if (fread(lengths, sizeof(uint32_t), 2, run->file) != 2) {
+        return 0;
+    }
+    size_t size = (size_t)lengths[0] + lengths[1] + 2;
+    if (size > run->record_capacity) {
+        char *grown = realloc(run->record, size);
+        if (!grown) {
+            return 0;
+        }
+        run->record = grown;
+        run->record_capacity = size;
+    }
+    char *value = run->record + lengths[0] + 1;
+    if (fread(run->record, 1, lengths[0], run->file) != lengths[0]
+        || fread(value, 1, lengths[1], run->file) != lengths[1]) {
+        return 0;
+    }
+    run->record[lengths[0]] = '\0';
+    value[lengths[1]] = '\0';
+    run->key = run->record;
+    run->value = value;
+    return 1;
+}
+
+// Vrai si l'entrée courante du run a doit sortir avant celle de b (à clés égales, le run
+// écrit le premier contient les entrées ajoutées les premières)
+static int run_before(const manifest_t *manifest, int a, int b) {
+    int cmp = strcmp(manifest->runs[a].key, manifest->runs[b].key);
+    return cmp < 0 || (cmp == 0 && a < b);
+}
+
+static void heap_sift_down(manifest_t *manifest, int i) {
+    for (;;) {
+        int smallest = i;
+        int left = 2 * i + 1, right = 2 * i + 2;
+        if (left < manifest->heap_size && run_before(manifest, manifest->heap[left], manifest->heap[smallest])) {
+            smallest = left;
+        }
+        if (right < manifest->heap_size && run_before(manifest, manifest->heap[right], manifest->heap[smallest])) {
+            smallest = right;
+        }
+        if (smallest == i) {
+            return;
+        }
+        int tmp = manifest->heap[i];
+        manifest->heap[i] = manifest->heap[smallest];
+        manifest->heap[smallest] = tmp;
+        i = smallest;
+    }
+}
+
+/**
+ * @brief Relit les runs depuis le début et construit le tas de leurs premières entrées.
+ */
+static void merge_start(manifest_t *manifest) {
+    manifest->heap_size = 0;
+    manifest->returned = 0;
+    for (int i = 0; i < manifest->run_count; i++) {
+        fflush(manifest->runs[i].file);
+        rewind(manifest->runs[i].file);
+        if (run_read(&manifest->runs[i])) {
+            manifest->heap[manifest->heap_size++] = i;
+        }
+    }
+    for (int i = manifest->heap_size / 2 - 1; i >= 0; i--) {
+        heap_sift_down(manifest, i);
+    }
+}
+
+static int merge_next(manifest_t *manifest, const char **key, const char **value) {
+    if (manifest->returned && manifest->heap_size > 0) {
+        // Le run de l'entrée rendue au dernier appel passe à la suivante, ou quitte le tas
+        if (!run_read(&manifest->runs[manifest->heap[0]])) {
+            manifest->heap[0] = manifest->heap[--manifest->heap_size];
+        }
+        heap_sift_down(manifest, 0);
+    }
+    manifest->returned = 0;
+    if (manifest->heap_size == 0) {
+        return 0;
+    }
+    const manifest_run_t *run = &manifest->runs[manifest->heap[0]];
+    *key = run->key;
+    *value = run->value;
+    manifest->returned = 1;
+    return 1;
+}
+
+/**
+ * @brief Fusionne tous les runs en un seul, pour garder un nombre borné de fichiers ouverts.
+ */
+static int compact_runs(manifest_t *manifest) {
+    manifest_run_t merged;
+    if (run_create(manifest, &merged) != 0) {
+        return -1;
+    }
+    merge_start(manifest);
+    const char *key, *value;
+    while (merge_next(manifest, &key, &value)) {
+        run_write(&merged, key, (uint32_t)strlen(key), value, (uint32_t)strlen(value));
+    }
+    if (fflush(merged.file) != 0 || ferror(merged.file)) {
+        perror("Erreur d'écriture d'un run du manifeste");
+        run_close(&merged);
+        return -1;
+    }
+    for (int i = 0; i < manifest->run_count; i++) {
+        run_close(&manifest->runs[i]);
+    }
+    manifest->runs[0] = merged;
+    manifest->run_count = 1;
+    manifest->heap_size = 0;
+    manifest->returned = 0;
+    return 0;
+}
+
+/**
+ * @brief Trie les entrées en mémoire et les écrit dans un nouveau run.
+ */
+static int spill(manifest_t *manifest) {
+    if (manifest->run_count == MANIFEST_MAX_RUNS && compact_runs(manifest) != 0) {
+        return -1;
+    }
+    manifest_run_t *run = &manifest->runs[manifest->run_count];
+    if (run_create(manifest, run) != 0) {
+        return -1;
+    }
+    qsort(manifest->records, manifest->count, sizeof(manifest_record_t *), compare_records);
+    for (size_t i = 0; i < manifest->count; i++) {
+        const manifest_record_t *record = manifest->records[i];
+        run_write(run, record->data, record->key_length, record->data + record->key_length + 1,
+                  record->value_length);
+    }
+    if (fflush(run->file) != 0 || ferror(run->file)) {
+        perror("Erreur d'écriture d'un run du manifeste");
+        run_close(run);
+        return -1;
+    }
+    manifest->run_count++;
+    manifest->total_runs++;
+    manifest->used = 0;
+    manifest->count = 0;
+    stats_add(STATS_MANIFEST_RUNS, 1);
+    if (verbose_flag) {
+        printf("[INFO] Manifeste : run %d écrit\n", manifest->total_runs);
+    }
+    return 0;
+}
+
+manifest_t *manifest_create(const char *dir, size_t memory) {
+    if (memory < MANIFEST_MIN_MEMORY) {
+        memory = MANIFEST_MIN_MEMORY;
+    }
+    manifest_t *manifest = calloc(1, sizeof(manifest_t));
+    if (!manifest) {
+        return NULL;
+    }
+    snprintf(manifest->dir, sizeof(manifest->dir), "%s", dir);
+    // Les trois quarts pour les entrées, le reste pour le tableau qui sert à les trier
+    manifest->buffer_size = memory / 4 * 3;
+    manifest->record_capacity = memory / 4 / sizeof(manifest_record_t *);
+    manifest->buffer = malloc(manifest->buffer_size);
+    manifest->records = malloc(manifest->record_capacity * sizeof(manifest_record_t *));
+    if (!manifest->buffer || !manifest->records) {
+        manifest_free(manifest);
+        return NULL;
+    }
+    return manifest;
+}
+
+int manifest_add(manifest_t *manifest, const char *key, const char *value) {
+    if (!value) {
+        value = "";
+    }
+    size_t key_length = strlen(key), value_length = strlen(value);
+    // Entrées alignées sur 8 octets
+    size_t size = (sizeof(manifest_record_t) + key_length + value_length + 2 + 7) & ~(size_t)7;
+    if (size > manifest->buffer_size) {
+        return -1;
+    }
+    if ((manifest->used + size > manifest->buffer_size || manifest->count == manifest->record_capacity)
+        && spill(manifest) != 0) {
+        return -1;
+    }
+    manifest_record_t *record = (manifest_record_t *)(manifest->buffer + manifest->used);
+    record->seq = manifest->seq++;
+    record->key_length = (uint32_t)key_length;
+    record->value_length = (uint32_t)value_length;
+    memcpy(record->data, key, key_length + 1);
+    memcpy(record->data + key_length + 1, value, value_length + 1);
+    manifest->records[manifest->count++] = record;
+    manifest->used += size;
+    return 0;
+}
+
+int manifest_finish(manifest_t *manifest) {
+    if (manifest->run_count == 0) {
+        // Tout a tenu en mémoire : lecture directe des entrées triées
+        qsort(manifest->records, manifest->count, sizeof(manifest_record_t *), compare_records);
+        manifest->position = 0;
+        return 0;
+    }
+    if (manifest->count > 0 && spill(manifest) != 0) {
+        return -1;
+    }
+    // Les entrées sont toutes sur disque : la mémoire est rendue pendant la lecture
+    free(manifest->buffer);
+    free(manifest->records);
+    manifest->buffer = NULL;
+    manifest->records = NULL;
+    merge_start(manifest);
+    return 0;
+}
+
+int manifest_next(manifest_t *manifest, const char **key, const char **value) {
+    if (manifest->run_count > 0) {
+        return merge_next(manifest, key, value);
+    }
+    if (manifest->position >= manifest->count) {
+        return 0;
+    }
+    const manifest_record_t *record = manifest->records[manifest->position++];
+    *key = record->data;
+    *value = record->data + record->key_length + 1;
+    return 1;
+}
+
+int manifest_run_count(const manifest_t *manifest) {
+    return manifest->total_runs;
+}
+
+void manifest_free(manifest_t *manifest) {
+    if (!manifest) {
+        return;
+    }
+    for (int i = 0; i < manifest->run_count; i++) {
+        run_close(&manifest->runs[i]);
+    }
+    free(manifest->buffer);
+    free(manifest->records);
+    free(manifest);
+}
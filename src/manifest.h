@@ -0,0 +1,31 @@
+#ifndef MANIFEST_H
+#define MANIFEST_H
+
+#include <stddef.h>
+
+// Manifeste trié en mémoire bornée (--memory-limit) : les entrées (clé, valeur) ajoutées
+// restent en mémoire tant qu'elles tiennent dans la limite donnée, puis sont triées par clé
+// et écrites dans un run temporaire (fichier anonyme du répertoire donné). La lecture
+// fusionne les runs. Au-delà de MANIFEST_MAX_RUNS runs, ils sont d'abord fusionnés en un seul.
+#define MANIFEST_MAX_RUNS 64
+// Tampon de lecture de chaque run pendant la fusion
+#define MANIFEST_RUN_BUFFER_SIZE (64 * 1024)
+// Mémoire minimale d'un manifeste
+#define MANIFEST_MIN_MEMORY (1024 * 1024)
+
+typedef struct manifest manifest_t;
+
+// Crée un manifeste dont les runs sont écrits dans dir, avec memory octets d'entrées en mémoire
+manifest_t *manifest_create(const char *dir, size_t memory);
+// Ajoute une entrée (value peut être NULL) ; -1 en cas d'erreur
+int manifest_add(manifest_t *manifest, const char *key, const char *value);
+// Termine les ajouts et prépare la lecture ; -1 en cas d'erreur
+int manifest_finish(manifest_t *manifest);
+// Entrée suivante par ordre de clé (strcmp), à clés égales dans l'ordre d'ajout ; key et
+// value restent valables jusqu'à l'appel suivant. Retourne 0 à la fin
+int manifest_next(manifest_t *manifest, const char **key, const char **value);
+// Nombre de runs écrits sur disque depuis la création
+int manifest_run_count(const manifest_t *manifest);
+void manifest_free(manifest_t *manifest);
+
+#endif // MANIFEST_H
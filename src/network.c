@@ -91,3 +91,67 @@ ssize_t receive_data(int port, size_t size) {
 
     return bytes_received;
 }
+
+int connect_to_server(const char *server_address, int port) {
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0) {
+        perror("Erreur dans la création du socket");
+        return -1;
+    }
+
+    struct sockaddr_in server_addr;
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(port);
+
+    if (inet_pton(AF_INET, server_address, &server_addr.sin_addr) <= 0) {
+        perror("Erreur de la conversion de l'adresse IP");
+        close(sock);
+        return -1;
+    }
+
+    if (connect(sock, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
+        perror("Erreur de connexion");
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+int wait_for_client(int port) {
+    int server_sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (server_sock < 0) {
+        perror("Erreur dans la création de socket");
+        return -1;
+    }
+    int reuse = 1;
+    setsockopt(server_sock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    struct sockaddr_in server_addr;
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_addr.s_addr = INADDR_ANY;
+    server_addr.sin_port = htons(port);
+
+    if (bind(server_sock, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
+        perror("Erreur dans la liaison du socket à l'adresse et au port");
+        close(server_sock);
+        return -1;
+    }
+
+    if (listen(server_sock, 1) < 0) {
+        perror("Erreur lors de l'écoute du serveur");
+        close(server_sock);
+        return -1;
+    }
+
+    printf("En attente d'une connexion sur le port %d...\n", port);
+    fflush(stdout);
+
+    int client_sock = accept(server_sock, NULL, NULL);
+    if (client_sock < 0) {
+        perror("Erreur lors de l'acceptation de la connexion");
+    }
+    close(server_sock);
+    return client_sock;
+}
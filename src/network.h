@@ -10,5 +10,9 @@
 
 void send_data(const char *server_address, int port, const void *data, size_t size);
 ssize_t receive_data(int port, size_t size);
+// Ouvre une connexion vers le serveur ; retourne le socket, -1 en cas d'erreur
+int connect_to_server(const char *server_address, int port);
+// Attend un client sur le port ; retourne le socket de la connexion, -1 en cas d'erreur
+int wait_for_client(int port);
 
 #endif // NETWORK_H
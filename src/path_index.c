@@ -0,0 +1,375 @@
+#include "path_index.h"
+#include "stats.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define PATH_INDEX_HEADER_SIZE (8 + sizeof(uint64_t))
+#define PATH_INDEX_LINE_SIZE (4096 * 4)
+
+extern int verbose_flag;
+
+const char *path_index_rel_path(const char *line, size_t *length) {
+    const char *sep = strchr(line, '/');
+    const char *rel = sep ? sep + 1 : line;
+    *length = strcspn(rel, ";\n");
+    return rel;
+}
+
+static int compare_elements(const void *a, const void *b) {
+    const char *pa = strchr((*(log_element *const *)a)->path, '/');
+    const char *pb = strchr((*(log_element *const *)b)->path, '/');
+    return strcmp(pa + 1, pb + 1);
+}
+
+/**
+ * @brief Écrit dans file l'index des entrées de logs ; -1 en cas d'erreur.
+ */
+static int write_index(FILE *file, const log_t *logs) {
+    uint64_t count = 0;
+    for (log_element *elt = logs->head; elt; elt = elt->next) {
+        count += strchr(elt->path, '/') != NULL;
+    }
+    log_element **sorted = malloc((count ? count : 1) * sizeof(log_element *));
+    uint64_t *offsets = malloc((count ? count : 1) * sizeof(uint64_t));
+    if (!sorted || !offsets) {
+        free(sorted);
+        free(offsets);
+        return -1;
+    }
+    uint64_t n = 0;
+    for (log_element *elt = logs->head; elt; elt = elt->next) {
+        if (strchr(elt->path, '/')) {
+            sorted[n++] = elt;
+        }
+    }
+    qsort(sorted, count, sizeof(log_element *), compare_elements);
+
+    // Les entrées sont écrites après la table des positions, remplie ensuite
+    fwrite(PATH_INDEX_MAGIC, 1, 8, file);
+    fwrite(&count, sizeof(uint64_t), 1, file);
+    fseeko(file, (off_t)(PATH_INDEX_HEADER_SIZE + count * sizeof(uint64_t)), SEEK_SET);
+    int saved_verbose = verbose_flag;
+    verbose_flag = 0; // write_log_element afficherait chaque entrée une seconde fois
+    for (uint64_t i = 0; i < count; i++) {
+        offsets[i] = (uint64_t)ftello(file);
+        write_log_element(sorted[i], file);
+    }
+    verbose_flag = saved_verbose;
+    fseeko(file, (off_t)PATH_INDEX_HEADER_SIZE, SEEK_SET);
+    fwrite(offsets, sizeof(uint64_t), count, file);
+    free(sorted);
+    free(offsets);
+    return ferror(file) ? -1 : 0;
+}
+
+int path_index_write(const char *index_path, const log_t *logs) {
+    // L'index de la sauvegarde précédente a été lié : il est détaché avant d'écrire
+    unlink(index_path);
+    FILE *file = fopen(index_path, "wb");
+    if (!file) {
+        perror("Erreur de création de l'index des chemins");
+        return -1;
+    }
+    int ret = write_index(file, logs);
+    if (fclose(file) != 0) {
+        ret = -1;
+    }
+    if (ret != 0) {
+        perror("Erreur d'écriture de l'index des chemins");
+    }
+    return ret;
+}
+
+// Index ouvert pour une recherche
+typedef struct {
+    int fd;
+    uint64_t count;
+    char line[PATH_INDEX_LINE_SIZE];
+} index_t;
+
+/**
+ * @brief Lit la ligne de l'entrée i (terminée par '\0' à la place du saut de ligne).
+ */
+static const char *read_entry(index_t *index, uint64_t i) {
+    uint64_t offset;
+    if (pread(index->fd, &offset, sizeof(offset), (off_t)(PATH_INDEX_HEADER_SIZE + i * sizeof(uint64_t)))
+        != sizeof(offset)) {
+        return NULL;
+    }
+    ssize_t n = pread(index->fd, index->line, sizeof(index->line) - 1, (off_t)offset);
+    if (n <= 0) {
+        return NULL;
+    }
+    stats_add(STATS_BYTES_READ, sizeof(offset) + n);
+    index->line[n] = '\0';
+    index->line[strcspn(index->line, "\n")] = '\0';
+    return index->line;
+}
+
+// Compare un chemin relatif non terminé (rel_len octets) à key, dans l'ordre de strcmp
+static int compare_rel(const char *rel, size_t rel_len, const char *key, size_t key_len) {
+    int cmp = memcmp(rel, key, rel_len < key_len ? rel_len : key_len);
+    if (cmp != 0) {
+        return cmp;
+    }
+    return rel_len < key_len ? -1 : (rel_len > key_len);
+}
+
+int path_index_lookup(const char *index_path, const char *prefix, log_t *logs) {
+    index_t *index = malloc(sizeof(index_t));
+    if (!index) {
+        return -1;
+    }
+    index->fd = open(index_path, O_RDONLY);
+    char magic[8];
+    if (index->fd < 0 || pread(index->fd, magic, 8, 0) != 8 || memcmp(magic, PATH_INDEX_MAGIC, 8) != 0
+        || pread(index->fd, &index->count, sizeof(uint64_t), 8) != sizeof(uint64_t)) {
+        if (index->fd >= 0) {
+            close(index->fd);
+        }
+        free(index);
+        return -1;
+    }
+
+    // Le préfixe est relatif à la racine de la sauvegarde, sans '/' au début ni à la fin
+    while (*prefix == '/') {
+        prefix++;
+    }
+    size_t prefix_len = strlen(prefix);
+    while (prefix_len > 0 && prefix[prefix_len - 1] == '/') {
+        prefix_len--;
+    }
+
+    // Première entrée >= prefix, par dichotomie
+    uint64_t low = 0, high = index->count;
+    while (low < high) {
+        uint64_t mid = low + (high - low) / 2;
+        const char *line = read_entry(index, mid);
+        if (!line) {
+            break;
+        }
+        size_t rel_len;
+        const char *rel = path_index_rel_path(line, &rel_len);
+        if (compare_rel(rel, rel_len, prefix, prefix_len) < 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    // Les entrées qui commencent par prefix se suivent ; seules prefix elle-même et
+    // celles sous prefix/ sont retenues (pas "prefix-2" par exemple)
+    int found = 0;
+    for (uint64_t i = low; i < index->count; i++) {
+        const char *line = read_entry(index, i);
+        if (!line) {
+            break;
+        }
+        size_t rel_len;
+        const char *rel = path_index_rel_path(line, &rel_len);
+        if (rel_len < prefix_len || memcmp(rel, prefix, prefix_len) != 0) {
+            break;
+        }
+        if (prefix_len == 0 || rel_len == prefix_len || rel[prefix_len] == '/') {
+            if (parse_log_line(logs, index->line)) {
+                found++;
+            }
+        }
+    }
+    if (verbose_flag) {
+        printf("[INFO] %d entrées sous '%.*s' dans %s\n", found, (int)prefix_len, prefix, index_path);
+    }
+    close(index->fd);
+    free(index);
+    return found;
+}
+
+struct path_index_reader {
+    FILE *file;
+    uint64_t remaining; // entrées pas encore lues
+    char *buffer;
+    char line[PATH_INDEX_LINE_SIZE];
+};
+
+/**
+ * @brief Vérifie l'en-tête de l'index ouvert et se place sur la première entrée.
+ */
+static int start_reading(path_index_reader_t *reader) {
+    char magic[8];
+    if (fread(magic, 1, 8, reader->file) != 8 || memcmp(magic, PATH_INDEX_MAGIC, 8) != 0
+        || fread(&reader->remaining, sizeof(uint64_t), 1, reader->file) != 1) {
+        return -1;
+    }
+    // Les entrées se suivent : la table des positions ne sert pas à une lecture séquentielle
+    return fseeko(reader->file, (off_t)(PATH_INDEX_HEADER_SIZE + reader->remaining * sizeof(uint64_t)),
+                  SEEK_SET);
+}
+
+path_index_reader_t *path_index_open(const char *snapshot_path) {
+    path_index_reader_t *reader = calloc(1, sizeof(path_index_reader_t));
+    if (!reader) {
+        return NULL;
+    }
+    reader->buffer = malloc(PATH_INDEX_BUFFER_SIZE);
+    char path[PATH_INDEX_LINE_SIZE];
+    snprintf(path, sizeof(path), "%s/%s", snapshot_path, PATH_INDEX_FILE);
+    reader->file = fopen(path, "rb");
+    if (reader->file && reader->buffer) {
+        setvbuf(reader->file, reader->buffer, _IOFBF, PATH_INDEX_BUFFER_SIZE);
+    }
+    if (!reader->file || start_reading(reader) != 0) {
+        // Sauvegarde sans index : il est construit en mémoire à partir du .backup_log
+        if (reader->file) {
+            fclose(reader->file);
+        }
+        snprintf(path, sizeof(path), "%s/.backup_log", snapshot_path);
+        if (access(path, F_OK) != 0) {
+            path_index_close(reader);
+            return NULL;
+        }
+        log_t logs = read_backup_log(path);
+        reader->file = tmpfile();
+        if (!reader->file || write_index(reader->file, &logs) != 0) {
+            free_backup_log(&logs);
+            path_index_close(reader);
+            return NULL;
+        }
+        free_backup_log(&logs);
+        rewind(reader->file);
+        if (start_reading(reader) != 0) {
+            path_index_close(reader);
+            return NULL;
+        }
+    }
+    return reader;
+}
+
+const char *path_index_next(path_index_reader_t *reader) {
+    if (reader->remaining == 0 || !fgets(reader->line, sizeof(reader->line), reader->file)) {
+        return NULL;
+    }
+    reader->remaining--;
+    reader->line[strcspn(reader->line, "\n")] = '\0';
+    return reader->line;
+}
+
+void path_index_close(path_index_reader_t *reader) {
+    if (!reader) {
+        return;
+    }
+    if (reader->file) {
+        fclose(reader->file);
+    }
+    free(reader->buffer);
+    free(reader);
+}
+
+struct path_index_writer {
+    char path[PATH_INDEX_LINE_SIZE];
+    FILE *entries; // lignes des entrées
+    FILE *offsets; // position de chaque ligne dans entries (uint64_t)
+    uint64_t count;
+    int failed;
+};
+
+/**
+ * @brief Fichier temporaire du répertoire de path, supprimé dès sa création.
+ */
+static FILE *temp_file_beside(const char *path) {
+    char temp_path[PATH_INDEX_LINE_SIZE + 16];
+    snprintf(temp_path, sizeof(temp_path), "%s.XXXXXX", path);
+    int fd = mkstemp(temp_path);
+    if (fd < 0) {
+        return NULL;
+    }
+    unlink(temp_path);
+    FILE *file = fdopen(fd, "w+b");
+    if (!file) {
+        close(fd);
+    }
+    return file;
+}
+
+path_index_writer_t *path_index_writer_open(const char *index_path) {
+    path_index_writer_t *writer = calloc(1, sizeof(path_index_writer_t));
+    if (!writer) {
+        return NULL;
+    }
+    snprintf(writer->path, sizeof(writer->path), "%s", index_path);
+    writer->entries = temp_file_beside(index_path);
+    writer->offsets = temp_file_beside(index_path);
+    if (!writer->entries || !writer->offsets) {
+        perror("Erreur de création de l'index des chemins");
+        writer->failed = 1;
+    }
+    return writer;
+}
+
+void path_index_writer_add(path_index_writer_t *writer, const log_element *elt) {
+    if (writer->failed || !strchr(elt->path, '/')) {
+        return;
+    }
+    uint64_t offset = (uint64_t)ftello(writer->entries);
+    fwrite(&offset, sizeof(uint64_t), 1, writer->offsets);
+    int saved_verbose = verbose_flag;
+    verbose_flag = 0; // write_log_element afficherait chaque entrée une seconde fois
+    write_log_element((log_element *)elt, writer->entries);
+    verbose_flag = saved_verbose;
+    writer->count++;
+}
+
+/**
+ * @brief Écrit l'en-tête, la table des positions (décalées de sa propre taille) puis les
+ * entrées, recopiées par blocs de PATH_INDEX_BUFFER_SIZE octets.
+ */
+static int assemble_index(path_index_writer_t *writer, FILE *file, char *buffer) {
+    uint64_t base = PATH_INDEX_HEADER_SIZE + writer->count * sizeof(uint64_t);
+    fwrite(PATH_INDEX_MAGIC, 1, 8, file);
+    fwrite(&writer->count, sizeof(uint64_t), 1, file);
+    rewind(writer->offsets);
+    uint64_t *offsets = (uint64_t *)buffer;
+    size_t per_block = PATH_INDEX_BUFFER_SIZE / sizeof(uint64_t);
+    size_t n;
+    while ((n = fread(offsets, sizeof(uint64_t), per_block, writer->offsets)) > 0) {
+        for (size_t i = 0; i < n; i++) {
+            offsets[i] += base;
+        }
+        fwrite(offsets, sizeof(uint64_t), n, file);
+    }
+    rewind(writer->entries);
+    while ((n = fread(buffer, 1, PATH_INDEX_BUFFER_SIZE, writer->entries)) > 0) {
+        fwrite(buffer, 1, n, file);
+    }
+    return ferror(file) || ferror(writer->offsets) || ferror(writer->entries) ? -1 : 0;
+}
+
+int path_index_writer_close(path_index_writer_t *writer) {
+    int ret = -1;
+    char *buffer = malloc(PATH_INDEX_BUFFER_SIZE);
+    if (!writer->failed && buffer && fflush(writer->entries) == 0 && fflush(writer->offsets) == 0) {
+        // L'index de la sauvegarde précédente a été lié : il est détaché avant d'écrire
+        unlink(writer->path);
+        FILE *file = fopen(writer->path, "wb");
+        if (file) {
+            ret = assemble_index(writer, file, buffer);
+            if (fclose(file) != 0) {
+                ret = -1;
+            }
+        }
+        if (ret != 0) {
+            perror("Erreur d'écriture de l'index des chemins");
+        }
+    }
+    free(buffer);
+    if (writer->entries) {
+        fclose(writer->entries);
+    }
+    if (writer->offsets) {
+        fclose(writer->offsets);
+    }
+    free(writer);
+    return ret;
+}
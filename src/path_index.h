@@ -0,0 +1,51 @@
+#ifndef PATH_INDEX_H
+#define PATH_INDEX_H
+
+#include "file_handler.h"
+#include <stdint.h>
+
+// Index des chemins d'une sauvegarde, écrit dans son répertoire à côté du .backup_log :
+// - PATH_INDEX_MAGIC (8 octets) puis le nombre d'entrées (uint64_t) ;
+// - la position de chaque entrée dans le fichier (uint64_t), dans l'ordre des chemins ;
+// - les entrées, lignes au format du .backup_log triées par chemin relatif (strcmp).
+// Une recherche lit O(log n) entrées ; les entrées d'un sous-arbre sont contiguës.
+#define PATH_INDEX_FILE ".path_index"
+#define PATH_INDEX_MAGIC "LP25IDX1"
+// Les lectures séquentielles se font par blocs de cette taille
+#define PATH_INDEX_BUFFER_SIZE (1024 * 1024)
+
+// Écrit l'index des entrées de logs dans index_path ; -1 en cas d'erreur
+int path_index_write(const char *index_path, const log_t *logs);
+
+/**
+ * @brief Ajoute à logs les entrées de l'index dont le chemin relatif est prefix ou se
+ * trouve sous le répertoire prefix.
+ *
+ * @return Le nombre d'entrées trouvées, -1 si l'index est absent ou illisible.
+ */
+int path_index_lookup(const char *index_path, const char *prefix, log_t *logs);
+
+// Chemin relatif d'une entrée "sauvegarde/chemin;..." et sa longueur
+const char *path_index_rel_path(const char *line, size_t *length);
+
+// Lecture séquentielle des entrées d'une sauvegarde, dans l'ordre des chemins
+typedef struct path_index_reader path_index_reader_t;
+
+// Ouvre l'index de la sauvegarde (construit depuis son .backup_log s'il n'existe pas) ; NULL si aucun des deux
+path_index_reader_t *path_index_open(const char *snapshot_path);
+// Entrée suivante (ligne au format du .backup_log, valable jusqu'à l'appel suivant) ; NULL à la fin
+const char *path_index_next(path_index_reader_t *reader);
+void path_index_close(path_index_reader_t *reader);
+
+// Écriture d'un index dont les entrées arrivent déjà triées par chemin (--memory-limit) :
+// les entrées et leurs positions passent par deux fichiers temporaires, créés à côté de
+// l'index, puis sont assemblées à la fermeture
+typedef struct path_index_writer path_index_writer_t;
+
+path_index_writer_t *path_index_writer_open(const char *index_path);
+// Ajoute l'entrée suivante (son chemin relatif suit celui de la précédente)
+void path_index_writer_add(path_index_writer_t *writer, const log_element *elt);
+// Écrit l'index et libère writer ; -1 en cas d'erreur
+int path_index_writer_close(path_index_writer_t *writer);
+
+#endif // PATH_INDEX_H
@@ -0,0 +1,374 @@
+#include "refcount.h"
+#include "stats.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+extern int verbose_flag;
+extern int dry_run_flag;
+
+int make_parent_dirs(const char *path) {
+    char tmp[4096];
+    snprintf(tmp, sizeof(tmp), "%s", path);
+    for (char *p = tmp + 1; *p; p++) {
+        if (*p == '/') {
+            *p = '\0';
+            if (mkdir(tmp, 0755) == -1 && errno != EEXIST) {
+                return -1;
+            }
+            stats_add(STATS_METADATA_OPS, 1);
+            *p = '/';
+        }
+    }
+    return 0;
+}
+
+void remove_empty_parents(const char *path, const char *stop) {
+    char tmp[4096];
+    snprintf(tmp, sizeof(tmp), "%s", path);
+    size_t stop_len = strlen(stop);
+    char *slash;
+    // rmdir échoue dès qu'un répertoire n'est pas vide : on s'arrête là
+    while ((slash = strrchr(tmp, '/')) != NULL && (size_t)(slash - tmp) > stop_len) {
+        *slash = '\0';
+        if (rmdir(tmp) != 0) {
+            break;
+        }
+        stats_add(STATS_METADATA_OPS, 1);
+    }
+}
+
+static void refs_path(const char *backup_dir, const char *location, char *path, size_t size) {
+    snprintf(path, size, "%s/%s/%s.refs", backup_dir, REFCOUNT_DIR, location);
+}
+
+int refcount_load(const char *backup_dir, const char *location, uint32_t **counts) {
+    char path[4096];
+    refs_path(backup_dir, location, path, sizeof(path));
+    *counts = NULL;
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        return 0;
+    }
+    struct stat st;
+    int count = 0;
+    if (fstat(fileno(file), &st) == 0 && st.st_size >= (off_t)sizeof(uint32_t)) {
+        count = st.st_size / sizeof(uint32_t);
+        *counts = malloc(count * sizeof(uint32_t));
+        if (!*counts || fread(*counts, sizeof(uint32_t), count, file) != (size_t)count) {
+            free(*counts);
+            *counts = NULL;
+            count = 0;
+        }
+    }
+    fclose(file);
+    return count;
+}
+
+int refcount_is_referenced(const char *backup_dir, const char *location) {
+    uint32_t *counts;
+    int count = refcount_load(backup_dir, location, &counts);
+    int referenced = 0;
+    for (int i = 0; i < count && !referenced; i++) {
+        referenced = counts[i] != 0;
+    }
+    free(counts);
+    return referenced;
+}
+
+/**
+ * @brief Réécrit les compteurs d'un emplacement (fichier temporaire puis rename).
+ *
+ * Un emplacement dont plus aucun chunk n'est référencé perd son fichier .refs.
+ * @return Vrai si au moins un chunk est encore référencé.
+ */
+static int refcount_store(const char *backup_dir, const char *location, const uint32_t *counts, int count) {
+    char path[4096];
+    refs_path(backup_dir, location, path, sizeof(path));
+    int referenced = 0;
+    for (int i = 0; i < count && !referenced; i++) {
+        referenced = counts[i] != 0;
+    }
+    if (!referenced) {
+        if (unlink(path) == 0) {
+            char root[4096];
+            snprintf(root, sizeof(root), "%s/%s", backup_dir, REFCOUNT_DIR);
+            remove_empty_parents(path, root);
+        }
+        stats_add(STATS_METADATA_OPS, 1);
+        return 0;
+    }
+
+    char tmp_path[4200];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    make_parent_dirs(tmp_path);
+    FILE *file = fopen(tmp_path, "wb");
+    if (!file) {
+        perror("Erreur d'écriture des compteurs de références");
+        return 1;
+    }
+    fwrite(counts, sizeof(uint32_t), count, file);
+    fclose(file);
+    if (rename(tmp_path, path) != 0) {
+        perror("Erreur de renommage des compteurs de références");
+    }
+    return 1;
+}
+
+/**
+ * @brief Enregistre les compteurs d'un emplacement après l'ajout de delta et le signale
+ * à lowered s'ils ont baissé.
+ */
+static void refcount_update(const char *backup_dir, const char *location, const uint32_t *counts, int count,
+                            int delta, refcount_lowered_cb lowered, void *ctx) {
+    int referenced = refcount_store(backup_dir, location, counts, count);
+    if (lowered && delta < 0) {
+        lowered(location, !referenced, ctx);
+    }
+}
+
+void refcount_add_refs(const char *backup_dir, const Chunk *chunks, int chunk_count, int delta,
+                       refcount_lowered_cb lowered, void *ctx) {
+    if (dry_run_flag) {
+        return;
+    }
+    // Les références d'un fichier désignent en général un petit nombre d'emplacements,
+    // dans l'ordre : on garde les compteurs de l'emplacement courant en mémoire
+    char *current = NULL;
+    uint32_t *counts = NULL;
+    int count = 0;
+
+    for (int i = 0; i < chunk_count; i++) {
+        unsigned int index;
+        const char *location;
+        if (parse_external_ref(&chunks[i], &index, &location) != 0) {
+            continue;
+        }
+        if (!current || strcmp(current, location) != 0) {
+            if (current) {
+                refcount_update(backup_dir, current, counts, count, delta, lowered, ctx);
+                free(current);
+                free(counts);
+            }
+            current = strdup(location);
+            count = refcount_load(backup_dir, location, &counts);
+        }
+        if (index >= (unsigned int)count) {
+            uint32_t *grown = realloc(counts, (index + 1) * sizeof(uint32_t));
+            if (!grown) {
+                continue;
+            }
+            memset(grown + count, 0, (index + 1 - count) * sizeof(uint32_t));
+            counts = grown;
+            count = index + 1;
+        }
+        if (delta < 0 && counts[index] < (uint32_t)-delta) {
+            counts[index] = 0;
+        } else {
+            counts[index] += delta;
+        }
+    }
+    if (current) {
+        refcount_update(backup_dir, current, counts, count, delta, lowered, ctx);
+    }
+    free(current);
+    free(counts);
+}
+
+int refcount_add_file(const char *backup_dir, const char *dedup_path, int delta,
+                      refcount_lowered_cb lowered, void *ctx) {
+    FILE *file = fopen(dedup_path, "rb");
+    if (!file) {
+        return -1;
+    }
+    DedupHeader header;
+    if (read_dedup_header(file, &header) != 0) {
+        fclose(file);
+        return -1;
+    }
+    int chunk_count = header.chunk_count;
+
+    // Seules les références externes sont lues, les données sont sautées
+    arena_t arena;
+    arena_init(&arena, 0);
+    Chunk *refs = NULL;
+    int ref_count = 0;
+    int ret = 0;
+    for (int i = 0; i < chunk_count; i++) {
+        unsigned char md5[MD5_DIGEST_LENGTH];
+        size_t size;
+        if (fread(md5, 1, MD5_DIGEST_LENGTH, file) != MD5_DIGEST_LENGTH
+            || fread(&size, sizeof(size_t), 1, file) != 1
+            || CHUNK_LENGTH(size) > header.chunk_size) {
+            ret = -1;
+            break;
+        }
+        if (!(size & CHUNK_EXTERNAL_REF)) {
+            fseek(file, (long)CHUNK_LENGTH(size), SEEK_CUR);
+            continue;
+        }
+        Chunk *grown = realloc(refs, (ref_count + 1) * sizeof(Chunk));
+        if (!grown) {
+            ret = -1;
+            break;
+        }
+        refs = grown;
+        Chunk *ref = refs + ref_count;
+        memcpy(ref->md5, md5, MD5_DIGEST_LENGTH);
+        ref->lenght = size;
+        ref->data = arena_alloc(&arena, CHUNK_LENGTH(size));
+        if (!ref->data || fread(ref->data, 1, CHUNK_LENGTH(size), file) != CHUNK_LENGTH(size)) {
+            ret = -1;
+            break;
+        }
+        ref_count++;
+    }
+    fclose(file);
+
+    refcount_add_refs(backup_dir, refs, ref_count, delta, lowered, ctx);
+    arena_free(&arena);
+    free(refs);
+    return ret;
+}
+
+uint32_t refcount_add(const char *backup_dir, const char *location, unsigned int index, int delta) {
+    uint32_t *counts;
+    int count = refcount_load(backup_dir, location, &counts);
+    if (index >= (unsigned int)count) {
+        uint32_t *grown = realloc(counts, (index + 1) * sizeof(uint32_t));
+        if (!grown) {
+            free(counts);
+            return 0;
+        }
+        memset(grown + count, 0, (index + 1 - count) * sizeof(uint32_t));
+        counts = grown;
+        count = index + 1;
+    }
+    if (delta < 0 && counts[index] < (uint32_t)-delta) {
+        counts[index] = 0;
+    } else {
+        counts[index] += delta;
+    }
+    uint32_t value = counts[index];
+    if (!dry_run_flag) {
+        refcount_store(backup_dir, location, counts, count);
+    }
+    free(counts);
+    return value;
+}
+
+int locate_dedup_file(const char *backup_dir, const char *location, char *path, size_t size) {
+    struct stat st;
+    snprintf(path, size, "%s/%s.dedup", backup_dir, location);
+    stats_add(STATS_METADATA_OPS, 1);
+    if (stat(path, &st) == 0) {
+        return 0;
+    }
+    snprintf(path, size, "%s/%s/%s.dedup", backup_dir, PACK_DIR, location);
+    stats_add(STATS_METADATA_OPS, 1);
+    if (stat(path, &st) == 0) {
+        return 0;
+    }
+    return -1;
+}
+
+/**
+ * @brief Taille des données du chunk index du .dedup location (sans le lire).
+ */
+static unsigned long long referenced_size(ref_sizes_t *sizes, const char *location, unsigned int index) {
+    if (!sizes->location || strcmp(sizes->location, location) != 0) {
+        free(sizes->location);
+        free(sizes->lengths);
+        sizes->location = strdup(location);
+        sizes->lengths = NULL;
+        sizes->count = 0;
+        char path[4096];
+        FILE *file = NULL;
+        if (locate_dedup_file(sizes->backup_dir, location, path, sizeof(path)) == 0) {
+            file = fopen(path, "rb");
+        }
+        DedupHeader header;
+        if (file && read_dedup_header(file, &header) == 0 && header.chunk_count > 0) {
+            int chunk_count = header.chunk_count;
+            sizes->lengths = malloc(chunk_count * sizeof(size_t));
+            unsigned char md5[MD5_DIGEST_LENGTH];
+            while (sizes->lengths && sizes->count < chunk_count
+                   && fread(md5, 1, MD5_DIGEST_LENGTH, file) == MD5_DIGEST_LENGTH
+                   && fread(sizes->lengths + sizes->count, sizeof(size_t), 1, file) == 1) {
+                fseeko(file, (off_t)CHUNK_LENGTH(sizes->lengths[sizes->count]), SEEK_CUR);
+                sizes->count++;
+            }
+        }
+        if (file) {
+            fclose(file);
+        }
+    }
+    if (index >= (unsigned int)sizes->count) {
+        return 0;
+    }
+    size_t length = sizes->lengths[index];
+    return (length & CHUNK_ZERO_RUN) ? CHUNK_ZERO_LENGTH(length) : CHUNK_LENGTH(length);
+}
+
+unsigned long long dedup_image_size(ref_sizes_t *sizes, FILE *file) {
+    DedupHeader header;
+    if (read_dedup_header(file, &header) != 0 || header.chunk_count <= 0) {
+        return 0;
+    }
+    int chunk_count = header.chunk_count;
+    // Taille de chaque chunk, pour les références vers un chunk précédent du fichier
+    unsigned long long *chunk_sizes = malloc(chunk_count * sizeof(unsigned long long));
+    if (!chunk_sizes) {
+        return 0;
+    }
+    unsigned long long total = 0;
+    Chunk chunk;
+    unsigned char data[CHUNK_REF_MAX_SIZE];
+    chunk.data = data;
+    for (int i = 0; i < chunk_count; i++) {
+        if (fread(chunk.md5, 1, MD5_DIGEST_LENGTH, file) != MD5_DIGEST_LENGTH
+            || fread(&chunk.lenght, sizeof(size_t), 1, file) != 1
+            || CHUNK_LENGTH(chunk.lenght) > header.chunk_size
+            || ((chunk.lenght & CHUNK_EXTERNAL_REF) && CHUNK_LENGTH(chunk.lenght) > CHUNK_REF_MAX_SIZE)) {
+            break;
+        }
+        size_t length = CHUNK_LENGTH(chunk.lenght);
+        chunk_sizes[i] = length;
+        if (chunk.lenght & CHUNK_ZERO_RUN) {
+            chunk_sizes[i] = CHUNK_ZERO_LENGTH(chunk.lenght);
+        } else if ((chunk.lenght & CHUNK_EXTERNAL_REF) || chunk.lenght == sizeof(unsigned int)) {
+            if (fread(data, 1, length, file) != length) {
+                break;
+            }
+            unsigned int index;
+            const char *location;
+            unsigned char md5[MD5_DIGEST_LENGTH];
+            if (parse_external_ref(&chunk, &index, &location) == 0) {
+                chunk_sizes[i] = referenced_size(sizes, location, index);
+            } else {
+                // Un chunk de 4 octets dont le MD5 n'est pas celui de ses données est une référence
+                compute_md5(data, length, md5);
+                memcpy(&index, data, sizeof(unsigned int));
+                if (memcmp(md5, chunk.md5, MD5_DIGEST_LENGTH) != 0 && index < (unsigned int)i) {
+                    chunk_sizes[i] = chunk_sizes[index];
+                }
+            }
+        } else if (fseeko(file, (off_t)length, SEEK_CUR) != 0) {
+            break;
+        }
+        total += chunk_sizes[i];
+    }
+    free(chunk_sizes);
+    return total;
+}
+
+void ref_sizes_free(ref_sizes_t *sizes) {
+    free(sizes->location);
+    free(sizes->lengths);
+    sizes->location = NULL;
+    sizes->lengths = NULL;
+    sizes->count = 0;
+}
@@ -0,0 +1,55 @@
+#ifndef REFCOUNT_H
+#define REFCOUNT_H
+
+#include "deduplication.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// Les compteurs de références d'un fichier .dedup "sauvegarde/chemin" sont stockés dans
+// backup_dir/REFCOUNT_DIR/sauvegarde/chemin.refs : un uint32_t par chunk, indexé comme
+// dans le .dedup. Un fichier .dedup supprimé d'une sauvegarde mais dont des chunks sont
+// encore référencés est déplacé dans backup_dir/PACK_DIR/sauvegarde/chemin.dedup.
+#define REFCOUNT_DIR ".refcounts"
+#define PACK_DIR ".packs"
+// Un pack dont moins de PACK_LIVE_THRESHOLD % des données sont encore référencées est compacté
+#define PACK_LIVE_THRESHOLD 50
+
+// Appelée, lors d'une décrémentation, pour chaque emplacement dont des compteurs ont baissé ;
+// released est vrai quand plus aucun de ses chunks n'est référencé
+typedef void (*refcount_lowered_cb)(const char *location, int released, void *ctx);
+
+// Ajoute delta au compteur de chaque chunk désigné par une référence externe de chunks
+// (chunks tels qu'écrits dans le .dedup, références internes non développées)
+void refcount_add_refs(const char *backup_dir, const Chunk *chunks, int chunk_count, int delta,
+                       refcount_lowered_cb lowered, void *ctx);
+// Même chose à partir d'un fichier .dedup, sans charger les données des chunks
+int refcount_add_file(const char *backup_dir, const char *dedup_path, int delta,
+                      refcount_lowered_cb lowered, void *ctx);
+// Ajoute delta au seul compteur index d'un emplacement ; retourne sa nouvelle valeur
+uint32_t refcount_add(const char *backup_dir, const char *location, unsigned int index, int delta);
+// Charge les compteurs d'un emplacement ; retourne leur nombre (0 si aucun)
+int refcount_load(const char *backup_dir, const char *location, uint32_t **counts);
+// Vrai si au moins un chunk de l'emplacement est encore référencé
+int refcount_is_referenced(const char *backup_dir, const char *location);
+// Chemin du .dedup d'un emplacement, dans sa sauvegarde ou dans PACK_DIR ; -1 s'il n'existe plus
+int locate_dedup_file(const char *backup_dir, const char *location, char *path, size_t size);
+
+// Tailles des chunks du dernier .dedup désigné par une référence externe, gardées d'un appel
+// de dedup_image_size à l'autre (les références d'un fichier désignent en général le même)
+typedef struct {
+    const char *backup_dir;
+    char *location;
+    size_t *lengths;
+    int count;
+} ref_sizes_t;
+
+// Taille d'origine de l'image .dedup lue depuis la position courante de file : seuls les
+// en-têtes des chunks et les références sont lus, les données sont sautées
+unsigned long long dedup_image_size(ref_sizes_t *sizes, FILE *file);
+void ref_sizes_free(ref_sizes_t *sizes);
+// Crée les répertoires parents manquants d'un chemin
+int make_parent_dirs(const char *path);
+// Supprime les répertoires parents de path devenus vides, sans remonter au-delà de stop
+void remove_empty_parents(const char *path, const char *stop);
+
+#endif // REFCOUNT_H
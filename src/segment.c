@@ -0,0 +1,328 @@
+#include "segment.h"
+#include "backup_manager.h"
+#include "file_handler.h"
+#include "refcount.h"
+#include "arena.h"
+#include "stats.h"
+#include "throttle.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define MAX_SIZE_PATH 2048
+
+extern int verbose_flag;
+extern int dry_run_flag;
+
+void segment_writer_init(segment_writer_t *writer, const char *backup_dir, const char *prefix) {
+    memset(writer, 0, sizeof(*writer));
+    snprintf(writer->dir, sizeof(writer->dir), "%s/%s", backup_dir, SEGMENT_DIR);
+    snprintf(writer->prefix, sizeof(writer->prefix), "%s", prefix);
+}
+
+/**
+ * @brief Ferme le segment courant et ouvre le suivant.
+ */
+static int segment_next(segment_writer_t *writer) {
+    if (writer->file && fclose(writer->file) != 0) {
+        writer->failed = 1;
+    }
+    writer->file = NULL;
+    if (!writer->buffer) {
+        writer->buffer = malloc(SEGMENT_BUFFER_SIZE);
+    }
+    if (mkdir(writer->dir, 0755) == -1 && errno != EEXIST) {
+        perror("Erreur de création du répertoire des segments");
+        return -1;
+    }
+    stats_add(STATS_METADATA_OPS, 1);
+    snprintf(writer->name, sizeof(writer->name), "%s.%d", writer->prefix, writer->index++);
+    char path[MAX_SIZE_PATH + 192];
+    snprintf(path, sizeof(path), "%s/%s", writer->dir, writer->name);
+    writer->file = fopen(path, "wb");
+    if (!writer->file) {
+        perror("Erreur de création du segment");
+        return -1;
+    }
+    if (writer->buffer) {
+        setvbuf(writer->file, writer->buffer, _IOFBF, SEGMENT_BUFFER_SIZE);
+    }
+    writer->offset = 0;
+    if (verbose_flag) {
+        printf("[INFO] Nouveau segment : %s\n", path);
+    }
+    return 0;
+}
+
+int segment_append(segment_writer_t *writer, const Chunk *chunks, int chunk_count,
+                   const char **segment, uint64_t *offset, uint32_t *length) {
+    if ((!writer->file || writer->offset >= SEGMENT_MAX_SIZE) && segment_next(writer) != 0) {
+        writer->failed = 1;
+        return -1;
+    }
+    uint64_t written = write_dedup_chunks(writer->file, chunks, chunk_count, get_chunk_size());
+    if (ferror(writer->file)) {
+        writer->failed = 1;
+        return -1;
+    }
+    *segment = writer->name;
+    *offset = writer->offset;
+    *length = (uint32_t)written;
+    writer->offset += written;
+    stats_add(STATS_BYTES_WRITTEN, written);
+    throttle_write(written);
+    return 0;
+}
+
+void segment_writer_resume(segment_writer_t *writer) {
+    DIR *dir = opendir(writer->dir);
+    if (!dir) {
+        return;
+    }
+    size_t prefix_len = strlen(writer->prefix);
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strncmp(entry->d_name, writer->prefix, prefix_len) == 0 && entry->d_name[prefix_len] == '.') {
+            int index = atoi(entry->d_name + prefix_len + 1);
+            if (index >= writer->index) {
+                writer->index = index + 1;
+            }
+        }
+    }
+    closedir(dir);
+}
+
+int segment_writer_flush(segment_writer_t *writer) {
+    if (writer->file && fflush(writer->file) != 0) {
+        writer->failed = 1;
+        return -1;
+    }
+    return 0;
+}
+
+int segment_writer_close(segment_writer_t *writer) {
+    if (writer->file && fclose(writer->file) != 0) {
+        perror("Erreur d'écriture du segment");
+        writer->failed = 1;
+    }
+    writer->file = NULL;
+    free(writer->buffer);
+    writer->buffer = NULL;
+    return writer->failed ? -1 : 0;
+}
+
+FILE *segment_open(const char *backup_dir, const char *segment, uint64_t offset) {
+    char path[MAX_SIZE_PATH];
+    snprintf(path, sizeof(path), "%s/%s/%s", backup_dir, SEGMENT_DIR, segment);
+    FILE *file = fopen(path, "rb");
+    if (file && fseeko(file, (off_t)offset, SEEK_SET) != 0) {
+        fclose(file);
+        return NULL;
+    }
+    return file;
+}
+
+void segment_remove_run(const char *backup_dir, const char *prefix) {
+    char dir_path[MAX_SIZE_PATH];
+    snprintf(dir_path, sizeof(dir_path), "%s/%s", backup_dir, SEGMENT_DIR);
+    DIR *dir = opendir(dir_path);
+    if (!dir) {
+        return;
+    }
+    size_t prefix_len = strlen(prefix);
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strncmp(entry->d_name, prefix, prefix_len) == 0 && entry->d_name[prefix_len] == '.') {
+            char path[MAX_SIZE_PATH + 256];
+            snprintf(path, sizeof(path), "%s/%s", dir_path, entry->d_name);
+            unlink(path);
+            stats_add(STATS_METADATA_OPS, 1);
+        }
+    }
+    closedir(dir);
+}
+
+/**
+ * @brief Segment cité par une ligne "chemin;date;md5[;segment;position;taille]" d'un .backup_log,
+ * NULL pour un fichier qui a son propre .dedup. La ligne est modifiée par le découpage.
+ */
+static const char *log_line_segment(char *line) {
+    line[strcspn(line, "\n")] = '\0';
+    char *saveptr = NULL;
+    strtok_r(line, ";", &saveptr);
+    strtok_r(NULL, ";", &saveptr);
+    strtok_r(NULL, ";", &saveptr);
+    return strtok_r(NULL, ";", &saveptr);
+}
+
+void segment_collect(const char *log_path, string_pool_t *segments) {
+    FILE *file = fopen(log_path, "r");
+    if (!file) {
+        return;
+    }
+    char line[4096];
+    while (fgets(line, sizeof(line), file)) {
+        const char *segment = log_line_segment(line);
+        if (segment) {
+            string_pool_intern(segments, segment);
+        }
+    }
+    fclose(file);
+}
+
+/**
+ * @brief Ajoute delta au compteur d'un segment ; s'il n'est plus cité, il est ajouté à released.
+ */
+static void segment_refs_store(const char *backup_dir, const char *segment, int delta, string_pool_t *released) {
+    char location[256];
+    snprintf(location, sizeof(location), "%s/%s", SEGMENT_DIR, segment);
+    if (refcount_add(backup_dir, location, 0, delta) == 0 && released) {
+        string_pool_intern(released, segment);
+    }
+}
+
+int segment_refs_add(const char *backup_dir, const char *log_path, int delta, string_pool_t *released) {
+    FILE *file = fopen(log_path, "r");
+    if (!file) {
+        return -1;
+    }
+    // Les entrées d'un même segment se suivent : leurs ajouts sont cumulés
+    char line[4096], current[256] = "";
+    int pending = 0;
+    while (fgets(line, sizeof(line), file)) {
+        const char *segment = log_line_segment(line);
+        if (!segment) {
+            continue;
+        }
+        if (strcmp(segment, current) != 0) {
+            if (pending) {
+                segment_refs_store(backup_dir, current, pending, released);
+            }
+            snprintf(current, sizeof(current), "%s", segment);
+            pending = 0;
+        }
+        pending += delta;
+    }
+    if (pending) {
+        segment_refs_store(backup_dir, current, pending, released);
+    }
+    fclose(file);
+    return 0;
+}
+
+void segment_refs_init(const char *backup_dir) {
+    if (dry_run_flag) {
+        return;
+    }
+    char marker[MAX_SIZE_PATH];
+    snprintf(marker, sizeof(marker), "%s/%s/%s/%s", backup_dir, REFCOUNT_DIR, SEGMENT_DIR, SEGMENT_REFS_MARKER);
+    if (access(marker, F_OK) == 0) {
+        return;
+    }
+    // Dépôt écrit avant les compteurs des segments : les .backup_log sont lus une fois
+    DIR *dir = opendir(backup_dir);
+    if (dir) {
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL) {
+            if (entry->d_name[0] == '.') {
+                continue;
+            }
+            char path[MAX_SIZE_PATH + 256];
+            snprintf(path, sizeof(path), "%s/%s/.backup_log", backup_dir, entry->d_name);
+            segment_refs_add(backup_dir, path, 1, NULL);
+        }
+        closedir(dir);
+    }
+    make_parent_dirs(marker);
+    FILE *file = fopen(marker, "w");
+    if (!file || fclose(file) != 0) {
+        perror("Erreur de création du marqueur des compteurs de segments");
+    }
+}
+
+/**
+ * @brief Vrai si le segment a été écrit par une sauvegarde encore en préparation
+ * (ses entrées ne sont pas toutes dans le point de reprise).
+ */
+static int staging_owns_segment(const char *backup_dir, const char *segment) {
+    const char *dot = strrchr(segment, '.');
+    if (!dot) {
+        return 0;
+    }
+    char path[MAX_SIZE_PATH + 256];
+    snprintf(path, sizeof(path), "%s/%s%.*s", backup_dir, STAGING_PREFIX, (int)(dot - segment), segment);
+    stats_add(STATS_METADATA_OPS, 1);
+    return access(path, F_OK) == 0;
+}
+
+/**
+ * @brief Segments cités par les sauvegardes en préparation : une sauvegarde interrompue
+ * (ou en cours) sera reprise par --resume à partir de son point de reprise.
+ */
+static string_pool_t *staged_segments(const char *backup_dir) {
+    string_pool_t *segments = string_pool_create();
+    DIR *dir = opendir(backup_dir);
+    if (!segments || !dir) {
+        if (dir) {
+            closedir(dir);
+        }
+        return segments;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strncmp(entry->d_name, STAGING_PREFIX, strlen(STAGING_PREFIX)) != 0) {
+            continue;
+        }
+        char path[MAX_SIZE_PATH + 256];
+        snprintf(path, sizeof(path), "%s/%s/%s", backup_dir, entry->d_name, CHECKPOINT_FILE);
+        segment_collect(path, segments);
+        snprintf(path, sizeof(path), "%s/%s/.backup_log", backup_dir, entry->d_name);
+        segment_collect(path, segments);
+    }
+    closedir(dir);
+    return segments;
+}
+
+int segment_sweep(const char *backup_dir, const string_pool_t *candidates, string_pool_t *removed) {
+    if (candidates->count == 0) {
+        return 0;
+    }
+    segment_refs_init(backup_dir);
+    string_pool_t *staged = NULL;
+    int count = 0;
+    for (size_t i = 0; i < candidates->capacity; i++) {
+        const char *segment = candidates->slots[i];
+        if (!segment) {
+            continue;
+        }
+        char location[256];
+        snprintf(location, sizeof(location), "%s/%s", SEGMENT_DIR, segment);
+        if (refcount_is_referenced(backup_dir, location) || staging_owns_segment(backup_dir, segment)) {
+            continue;
+        }
+        // Lus seulement si un segment n'est plus cité par aucune sauvegarde validée
+        if (!staged) {
+            staged = staged_segments(backup_dir);
+        }
+        if (staged && string_pool_find(staged, segment)) {
+            continue;
+        }
+        char path[MAX_SIZE_PATH + 256];
+        snprintf(path, sizeof(path), "%s/%s/%s", backup_dir, SEGMENT_DIR, segment);
+        if (unlink(path) == 0) {
+            count++;
+            stats_add(STATS_METADATA_OPS, 1);
+            if (removed) {
+                string_pool_intern(removed, segment);
+            }
+            if (verbose_flag) {
+                printf("[INFO] Segment supprimé : %s\n", path);
+            }
+        }
+    }
+    string_pool_free(staged);
+    return count;
+}
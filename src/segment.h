@@ -0,0 +1,64 @@
+#ifndef SEGMENT_H
+#define SEGMENT_H
+
+#include "deduplication.h"
+#include "arena.h"
+#include <stdio.h>
+#include <stdint.h>
+
+// Les petits fichiers (au plus SEGMENT_SMALL_FILE octets, un seul chunk) n'ont pas leur
+// propre .dedup : leur image .dedup est ajoutée à la suite d'un segment partagé,
+// backup_dir/SEGMENT_DIR/horodatage.N, et le .backup_log donne (segment, position, taille)
+#define SEGMENT_DIR ".segments"
+#define SEGMENT_SMALL_FILE CHUNK_MIN_SIZE
+// Au-delà de cette taille, la sauvegarde passe au segment suivant
+#define SEGMENT_MAX_SIZE (64 * 1024 * 1024)
+// Les segments sont écrits séquentiellement par blocs de cette taille
+#define SEGMENT_BUFFER_SIZE (1024 * 1024)
+
+// Segments écrits par une sauvegarde
+typedef struct {
+    char dir[2048];    // backup_dir/SEGMENT_DIR
+    char prefix[128];  // horodatage de la sauvegarde
+    int index;         // numéro du prochain segment
+    FILE *file;        // segment courant (NULL tant qu'aucun petit fichier n'a été rangé)
+    char name[160];    // nom du segment courant
+    uint64_t offset;   // taille du segment courant
+    char *buffer;
+    int failed;        // une écriture a échoué
+} segment_writer_t;
+
+// Prépare l'écriture des segments de la sauvegarde prefix (aucun fichier n'est créé)
+void segment_writer_init(segment_writer_t *writer, const char *backup_dir, const char *prefix);
+// Ajoute l'image .dedup des chunks au segment courant : renseigne son nom, la position et la taille
+int segment_append(segment_writer_t *writer, const Chunk *chunks, int chunk_count,
+                   const char **segment, uint64_t *offset, uint32_t *length);
+// Reprend une sauvegarde interrompue : les segments déjà écrits sont conservés, les suivants portent de nouveaux numéros
+void segment_writer_resume(segment_writer_t *writer);
+// Transmet au système les images en attente dans le tampon du segment courant ; -1 en cas d'erreur
+int segment_writer_flush(segment_writer_t *writer);
+// Ferme le segment courant ; -1 si une écriture a échoué
+int segment_writer_close(segment_writer_t *writer);
+// Ouvre un segment, positionné sur l'image .dedup qui commence à offset
+FILE *segment_open(const char *backup_dir, const char *segment, uint64_t offset);
+// Supprime les segments écrits par la sauvegarde prefix (sauvegarde interrompue)
+void segment_remove_run(const char *backup_dir, const char *prefix);
+
+// Le nombre d'entrées des sauvegardes validées qui citent un segment est gardé dans le
+// magasin des compteurs de références (emplacement SEGMENT_DIR/segment, un seul compteur) :
+// ajouté à la validation d'une sauvegarde, retiré à sa suppression par --prune. Ce fichier,
+// dans REFCOUNT_DIR/SEGMENT_DIR, indique que les compteurs des segments du dépôt sont tenus
+#define SEGMENT_REFS_MARKER ".counted"
+
+// Ajoute à segments les segments cités par un .backup_log ou un point de reprise
+void segment_collect(const char *log_path, string_pool_t *segments);
+// Ajoute delta au compteur de chaque segment cité par un .backup_log, une fois par entrée ;
+// les segments qui ne sont plus cités sont ajoutés à released (NULL : ignorés). -1 si le log est illisible
+int segment_refs_add(const char *backup_dir, const char *log_path, int delta, string_pool_t *released);
+// Dépôt sans SEGMENT_REFS_MARKER : compte une fois les segments cités par les .backup_log des sauvegardes
+void segment_refs_init(const char *backup_dir);
+// Supprime ceux des segments candidates qui ne sont plus cités ni par une sauvegarde validée
+// ni par une sauvegarde en préparation, et les ajoute à removed (NULL : ignorés) ; retourne leur nombre
+int segment_sweep(const char *backup_dir, const string_pool_t *candidates, string_pool_t *removed);
+
+#endif // SEGMENT_H
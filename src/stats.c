@@ -0,0 +1,130 @@
+#include "stats.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+
+static const char *phase_names[STATS_PHASE_COUNT] = {
+    "clone", "scan", "hash", "dedup", "write", "delete", "log_update", "commit",
+    "checkpoint", "throttle", "restore_read", "restore_write"
+};
+
+static const char *counter_names[STATS_COUNTER_COUNT] = {
+    "files_scanned", "dirs_scanned", "files_unchanged", "files_backed_up",
+    "files_resumed", "files_duplicate", "files_deleted", "files_restored", "bytes_read", "bytes_hashed",
+    "bytes_zero",     "chunks_unique", "chunks_duplicate", "chunks_referenced", "bytes_written", "links_created",
+    "copy_fallbacks", "metadata_ops", "cache_hits", "cache_misses", "cache_evictions",
+    "manifest_runs", "bloom_negatives", "bloom_disk_hits", "bloom_false_pos"
+};
+
+// Les compteurs sont mis à jour par opérations atomiques : pas de verrou sur le chemin critique
+static uint64_t counters[STATS_COUNTER_COUNT];
+static uint64_t phase_ns[STATS_PHASE_COUNT];
+static uint64_t phase_calls[STATS_PHASE_COUNT];
+static uint64_t run_start_ns;
+static unsigned long long start_syscr, start_syscw;
+
+/**
+ * @brief Lit les nombres d'appels système read/write du processus dans /proc/self/io.
+ */
+static void read_syscalls(unsigned long long *syscr, unsigned long long *syscw) {
+    *syscr = 0;
+    *syscw = 0;
+    FILE *f = fopen("/proc/self/io", "r");
+    if (!f) {
+        return;
+    }
+    char key[64];
+    unsigned long long value;
+    while (fscanf(f, "%63[^:]: %llu\n", key, &value) == 2) {
+        if (strcmp(key, "syscr") == 0) {
+            *syscr = value;
+        } else if (strcmp(key, "syscw") == 0) {
+            *syscw = value;
+        }
+    }
+    fclose(f);
+}
+
+uint64_t stats_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+void stats_start(void) {
+    memset(counters, 0, sizeof(counters));
+    memset(phase_ns, 0, sizeof(phase_ns));
+    memset(phase_calls, 0, sizeof(phase_calls));
+    read_syscalls(&start_syscr, &start_syscw);
+    run_start_ns = stats_now_ns();
+}
+
+void stats_add(stats_counter_t counter, uint64_t value) {
+    __atomic_fetch_add(&counters[counter], value, __ATOMIC_RELAXED);
+}
+
+uint64_t stats_get(stats_counter_t counter) {
+    return __atomic_load_n(&counters[counter], __ATOMIC_RELAXED);
+}
+
+void stats_phase_end(stats_phase_t phase, uint64_t start_ns) {
+    __atomic_fetch_add(&phase_ns[phase], stats_now_ns() - start_ns, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&phase_calls[phase], 1, __ATOMIC_RELAXED);
+}
+
+void stats_print(FILE *out, int json) {
+    double elapsed = (stats_now_ns() - run_start_ns) / 1e9;
+    unsigned long long syscr, syscw;
+    read_syscalls(&syscr, &syscw);
+    syscr -= start_syscr;
+    syscw -= start_syscw;
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    uint64_t chunks = counters[STATS_CHUNKS_UNIQUE] + counters[STATS_CHUNKS_DUPLICATE];
+    uint64_t lookups = counters[STATS_CACHE_HITS] + counters[STATS_CACHE_MISSES];
+    double hit_rate = lookups ? (double)counters[STATS_CACHE_HITS] / lookups : 0.0;
+    // Part des contenus absents que le filtre de Bloom n'a pas écartés
+    uint64_t absent = counters[STATS_BLOOM_NEGATIVES] + counters[STATS_BLOOM_FALSE_POSITIVES];
+    double false_positive_rate = absent ? (double)counters[STATS_BLOOM_FALSE_POSITIVES] / absent : 0.0;
+
+    if (json) {
+        fprintf(out, "{\"elapsed_seconds\": %.6f, \"peak_rss_kb\": %ld, ", elapsed, usage.ru_maxrss);
+        fprintf(out, "\"syscalls\": {\"read\": %llu, \"write\": %llu, \"metadata\": %llu, \"total\": %llu}, ",
+                syscr, syscw, (unsigned long long)counters[STATS_METADATA_OPS],
+                syscr + syscw + (unsigned long long)counters[STATS_METADATA_OPS]);
+        fprintf(out, "\"counters\": {");
+        for (int i = 0; i < STATS_COUNTER_COUNT; i++) {
+            fprintf(out, "%s\"%s\": %llu", i ? ", " : "", counter_names[i], (unsigned long long)counters[i]);
+        }
+        fprintf(out, ", \"dedup_ratio\": %.4f, \"cache_hit_rate\": %.4f, \"bloom_false_positive_rate\": %.4f}, "
+                "\"phases\": {",
+                counters[STATS_CHUNKS_UNIQUE] ? (double)chunks / counters[STATS_CHUNKS_UNIQUE] : 0.0, hit_rate,
+                false_positive_rate);
+        for (int i = 0; i < STATS_PHASE_COUNT; i++) {
+            fprintf(out, "%s\"%s\": {\"seconds\": %.6f, \"calls\": %llu}", i ? ", " : "", phase_names[i],
+                    phase_ns[i] / 1e9, (unsigned long long)phase_calls[i]);
+        }
+        fprintf(out, "}}\n");
+        return;
+    }
+
+    fprintf(out, "Durée totale : %.3f s, RSS max : %ld Ko\n", elapsed, usage.ru_maxrss);
+    fprintf(out, "Appels système : %llu read, %llu write, %llu métadonnées\n",
+            syscr, syscw, (unsigned long long)counters[STATS_METADATA_OPS]);
+    for (int i = 0; i < STATS_PHASE_COUNT; i++) {
+        if (phase_calls[i]) {
+            fprintf(out, "  %-14s %10.3f s  (%llu appels)\n", phase_names[i], phase_ns[i] / 1e9,
+                    (unsigned long long)phase_calls[i]);
+        }
+    }
+    for (int i = 0; i < STATS_COUNTER_COUNT; i++) {
+        fprintf(out, "  %-18s %llu\n", counter_names[i], (unsigned long long)counters[i]);
+    }
+    if (lookups) {
+        fprintf(out, "  %-18s %.1f %%\n", "cache_hit_rate", hit_rate * 100);
+    }
+    if (absent) {
+        fprintf(out, "  %-18s %.2f %%\n", "bloom_fp_rate", false_positive_rate * 100);
+    }
+}
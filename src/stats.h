@@ -0,0 +1,67 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+// Phases chronométrées d'une sauvegarde ou d'une restauration
+typedef enum {
+    STATS_PHASE_CLONE,         // duplication de la dernière sauvegarde par liens durs
+    STATS_PHASE_SCAN,          // parcours de la source (readdir + stat)
+    STATS_PHASE_HASH,          // calcul du MD5 des fichiers source
+    STATS_PHASE_DEDUP,         // découpage en chunks et déduplication
+    STATS_PHASE_WRITE,         // écriture des fichiers .dedup
+    STATS_PHASE_DELETE,        // suppression des fichiers disparus de la source
+    STATS_PHASE_LOG,           // mise à jour et copie du .backup_log
+    STATS_PHASE_COMMIT,        // syncfs puis renommage de la sauvegarde préparée
+    STATS_PHASE_CHECKPOINT,    // points de reprise d'une sauvegarde en cours (syncfs + entrées terminées)
+    STATS_PHASE_THROTTLE,      // pauses imposées par --bwlimit et --background
+    STATS_PHASE_RESTORE_READ,  // lecture des .dedup pendant la restauration
+    STATS_PHASE_RESTORE_WRITE, // écriture des fichiers restaurés
+    STATS_PHASE_COUNT
+} stats_phase_t;
+
+// Compteurs cumulés sur toute l'exécution
+typedef enum {
+    STATS_FILES_SCANNED,
+    STATS_DIRS_SCANNED,
+    STATS_FILES_UNCHANGED,
+    STATS_FILES_BACKED_UP,
+    STATS_FILES_RESUMED, // fichiers terminés avant une interruption, repris par --resume
+    STATS_FILES_DUPLICATE, // fichiers identiques à un contenu déjà stocké, liés sans être redécoupés
+    STATS_FILES_DELETED,
+    STATS_FILES_RESTORED,
+    STATS_BYTES_READ,
+    STATS_BYTES_HASHED,
+    STATS_BYTES_ZERO, // octets nuls (trous et blocs à zéro) enregistrés sans être stockés
+    STATS_CHUNKS_UNIQUE,
+    STATS_CHUNKS_DUPLICATE,
+    STATS_CHUNKS_REFERENCED, // chunks remplacés par une référence vers une sauvegarde précédente
+    STATS_BYTES_WRITTEN,
+    STATS_LINKS_CREATED,
+    STATS_COPY_FALLBACKS,
+    STATS_METADATA_OPS, // stat, mkdir, link, unlink, rmdir
+    STATS_CACHE_HITS,      // références résolues par le cache de chunks de la restauration
+    STATS_CACHE_MISSES,
+    STATS_CACHE_EVICTIONS,
+    STATS_MANIFEST_RUNS, // runs triés écrits sur disque par --memory-limit
+    STATS_BLOOM_NEGATIVES, // contenus absents de .file_digests écartés par le filtre de Bloom, sans lecture
+    STATS_BLOOM_DISK_HITS, // contenus trouvés sur disque après le filtre
+    STATS_BLOOM_FALSE_POSITIVES, // lectures sur disque pour un contenu absent
+    STATS_COUNTER_COUNT
+} stats_counter_t;
+
+// Démarre la mesure globale (horloge et compteurs d'appels système du processus)
+void stats_start(void);
+// Incrémente un compteur (utilisable depuis plusieurs threads)
+void stats_add(stats_counter_t counter, uint64_t value);
+// Lit la valeur courante d'un compteur
+uint64_t stats_get(stats_counter_t counter);
+// Horloge monotone en nanosecondes
+uint64_t stats_now_ns(void);
+// Ajoute à une phase le temps écoulé depuis start_ns
+void stats_phase_end(stats_phase_t phase, uint64_t start_ns);
+// Affiche le résumé, en JSON si json est non nul, sinon en texte
+void stats_print(FILE *out, int json);
+
+#endif // STATS_H
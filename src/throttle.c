@@ -0,0 +1,181 @@
+#include "throttle.h"
+#include "stats.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+
+// ioprio_set n'a pas d'enveloppe dans la glibc (linux/ioprio.h)
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_CLASS_BE 2
+#define IOPRIO_CLASS_IDLE 3
+#define IOPRIO_WHO_PROCESS 1
+// Lectures observées avant de fixer la latence de référence
+#define LATENCY_WARMUP 64
+
+extern int verbose_flag;
+
+// Seau à jetons : rate octets/s, au plus rate * THROTTLE_BURST_SECONDS en réserve
+typedef struct {
+    uint64_t rate;
+    double tokens;
+    uint64_t last_ns;
+} bucket_t;
+
+static bucket_t read_bucket, write_bucket;
+static int background = 0;
+static int active = 0; // une limite ou le mode discret est actif
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Latence des lectures de la source : moyenne glissante et valeur de référence
+static double latency_ns = 0;
+static double baseline_ns = 0;
+static uint64_t latency_count = 0;
+static uint64_t backoff_ns = 0;
+
+static void sleep_ns(uint64_t ns) {
+    uint64_t start = stats_now_ns();
+    struct timespec ts = {.tv_sec = ns / 1000000000ULL, .tv_nsec = ns % 1000000000ULL};
+    while (nanosleep(&ts, &ts) != 0) {
+    }
+    stats_phase_end(STATS_PHASE_THROTTLE, start);
+}
+
+/**
+ * @brief Retire bytes jetons du seau ; retourne l'attente nécessaire pour rester sous la limite.
+ */
+static uint64_t bucket_take(bucket_t *bucket, size_t bytes) {
+    if (bucket->rate == 0) {
+        return 0;
+    }
+    uint64_t now = stats_now_ns();
+    double burst = bucket->rate * THROTTLE_BURST_SECONDS;
+    if (bucket->last_ns == 0) {
+        bucket->tokens = burst;
+    } else {
+        bucket->tokens += (now - bucket->last_ns) / 1e9 * bucket->rate;
+        if (bucket->tokens > burst) {
+            bucket->tokens = burst;
+        }
+    }
+    bucket->last_ns = now;
+    bucket->tokens -= bytes;
+    // Les jetons manquants arrivent pendant la pause : ils sont ajoutés au prochain appel
+    return bucket->tokens < 0 ? (uint64_t)(-bucket->tokens / bucket->rate * 1e9) : 0;
+}
+
+/**
+ * @brief Met à jour la latence des lectures ; retourne la pause à faire si elle augmente.
+ */
+static uint64_t observe_latency(uint64_t ns) {
+    latency_ns = latency_count == 0 ? ns : latency_ns + (ns - latency_ns) / 32;
+    latency_count++;
+    if (latency_count <= LATENCY_WARMUP) {
+        baseline_ns = latency_ns;
+        return 0;
+    }
+    // La référence suit la latence quand elle baisse, et lentement quand elle monte
+    // durablement (un autre disque, une autre charge)
+    if (latency_ns < baseline_ns) {
+        baseline_ns = latency_ns;
+    } else {
+        baseline_ns += (latency_ns - baseline_ns) / 4096;
+    }
+    if (latency_ns > THROTTLE_BACKOFF_RATIO * baseline_ns) {
+        // Hausse progressive, baisse de moitié dès que la latence redescend
+        backoff_ns += THROTTLE_BACKOFF_MIN_NS;
+        if (backoff_ns > THROTTLE_BACKOFF_MAX_NS) {
+            backoff_ns = THROTTLE_BACKOFF_MAX_NS;
+        }
+    } else {
+        backoff_ns /= 2;
+        if (backoff_ns < THROTTLE_BACKOFF_MIN_NS) {
+            backoff_ns = 0;
+        }
+    }
+    return backoff_ns;
+}
+
+void throttle_set_bwlimit(uint64_t read_rate, uint64_t write_rate) {
+    read_bucket.rate = read_rate;
+    write_bucket.rate = write_rate;
+    active = background || read_rate || write_rate;
+}
+
+void throttle_set_background(int enabled) {
+    background = enabled;
+    active = background || read_bucket.rate || write_bucket.rate;
+}
+
+int throttle_set_ioprio(const char *spec) {
+    int class, data = 0;
+    if (strcmp(spec, "idle") == 0) {
+        class = IOPRIO_CLASS_IDLE;
+    } else if (strncmp(spec, "best-effort", 11) == 0 && (spec[11] == '\0' || spec[11] == ':')) {
+        class = IOPRIO_CLASS_BE;
+        data = spec[11] == ':' ? atoi(spec + 12) : 4;
+        if (data < 0 || data > 7) {
+            return -1;
+        }
+    } else {
+        return -1;
+    }
+    if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, (class << IOPRIO_CLASS_SHIFT) | data) != 0) {
+        perror("Erreur ioprio_set");
+        return -1;
+    }
+    if (verbose_flag) {
+        printf("[INFO] Classe d'E/S : %s\n", spec);
+    }
+    return 0;
+}
+
+void throttle_read(size_t size, uint64_t latency) {
+    if (!active) {
+        return;
+    }
+    pthread_mutex_lock(&lock);
+    uint64_t wait = bucket_take(&read_bucket, size);
+    uint64_t backoff = background ? observe_latency(latency) : 0;
+    pthread_mutex_unlock(&lock);
+    if (wait + backoff > 0) {
+        sleep_ns(wait + backoff);
+    }
+}
+
+size_t throttle_fread(void *buffer, size_t size, FILE *file) {
+    if (!active) {
+        return fread(buffer, 1, size, file);
+    }
+    uint64_t start = stats_now_ns();
+    size_t read = fread(buffer, 1, size, file);
+    throttle_read(read, stats_now_ns() - start);
+    return read;
+}
+
+void throttle_write(size_t size) {
+    if (!active) {
+        return;
+    }
+    pthread_mutex_lock(&lock);
+    uint64_t wait = bucket_take(&write_bucket, size);
+    pthread_mutex_unlock(&lock);
+    if (wait > 0) {
+        sleep_ns(wait);
+    }
+}
+
+void throttle_release_file(const char *path) {
+    if (!background) {
+        return;
+    }
+    int fd = open(path, O_RDONLY);
+    if (fd >= 0) {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+        stats_add(STATS_METADATA_OPS, 1);
+    }
+}
@@ -0,0 +1,32 @@
+#ifndef THROTTLE_H
+#define THROTTLE_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+// Réserve d'un seau à jetons : le débit peut dépasser la limite pendant ce temps au plus
+#define THROTTLE_BURST_SECONDS 0.1
+// La latence moyenne des lectures de la source dépasse ce multiple de sa valeur de
+// référence : la sauvegarde fait une pause avant chaque lecture
+#define THROTTLE_BACKOFF_RATIO 3.0
+// Pause ajoutée à chaque lecture lente (jusqu'au maximum), divisée par deux à chaque lecture normale
+#define THROTTLE_BACKOFF_MIN_NS 1000000ULL
+#define THROTTLE_BACKOFF_MAX_NS 200000000ULL
+
+// Limite les lectures de la source et les écritures de la sauvegarde (octets/s, 0 : pas de limite)
+void throttle_set_bwlimit(uint64_t read_rate, uint64_t write_rate);
+// Mode discret : les pages des fichiers lus sont retirées du cache et les lectures
+// ralentissent d'elles-mêmes quand leur latence augmente
+void throttle_set_background(int enabled);
+// Classe d'E/S du processus : "idle", "best-effort" ou "best-effort:N" (N de 0 à 7) ; -1 en cas d'erreur
+int throttle_set_ioprio(const char *spec);
+// Compte size octets lus de la source en latency ns (attend si la limite ou la latence l'exige)
+void throttle_read(size_t size, uint64_t latency);
+// fread d'un fichier source, soumis à la limite de lecture et à la mesure de latence
+size_t throttle_fread(void *buffer, size_t size, FILE *file);
+// Compte size octets écrits dans la sauvegarde (attend si la limite d'écriture est atteinte)
+void throttle_write(size_t size);
+// Fin de la lecture d'un fichier source : en mode discret, ses pages quittent le cache
+void throttle_release_file(const char *path);
+
+#endif // THROTTLE_H
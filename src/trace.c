@@ -0,0 +1,187 @@
+#define _GNU_SOURCE
+#include "trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+
+// Nombre d'événements conservés par thread : au-delà, les plus anciens sont écrasés
+#define TRACE_RING_SIZE 65536
+// Longueur maximale de l'argument (chemin) conservé avec un événement
+#define TRACE_ARG_SIZE 64
+
+typedef struct {
+    const char *name;
+    uint64_t ts_ns;
+    char phase; // 'B' (début) ou 'E' (fin)
+    char arg[TRACE_ARG_SIZE];
+} trace_event_t;
+
+// Tampon circulaire propre à un thread, chaîné dans la liste globale à sa création
+typedef struct trace_ring {
+    trace_event_t *events;
+    uint64_t written; // nombre total d'événements écrits (modulo TRACE_RING_SIZE pour l'index)
+    long tid;
+    struct trace_ring *next;
+} trace_ring_t;
+
+int trace_enabled = 0;
+
+static char *trace_path = NULL;
+static trace_ring_t *rings = NULL;
+static pthread_mutex_t rings_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread trace_ring_t *thread_ring = NULL;
+static uint64_t trace_start_ns;
+
+static uint64_t trace_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * @brief Retourne le tampon du thread courant, créé au premier événement.
+ *
+ * Le verrou n'est pris qu'à la création : l'enregistrement d'un événement n'en prend aucun.
+ */
+static trace_ring_t *current_ring(void) {
+    if (thread_ring) {
+        return thread_ring;
+    }
+    trace_ring_t *ring = calloc(1, sizeof(trace_ring_t));
+    if (!ring) {
+        return NULL;
+    }
+    ring->events = malloc(TRACE_RING_SIZE * sizeof(trace_event_t));
+    if (!ring->events) {
+        free(ring);
+        return NULL;
+    }
+    ring->tid = syscall(SYS_gettid);
+    pthread_mutex_lock(&rings_lock);
+    ring->next = rings;
+    rings = ring;
+    pthread_mutex_unlock(&rings_lock);
+    thread_ring = ring;
+    return ring;
+}
+
+static void record(const char *name, char phase, const char *arg) {
+    trace_ring_t *ring = current_ring();
+    if (!ring) {
+        return;
+    }
+    trace_event_t *ev = &ring->events[ring->written % TRACE_RING_SIZE];
+    ev->name = name;
+    ev->phase = phase;
+    ev->ts_ns = trace_now_ns();
+    if (arg) {
+        // On garde la fin du chemin, plus parlante que son début
+        size_t len = strlen(arg);
+        const char *tail = len >= TRACE_ARG_SIZE ? arg + len - (TRACE_ARG_SIZE - 1) : arg;
+        memcpy(ev->arg, tail, strlen(tail) + 1);
+    } else {
+        ev->arg[0] = '\0';
+    }
+    ring->written++;
+}
+
+static void close_at_exit(void) {
+    trace_close();
+}
+
+int trace_open(const char *path) {
+    if (!path) {
+        return -1;
+    }
+    free(trace_path);
+    trace_path = strdup(path);
+    trace_start_ns = trace_now_ns();
+    trace_enabled = 1;
+    static int registered = 0;
+    if (!registered) {
+        atexit(close_at_exit);
+        registered = 1;
+    }
+    return 0;
+}
+
+void trace_begin(const char *name, const char *arg) {
+    record(name, 'B', arg);
+}
+
+void trace_end(const char *name) {
+    record(name, 'E', NULL);
+}
+
+static void write_json_string(FILE *out, const char *s) {
+    fputc('"', out);
+    for (; *s; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\') {
+            fputc('\\', out);
+            fputc(c, out);
+        } else if (c < 0x20) {
+            fprintf(out, "\\u%04x", c);
+        } else {
+            fputc(c, out);
+        }
+    }
+    fputc('"', out);
+}
+
+void trace_close(void) {
+    if (!trace_enabled) {
+        return;
+    }
+    trace_enabled = 0;
+
+    FILE *out = fopen(trace_path, "w");
+    if (!out) {
+        perror("Erreur ouverture du fichier de trace");
+    }
+    pid_t pid = getpid();
+    int first = 1;
+    uint64_t dropped = 0;
+
+    if (out) {
+        fprintf(out, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+    }
+    pthread_mutex_lock(&rings_lock);
+    for (trace_ring_t *ring = rings; ring;) {
+        uint64_t begin = ring->written > TRACE_RING_SIZE ? ring->written - TRACE_RING_SIZE : 0;
+        dropped += begin;
+        for (uint64_t i = begin; out && i < ring->written; i++) {
+            trace_event_t *ev = &ring->events[i % TRACE_RING_SIZE];
+            fprintf(out, "%s{\"name\": ", first ? "" : ",\n");
+            write_json_string(out, ev->name);
+            fprintf(out, ", \"cat\": \"lp25\", \"ph\": \"%c\", \"ts\": %.3f, \"pid\": %d, \"tid\": %ld",
+                    ev->phase, (ev->ts_ns - trace_start_ns) / 1000.0, (int)pid, ring->tid);
+            if (ev->arg[0]) {
+                fprintf(out, ", \"args\": {\"path\": ");
+                write_json_string(out, ev->arg);
+                fputc('}', out);
+            }
+            fputc('}', out);
+            first = 0;
+        }
+        trace_ring_t *next = ring->next;
+        free(ring->events);
+        free(ring);
+        ring = next;
+    }
+    rings = NULL;
+    thread_ring = NULL;
+    pthread_mutex_unlock(&rings_lock);
+
+    if (out) {
+        fprintf(out, "\n], \"otherData\": {\"dropped_events\": %llu}}\n", (unsigned long long)dropped);
+        fclose(out);
+    }
+    free(trace_path);
+    trace_path = NULL;
+}
@@ -0,0 +1,19 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+// Non nul lorsque --trace est actif : les macros ne coûtent qu'un test sinon
+extern int trace_enabled;
+
+// Active l'enregistrement ; le fichier est écrit par trace_close (ou à la sortie du programme)
+int trace_open(const char *path);
+// Début d'un intervalle ; name doit rester valide jusqu'à l'écriture (chaîne littérale)
+void trace_begin(const char *name, const char *arg);
+// Fin de l'intervalle ouvert avec le même nom
+void trace_end(const char *name);
+// Écrit les événements de tous les threads au format Chrome trace-event et libère les tampons
+void trace_close(void);
+
+#define TRACE_BEGIN(name, arg) do { if (trace_enabled) trace_begin((name), (arg)); } while (0)
+#define TRACE_END(name) do { if (trace_enabled) trace_end(name); } while (0)
+
+#endif // TRACE_H